@@ -27,6 +27,7 @@
 #include<ros/ros.h>
 #include <std_msgs/Header.h>
 #include "std_msgs/String.h"
+#include <std_msgs/UInt8MultiArray.h>
 #include <image_transport/image_transport.h>
 #include <cv_bridge/cv_bridge.h>
 #include<opencv2/core/core.hpp>
@@ -34,6 +35,7 @@
 #include"../../../include/System.h"
 
 #include "../../../include/KeyFrame.h"
+#include "../../../include/Modeler/SFMTranscriptStream.h"
 // #include "../../../include/MapPoint.h"
 // #include "../../../include/Converter.h"
 // #include "../../../include/Map.h"
@@ -55,7 +57,10 @@ public:
 
 int max_kfId;
 ros::Publisher pubTask;
-ros::Publisher pubCARVScripts;
+ros::Publisher pubCARVStream;
+// CARV transcript and keyframe poses, encoded as binary frames (see SFMTranscriptStream.h)
+dlovi::compvis::BufferSink carvStreamSink;
+dlovi::compvis::SFMTranscriptPublisher* pCARVStreamPublisher;
 int main(int argc, char **argv)
 {
     max_kfId=0;
@@ -79,7 +84,11 @@ int main(int argc, char **argv)
     ros::Subscriber sub = nodeHandler.subscribe("/camera/image_raw", 1, &ImageGrabber::GrabImage,&igb);
 
     pubTask = nodeHandler.advertise<std_msgs::String>("/chris/twc", 1);
-    pubCARVScripts = nodeHandler.advertise<std_msgs::String>("/carv/script", 1);
+    // Keep every frame: the receiver can only rebuild the model from the complete stream
+    pubCARVStream = nodeHandler.advertise<std_msgs::UInt8MultiArray>("/carv/stream", 1000);
+    dlovi::compvis::SFMTranscriptPublisher carvStreamPublisher(SLAM.mpModeler->mTranscriptInterface.getTranscriptRef(),
+                                                               &SLAM.mpModeler->mMutexTranscript, &carvStreamSink);
+    pCARVStreamPublisher = &carvStreamPublisher;
     ros::spin();
 
     // Stop all threads
@@ -125,22 +134,31 @@ void ImageGrabber::GrabImage(const sensor_msgs::ImageConstPtr& msg)
         std::stringstream ss;
         ss<<pKF->mnId<<",";
         ss<<std::setprecision(15)<<pKF->mTimeStamp<<",";
+        ss<<std::setprecision(6);
         for(int ti=0;ti<TWC.rows;ti++)
-        {
           for(int tj=0;tj<TWC.cols;tj++)
-          {
-            std::ostringstream ssss;
-            ssss << TWC.at<float>(ti,tj);
-            ss<<ssss.str()<<",";
-          }
-        }
+            ss<<TWC.at<float>(ti,tj)<<",";
         msg.data = ss.str();
         pubTask.publish(msg);
+
+        dlovi::compvis::transcriptstream::KeyFramePose pose;
+        pose.nId = pKF->mnId;
+        pose.dTimestamp = pKF->mTimeStamp;
+        for(int ti=0;ti<3;ti++)
+          for(int tj=0;tj<4;tj++)
+            pose.arrTwc[ti*4+tj] = TWC.at<float>(ti,tj);
+        pCARVStreamPublisher->publishKeyFramePose(pose);
         max_kfId=nowMaxId;
       }
     }
-    std_msgs::String msgScript;  //publish CARV model scripts
-    msgScript.data = mpSLAM->mpModeler->mTranscriptInterface.m_SFMTranscript.getNewCommand();
-    if(msgScript.data !="")
-      pubCARVScripts.publish(msgScript);
+
+    // publish the CARV transcript lines added since the last frame (read under the modeler's transcript lock)
+    pCARVStreamPublisher->publishNew();
+    if(!carvStreamSink.getBuffer().empty())
+    {
+      std_msgs::UInt8MultiArray msgStream;
+      msgStream.data = carvStreamSink.getBuffer();
+      pubCARVStream.publish(msgStream);
+      carvStreamSink.clear();
+    }
 }
\ No newline at end of file
@@ -0,0 +1,145 @@
+/**
+ * File: HammingDistance.h
+ * Description: Hamming distance kernels on packed binary descriptors, used by
+ *   the flat vocabulary layout of TemplatedVocabulary
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#ifndef __D_T_HAMMING_DISTANCE__
+#define __D_T_HAMMING_DISTANCE__
+
+#include <stdint.h>
+#include <cstring>
+
+// The AVX2 kernel is compiled for its own target and chosen at run time, so
+// the default flags can use it on CPUs that have it
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define DBOW2_HAMMING_AVX2
+#include <immintrin.h>
+#endif
+
+namespace DBoW2 {
+
+/// Number of bits set in a 64 bit word
+inline int popcount64(uint64_t v)
+{
+#ifdef __POPCNT__
+  return __builtin_popcountll(v);
+#else
+  // http://graphics.stanford.edu/~seander/bithacks.html#CountBitsSetParallel
+  v = v - ((v >> 1) & 0x5555555555555555ULL);
+  v = (v & 0x3333333333333333ULL) + ((v >> 2) & 0x3333333333333333ULL);
+  v = (v + (v >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+  return (int)((v * 0x0101010101010101ULL) >> 56);
+#endif
+}
+
+/**
+ * Hamming distance between two packed binary descriptors
+ * @param a descriptor
+ * @param b descriptor
+ * @param L descriptor length in bytes (multiple of 8)
+ */
+inline int hammingDistance(const unsigned char *a, const unsigned char *b,
+  unsigned int L)
+{
+  int dist = 0;
+  for(unsigned int i = 0; i < L; i += 8)
+  {
+    uint64_t va, vb;
+    memcpy(&va, a + i, 8);
+    memcpy(&vb, b + i, 8);
+    dist += popcount64(va ^ vb);
+  }
+  return dist;
+}
+
+#ifdef DBOW2_HAMMING_AVX2
+/// Hamming distance between two 32 byte descriptors (nibble lookup popcount)
+__attribute__((target("avx2")))
+inline int hammingDistance32(const __m256i &a, const unsigned char *b)
+{
+  const __m256i lookup = _mm256_setr_epi8(
+    0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4,
+    0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4);
+  const __m256i low_mask = _mm256_set1_epi8(0x0f);
+
+  const __m256i x = _mm256_xor_si256(a,
+    _mm256_loadu_si256((const __m256i*)b));
+  const __m256i lo = _mm256_and_si256(x, low_mask);
+  const __m256i hi = _mm256_and_si256(_mm256_srli_epi16(x, 4), low_mask);
+  const __m256i cnt = _mm256_add_epi8(_mm256_shuffle_epi8(lookup, lo),
+    _mm256_shuffle_epi8(lookup, hi));
+  const __m256i sad = _mm256_sad_epu8(cnt, _mm256_setzero_si256());
+  const __m128i s = _mm_add_epi64(_mm256_castsi256_si128(sad),
+    _mm256_extracti128_si256(sad, 1));
+  return (int)(_mm_cvtsi128_si64(s) + _mm_extract_epi64(s, 1));
+}
+
+/// closestDescriptor for 32 byte descriptors, only to be called if hasAVX2()
+__attribute__((target("avx2")))
+inline unsigned int closestDescriptor32(const unsigned char *f,
+  const unsigned char *descriptors, unsigned int n)
+{
+  const __m256i vf = _mm256_loadu_si256((const __m256i*)f);
+  unsigned int best_i = 0;
+  int best_d = hammingDistance32(vf, descriptors);
+  for(unsigned int i = 1; i < n; ++i)
+  {
+    const int d = hammingDistance32(vf, descriptors + i*32);
+    if(d < best_d)
+    {
+      best_d = d;
+      best_i = i;
+    }
+  }
+  return best_i;
+}
+
+/// Whether the running CPU has AVX2 (checked once)
+inline bool hasAVX2()
+{
+#ifdef __AVX2__
+  return true;
+#else
+  static const bool avx2 = (__builtin_cpu_init(),
+    __builtin_cpu_supports("avx2") != 0);
+  return avx2;
+#endif
+}
+#endif
+
+/**
+ * Returns the index of the descriptor closest to the given one among n
+ * descriptors stored contiguously. Ties are resolved in favour of the first one.
+ * @param f query descriptor
+ * @param descriptors n packed descriptors of L bytes
+ * @param n number of descriptors (> 0)
+ * @param L descriptor length in bytes (multiple of 8)
+ */
+inline unsigned int closestDescriptor(const unsigned char *f,
+  const unsigned char *descriptors, unsigned int n, unsigned int L)
+{
+#ifdef DBOW2_HAMMING_AVX2
+  if(L == 32 && hasAVX2())
+    return closestDescriptor32(f, descriptors, n);
+#endif
+
+  unsigned int best_i = 0;
+  int best_d = hammingDistance(f, descriptors, L);
+  for(unsigned int i = 1; i < n; ++i)
+  {
+    const int d = hammingDistance(f, descriptors + i*L, L);
+    if(d < best_d)
+    {
+      best_d = d;
+      best_i = i;
+    }
+  }
+  return best_i;
+}
+
+} // namespace DBoW2
+
+#endif
@@ -3,6 +3,9 @@
  * Added functions: Save and Load from text files without using cv::FileStorage.
  * Date: August 2015
  * Raúl Mur-Artal
+ *
+ * Added a flat, memory-mappable layout of the tree (loadFromFlatFile,
+ * saveToFlatFile) which is also used by transform.
  */
 
 /**
@@ -26,10 +29,18 @@
 #include <algorithm>
 #include <opencv2/core/core.hpp>
 #include <limits>
+#include <cstring>
+#include <stdint.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "FeatureVector.h"
 #include "BowVector.h"
 #include "ScoringObject.h"
+#include "HammingDistance.h"
 
 #include "../DUtils/Random.h"
 
@@ -145,6 +156,20 @@ public:
   virtual void transform(const std::vector<TDescriptor>& features,
     BowVector &v, FeatureVector &fv, int levelsup) const;
 
+  /**
+   * Transform a set of binary descriptors, one per row of a CV_8U matrix,
+   * into a bow vector and a feature vector. All the features go down the
+   * flat tree together one level at a time, and the vectors are filled in
+   * order, without splitting the matrix into one cv::Mat per descriptor.
+   * Gives the same result as the std::vector version
+   * @param descriptors
+   * @param v (out) bow vector
+   * @param fv (out) feature vector of nodes and feature indexes
+   * @param levelsup levels to go up the vocabulary tree to get the node index
+   */
+  void transform(const cv::Mat &descriptors,
+    BowVector &v, FeatureVector &fv, int levelsup) const;
+
   /**
    * Transforms a single feature into a word (without weight)
    * @param feature
@@ -237,8 +262,12 @@ public:
   /**
    * Loads the vocabulary from a text file
    * @param filename
+   * @param keep_tree if false, only the flat layout is kept once it is
+   *   built, and the vocabulary has the capabilities of a mapped flat file
+   *   (see loadFromFlatFile). Keep the tree to save the vocabulary in
+   *   another format or to modify it
    */
-  bool loadFromTextFile(const std::string &filename);
+  bool loadFromTextFile(const std::string &filename, bool keep_tree = false);
 
   /**
    * Saves the vocabulary into a text file
@@ -249,8 +278,9 @@ public:
   /**
    * Loads the vocabulary from a binary file
    * @param filename
+   * @param keep_tree see loadFromTextFile
    */
-  bool loadFromBinaryFile(const std::string &filename);
+  bool loadFromBinaryFile(const std::string &filename, bool keep_tree = false);
 
   /**
    * Saves the vocabulary into a binary file
@@ -258,6 +288,32 @@ public:
    */
   void saveToBinaryFile(const std::string &filename) const;  
 
+  /**
+   * Loads the vocabulary from a flat file written by saveToFlatFile
+   * @param filename
+   * @param map if true, the file is memory-mapped read-only and used in place,
+   *   so that several processes share the same pages. The tree nodes are not
+   *   rebuilt then: the vocabulary can transform features, score vectors,
+   *   return parent nodes and word weights, and be saved as a flat file again.
+   *   If false, the file is read and the whole tree is rebuilt.
+   * @return false if the file could not be read or is not a flat vocabulary
+   */
+  bool loadFromFlatFile(const std::string &filename, bool map = true);
+
+  /**
+   * Saves the vocabulary into a flat file: contiguous node array, packed
+   * children descriptors and precomputed word weights. Only for binary
+   * descriptors.
+   * @param filename
+   * @return true on success
+   */
+  bool saveToFlatFile(const std::string &filename) const;
+
+  /**
+   * Returns whether the vocabulary is a memory-mapped flat file
+   */
+  inline bool isMapped() const { return m_flat_mapping != NULL; }
+
 
   /**
    * Saves the vocabulary into a file
@@ -341,6 +397,43 @@ protected:
     inline bool isLeaf() const { return children.empty(); }
   };
 
+  /// Header of the flat layout of the tree. The same image is used in memory
+  /// and on disk, so a flat file can be mapped and used without parsing
+  struct FlatHeader
+  {
+    /// "DBOW2FLT"
+    char magic[8];
+    uint32_t version;
+    int32_t k;
+    int32_t L;
+    int32_t scoring;
+    int32_t weighting;
+    /// Bytes per descriptor
+    uint32_t descriptor_length;
+    uint32_t n_nodes;
+    uint32_t n_words;
+    /// Byte offsets of the arrays from the beginning of the image
+    uint64_t nodes_offset;
+    uint64_t children_offset;
+    uint64_t descriptors_offset;
+    uint64_t words_offset;
+    /// Total size of the image in bytes
+    uint64_t size;
+  };
+
+  /// Node of the flat layout. The children of a node are the entries
+  /// [first_child, first_child + n_children) of the children array, and their
+  /// descriptors are packed in the same order in the descriptor array, so that
+  /// each tree level is resolved by scanning one contiguous block
+  struct FlatNode
+  {
+    uint32_t parent;
+    uint32_t first_child;
+    uint32_t n_children;
+    uint32_t word_id;
+    double weight;
+  };
+
 protected:
 
   /**
@@ -414,6 +507,35 @@ protected:
    * @param features
    */
   void setNodeWeights(const vector<vector<TDescriptor> > &features);
+
+  /**
+   * Builds the flat layout from the tree nodes. Must be called every time
+   * the nodes are created or modified
+   */
+  void buildFlatTree();
+
+  /**
+   * Points the flat layout to the given image after validating it
+   * @param image flat image (see FlatHeader)
+   * @param size bytes available in image
+   * @return false if the image is not a valid flat vocabulary
+   */
+  bool setFlatImage(const unsigned char *image, size_t size);
+
+  /**
+   * Rebuilds the tree nodes and words from the flat layout
+   */
+  void expandFlatTree();
+
+  /**
+   * Drops the flat layout, unmapping the file if necessary
+   */
+  void releaseFlatTree();
+
+  /**
+   * Frees the tree nodes and words if the flat layout holds the tree
+   */
+  void releaseTree();
   
 protected:
 
@@ -438,6 +560,20 @@ protected:
   /// Words of the vocabulary (tree leaves)
   /// this condition holds: m_words[wid]->word_id == wid
   std::vector<Node*> m_words;
+
+  /// Flat layout of the tree, either in m_flat_buffer or memory-mapped
+  const FlatHeader *m_flat;
+  const FlatNode *m_flat_nodes;
+  const uint32_t *m_flat_children;
+  const unsigned char *m_flat_descriptors;
+  const uint32_t *m_flat_words;
+
+  /// Storage of the flat layout when it is not mapped
+  std::vector<unsigned char> m_flat_buffer;
+
+  /// Mapped flat file, if any
+  void *m_flat_mapping;
+  size_t m_flat_mapping_size;
   
 };
 
@@ -447,7 +583,9 @@ template<class TDescriptor, class F>
 TemplatedVocabulary<TDescriptor,F>::TemplatedVocabulary
   (int k, int L, WeightingType weighting, ScoringType scoring)
   : m_k(k), m_L(L), m_weighting(weighting), m_scoring(scoring),
-  m_scoring_object(NULL)
+  m_scoring_object(NULL), m_flat(NULL), m_flat_nodes(NULL),
+  m_flat_children(NULL), m_flat_descriptors(NULL), m_flat_words(NULL),
+  m_flat_mapping(NULL), m_flat_mapping_size(0)
 {
   createScoringObject();
 }
@@ -456,7 +594,9 @@ TemplatedVocabulary<TDescriptor,F>::TemplatedVocabulary
 
 template<class TDescriptor, class F>
 TemplatedVocabulary<TDescriptor,F>::TemplatedVocabulary
-  (const std::string &filename): m_scoring_object(NULL)
+  (const std::string &filename): m_scoring_object(NULL), m_flat(NULL),
+  m_flat_nodes(NULL), m_flat_children(NULL), m_flat_descriptors(NULL),
+  m_flat_words(NULL), m_flat_mapping(NULL), m_flat_mapping_size(0)
 {
   load(filename);
 }
@@ -465,7 +605,9 @@ TemplatedVocabulary<TDescriptor,F>::TemplatedVocabulary
 
 template<class TDescriptor, class F>
 TemplatedVocabulary<TDescriptor,F>::TemplatedVocabulary
-  (const char *filename): m_scoring_object(NULL)
+  (const char *filename): m_scoring_object(NULL), m_flat(NULL),
+  m_flat_nodes(NULL), m_flat_children(NULL), m_flat_descriptors(NULL),
+  m_flat_words(NULL), m_flat_mapping(NULL), m_flat_mapping_size(0)
 {
   load(filename);
 }
@@ -529,7 +671,9 @@ void TemplatedVocabulary<TDescriptor,F>::setWeightingType(WeightingType type)
 template<class TDescriptor, class F>
 TemplatedVocabulary<TDescriptor,F>::TemplatedVocabulary(
   const TemplatedVocabulary<TDescriptor, F> &voc)
-  : m_scoring_object(NULL)
+  : m_scoring_object(NULL), m_flat(NULL), m_flat_nodes(NULL),
+  m_flat_children(NULL), m_flat_descriptors(NULL), m_flat_words(NULL),
+  m_flat_mapping(NULL), m_flat_mapping_size(0)
 {
   *this = voc;
 }
@@ -540,6 +684,7 @@ template<class TDescriptor, class F>
 TemplatedVocabulary<TDescriptor,F>::~TemplatedVocabulary()
 {
   delete m_scoring_object;
+  releaseFlatTree();
 }
 
 // --------------------------------------------------------------------------
@@ -561,6 +706,23 @@ TemplatedVocabulary<TDescriptor,F>::operator=
   
   this->m_nodes = voc.m_nodes;
   this->createWords();
+
+  if(!this->m_nodes.empty())
+  {
+    this->buildFlatTree();
+  }
+  else if(voc.m_flat != NULL)
+  {
+    // voc is a mapped vocabulary without nodes: copy its flat image
+    this->releaseFlatTree();
+    const unsigned char *image = (const unsigned char*)voc.m_flat;
+    this->m_flat_buffer.assign(image, image + voc.m_flat->size);
+    this->setFlatImage(&this->m_flat_buffer[0], this->m_flat_buffer.size());
+  }
+  else
+  {
+    this->releaseFlatTree();
+  }
   
   return *this;
 }
@@ -596,6 +758,8 @@ void TemplatedVocabulary<TDescriptor,F>::create(
 
   // and set the weight of each node of the tree
   setNodeWeights(training_features);
+
+  buildFlatTree();
   
 }
 
@@ -1013,6 +1177,7 @@ void TemplatedVocabulary<TDescriptor,F>::setNodeWeights
 template<class TDescriptor, class F>
 inline unsigned int TemplatedVocabulary<TDescriptor,F>::size() const
 {
+  if(m_flat != NULL) return m_flat->n_words;
   return m_words.size();
 }
 
@@ -1021,6 +1186,7 @@ inline unsigned int TemplatedVocabulary<TDescriptor,F>::size() const
 template<class TDescriptor, class F>
 inline bool TemplatedVocabulary<TDescriptor,F>::empty() const
 {
+  if(m_flat != NULL) return m_flat->n_words == 0;
   return m_words.empty();
 }
 
@@ -1054,6 +1220,8 @@ TDescriptor TemplatedVocabulary<TDescriptor,F>::getWord(WordId wid) const
 template<class TDescriptor, class F>
 WordValue TemplatedVocabulary<TDescriptor, F>::getWordWeight(WordId wid) const
 {
+  if(m_words.empty() && m_flat != NULL)
+    return m_flat_nodes[m_flat_words[wid]].weight;
   return m_words[wid]->weight;
 }
 
@@ -1208,6 +1376,117 @@ void TemplatedVocabulary<TDescriptor,F>::transform(
 
 // --------------------------------------------------------------------------
 
+template<class TDescriptor, class F>
+void TemplatedVocabulary<TDescriptor,F>::transform(
+  const cv::Mat &descriptors,
+  BowVector &v, FeatureVector &fv, int levelsup) const
+{
+  v.clear();
+  fv.clear();
+
+  if(empty() || descriptors.empty())
+  {
+    return;
+  }
+
+  if(m_flat == NULL || descriptors.type() != CV_8U ||
+    descriptors.cols != (int)m_flat->descriptor_length)
+  {
+    std::vector<TDescriptor> features(descriptors.rows);
+    for(int i = 0; i < descriptors.rows; ++i)
+      features[i] = descriptors.row(i);
+    transform(features, v, fv, levelsup);
+    return;
+  }
+
+  const unsigned int N = descriptors.rows;
+  const unsigned int L = m_flat->descriptor_length;
+
+  // propagate all the features down the flat tree one level at a time, so
+  // that the upper levels, shared by every feature, are scanned back to back
+  std::vector<uint32_t> nodes(N, 0); // current node of every feature
+  std::vector<uint32_t> nids(N, 0); // node levelsup levels up from the word
+
+  const int nid_level = m_L - levelsup;
+  int current_level = 0;
+  bool descending = true;
+
+  while(descending)
+  {
+    descending = false;
+    ++current_level;
+
+    for(unsigned int i = 0; i < N; ++i)
+    {
+      const FlatNode &node = m_flat_nodes[nodes[i]];
+      if(node.n_children == 0) continue; // word reached
+
+      const unsigned int c = closestDescriptor(descriptors.ptr<unsigned char>(i),
+        m_flat_descriptors + (size_t)node.first_child * L, node.n_children, L);
+      nodes[i] = m_flat_children[node.first_child + c];
+
+      if(current_level == nid_level) nids[i] = nodes[i];
+      descending = true;
+    }
+  }
+
+  // sort (word, feature) and (node, feature) pairs. Features stay in order
+  // within a word, so weights are added in the same order as in the
+  // feature by feature version, and both vectors are filled from the end
+  std::vector<std::pair<WordId, unsigned int> > words;
+  std::vector<std::pair<NodeId, unsigned int> > features;
+  words.reserve(N);
+  features.reserve(N);
+
+  for(unsigned int i = 0; i < N; ++i)
+  {
+    if(m_flat_nodes[nodes[i]].weight > 0) // not stopped
+    {
+      words.push_back(std::make_pair(m_flat_nodes[nodes[i]].word_id, i));
+      features.push_back(std::make_pair(nids[i], i));
+    }
+  }
+
+  std::sort(words.begin(), words.end());
+  std::sort(features.begin(), features.end());
+
+  // TF, TF_IDF: weights are accumulated. IDF, BINARY: the first weight is kept
+  const bool accumulate = (m_weighting == TF || m_weighting == TF_IDF);
+
+  for(size_t j = 0; j < words.size(); ++j)
+  {
+    const WordValue w = m_flat_nodes[nodes[words[j].second]].weight;
+    if(v.empty() || v.rbegin()->first != words[j].first)
+      v.insert(v.end(), BowVector::value_type(words[j].first, w));
+    else if(accumulate)
+      v.rbegin()->second += w;
+  }
+
+  for(size_t j = 0; j < features.size(); ++j)
+  {
+    if(fv.empty() || fv.rbegin()->first != features[j].first)
+      fv.insert(fv.end(), FeatureVector::value_type(features[j].first,
+        std::vector<unsigned int>()));
+    fv.rbegin()->second.push_back(features[j].second);
+  }
+
+  // normalize
+  LNorm norm;
+  bool must = m_scoring_object->mustNormalize(norm);
+
+  if(accumulate && !v.empty() && !must)
+  {
+    // unnecessary when normalizing
+    const double nd = v.size();
+    for(BowVector::iterator vit = v.begin(); vit != v.end(); vit++)
+      vit->second /= nd;
+  }
+
+  if(must) v.normalize(norm);
+}
+
+// --------------------------------------------------------------------------
+
 template<class TDescriptor, class F> 
 inline double TemplatedVocabulary<TDescriptor,F>::score
   (const BowVector &v1, const BowVector &v2) const
@@ -1231,6 +1510,37 @@ template<class TDescriptor, class F>
 void TemplatedVocabulary<TDescriptor,F>::transform(const TDescriptor &feature, 
   WordId &word_id, WordValue &weight, NodeId *nid, int levelsup) const
 { 
+  if(m_flat != NULL)
+  {
+    // propagate the feature down the flat tree: the children descriptors of
+    // every node are contiguous, so each level is a single scan
+    const unsigned int L = m_flat->descriptor_length;
+    const unsigned char *f = feature.data;
+
+    const int nid_level = m_L - levelsup;
+    if(nid_level <= 0 && nid != NULL) *nid = 0; // root
+
+    NodeId final_id = 0; // root
+    int current_level = 0;
+
+    do
+    {
+      ++current_level;
+      const FlatNode &node = m_flat_nodes[final_id];
+      const unsigned int i = closestDescriptor(f,
+        m_flat_descriptors + (size_t)node.first_child * L, node.n_children, L);
+      final_id = m_flat_children[node.first_child + i];
+
+      if(nid != NULL && current_level == nid_level)
+        *nid = final_id;
+
+    } while(m_flat_nodes[final_id].n_children > 0);
+
+    word_id = m_flat_nodes[final_id].word_id;
+    weight = m_flat_nodes[final_id].weight;
+    return;
+  }
+
   // propagate the feature down the tree
   vector<NodeId> nodes;
   typename vector<NodeId>::const_iterator nit;
@@ -1277,6 +1587,17 @@ template<class TDescriptor, class F>
 NodeId TemplatedVocabulary<TDescriptor,F>::getParentNode
   (WordId wid, int levelsup) const
 {
+  if(m_words.empty() && m_flat != NULL)
+  {
+    NodeId ret = m_flat_words[wid];
+    while(levelsup > 0 && ret != 0)
+    {
+      --levelsup;
+      ret = m_flat_nodes[ret].parent;
+    }
+    return ret;
+  }
+
   NodeId ret = m_words[wid]->id; // node id
   while(levelsup > 0 && ret != 0) // ret == 0 --> root
   {
@@ -1342,13 +1663,15 @@ int TemplatedVocabulary<TDescriptor,F>::stopWords(double minWeight)
       (*wit)->weight = 0;
     }
   }
+  if(c > 0) buildFlatTree();
   return c;
 }
 
 // --------------------------------------------------------------------------
 
 template<class TDescriptor, class F>
-bool TemplatedVocabulary<TDescriptor,F>::loadFromTextFile(const std::string &filename)
+bool TemplatedVocabulary<TDescriptor,F>::loadFromTextFile(const std::string &filename,
+  bool keep_tree)
 {
     ifstream f;
     f.open(filename.c_str());
@@ -1358,6 +1681,7 @@ bool TemplatedVocabulary<TDescriptor,F>::loadFromTextFile(const std::string &fil
 
     m_words.clear();
     m_nodes.clear();
+    releaseFlatTree();
 
     string s;
     getline(f,s);
@@ -1432,6 +1756,9 @@ bool TemplatedVocabulary<TDescriptor,F>::loadFromTextFile(const std::string &fil
         }
     }
 
+    buildFlatTree();
+    if(!keep_tree) releaseTree();
+
     return true;
 
 }
@@ -1464,7 +1791,8 @@ void TemplatedVocabulary<TDescriptor,F>::saveToTextFile(const std::string &filen
 // --------------------------------------------------------------------------
 
 template<class TDescriptor, class F>
-bool TemplatedVocabulary<TDescriptor,F>::loadFromBinaryFile(const std::string &filename) {
+bool TemplatedVocabulary<TDescriptor,F>::loadFromBinaryFile(const std::string &filename,
+  bool keep_tree) {
   fstream f;
   f.open(filename.c_str(), ios_base::in|ios::binary);
   unsigned int nb_nodes, size_node;
@@ -1479,6 +1807,7 @@ bool TemplatedVocabulary<TDescriptor,F>::loadFromBinaryFile(const std::string &f
   m_words.clear();
   m_words.reserve(pow((double)m_k, (double)m_L + 1));
   m_nodes.clear();
+  releaseFlatTree();
   m_nodes.resize(nb_nodes+1);
   m_nodes[0].id = 0;
   char buf[size_node]; int nid = 1;
@@ -1504,6 +1833,8 @@ bool TemplatedVocabulary<TDescriptor,F>::loadFromBinaryFile(const std::string &f
 	nid+=1;
   }
   f.close();
+  buildFlatTree();
+  if(!keep_tree) releaseTree();
   return true;
 }
 
@@ -1535,6 +1866,303 @@ void TemplatedVocabulary<TDescriptor,F>::saveToBinaryFile(const std::string &fil
 
 // --------------------------------------------------------------------------
 
+template<class TDescriptor, class F>
+void TemplatedVocabulary<TDescriptor,F>::buildFlatTree()
+{
+  releaseFlatTree();
+
+  if(m_nodes.empty()) return;
+
+  const uint32_t L = F::L;
+  const uint32_t n_nodes = m_nodes.size();
+  const uint32_t n_words = m_words.size();
+
+  uint32_t n_children = 0;
+  for(size_t i = 0; i < m_nodes.size(); ++i)
+    n_children += m_nodes[i].children.size();
+
+  // arrays start at 64 byte boundaries
+  const uint64_t align = 64;
+  FlatHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, "DBOW2FLT", 8);
+  header.version = 1;
+  header.k = m_k;
+  header.L = m_L;
+  header.scoring = m_scoring;
+  header.weighting = m_weighting;
+  header.descriptor_length = L;
+  header.n_nodes = n_nodes;
+  header.n_words = n_words;
+  header.nodes_offset = (sizeof(FlatHeader) + align - 1) / align * align;
+  header.children_offset = (header.nodes_offset + 
+    (uint64_t)n_nodes * sizeof(FlatNode) + align - 1) / align * align;
+  header.descriptors_offset = (header.children_offset + 
+    (uint64_t)n_children * sizeof(uint32_t) + align - 1) / align * align;
+  header.words_offset = (header.descriptors_offset + 
+    (uint64_t)n_children * L + align - 1) / align * align;
+  header.size = header.words_offset + (uint64_t)n_words * sizeof(uint32_t);
+
+  m_flat_buffer.assign(header.size, 0);
+  unsigned char *image = &m_flat_buffer[0];
+  memcpy(image, &header, sizeof(header));
+
+  FlatNode *nodes = (FlatNode*)(image + header.nodes_offset);
+  uint32_t *children = (uint32_t*)(image + header.children_offset);
+  unsigned char *descriptors = image + header.descriptors_offset;
+  uint32_t *words = (uint32_t*)(image + header.words_offset);
+
+  uint32_t c = 0;
+  for(uint32_t i = 0; i < n_nodes; ++i)
+  {
+    const Node &node = m_nodes[i];
+    nodes[i].parent = node.parent;
+    nodes[i].first_child = c;
+    nodes[i].n_children = node.children.size();
+    nodes[i].word_id = node.word_id;
+    nodes[i].weight = node.weight;
+
+    for(size_t j = 0; j < node.children.size(); ++j, ++c)
+    {
+      const TDescriptor &d = m_nodes[node.children[j]].descriptor;
+      children[c] = node.children[j];
+      if(d.data != NULL)
+        memcpy(descriptors + (size_t)c * L, d.data, L);
+    }
+  }
+
+  for(uint32_t w = 0; w < n_words; ++w)
+    words[w] = m_words[w]->id;
+
+  setFlatImage(image, m_flat_buffer.size());
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+bool TemplatedVocabulary<TDescriptor,F>::setFlatImage(
+  const unsigned char *image, size_t size)
+{
+  m_flat = NULL;
+  m_flat_nodes = NULL;
+  m_flat_children = NULL;
+  m_flat_descriptors = NULL;
+  m_flat_words = NULL;
+
+  if(size < sizeof(FlatHeader)) return false;
+
+  const FlatHeader *header = (const FlatHeader*)image;
+  if(memcmp(header->magic, "DBOW2FLT", 8) != 0 || header->version != 1)
+    return false;
+
+  if(header->descriptor_length != (uint32_t)F::L || 
+    header->descriptor_length % 8 != 0 || header->size > size ||
+    header->n_nodes == 0)
+    return false;
+
+  const uint64_t n_children = header->n_nodes - 1;
+  if(header->nodes_offset + (uint64_t)header->n_nodes * sizeof(FlatNode) > size ||
+    header->children_offset + n_children * sizeof(uint32_t) > size ||
+    header->descriptors_offset + n_children * header->descriptor_length > size ||
+    header->words_offset + (uint64_t)header->n_words * sizeof(uint32_t) > size)
+    return false;
+
+  if(header->nodes_offset % sizeof(double) != 0 ||
+    header->children_offset % sizeof(uint32_t) != 0 ||
+    header->words_offset % sizeof(uint32_t) != 0)
+    return false;
+
+  const FlatNode *nodes = (const FlatNode*)(image + header->nodes_offset);
+  const uint32_t *children = (const uint32_t*)(image + header->children_offset);
+  const uint32_t *words = (const uint32_t*)(image + header->words_offset);
+
+  // transform and getParentNode walk the tree without checks, so the links
+  // must stay in range. Children come after their parent, which also rules
+  // out cycles
+  for(uint32_t i = 0; i < header->n_nodes; ++i)
+  {
+    const FlatNode &node = nodes[i];
+    if(i > 0 && node.parent >= i)
+      return false;
+    if((uint64_t)node.first_child + node.n_children > n_children)
+      return false;
+    if(i > 0 && node.n_children == 0 && node.word_id >= header->n_words)
+      return false;
+    for(uint32_t j = 0; j < node.n_children; ++j)
+    {
+      const uint32_t child = children[node.first_child + j];
+      if(child <= i || child >= header->n_nodes)
+        return false;
+    }
+  }
+
+  for(uint32_t w = 0; w < header->n_words; ++w)
+  {
+    if(words[w] >= header->n_nodes)
+      return false;
+  }
+
+  m_flat = header;
+  m_flat_nodes = nodes;
+  m_flat_children = children;
+  m_flat_descriptors = image + header->descriptors_offset;
+  m_flat_words = words;
+
+  return true;
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+void TemplatedVocabulary<TDescriptor,F>::expandFlatTree()
+{
+  const uint32_t L = m_flat->descriptor_length;
+
+  m_nodes.clear();
+  m_nodes.resize(m_flat->n_nodes);
+  for(uint32_t i = 0; i < m_flat->n_nodes; ++i)
+  {
+    const FlatNode &fnode = m_flat_nodes[i];
+    Node &node = m_nodes[i];
+    node.id = i;
+    node.parent = fnode.parent;
+    node.weight = fnode.weight;
+    node.word_id = fnode.word_id;
+    node.children.assign(m_flat_children + fnode.first_child,
+      m_flat_children + fnode.first_child + fnode.n_children);
+
+    for(uint32_t j = 0; j < fnode.n_children; ++j)
+    {
+      TDescriptor &d = m_nodes[m_flat_children[fnode.first_child + j]].descriptor;
+      d = cv::Mat(1, L, CV_8U);
+      memcpy(d.data, m_flat_descriptors + (size_t)(fnode.first_child + j) * L, L);
+    }
+  }
+
+  m_words.resize(m_flat->n_words);
+  for(uint32_t w = 0; w < m_flat->n_words; ++w)
+    m_words[w] = &m_nodes[m_flat_words[w]];
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+void TemplatedVocabulary<TDescriptor,F>::releaseFlatTree()
+{
+  m_flat = NULL;
+  m_flat_nodes = NULL;
+  m_flat_children = NULL;
+  m_flat_descriptors = NULL;
+  m_flat_words = NULL;
+
+  m_flat_buffer.clear();
+
+  if(m_flat_mapping != NULL)
+  {
+    munmap(m_flat_mapping, m_flat_mapping_size);
+    m_flat_mapping = NULL;
+    m_flat_mapping_size = 0;
+  }
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+void TemplatedVocabulary<TDescriptor,F>::releaseTree()
+{
+  if(m_flat == NULL) return;
+
+  // swap to give the memory back
+  std::vector<Node*>().swap(m_words);
+  std::vector<Node>().swap(m_nodes);
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+bool TemplatedVocabulary<TDescriptor,F>::loadFromFlatFile(
+  const std::string &filename, bool map)
+{
+  m_words.clear();
+  m_nodes.clear();
+  releaseFlatTree();
+
+  int fd = open(filename.c_str(), O_RDONLY);
+  if(fd < 0) return false;
+
+  struct stat st;
+  if(fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(FlatHeader))
+  {
+    close(fd);
+    return false;
+  }
+  const size_t size = st.st_size;
+
+  bool ok;
+  if(map)
+  {
+    // read-only shared mapping: the pages are shared with any other process
+    // using the same file
+    void *p = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(p == MAP_FAILED) return false;
+
+    m_flat_mapping = p;
+    m_flat_mapping_size = size;
+    ok = setFlatImage((const unsigned char*)p, size);
+  }
+  else
+  {
+    m_flat_buffer.resize(size);
+    size_t n = 0;
+    while(n < size)
+    {
+      const ssize_t r = read(fd, &m_flat_buffer[n], size - n);
+      if(r <= 0) break;
+      n += r;
+    }
+    close(fd);
+    ok = n == size && setFlatImage(&m_flat_buffer[0], size);
+  }
+
+  if(!ok)
+  {
+    std::cerr << "Vocabulary loading failure: " << filename
+      << " is not a correct flat file!" << endl;
+    releaseFlatTree();
+    return false;
+  }
+
+  m_k = m_flat->k;
+  m_L = m_flat->L;
+  m_scoring = (ScoringType)m_flat->scoring;
+  m_weighting = (WeightingType)m_flat->weighting;
+  createScoringObject();
+
+  if(!map) expandFlatTree();
+
+  return true;
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+bool TemplatedVocabulary<TDescriptor,F>::saveToFlatFile(
+  const std::string &filename) const
+{
+  if(m_flat == NULL) return false;
+
+  fstream f;
+  f.open(filename.c_str(), ios_base::out|ios::binary);
+  if(!f.is_open()) return false;
+
+  f.write((const char*)m_flat, m_flat->size);
+  f.close();
+  return !f.fail();
+}
+
+// --------------------------------------------------------------------------
+
 template<class TDescriptor, class F>
 void TemplatedVocabulary<TDescriptor,F>::save(const std::string &filename) const
 {
@@ -1660,6 +2288,7 @@ void TemplatedVocabulary<TDescriptor,F>::load(const cv::FileStorage &fs,
 {
   m_words.clear();
   m_nodes.clear();
+  releaseFlatTree();
   
   cv::FileNode fvoc = fs[name];
   
@@ -1704,6 +2333,8 @@ void TemplatedVocabulary<TDescriptor,F>::load(const cv::FileStorage &fs,
     m_nodes[nid].word_id = wid;
     m_words[wid] = &m_nodes[nid];
   }
+
+  buildFlatTree();
 }
 
 // --------------------------------------------------------------------------
@@ -101,6 +101,11 @@ public:
     void SetNotErase();
     void SetErase();
 
+    // carv: held by the modeler from the moment the keyframe is reported until its stages have taken it, independently
+    // of SetNotErase/SetErase (a loop closure may hold those at the same time)
+    void SetModelerPin();
+    void ReleaseModelerPin();
+
     // Set/check bad flag
     void SetBadFlag();
     bool isBad();
@@ -145,14 +150,6 @@ public:
     long unsigned int mnBALocalForKF;
     long unsigned int mnBAFixedForKF;
 
-    // Variables used by the keyframe database
-    long unsigned int mnLoopQuery;
-    int mnLoopWords;
-    float mLoopScore;
-    long unsigned int mnRelocQuery;
-    int mnRelocWords;
-    float mRelocScore;
-
     // Variables used by loop closing
     cv::Mat mTcwGBA;
     cv::Mat mTcwBefGBA;
@@ -226,6 +223,7 @@ protected:
 
     // Bad flags
     bool mbNotErase;
+    bool mbModelerPin;
     bool mbToBeErased;
     bool mbBad;    
 
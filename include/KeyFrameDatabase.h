@@ -59,11 +59,28 @@ public:
 
 protected:
 
+  // Posting list of a word: ids of the keyframes containing it and the word weight
+  // in each of them, stored in two contiguous arrays
+  struct InvertedFileEntry
+  {
+      std::vector<unsigned int> vKFIds;
+      std::vector<float> vWeights;
+  };
+
+  // Accumulate the similarity score and the number of shared words of every keyframe
+  // sharing a word with the query. Scores and words are dense arrays indexed by keyframe id.
+  // Returns the keyframes sharing words. Must be called with mMutex locked.
+  std::vector<KeyFrame*> ScoreSharingKeyFrames(const DBoW2::BowVector &BowVec,
+                                               std::vector<float> &vScores, std::vector<int> &vnWords);
+
   // Associated vocabulary
   const ORBVocabulary* mpVoc;
 
   // Inverted file
-  std::vector<list<KeyFrame*> > mvInvertedFile;
+  std::vector<InvertedFileEntry> mvInvertedFile;
+
+  // Keyframes in the database indexed by id (NULL if not in the database)
+  std::vector<KeyFrame*> mvpKeyFrames;
 
   // Mutex
   std::mutex mMutex;
@@ -28,6 +28,7 @@
 #include "Tracking.h"
 
 #include "KeyFrameDatabase.h"
+#include "ThreadPool.h"
 
 #include <thread>
 #include <mutex>
@@ -142,6 +143,9 @@ protected:
     // Fix scale in the stereo/RGB-D case
     bool mbFixScale;
 
+    // Workers for loop verification and correction
+    ThreadPool mThreadPool;
+
 
     bool mnFullBAIdx;
 };
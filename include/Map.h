@@ -27,6 +27,7 @@
 #include <set>
 
 #include <mutex>
+#include <atomic>
 
 #include <iostream>
 
@@ -73,6 +74,9 @@ namespace ORB_SLAM2 {
 
         void clear();
 
+        // carv: number of clear() calls so far. Lock-free, so it can be read while mMutexMap is held.
+        int GetGeneration();
+
         vector<KeyFrame *> mvpKeyFrameOrigins;
 
         std::mutex mMutexMapUpdate;
@@ -99,6 +103,8 @@ namespace ORB_SLAM2 {
         // Index related to a big change in the map (loop closure, global BA)
         int mnBigChangeIdx;
 
+        std::atomic<int> mnGeneration;
+
         std::mutex mMutexMap;
     };
 
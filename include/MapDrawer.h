@@ -28,6 +28,8 @@
 
 #include<mutex>
 
+class ProbabilityMapping;
+
 namespace ORB_SLAM2
 {
 
@@ -39,6 +41,7 @@ public:
     Map* mpMap;
 
     void DrawMapPoints();
+    void DrawSemiDensePoints(ProbabilityMapping* pProbabilityMapping);
     void DrawKeyFrames(const bool bDrawKF, const bool bDrawGraph);
     void DrawCurrentCamera(pangolin::OpenGlMatrix &Twc);
     void SetCurrentCameraPose(const cv::Mat &Tcw);
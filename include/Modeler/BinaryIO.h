@@ -0,0 +1,84 @@
+#ifndef __DLOVI_BINARYIO_H
+#define __DLOVI_BINARYIO_H
+
+#include <iostream>
+#include <vector>
+#include "Modeler/Matrix.h"
+#include "Modeler/Exception.h"
+
+// Raw native-endian binary I/O used by the CARV checkpoints.  Reads throw on a short / failed stream, and element counts
+// are checked against the size of the rest of the stream before anything is allocated.
+
+namespace dlovi{
+  namespace binaryio{
+    template <class T>
+    inline void write(std::ostream & out, const T & val){
+      out.write(reinterpret_cast<const char *>(& val), sizeof(T));
+    }
+
+    template <class T>
+    inline T read(std::istream & in){
+      T val;
+      if(! in.read(reinterpret_cast<char *>(& val), sizeof(T)))
+        throw dlovi::Exception("Unexpected end of binary stream.");
+      return val;
+    }
+
+    // Reads an element count, and throws unless that many elements of nElementSize bytes fit in the rest of the stream.
+    inline int readCount(std::istream & in, size_t nElementSize){
+      int nCount = read<int>(in);
+      std::streampos posCur = in.tellg();
+      in.seekg(0, std::ios::end);
+      std::streampos posEnd = in.tellg();
+      in.seekg(posCur);
+      if(nCount < 0 || posCur < 0 || posEnd < posCur || (unsigned long long)nCount * nElementSize > (unsigned long long)(posEnd - posCur))
+        throw dlovi::Exception("Bad element count in binary stream.");
+      return nCount;
+    }
+
+    inline void writeVec3(std::ostream & out, const dlovi::Matrix & mat){
+      write<double>(out, mat(0)); write<double>(out, mat(1)); write<double>(out, mat(2));
+    }
+
+    inline dlovi::Matrix readVec3(std::istream & in){
+      dlovi::Matrix mat(3, 1);
+      mat(0) = read<double>(in); mat(1) = read<double>(in); mat(2) = read<double>(in);
+      return mat;
+    }
+
+    inline void writeVec3Array(std::ostream & out, const std::vector<dlovi::Matrix> & arrMat){
+      write<int>(out, (int)arrMat.size());
+      for(std::vector<dlovi::Matrix>::const_iterator it = arrMat.begin(); it != arrMat.end(); it++)
+        writeVec3(out, *it);
+    }
+
+    inline void readVec3Array(std::istream & in, std::vector<dlovi::Matrix> & arrMat){
+      int nSize = readCount(in, 3 * sizeof(double));
+      arrMat.clear();
+      arrMat.reserve(nSize);
+      for(int i = 0; i < nSize; i++)
+        arrMat.push_back(readVec3(in));
+    }
+
+    inline void writeIndexLists(std::ostream & out, const std::vector<std::vector<int> > & arrLists){
+      write<int>(out, (int)arrLists.size());
+      for(std::vector<std::vector<int> >::const_iterator it = arrLists.begin(); it != arrLists.end(); it++){
+        write<int>(out, (int)it->size());
+        if(! it->empty())
+          out.write(reinterpret_cast<const char *>(& (*it)[0]), it->size() * sizeof(int));
+      }
+    }
+
+    inline void readIndexLists(std::istream & in, std::vector<std::vector<int> > & arrLists){
+      int nSize = readCount(in, sizeof(int));
+      arrLists.assign(nSize, std::vector<int>());
+      for(int i = 0; i < nSize; i++){
+        arrLists[i].resize(readCount(in, sizeof(int)));
+        if(! arrLists[i].empty() && ! in.read(reinterpret_cast<char *>(& arrLists[i][0]), arrLists[i].size() * sizeof(int)))
+          throw dlovi::Exception("Unexpected end of binary stream.");
+      }
+    }
+  }
+}
+
+#endif
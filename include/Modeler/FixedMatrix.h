@@ -0,0 +1,154 @@
+#ifndef __FIXEDMATRIX_H
+#define __FIXEDMATRIX_H
+
+#include <cmath>
+#include <sstream>
+#include "Modeler/Matrix.h"
+#include "Modeler/Exception.h"
+
+// Matrices with their size fixed at compile time, held inline (no heap), for the small vectors and matrices of the
+// geometric tests: 3x1 points, camera centers and directions, 3x3 rotations.  Storage is column-major, as in Matrix,
+// and the accessors are unchecked.  Conversions to and from Matrix are explicit and check the size.
+
+namespace dlovi{
+
+	template <int R, int C>
+	class FixedMatrix{
+	public:
+		// Constructors
+		FixedMatrix(){} // Uninitialized
+		explicit FixedMatrix(const double fillval){ fill(fillval); }
+		FixedMatrix(const double x, const double y, const double z){
+			static_assert(R * C == 3, "FixedMatrix(x, y, z) is for 3-vectors");
+			m_arrData[0] = x; m_arrData[1] = y; m_arrData[2] = z;
+		}
+		explicit FixedMatrix(const Matrix & ref){
+			// A vector converts from a row or a column vector of the same length, as Matrix::dot treats both alike
+			bool bVectors = (R == 1 || C == 1) && ref.isVector() && ref.numElements() == R * C;
+			if(! bVectors && (ref.numRows() != R || ref.numCols() != C)){
+				std::stringstream ss;
+				ss << "FixedMatrix<" << R << ", " << C << ">: cannot convert a " << ref.numRows() << "x" << ref.numCols() << " Matrix";
+				dlovi::Exception ex(ss.str()); ex.tag("FixedMatrix", "FixedMatrix"); throw ex;
+			}
+			for(int i = 0; i < R * C; i++)
+				m_arrData[i] = ref(i);
+		}
+
+		// Getters
+		static int numRows(){ return R; }
+		static int numCols(){ return C; }
+		static int numElements(){ return R * C; }
+		double at(const int index) const{ return m_arrData[index]; }
+		double at(const int row, const int col) const{ return m_arrData[col * R + row]; }
+
+		// Operators
+		const double & operator()(const int index) const{ return m_arrData[index]; }
+		double & operator()(const int index){ return m_arrData[index]; }
+		const double & operator()(const int row, const int col) const{ return m_arrData[col * R + row]; }
+		double & operator()(const int row, const int col){ return m_arrData[col * R + row]; }
+
+		FixedMatrix operator+() const{ return *this; }
+		FixedMatrix operator-() const{
+			FixedMatrix retVal;
+			for(int i = 0; i < R * C; i++)
+				retVal.m_arrData[i] = -m_arrData[i];
+			return retVal;
+		}
+		FixedMatrix operator+(const FixedMatrix & rhs) const{ FixedMatrix retVal(*this); return retVal += rhs; }
+		FixedMatrix operator-(const FixedMatrix & rhs) const{ FixedMatrix retVal(*this); return retVal -= rhs; }
+		FixedMatrix operator*(const double rhs) const{ FixedMatrix retVal(*this); return retVal *= rhs; }
+		FixedMatrix operator/(const double rhs) const{ FixedMatrix retVal(*this); return retVal /= rhs; }
+		template <int C2>
+		FixedMatrix<R, C2> operator*(const FixedMatrix<C, C2> & rhs) const{
+			FixedMatrix<R, C2> retVal(0.0);
+			for(int j = 0; j < C2; j++){
+				for(int k = 0; k < C; k++){
+					for(int i = 0; i < R; i++)
+						retVal(i, j) += at(i, k) * rhs(k, j);
+				}
+			}
+			return retVal;
+		}
+
+		FixedMatrix & operator+=(const FixedMatrix & rhs){
+			for(int i = 0; i < R * C; i++)
+				m_arrData[i] += rhs.m_arrData[i];
+			return *this;
+		}
+		FixedMatrix & operator-=(const FixedMatrix & rhs){
+			for(int i = 0; i < R * C; i++)
+				m_arrData[i] -= rhs.m_arrData[i];
+			return *this;
+		}
+		FixedMatrix & operator*=(const double rhs){
+			for(int i = 0; i < R * C; i++)
+				m_arrData[i] *= rhs;
+			return *this;
+		}
+		FixedMatrix & operator/=(const double rhs){
+			// Divides (rather than multiplying by the reciprocal) to round as Matrix does
+			for(int i = 0; i < R * C; i++)
+				m_arrData[i] /= rhs;
+			return *this;
+		}
+
+		// Public Methods
+		void fill(const double fillval){
+			for(int i = 0; i < R * C; i++)
+				m_arrData[i] = fillval;
+		}
+		double dot(const FixedMatrix & rhs) const{
+			double retVal = 0.0;
+			for(int i = 0; i < R * C; i++)
+				retVal += m_arrData[i] * rhs.m_arrData[i];
+			return retVal;
+		}
+		FixedMatrix cross(const FixedMatrix & rhs) const{
+			static_assert(R * C == 3, "FixedMatrix::cross is for 3-vectors");
+			FixedMatrix retVal;
+			retVal.m_arrData[0] = m_arrData[1] * rhs.m_arrData[2] - m_arrData[2] * rhs.m_arrData[1];
+			retVal.m_arrData[1] = m_arrData[2] * rhs.m_arrData[0] - m_arrData[0] * rhs.m_arrData[2];
+			retVal.m_arrData[2] = m_arrData[0] * rhs.m_arrData[1] - m_arrData[1] * rhs.m_arrData[0];
+			return retVal;
+		}
+		double norm() const{ return std::sqrt(dot(*this)); } // 2-norm for vectors, Frobenius norm otherwise
+		FixedMatrix<C, R> transpose() const{
+			FixedMatrix<C, R> retVal;
+			for(int i = 0; i < R; i++){
+				for(int j = 0; j < C; j++)
+					retVal(j, i) = at(i, j);
+			}
+			return retVal;
+		}
+		Matrix toMatrix() const{
+			Matrix retVal(R, C);
+			for(int i = 0; i < R * C; i++)
+				retVal(i) = m_arrData[i];
+			return retVal;
+		}
+		const double * data() const{ return m_arrData; }
+		double * data(){ return m_arrData; }
+
+		// Public Static Methods
+		static FixedMatrix zeros(){ return FixedMatrix(0.0); }
+		static FixedMatrix eye(){
+			FixedMatrix retVal(0.0);
+			for(int i = 0; i < R && i < C; i++)
+				retVal(i, i) = 1.0;
+			return retVal;
+		}
+
+	private:
+		// Members
+		double m_arrData[R * C];
+	};
+
+	// Left hand binary operators
+	template <int R, int C>
+	inline FixedMatrix<R, C> operator*(const double lhs, const FixedMatrix<R, C> & rhs){ return rhs * lhs; }
+
+	typedef FixedMatrix<3, 1> FixedVector3;
+	typedef FixedMatrix<3, 3> FixedMatrix33;
+}
+
+#endif
@@ -38,6 +38,7 @@
 #include <unordered_map>
 #include "Modeler/lovimath.h"
 #include "Modeler/Matrix.h"
+#include "Modeler/FixedMatrix.h"
 // #include <maxflow/graph.h>
 #include "Modeler/GraphWrapper_Boost.h"
 
@@ -49,6 +50,9 @@
 #include <CGAL/Triangulation_cell_base_with_info_3.h>
 #include <CGAL/Projection_traits_xy_3.h>
 #include <CGAL/intersections.h>
+#include <CGAL/spatial_sort.h>
+#include <CGAL/Spatial_sort_traits_adapter_3.h>
+#include <CGAL/property_map.h>
 
 using namespace std;
 
@@ -264,19 +268,22 @@ namespace dlovi {
                 // Asymmetric distance heuristic.
                 // Sum of two triangle areas, use the base segment PQ as constraint x, and the two points from y as R1 and R2.
                 // Note: For efficiency, to avoid unnecessary division by 2 and square-roots, use the sum of twice-the-areas squared = squared area of parallelograms.
-                const Matrix & P = vecCamCenters[x.first];
-                Matrix Q(3, 1); Q(0) = vecVertexHandles[x.second]->point().x(); Q(1) = vecVertexHandles[x.second]->point().y(); Q(2) = vecVertexHandles[x.second]->point().z();
-                const Matrix & R1 = vecCamCenters[y.first];
-                Matrix R2(3, 1); R2(0) = vecVertexHandles[y.second]->point().x(); R2(1) = vecVertexHandles[y.second]->point().y(); R2(2) = vecVertexHandles[y.second]->point().z();
+                // Runs for every pair of constraints compared on eviction, so everything is fixed-size.
+                const Matrix & matP = vecCamCenters[x.first];
+                const Matrix & matR1 = vecCamCenters[y.first];
+                FixedVector3 P(matP(0), matP(1), matP(2));
+                FixedVector3 Q(vecVertexHandles[x.second]->point().x(), vecVertexHandles[x.second]->point().y(), vecVertexHandles[x.second]->point().z());
+                FixedVector3 R1(matR1(0), matR1(1), matR1(2));
+                FixedVector3 R2(vecVertexHandles[y.second]->point().x(), vecVertexHandles[y.second]->point().y(), vecVertexHandles[y.second]->point().z());
 
                 // Vector distances
-                Matrix PQ(Q - P);
-                Matrix PR1(R1 - P);
-                Matrix PR2(R2 - P);
+                FixedVector3 PQ(Q - P);
+                FixedVector3 PR1(R1 - P);
+                FixedVector3 PR2(R2 - P);
 
                 // Sum of squared areas of parallelograms
-                Matrix PQxPR1(PQ.cross(PR1));
-                Matrix PQxPR2(PQ.cross(PR2));
+                FixedVector3 PQxPR1(PQ.cross(PR1));
+                FixedVector3 PQxPR2(PQ.cross(PR2));
                 return PQxPR1.dot(PQxPR1) + PQxPR2.dot(PQxPR2);
             }
 
@@ -318,14 +325,14 @@ namespace dlovi {
 
         // Getters
         const vector<Matrix> & getPoints() const;
-        Matrix getPoint(const int index) const;
+        const Matrix & getPoint(const int index) const;
         int numPoints() const;
         const vector<Matrix> & getCams() const;
-        Matrix getCam(const int index) const;
+        const Matrix & getCam(const int index) const;
         const vector<Matrix> & getCamCenters() const;
-        Matrix getCamCenter(const int index) const;
+        const Matrix & getCamCenter(const int index) const;
         const vector<Matrix> & getPrincipleRays() const;
-        Matrix getPrincipleRay(const int index) const;
+        const Matrix & getPrincipleRay(const int index) const;
         const vector<vector<int> > & getVisibilityList() const;
         const vector<int> & getVisibilityList(const int index) const;
         int numCams() const;
@@ -338,6 +345,8 @@ namespace dlovi {
         void setCamCenters(const vector<Matrix> & ref);
         void setPrincipleRays(const vector<Matrix> & ref);
         void setVisibilityList(const vector<vector<int> > & ref);
+        void setBounds(const double nBoundsMin, const double nBoundsMax);
+        void setConstraintClipBox(const Matrix & matMin, const Matrix & matMax); // free-space constraints are cut where they leave the box
 
         void addPoint(const Matrix & ref);
         void addCamCenter(const Matrix & ref);
@@ -356,14 +365,23 @@ namespace dlovi {
         void removeVertex(Delaunay3 & dt, vector<Delaunay3::Vertex_handle> & vecVertexHandles, const int pointIndex) const;
         void removeVertex(Delaunay3 & dt, vector<Delaunay3::Vertex_handle> & vecVertexHandles, const set<int> & setPointIndices) const; // for batch deletes
         void moveVertex(Delaunay3 & dt, vector<Delaunay3::Vertex_handle> & vecVertexHandles, const int pointIndex) const;
-        void moveVertex(Delaunay3 & dt, vector<Delaunay3::Vertex_handle> & vecVertexHandles, const vector<int> & arrPointIndices) const;
+        void moveVertex(Delaunay3 & dt, vector<Delaunay3::Vertex_handle> & vecVertexHandles, const vector<int> & arrPointIndices,
+                        const double dMinDisplacement = 0.0) const; // for batch moves, vertices moving by dMinDisplacement or less stay in place
         void applyConstraint(Delaunay3 & dt, vector<Delaunay3::Vertex_handle> & vecVertexHandles, const int camIndex, const int pointIndex) const;
         void removeConstraint(Delaunay3 & dt, vector<Delaunay3::Vertex_handle> & vecVertexHandles, const int camIndex, const int pointIndex) const;
 
         void tetsToTris(const Delaunay3 & dt, vector<Matrix> & points, list<Matrix> & tris, const int nVoteThresh = 1) const;
+        // Same, also giving the index (into getPoints()) of the point at each model vertex, found through vecVertexHandles
+        void tetsToTris(const Delaunay3 & dt, const vector<Delaunay3::Vertex_handle> & vecVertexHandles, vector<Matrix> & points,
+                        vector<int> & pointIndices, list<Matrix> & tris, const int nVoteThresh = 1) const;
         int writeObj(const string filename, const vector<Matrix> & points, const list<Matrix> & tris) const;
         void writeObj(ostream & outfile, const vector<Matrix> & points, const list<Matrix> & tris) const;
 
+        // Binary checkpoint of the algorithm state together with the carved triangulation.  readCheckpoint() rebuilds dt and vecVertexHandles
+        // in place of the current ones, and throws if the stream is not a matching checkpoint.
+        void writeCheckpoint(ostream & out, const Delaunay3 & dt, const vector<Delaunay3::Vertex_handle> & vecVertexHandles) const;
+        void readCheckpoint(istream & in, Delaunay3 & dt, vector<Delaunay3::Vertex_handle> & vecVertexHandles);
+
         void calculateBoundsValues(); // TODO: Refactor.  E.g. move back to private, declare friend classes that need access, e.g. SFMTranscriptInterface_Delaunay
 
     private:
@@ -371,19 +389,22 @@ namespace dlovi {
         void copy(const vector<Matrix> & points, const vector<Matrix> & cams, const vector<Matrix> & camCenters,
                   const vector<Matrix> & principleRays, const vector<vector<int> > & visibilityList);
         void createBounds(Delaunay3 & dt) const;
+        Segment constraintSegment(const PointD3 & Q, const int camIndex) const;
         void markTetrahedraCrossingConstraint(Delaunay3 & dt, const Delaunay3::Vertex_handle hndlQ, const Segment & constraint) const;
         void markTetrahedraCrossingConstraintWithBookKeeping(Delaunay3 & dt, const vector<Delaunay3::Vertex_handle> & vecVertexHandles, const Delaunay3::Vertex_handle hndlQ,
                                                              const Segment & constraint, const int camIndex, const int featureIndex, const bool bOnlyMarkNew = false) const;
         void addNewlyObservedFeatures(Delaunay3 & dt, vector<Delaunay3::Vertex_handle> & vecVertexHandles, vector<int> & localVisList, const vector<int> & originalLocalVisList) const;
         void addNewlyObservedFeature(Delaunay3 & dt, vector<Delaunay3::Vertex_handle> & vecVertexHandles,
                                      set<pair<int, int>, Delaunay3CellInfo::LtConstraint> & setUnionedConstraints, const PointD3 & Q, const int nPointIndex) const;
-        bool triangleConstraintIntersectionTest(const Delaunay3::Facet & tri, const Matrix & segSrc, const Matrix & segDest) const;
-        bool triangleConstraintIntersectionTest(bool & bCrossesInteriorOfConstraint, const vector<Matrix> & points, const Matrix & tri, const pair<Matrix, Matrix> & constraint) const;
-        bool cellTraversalExitTest(int & f, const Delaunay3::Cell_handle tetCur, const Delaunay3::Cell_handle tetPrev, const Matrix & matQ, const Matrix & matO) const;
+        bool triangleConstraintIntersectionTest(const Delaunay3::Facet & tri, const FixedVector3 & segSrc, const FixedVector3 & segDest) const;
+        bool triangleConstraintIntersectionTest(bool & bCrossesInteriorOfConstraint, const FixedVector3 & v0, const FixedVector3 & v1, const FixedVector3 & v2,
+                                                const FixedVector3 & segSrc, const FixedVector3 & segDest) const;
+        bool cellTraversalExitTest(int & f, const Delaunay3::Cell_handle tetCur, const Delaunay3::Cell_handle tetPrev, const FixedVector3 & matQ, const FixedVector3 & matO) const;
         void facetToTri(const Delaunay3::Facet & f, vector<Delaunay3::Vertex_handle> & vecTri) const;
         double timestamp() const;
         void tetsToTris_naive(const Delaunay3 & dt, vector<Matrix> & points, list<Matrix> & tris, const int nVoteThresh) const;
-        void tetsToTris_maxFlowSimple(const Delaunay3 & dt, vector<Matrix> & points, list<Matrix> & tris, const int nVoteThresh) const;
+        void tetsToTris_maxFlowSimple(const Delaunay3 & dt, vector<Matrix> & points, list<Matrix> & tris, const int nVoteThresh,
+                                      vector<Delaunay3::Vertex_handle> * pModelVertexHandles = NULL) const;
 
         // Private Members
         vector<Matrix> m_points;
@@ -393,6 +414,9 @@ namespace dlovi {
         vector<vector<int> > m_visibilityList;
         double m_nBoundsMin;
         double m_nBoundsMax;
+        bool m_bClipConstraints;
+        FixedVector3 m_vecClipMin;
+        FixedVector3 m_vecClipMax;
         mutable map<int, int> m_mapPoint_VertexHandle; // TODO: Refactor
     };
 }
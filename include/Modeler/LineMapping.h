@@ -0,0 +1,116 @@
+#ifndef __LINEMAPPING_H
+#define __LINEMAPPING_H
+
+#include <vector>
+#include <list>
+#include <map>
+#include <mutex>
+#include <opencv2/core/core.hpp>
+
+#include "ThreadPool.h"
+#include "Modeler/Modeler.h"
+
+namespace ORB_SLAM2 {
+
+    class KeyFrame;
+    class MapPoint;
+
+    // Points along the straight edges seen by the keyframes, so that CARV carves planar walls flat.
+    //
+    // A segment detected in a keyframe is kept if the map points projecting next to it also project next to one segment
+    // in each of 3 covisible keyframes at a distance; points are then laid between its outermost supporting map points.
+    // The modeler hands the keyframes over once logged and gets the points back, so that neither thread waits on the other.
+    // Detection runs one keyframe per pool task, and the points near a segment, or the segments near a point, are looked
+    // up in grids of image cells instead of testing every pair.
+    class LineMapping {
+    public:
+        // nThreads is the number of pool workers helping the line thread (0: one per hardware thread minus the caller)
+        LineMapping(size_t nThreads = 0);
+
+        void SetModeler(Modeler* pModeler);
+        // Called by the modeler thread with the image of each keyframe it logs
+        void InsertKeyFrame(KeyFrame* pKF, const cv::Mat& im);
+
+        // Main function
+        void Run();
+
+        // Thread Synch
+        void RequestReset();
+        void RequestFinish();
+        bool isFinished();
+
+        // EDLines on a gray image.  The library fills static tables on first use: calls are serialized.
+        static std::vector<LineSegment> DetectLineSegments(const cv::Mat& imGray);
+
+    protected:
+        // Image cells of CELL_SIZE pixels listing the points or segments that fall in them
+        class CellGrid {
+        public:
+            static const int CELL_SIZE = 16;
+
+            CellGrid();
+            void Reset(int nCols, int nRows);
+            void AddPoint(const cv::Point2f& pt, int nIndex);
+            void AddSegment(const cv::Point2f& start, const cv::Point2f& end, int nIndex);
+
+            // Indices, sorted and unique, of the entries that can be within fRadius of the segment (a point if start == end)
+            void GetNear(const cv::Point2f& start, const cv::Point2f& end, float fRadius, std::vector<int>& vIndices) const;
+
+        protected:
+            void GetCellsOnSegment(const cv::Point2f& start, const cv::Point2f& end, std::vector<cv::Point>& vCells) const;
+            cv::Point GetCell(const cv::Point2f& pt) const;
+
+            int mnGridCols;
+            int mnGridRows;
+            std::vector<std::vector<int> > mvCells;
+        };
+
+        // Segments of a keyframe, long enough to be matched
+        struct KeyFrameLines {
+            std::vector<LineSegment> vLines;
+            CellGrid grid;
+        };
+
+        // Pose and calibration of a keyframe, read once per keyframe processed
+        struct KeyFrameView {
+            void Set(KeyFrame* pKF);
+            bool Project(const cv::Vec3f& Pw, cv::Point2f& xy) const;
+
+            KeyFrame* pKF;
+            cv::Matx33f Rcw;
+            cv::Vec3f tcw;
+            float fx, fy, cx, cy;
+            float fMinX, fMinY, fMaxX, fMaxY;
+            float fThreshold; // max distance in pixels between a supporting point and its segment
+        };
+
+        void LineLoop();
+        std::vector<cv::Point3f> GetPointsOnLineSegments(KeyFrame* pKF, KeyFrameLines& lines);
+
+        void ResetIfRequested();
+        bool CheckFinish();
+        void SetFinish();
+
+        Modeler* mpModeler;
+        ThreadPool mThreadPool;
+
+        // Keyframes handed over by the modeler, not picked up by the line thread yet
+        std::list<std::pair<KeyFrame*, cv::Mat> > mlNewKeyFrames;
+        std::mutex mMutexNewKFs;
+
+        // Segments of the most recent keyframes, touched by the line thread only.  Past mnMaxKeyFrames, the oldest are
+        // dropped (and can no longer be matched against).
+        std::map<KeyFrame*, KeyFrameLines> mmKeyFrameLines;
+        std::list<KeyFrame*> mlKeyFrameOrder;
+        size_t mnMaxKeyFrames;
+
+        bool mbResetRequested;
+        std::mutex mMutexReset;
+
+        bool mbFinishRequested;
+        bool mbFinished;
+        std::mutex mMutexFinish;
+    };
+}
+
+#endif //__LINEMAPPING_H
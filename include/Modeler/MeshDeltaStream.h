@@ -0,0 +1,143 @@
+#ifndef __MESHDELTASTREAM_H
+#define __MESHDELTASTREAM_H
+
+#include <vector>
+#include <list>
+#include <map>
+#include <unordered_map>
+#include <tuple>
+#include <string>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <cstddef>
+#include <stdint.h>
+#include "Modeler/Matrix.h"
+#include "Modeler/SFMTranscriptStream.h"
+
+// Binary stream of changes to the extracted surface, for viewers that show the model without carving it themselves.
+//
+// Frames are laid out like the transcript stream's, with the magic 'C' 'M':
+//     'C' 'M' <version: u8> <payload length: u32 little-endian> <payload>
+// and each frame holds one delta, a sequence of records that ends with MR_END.  Vertices and triangles are named by ids
+// the publisher assigns; a vertex keeps its id as long as it stays at the same position in the surfaces that are
+// extracted, so the size of a delta follows the change of the surface, not the activity of the map.
+
+namespace dlovi{
+    namespace compvis{
+
+        namespace meshdelta{
+            const uint8_t VERSION = 1;
+            const size_t FRAME_HEADER_SIZE = 7;
+
+            enum RecordType {
+                MR_RESET = 1,       // drop all vertices and triangles (starts a full snapshot)
+                MR_ADDVERTEX,       // vertex id, [x y z]
+                MR_REMOVEVERTEX,    // vertex id
+                MR_ADDTRIANGLE,     // triangle id, 3 vertex ids, texture frame id + 1 (0: none)
+                MR_REMOVETRIANGLE,  // triangle id
+                MR_END              // model sequence number; the consumer's mesh now matches that extraction
+            };
+        }
+
+        // Diffs each extracted surface against the one the consumer has and writes the delta to a sink, on its own thread.
+        // A slow consumer exerts backpressure through the sink's blocking write(): while a delta is being written, newer
+        // surfaces replace each other and only the latest one is sent next, as a single delta.  If the sink fails, the
+        // next delta is a full snapshot (so a consumer can reconnect behind it).
+        class MeshDeltaPublisher{
+        public:
+            // Constructors and Destructors
+            MeshDeltaPublisher(ByteSink * pSink);
+            ~MeshDeltaPublisher();
+            MeshDeltaPublisher(const MeshDeltaPublisher &) = delete;
+            MeshDeltaPublisher & operator=(const MeshDeltaPublisher &) = delete;
+
+            // Getters
+            int numModelsSent() const;
+            int numModelsCoalesced() const;
+            size_t numBytesSent() const;
+
+            // Public Methods
+            // Returns at once.  arrTriTextureFrames, if not empty, holds a texture frame id (-1: none) per triangle.
+            void publish(const std::vector<dlovi::Matrix> & arrPoints, const std::list<dlovi::Matrix> & lstTris,
+                         const std::vector<long> & arrTriTextureFrames = std::vector<long>());
+            void requestResync();
+            void flush();
+
+        private:
+            // Private Types
+            struct Model{
+                std::vector<dlovi::Matrix> arrPoints;
+                std::list<dlovi::Matrix> lstTris;
+                std::vector<long> arrTriTextureFrames;
+            };
+            struct SentTriangle{
+                uint32_t nId;
+                long nTextureFrame;
+            };
+
+            // Private Methods
+            void run();
+            void encodeDelta(const Model & objModel, std::string & strPayload);
+            uint32_t addVertexRef(const dlovi::Matrix & matPoint, std::string & strPayload);
+            void removeVertexRef(uint32_t nVertexId, std::string & strPayload);
+
+            // Member Variables
+            ByteSink * m_pSink;
+            std::thread m_thread;
+            mutable std::mutex m_mutex;
+            std::condition_variable m_condition;
+            Model m_objPending;
+            bool m_bPending;
+            bool m_bSending;
+            bool m_bStop;
+            bool m_bResync;
+            int m_nNumModelsSent;
+            int m_nNumModelsCoalesced;
+            size_t m_nNumBytesSent;
+
+            // What the consumer has, touched by the sender thread only
+            std::map<std::tuple<double, double, double>, uint32_t> m_mapPosition_Vertex;
+            std::unordered_map<uint32_t, std::pair<std::tuple<double, double, double>, int> > m_mapVertex_PositionRefs;
+            std::map<std::tuple<uint32_t, uint32_t, uint32_t>, SentTriangle> m_mapTriangles; // keyed by vertex ids, smallest first
+            uint32_t m_nNextVertexId;
+            uint32_t m_nNextTriangleId;
+            uint32_t m_nSequence;
+        };
+
+        // Rebuilds the mesh from the frames in arbitrary byte chunks.  Throws a dlovi::Exception on a malformed stream.
+        class MeshDeltaDecoder{
+        public:
+            // Constructors and Destructors
+            MeshDeltaDecoder();
+
+            // Getters
+            int numModelsDecoded() const;
+            uint32_t getSequence() const;
+            void getModel(std::vector<dlovi::Matrix> & arrPoints, std::list<dlovi::Matrix> & lstTris,
+                          std::vector<long> * pTriTextureFrames = NULL) const;
+
+            // Public Methods
+            void feed(const char * pData, size_t nSize);
+
+        private:
+            // Private Types
+            struct Triangle{
+                uint32_t arrVertices[3];
+                long nTextureFrame;
+            };
+
+            // Private Methods
+            void decodePayload(const char * pData, size_t nSize);
+
+            // Member Variables
+            std::string m_strPending; // bytes of a frame that is not complete yet
+            std::map<uint32_t, dlovi::Matrix> m_mapVertices;
+            std::map<uint32_t, Triangle> m_mapTriangles;
+            int m_nNumModelsDecoded;
+            uint32_t m_nSequence;
+        };
+    }
+}
+
+#endif
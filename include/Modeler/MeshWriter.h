@@ -0,0 +1,46 @@
+#ifndef __MESHWRITER_H
+#define __MESHWRITER_H
+
+#include <iostream>
+#include <vector>
+#include <list>
+#include <string>
+#include <stdint.h>
+#include "Modeler/Matrix.h"
+
+// Writers of an extracted surface to disk, none of which needs a GL context.  The binary formats are written straight
+// from the points and triangles through a fixed-size buffer, never holding the whole file in memory:
+//     .ply  binary little-endian PLY: float x y z [uchar red green blue] per vertex, 3 int indices per face
+//     .glb  binary glTF 2.0: one indexed triangle mesh, with COLOR_0 (normalized ubyte rgba) if there are colours
+//     .obj  ASCII OBJ: vertices and faces only
+
+namespace dlovi{
+    namespace compvis{
+
+        class MeshWriter{
+        public:
+            enum Format{
+                MF_OBJ,
+                MF_PLY,
+                MF_GLB
+            };
+
+            // By extension, case-insensitive: MF_OBJ unless it is .ply or .glb
+            static Format formatFromFileName(const std::string & strFileName);
+
+            // arrColors, if not empty, holds r g b per point
+            static void writePly(std::ostream & out, const std::vector<dlovi::Matrix> & arrPoints, const std::list<dlovi::Matrix> & lstTris,
+                                 const std::vector<uint8_t> & arrColors = std::vector<uint8_t>());
+            static void writeGlb(std::ostream & out, const std::vector<dlovi::Matrix> & arrPoints, const std::list<dlovi::Matrix> & lstTris,
+                                 const std::vector<uint8_t> & arrColors = std::vector<uint8_t>());
+            static void writeObj(std::ostream & out, const std::vector<dlovi::Matrix> & arrPoints, const std::list<dlovi::Matrix> & lstTris);
+
+            // In the format of its extension (OBJ drops the colours).  Written beside strFileName and renamed over it, so a
+            // reader never sees a partial file.  Returns false on failure.
+            static bool writeFile(const std::string & strFileName, const std::vector<dlovi::Matrix> & arrPoints,
+                                  const std::list<dlovi::Matrix> & lstTris, const std::vector<uint8_t> & arrColors = std::vector<uint8_t>());
+        };
+    }
+}
+
+#endif
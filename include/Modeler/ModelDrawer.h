@@ -16,6 +16,7 @@
 #include "Modeler/Matrix.h"
 #include "Modeler/Modeler.h"
 #include "Modeler/TextureFrame.h"
+#include "Modeler/TextureAtlas.h"
 
 namespace ORB_SLAM2
 {
@@ -35,7 +36,8 @@ namespace ORB_SLAM2
         cv::Mat DrawLines();
 
         void UpdateModel();
-        void SetUpdatedModel(const vector<dlovi::Matrix> & modelPoints, const list<dlovi::Matrix> & modelTris);
+        void SetUpdatedModel(const vector<dlovi::Matrix> & modelPoints, const list<dlovi::Matrix> & modelTris,
+                             const vector<TriangleTexture> & modelTriTextures = vector<TriangleTexture>());
 
         void MarkUpdateDone();
         bool UpdateRequested();
@@ -46,15 +48,43 @@ namespace ORB_SLAM2
 
         void SetModeler(Modeler* pModeler);
         Modeler* mpModeler;
+
+        // Drops the frame images uploaded for DrawFrame on the next draw (frame ids start over after a reset)
+        void ResetFrameTextures();
     private:
 
+        // Texture of the image of frame nFrameId, uploaded on first use only; NULL if the image is gone
+        pangolin::GlTexture* GetFrameTexture(long unsigned int nFrameId, bool bRGB);
 
+        // Uploads the rows of the atlas pages baked since the last draw
+        void UploadAtlas(bool bRGB);
+        // Vertex arrays of the textured triangles, one per atlas page
+        void BuildAtlasBatches();
 
         bool mbModelUpdateRequested;
         bool mbModelUpdateDone;
 
         std::pair<vector<dlovi::Matrix>, list<dlovi::Matrix>> mModel;
         std::pair<vector<dlovi::Matrix>, list<dlovi::Matrix>> mUpdatedModel;
+        vector<TriangleTexture> mvTriTextures;
+        vector<TriangleTexture> mvUpdatedTriTextures;
+
+        struct AtlasBatch {
+            vector<float> vVertices;
+            vector<float> vNormals;
+            vector<float> vTexCoords;
+        };
+        vector<AtlasBatch> mvAtlasBatches;
+        bool mbAtlasBatchesStale;
+        vector<GLuint> mvAtlasTextures;
+
+        // Frame images uploaded for DrawFrame by frame id, the least recently drawn last in the list
+        std::map<long unsigned int, pangolin::GlTexture*> mmFrameTextures;
+        std::list<long unsigned int> mlFrameTextureLRU;
+        size_t mnMaxFrameTextures;
+        GLuint mnFramePBO;
+        bool mbFrameTexturesReset;
+        std::mutex mMutexFrameTextures;
 
     };
 
@@ -0,0 +1,65 @@
+#ifndef __MODELEXPORTER_H
+#define __MODELEXPORTER_H
+
+#include <vector>
+#include <list>
+#include <string>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <stdint.h>
+#include <opencv2/core/core.hpp>
+
+#include "Modeler/Matrix.h"
+#include "Modeler/TextureFrame.h"
+
+namespace ORB_SLAM2 {
+
+    // Snapshots of the surface written to one file on a thread of their own, so that the modeler never waits on the disk
+    // and no viewer is needed.  The format follows the extension of the file (see MeshWriter).
+    //
+    // Each snapshot replaces the file atomically.  Snapshots handed over while one is being written replace each other:
+    // only the latest is written next.  Vertices are coloured, if textures are given, from the most recent keyframe image
+    // they project in.
+    class ModelExporter {
+    public:
+        // bRGB: the images are in RGB order (BGR otherwise), as Camera.RGB
+        ModelExporter(const std::string& strFileName, bool bRGB);
+        // Writes the pending snapshot before it returns
+        ~ModelExporter();
+
+        // Returns at once, taking the contents of vPoints and lTris.  vTextures are the texture keyframes and their images,
+        // the most recent first (or none).
+        void Snapshot(std::vector<dlovi::Matrix>& vPoints, std::list<dlovi::Matrix>& lTris,
+                      const std::vector<std::pair<cv::Mat, TextureFrame> >& vTextures);
+        // Waits until the pending snapshot is written
+        void Flush();
+
+        int NumSnapshotsWritten();
+        const std::string& GetFileName() const;
+
+        // r g b per point, grey where no image sees it
+        static std::vector<uint8_t> ComputeVertexColors(const std::vector<dlovi::Matrix>& vPoints,
+                                                        std::vector<std::pair<cv::Mat, TextureFrame> >& vTextures, bool bRGB);
+
+    protected:
+        void Run();
+
+        std::string mstrFileName;
+        bool mbRGB;
+
+        std::vector<dlovi::Matrix> mvPendingPoints;
+        std::list<dlovi::Matrix> mlPendingTris;
+        std::vector<std::pair<cv::Mat, TextureFrame> > mvPendingTextures;
+        bool mbPending;
+        bool mbWriting;
+        bool mbStop;
+        int mnSnapshotsWritten;
+
+        std::mutex mMutexSnapshot;
+        std::condition_variable mCondSnapshot;
+        std::thread mThread;
+    };
+}
+
+#endif //__MODELEXPORTER_H
@@ -2,15 +2,23 @@
 #ifndef __MODELER_H
 #define __MODELER_H
 
+#include <chrono>
 #include <mutex>
 
 #include "Modeler/SFMTranscriptInterface_ORBSLAM.h"
 #include "Modeler/SFMTranscriptInterface_Delaunay.h"
+#include "Modeler/SFMTranscriptInterface_TiledDelaunay.h"
 #include "Modeler/ModelDrawer.h"
 #include "Modeler/TextureFrame.h"
+#include "Modeler/TextureAtlas.h"
+#include "Modeler/TranscriptEventQueue.h"
+#include "Modeler/MeshDeltaStream.h"
+#include "Modeler/ModelExporter.h"
 
 #include "Thirdparty/EDLines/LS.h"
 
+class ProbabilityMapping;
+
 namespace ORB_SLAM2 {
 
     class Tracking;
@@ -19,6 +27,8 @@ namespace ORB_SLAM2 {
     class KeyFrame;
     class Frame;
     class ModelDrawer;
+    class LineMapping;
+    class Map;
 
     class LinePoint;
 
@@ -117,21 +127,75 @@ namespace ORB_SLAM2 {
 
         void SetTracker(Tracking* pTracker);
 
+        void SetMap(Map* pMap);
+
         // Main function
         void Run();
 
         void UpdateModelDrawer();
+        void ProcessTranscriptEvents();
+        void SnapshotKeyFrame(KeyFrame* pKF, KeyFrameSnapshot& snapshot);
+        void SnapshotAdjustment(const AdjustedEntities& adjusted, AdjustmentSnapshot& snapshot);
         bool CheckNewTranscriptEntry();
         void RunRemainder();
 
-        void AddPointsOnLineSegments();
+        // Bundle adjustment entries leave in place the vertices that moved by dDepthFraction of the median scene depth or less
+        // (SFMTranscriptInterface_Delaunay::setMinVertexDisplacement).  To be called before Run.
+        void SetMinVertexDisplacement(double dDepthFraction);
+
+        // Bundle adjustment entries only log the points and cameras that moved by more than fDepthFraction of the median scene
+        // depth since they were last logged (SFMTranscriptInterface_ORBSLAM::setBundleAdjustmentMoveThreshold).  To be called
+        // before Run.
+        void SetBundleAdjustmentMoveThreshold(float fDepthFraction);
+
+        // Carves in cubic tiles of dTileSize (SFMTranscriptInterface_TiledDelaunay), on nThreads threads (0: one per hardware
+        // thread), instead of in one triangulation.  To be called before Run.  The tiles keep no checkpoint, so the transcript
+        // is not compacted then.
+        void SetTiling(double dTileSize, size_t nThreads);
+
+        // Only keeps the points within dRadius of the latest keyframe in the triangulation, the surface beyond is frozen
+        // (SFMTranscriptInterface_Delaunay::setWindowRadius) and returned after the live one by GetCurrentModel.  0 disables
+        // it; not used with tiling.  To be called before Run.
+        void SetWindowRadius(double dRadius);
+        std::pair<std::vector<dlovi::Matrix>, std::list<dlovi::Matrix> > GetCurrentModel() const;
+        std::vector<int> GetCurrentModelPointIndices() const;
+        int NumModelUpdates() const;
+
+        // Sends the changes of every extracted surface to pSink (NULL stops).  With bTextureFrames, each triangle carries the
+        // id of the recent keyframe that textures it best.
+        void SetMeshDeltaSink(dlovi::compvis::ByteSink* pSink, bool bTextureFrames = false);
+        void PublishMeshDelta();
+        std::vector<long> ComputeTriangleTextureFrames(const std::vector<dlovi::Matrix>& vPoints, const std::list<dlovi::Matrix>& lTris);
+
+        // Snapshots of the extracted surface written to strFileName (.ply, .glb, else OBJ; empty stops) every nKeyFrames
+        // logged keyframes and every dSeconds, whichever comes first (0: never); the last surface is written when the
+        // modeler finishes.  With bColors, vertices are coloured from the texture keyframes, in the order given by bRGB.
+        void SetModelExport(const std::string& strFileName, int nKeyFrames, double dSeconds, bool bColors, bool bRGB);
+        void ExportModel(bool bFinal);
+
+        // Hands each logged keyframe and its image over to the semi-dense stage (NULL: off).  With bSemiDenseToCARV, the
+        // fused points it sends back are logged as points seen from their keyframe and from a camera of their own at its
+        // centre, like the line points.
+        void SetProbabilityMapping(ProbabilityMapping* pProbabilityMapping, bool bSemiDenseToCARV);
+        void AddSemiDensePoints(KeyFrame* pKF, const std::vector<cv::Point3f>& vPoints);
+
+        // Hands each logged keyframe and its image over to the line stage (NULL: off), which sends back points on the
+        // straight edges it verified, logged like the semi-dense points.  pKF is only read during the call (the stage still
+        // holds it then); nothing refers to it once the points are queued.
+        void SetLineMapping(LineMapping* pLineMapping);
+        void AddLinePoints(KeyFrame* pKF, const std::vector<cv::Point3f>& vPoints);
+        void SetImageWithLines(const std::vector<LineSegment>& vLines, const cv::Mat& im);
+
+        // Logs the points sent back by the semi-dense and line stages
+        void AddKeyFramePointEntries();
+        void AddKeyFramePoints(KeyFrame* pKF, const std::vector<cv::Point3f>& vPoints);
+
         void DetectLineSegmentsLater(KeyFrame* pKF);
-        std::vector<LineSegment> DetectLineSegments(cv::Mat& im);
-        std::vector<cv::Point3f> GetPointsOnLineSegments(KeyFrame* pKF);
         std::vector<LinePoint> GetPointsOnLineSegmentsOffline();
         void saveLinePointToFile(std::vector<LinePoint>& vPOnLine, const std::string & strFileName);
         double computeNG(double N, double Khat);
 
+        // Called from the SLAM threads: the entries are only queued, and logged to the transcript by the modeler thread
         void AddKeyFrameEntry(KeyFrame* pKF);
         void AddDeletePointEntry(MapPoint* pMP);
         void AddDeleteObservationEntry(KeyFrame* pKF, MapPoint* pMP);
@@ -148,11 +212,17 @@ namespace ORB_SLAM2 {
 
         // get last n keyframes for texturing
         std::vector<pair<cv::Mat,TextureFrame>> GetTextures(int n);
+        // frame id of the last keyframe for texturing, false if there is none
+        bool GetLastTextureFrameId(long unsigned int & nFrameId);
+        // image of a frame (shared, not to be written to), empty if it left the queue
+        cv::Mat GetFrameImage(const long unsigned int & nFrameId);
 
         // get last detected lines and cooresponding image
         cv::Mat GetImageWithLines();
 
-        void writeToFile(const std::string & strFileName) const;
+        void writeToFile(const std::string & strFileName);
+        // Last surface given to the viewer, textured from the atlas (see TextureAtlas::WriteObj)
+        bool writeTexturedModel(const std::string & strPrefix);
 
     public:
         void ResetIfRequested();
@@ -171,17 +241,56 @@ namespace ORB_SLAM2 {
 
         ModelDrawer* mpModelDrawer;
 
-        // This avoid that two transcript entries are created simultaneously in separate threads
+        // Map changes reported by the SLAM threads, waiting to be logged by the modeler thread
+        TranscriptEventQueue mTranscriptEvents;
+
+        // Records of an older map generation than this (reported before the last reset) are dropped
+        Map* mpMap;
+        int mnMinMapGeneration;
+
+        // Guards the transcript against the viewer saving it while the modeler thread writes entries
         std::mutex mMutexTranscript;
 
         //number of lines in transcript last time checked
         int mnLastNumLines;
 
+        // Every mnCheckpointInterval consumed transcript lines, the carving state is checkpointed and the transcript compacted
+        int mnCheckpointInterval;
+        int mnLastCheckpointLine;
+
+        // Mesh deltas for remote viewers, published after each surface extraction (see MeshDeltaStream.h)
+        dlovi::compvis::MeshDeltaPublisher* mpMeshDeltaPublisher;
+        bool mbMeshDeltaTextureFrames;
+        int mnLastPublishedModel;
+        std::mutex mMutexMeshDelta;
+
+        // Surface snapshots on disk, written by the exporter's thread
+        ModelExporter* mpModelExporter;
+        int mnExportKeyFrames;
+        double mdExportSeconds;
+        bool mbExportColors;
+        int mnKeyFramesSinceExport;
+        std::chrono::steady_clock::time_point mLastExportTime;
+        int mnLastExportedModel;
+        std::mutex mMutexModelExport;
+
+        // Optional semi-dense and line stages, and the points they sent back that are not logged yet
+        ProbabilityMapping* mpProbabilityMapping;
+        LineMapping* mpLineMapping;
+        struct KeyFramePoints {
+            long unsigned int mnKFId;
+            cv::Point3f mCamCenter; // of the keyframe when the points came back
+            std::vector<cv::Point3f> mvPoints;
+        };
+        std::deque<KeyFramePoints> mdKeyFramePoints;
+        std::mutex mMutexKeyFramePoints;
+
         //CARV interface
         SFMTranscriptInterface_ORBSLAM mTranscriptInterface; // An interface to a transcript / log of the map's work.
         //CARV runner instance
         dlovi::FreespaceDelaunayAlgorithm mObjAlgorithm;
         SFMTranscriptInterface_Delaunay mAlgInterface; // An encapsulation of the interface between the transcript and the surface inferring algorithm.
+        SFMTranscriptInterface_TiledDelaunay* mpTiledAlgInterface; // used instead of mAlgInterface if set (see SetTiling)
         bool mbFirstKeyFrame;
 
         //queue for the keyframes used to texture the model, keyframe mnFrameId
@@ -189,6 +298,9 @@ namespace ORB_SLAM2 {
         size_t mnMaxTextureQueueSize;
         std::mutex mMutexTexture;
 
+        // Triangle textures baked from the logged keyframes, for the viewer and the export
+        TextureAtlas mTextureAtlas;
+
         //queue for the frames recieved, pair<mnID,image>
         std::map<long unsigned int, cv::Mat> mmFrameQueue;
         size_t mnMaxFrameQueueSize;
@@ -204,9 +316,6 @@ namespace ORB_SLAM2 {
         cv::Mat mImLines;
         std::mutex mMutexLines;
 
-        //lines detected from previous kf
-        std::map<KeyFrame*,std::vector<LineSegment>> mmpKFvLS;
-
     };
 }
 
@@ -31,9 +31,16 @@
 #include <cstdlib>
 #include <stdio.h>
 #include <vector>
+#include <list>
+#include <map>
 #include <numeric>
+#include <fstream>
 #include <eigen3/Eigen/Core>
 #include <mutex>
+#include <functional>
+#include <opencv2/core/core.hpp>
+
+#include "ThreadPool.h"
 
 #define covisN 7
 #define sigmaI 20
@@ -52,12 +59,13 @@
 namespace ORB_SLAM2 {
     class KeyFrame;
     class Map;
+    class Modeler;
 }
 
-namespace cv {
-    class Mat;
-}
-
+// Semi-dense inverse depth maps of the keyframes (Mur-Artal & Tardos, "Probabilistic Semi-Dense Mapping from Highly
+// Accurate Feature-Based Monocular SLAM"), as an optional stage behind the modeler: the modeler hands over each keyframe
+// it logs together with its image, and gets the fused points of the keyframes that passed the inter-keyframe check back
+// as extra points for CARV.  Runs on its own thread; the per-pixel work of a keyframe is split over a thread pool by rows.
 class ProbabilityMapping {
 public:
 
@@ -69,15 +77,71 @@ public:
         Eigen::Vector3f Pw; // point pose in world frame
     };
 
-    ProbabilityMapping(ORB_SLAM2::Map *pMap);
+    // Semi-dense state of a keyframe, kept here rather than in ORB_SLAM2::KeyFrame
+    struct SemiDenseKeyFrame {
+        SemiDenseKeyFrame():I_stddev(0.0),semidense_flag_(false),interKF_depth_flag_(false){};
+        cv::Mat im_;          // undistorted gray image
+        cv::Mat GradImg;      // gradient modulus (CV_32F)
+        cv::Mat GradTheta;    // gradient orientation in degrees (CV_32F)
+        cv::Mat depth_map_;   // inverse depth, 0 where unknown (CV_32F)
+        cv::Mat depth_sigma_; // sigma of the inverse depth (CV_32F)
+        float I_stddev;
+        bool semidense_flag_;     // depth map reconstructed
+        bool interKF_depth_flag_; // checked against the neighbours, points emitted
+    };
+
+    // Epipolar geometry between a keyframe and one of its neighbours, computed once per pair instead of per pixel
+    struct NeighbourPair {
+        ORB_SLAM2::KeyFrame* pKF2;
+        SemiDenseKeyFrame* pSD2;
+        Eigen::Matrix3f F12;  // x1' * F12 * x2 = 0
+        Eigen::Matrix3f R21;
+        Eigen::Vector3f t21;
+        float rot;            // median in-plane rotation of the ORB keypoints matched between the pair
+    };
+
+    // Points of a finished keyframe, kept in its camera frame so that pose corrections cost nothing until the points are
+    // needed.  World positions are materialized on access, and again only once the keyframe has moved.
+    struct SemiDensePointSet {
+        SemiDensePointSet():fMedianDepth(0.0){};
+        std::vector<cv::Point3f> vPc; // confident pixels only
+        std::vector<cv::Point3f> vPw; // world positions for Tcw, empty until first needed
+        cv::Mat Tcw;                  // pose of the keyframe vPw was computed with
+        float fMedianDepth;
+    };
+
+    // nThreads is the number of pool workers helping the mapping thread (0: one per hardware thread minus the caller)
+    ProbabilityMapping(ORB_SLAM2::Map *pMap, size_t nThreads = 0);
+
+    // With a modeler set, the fused points of each finished keyframe are passed to Modeler::AddSemiDensePoints
+    void SetModeler(ORB_SLAM2::Modeler* pModeler);
+
+    // Called by the modeler thread for each keyframe it logged; im is the undistorted image of the keyframe
+    void InsertKeyFrame(ORB_SLAM2::KeyFrame* pKF, const cv::Mat& im);
 
-    /* * \brief void SemiDenseLoop(ORB_SLAM2::KeyFrame kf, depthHo**, std::vector<depthHo>*): return results of epipolar search (depth hypotheses) */
-    void SemiDenseRecon(ORB_SLAM2::KeyFrame* kf);
+    // Main function
+    void Run();
+
+    // Calls f with the world positions of the points of each good keyframe, in turn, while holding the point sets.
+    // Stale world positions are refreshed first (see UpdateAllSemiDensePointSet).
+    void ForEachSemiDensePointSet(const std::function<void(const std::vector<cv::Point3f>&)>& f);
+    bool SaveSemiDensePointCloud(const std::string& strFileName);
+
+    // Recomputes the world positions of the keyframes whose pose moved a point at their median depth by more than
+    // mfMoveThresholdDepthFraction of that depth (local BA, loop closure).  Returns how many were.
+    size_t UpdateAllSemiDensePointSet();
+
+    void RequestReset();
+    void RequestFinish();
+    bool isFinished();
+
+    /* * \brief void SemiDenseRecon(ORB_SLAM2::KeyFrame kf, depthHo**, std::vector<depthHo>*): return results of epipolar search (depth hypotheses) */
+    void SemiDenseRecon(ORB_SLAM2::KeyFrame* kf, SemiDenseKeyFrame* sd, std::vector<NeighbourPair>& neighbors);
     /* * \brief void stereo_search_constraints(): return min, max inverse depth */
     void StereoSearchConstraints(ORB_SLAM2::KeyFrame* kf, float* min_depth, float* max_depth);
     /* * \brief void epipolar_search(): return distribution of inverse depths/sigmas for each pixel */
-    void EpipolarSearch(ORB_SLAM2::KeyFrame *kf1, ORB_SLAM2::KeyFrame *kf2, const int x, const int y, float pixel, float min_depth, float max_depth, depthHo *dh, cv::Mat F12, float &best_u, float &best_v,float th_pi,float rot);
-    void GetSearchRange(float& umin, float& umax, int px, int py, float mind, float maxd, ORB_SLAM2::KeyFrame* kf, ORB_SLAM2::KeyFrame* kf2);
+    void EpipolarSearch(ORB_SLAM2::KeyFrame *kf1, SemiDenseKeyFrame* sd1, const NeighbourPair& pair, const int x, const int y, float pixel, float min_depth, float max_depth, depthHo *dh, float &best_u, float &best_v, float th_pi);
+    void GetSearchRange(float& umin, float& umax, const Eigen::Vector3f& Rxp, float mind, float maxd, ORB_SLAM2::KeyFrame* kf, const NeighbourPair& pair, int cols);
     /* * \brief void inverse_depth_hypothesis_fusion(const vector<depthHo> H, depthHo* dist):
  * *         get the parameters of depth hypothesis distrubution from list of depth hypotheses */
     void InverseDepthHypothesisFusion(const std::vector<depthHo>& h, depthHo &dist);
@@ -85,23 +149,61 @@ public:
     void IntraKeyFrameDepthChecking(cv::Mat& depth_map, cv::Mat& depth_sigma, const cv::Mat gradimg);
     void IntraKeyFrameDepthGrowing(cv::Mat& depth_map, cv::Mat& depth_sigma, const cv::Mat gradimg);
 
-    void UpdateSemiDensePointSet(ORB_SLAM2::KeyFrame* kf);
-    void UpdateAllSemiDensePointSet();
+    void InterKeyFrameDepthChecking(ORB_SLAM2::KeyFrame* currentKf, SemiDenseKeyFrame* sd, std::vector<NeighbourPair>& neighbors);
 
-    void InterKeyFrameDepthChecking(ORB_SLAM2::KeyFrame* currentKf, std::vector<ORB_SLAM2::KeyFrame*> neighbors);
+    // Points, in the camera frame, of the pixels whose inverse depth sigma is below fMaxSigma; with nCellSize > 1 only the
+    // most certain pixel of each nCellSize x nCellSize cell is kept
+    std::vector<cv::Point3f> GetSemiDensePoints(ORB_SLAM2::KeyFrame* kf, SemiDenseKeyFrame* sd, float fMaxSigma, int nCellSize);
 
 
 private:
-    void ComputeInvDepthHypothesis(ORB_SLAM2::KeyFrame* kf, ORB_SLAM2::KeyFrame *kf2, float ustar, float ustar_var, float a, float b, float c, depthHo *dh, int x, int y);
-    void GetPixelDepth(float uj, int px, int py, ORB_SLAM2::KeyFrame* kf, ORB_SLAM2::KeyFrame *kf2, float &p);
+    void SemiDenseLoop();
+    bool GetNeighbors(ORB_SLAM2::KeyFrame* kf, std::vector<NeighbourPair>& neighbors);
+    void ComputeGradient(SemiDenseKeyFrame* sd);
+    void EmitPoints(ORB_SLAM2::KeyFrame* kf, SemiDenseKeyFrame* sd);
+    bool UpdateSemiDensePointSet(ORB_SLAM2::KeyFrame* kf, SemiDensePointSet& set);
+    static void TransformToWorld(const cv::Mat& Tcw, const std::vector<cv::Point3f>& vPc, std::vector<cv::Point3f>& vPw);
+    void ResetIfRequested();
+    bool CheckFinish();
+    void SetFinish();
+
+    // Rxp is R21 times the pixel on the normalized plane of kf
+    void ComputeInvDepthHypothesis(ORB_SLAM2::KeyFrame* kf, const NeighbourPair& pair, const Eigen::Vector3f& Rxp, float ustar, float ustar_var, depthHo *dh);
+    void GetPixelDepth(float uj, const Eigen::Vector3f& Rxp, ORB_SLAM2::KeyFrame* kf, const NeighbourPair& pair, float &p);
     bool ChiTest(const depthHo& ha, const depthHo& hb, float* chi_val);
     bool ChiTest(const float& a, const float& b, const float sigma_a, float sigma_b);
     void GetFusion(const std::vector<std::pair <float,float> > supported, float& depth, float& sigma);
     void GetFusion(const std::vector<depthHo>& best_compatible_ho, depthHo& hypothesis, float* min_sigma);
-    cv::Mat ComputeFundamental(ORB_SLAM2::KeyFrame *&pKF1, ORB_SLAM2::KeyFrame *&pKF2);
-    cv::Mat GetSkewSymmetricMatrix(const cv::Mat &v);
+    Eigen::Matrix3f ComputeFundamental(ORB_SLAM2::KeyFrame *&pKF1, ORB_SLAM2::KeyFrame *&pKF2);
+    Eigen::Matrix3f GetSkewSymmetricMatrix(const Eigen::Vector3f &v);
     std::vector<float> GetRotInPlane(ORB_SLAM2::KeyFrame* kf1, ORB_SLAM2::KeyFrame* kf2);
 
+    ORB_SLAM2::Map* mpMap;
+    ORB_SLAM2::Modeler* mpModeler;
+
+    ORB_SLAM2::ThreadPool mThreadPool;
+
+    // Keyframes handed over by the modeler, not picked up by the mapping thread yet
+    std::list<std::pair<ORB_SLAM2::KeyFrame*, cv::Mat> > mlNewKeyFrames;
+    std::mutex mMutexNewKFs;
+
+    // Semi-dense state of the most recent keyframes, touched by the mapping thread only.  mlKeyFrameOrder is the order
+    // of arrival: past mnMaxKeyFrames, the oldest keyframes are dropped (and can no longer serve as neighbours).
+    std::map<ORB_SLAM2::KeyFrame*, SemiDenseKeyFrame> mmSemiDense;
+    std::list<ORB_SLAM2::KeyFrame*> mlKeyFrameOrder;
+    size_t mnMaxKeyFrames;
+
+    // Points of the finished keyframes; they outlive the window above
+    std::map<ORB_SLAM2::KeyFrame*, SemiDensePointSet> mmPointSets;
+    float mfMoveThresholdDepthFraction;
+    std::mutex mMutexPointSets;
+
+    bool mbResetRequested;
+    std::mutex mMutexReset;
+
+    bool mbFinishRequested;
+    bool mbFinished;
+    std::mutex mMutexFinish;
 };
 
 #endif
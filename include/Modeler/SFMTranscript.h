@@ -3,6 +3,8 @@
 
 #include <vector>
 #include <string>
+#include <atomic>
+#include <iostream>
 
 namespace dlovi{
 
@@ -59,12 +61,15 @@ namespace dlovi{
             // Constructors and Destructors
             SFMTranscript();
             ~SFMTranscript();
+            SFMTranscript(const SFMTranscript &) = delete;
+            SFMTranscript & operator=(const SFMTranscript &) = delete;
 
             // Getters
             int numEntries() const;
             TranscriptType getTranscriptType() const;
             int numLines() const;
-            std::string getLine(const int nLineIndex) const;
+            int firstRetainedLine() const;
+            const std::string & getLine(const int nLineIndex) const;
             std::string getEntryText(const int nIndex) const;
             EntryType getEntryType(const int nIndex) const;
             const std::vector<dlovi::Matrix> & getEntryPoints(const int nIndex) const;
@@ -75,10 +80,13 @@ namespace dlovi{
             const std::vector<dlovi::Matrix> & getEntryPoints_Step() const;
             const std::vector<dlovi::Matrix> & getEntryCamCenters_Step() const;
             const std::vector<std::vector<int> > & getEntryVisList_Step() const;
+            int getStepLineIndex() const;
             bool isIncrementalSFM() const;
             bool isValid() const;
+            bool hasAllLines() const; // no line of the whole transcript released or compacted away (nor read back compacted)
 
             // Setters
+            void setSpillFile(const std::string & strFileName);
 
             // Public Methods
             void readFromFile(const std::string & strFileName);
@@ -86,14 +94,20 @@ namespace dlovi{
             void processTranscriptText();
             void stepTranscriptText(bool bFirstEntry = false);
             void addLine(const std::string & line);
+            void releaseLinesBefore(int nLineIndex);
+            void compactBefore(int nLineIndex);
+            void writeStepState(std::ostream & out) const;
+            void resumeFromStepState(std::istream & in);
             void invalidate();
 
+            // Both return the body lines added since the last call and require the lock the writer holds while adding lines
+            void getNewLines(std::vector<std::string> & arrLines);
             std::string getNewCommand();
+            // Keeps the lines not returned by the above yet from being released from now on, before the first call (same lock)
+            void trackNewLines();
 
         private:
             // Private Methods
-            int currentNum;
-            std::vector<std::string> bufferCommand;
             void prepareForNewEntry();
             void prepareForNewEntry(EntryType enumEntryType);
             void prepareForNewEntry_Step(EntryType & enumEntryType, EntryType enumNewEntryType);
@@ -109,7 +123,28 @@ namespace dlovi{
             // Members
             TranscriptType m_enumTranscriptType;
             bool m_bValid;
-            std::vector<std::string> m_arrStrLine; // indexed by line #
+
+            // Lines are stored in fixed-size chunks that never move once allocated, and the line count is published
+            // after the line is written, so a reader can use getLine(i) for any i < numLines() without copying.
+            // Chunks that have been consumed are released by releaseLinesBefore() (appended to the spill file first,
+            // if there is one, so writeToFile() still writes the whole transcript).
+            static const int LINES_PER_CHUNK_LOG2 = 12;
+            static const int LINES_PER_CHUNK = 1 << LINES_PER_CHUNK_LOG2;
+            static const int MAX_CHUNKS = 1 << 16;
+            std::vector<std::string *> m_arrLineChunks; // indexed by chunk #, MAX_CHUNKS long so it never reallocates.  NULL if not allocated yet / released.
+            std::atomic<int> m_nNumLines;
+            int m_nFirstRetainedLine;
+            std::string m_strSpillFileName;
+
+            // After compactBefore(), the lines before m_nCompactedLine are covered by a checkpoint and dropped for good:
+            // writeToFile() writes the header lines, a "Compacted: <line>" header line, then the body from m_nCompactedLine on.
+            int m_nCompactedLine;
+            std::vector<std::string> m_arrStrHeaderLines; // the "SFM Transcript:" line(s)
+            int m_nLineOffset; // line i is line i + m_nLineOffset of the whole transcript (non-zero once read back compacted)
+
+            int m_nStepLineIndex; // next line to be read by stepTranscriptText()
+            int m_nNewCommandLine; // next line to be returned by getNewLines() / getNewCommand()
+            bool m_bNewCommandsTracked; // once getNewLines() has been used, lines it has not returned yet are not released
 
             int m_nNumEntries;
             std::vector<std::string> m_arrEntryText; // indexed by entry
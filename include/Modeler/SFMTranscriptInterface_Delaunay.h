@@ -27,6 +27,8 @@ public:
 
     // Getters
     std::pair<std::vector<dlovi::Matrix>, std::list<dlovi::Matrix> > getCurrentModel() const;
+    std::vector<int> getCurrentModelPointIndices() const; // transcript point index of each vertex of the current model
+    std::pair<std::vector<dlovi::Matrix>, std::list<dlovi::Matrix> > getFrozenModel() const;
     dlovi::compvis::SFMTranscript::EntryType getCurrentEntryType() const;
     const dlovi::compvis::SFMTranscript::EntryData & getCurrentEntryData() const;
     std::string getCurrentEntryText() const;
@@ -34,10 +36,18 @@ public:
     std::vector<dlovi::Matrix> getCurrentEntryCamCenters() const;
     std::vector<std::vector<int> > getCurrentEntryVisList() const;
     int numFreeSpaceConstraintsInTriangulation() const;
+    int numModelUpdates() const;
+    double getMinVertexDisplacement() const;
 
     // Setters
     void setTranscriptRef(dlovi::compvis::SFMTranscript * pTranscript);
     void setAlgorithmRef(dlovi::FreespaceDelaunayAlgorithm * pAlgorithm);
+    void setModelUpdateInterval(double dSeconds);
+    void setModelUpdateBatchSize(int nEntries);
+    void setMinVertexDisplacement(double dDepthFraction);
+    void setWindowRadius(double dRadius);
+    void setWindowTilePrefix(const std::string & strPrefix);
+    void setRegion(const dlovi::Matrix & matMin, const dlovi::Matrix & matMax);
 
     // Public Methods
     void loadTranscriptFromFile(const std::string & strFileName);
@@ -47,16 +57,33 @@ public:
     void runOnlyFinalState();
     void runRemainder();
     void step(bool bRunAlgorithm = true);
+    void applyCurrentEntry();
+    bool currentEntryConcernsRegion() const;
+    void skipCurrentEntry();
     void rewind();
     bool isDone();
     void writeCurrentModelToFile(const std::string & strFileName) const;
+    bool updateModel(bool bForce = false);
+
+    // A checkpoint holds the whole carving state at the current transcript position, so the transcript lines before it can be
+    // dropped (see SFMTranscript::compactBefore).  loadCheckpoint() expects the matching compacted transcript to be loaded already,
+    // and fails if the transcript does not start at the line the checkpoint covers.
+    bool writeCheckpoint(const std::string & strFileName) const;
+    bool loadCheckpoint(const std::string & strFileName);
 
 private:
     // Private Methods
     void computeCurrentModel(int nVoteThresh = 1);
     bool isPointTooLarge(const dlovi::Matrix & matPoint) const;
+    bool isPointExcluded(int nPointIndex) const;
+    bool isPointInRegion(const dlovi::Matrix & matPoint) const;
+    void claimRegionPoints(const std::vector<int> & arrPointIndices);
+    void refreshSkippedGeometry();
+    void slideWindow(int nCamIndex);
+    void freezeTris(const std::vector<dlovi::Matrix> & arrPoints, const std::list<dlovi::Matrix> & lstTris, const std::vector<bool> & arrIsFrozenPoint);
     std::vector<int> & filterOutGiantPoints(std::vector<int> & arrPointIndices) const;
     std::vector<std::vector<int> > & filterOutGiantPointsFromCurrentVisList(std::vector<std::vector<int> > & arrVisLists) const;
+    double sceneDepth() const;
     double timestamp() const;
 
     // Member Variables
@@ -65,9 +92,46 @@ private:
     dlovi::FreespaceDelaunayAlgorithm::Delaunay3 m_objDelaunay;
     std::vector<dlovi::FreespaceDelaunayAlgorithm::Delaunay3::Vertex_handle> m_arrVertexHandles;
     std::vector<dlovi::Matrix> m_arrModelPoints;
+    std::vector<int> m_arrModelPointIndices;
     std::list<dlovi::Matrix> m_lstModelTris;
     int m_nCurrentEntryIndex;
     std::set<int> m_setGiantPoints;
+
+    // Entries only modify the triangulation; the surface is extracted once per group of entries
+    // (see runRemainder), and at most once every m_dModelUpdateInterval seconds.
+    bool m_bModelOutdated;
+    int m_nEntriesSinceModelUpdate;
+    int m_nModelUpdateBatchSize; // Within a long group, try to extract the surface after this many entries
+    double m_dModelUpdateInterval;
+    double m_dLastModelUpdate;
+    int m_nNumModelUpdates; // surfaces extracted so far, so that consumers can tell a new one
+
+    // Bundle adjustment entries leave in place the vertices moved by this fraction of the scene depth (see sceneDepth) or less, so
+    // that the threshold follows the scale of the map
+    double m_dMinVertexDisplacement;
+
+    // Sliding window (disabled if m_dWindowRadius is 0): only the points within m_dWindowRadius of the latest keyframe are kept in
+    // the triangulation.  The surface beyond is frozen into tiles, written out as m_strWindowTilePrefix<n>.obj, or appended to
+    // m_arrFrozenPoints / m_lstFrozenTris if there is no prefix.  Frozen points are then ignored like the giant points.
+    double m_dWindowRadius;
+    dlovi::Matrix m_matWindowCenter;
+    bool m_bWindowCenterSet;
+    std::set<int> m_setFrozenPoints;
+    std::string m_strWindowTilePrefix;
+    int m_nNumWindowTiles;
+    std::vector<dlovi::Matrix> m_arrFrozenPoints;
+    std::list<dlovi::Matrix> m_lstFrozenTris;
+
+    // Region (used for the tiles of SFMTranscriptInterface_TiledDelaunay): a point joins the triangulation only once a keyframe observes
+    // it within [m_matRegionMin, m_matRegionMax].  The other points are ignored like the giant points.
+    bool m_bRegionSet;
+    dlovi::Matrix m_matRegionMin;
+    dlovi::Matrix m_matRegionMax;
+    std::set<int> m_setRegionPoints;
+
+    // With a region, the entries that observe no point inside it and touch none of its points are skipped (skipCurrentEntry) rather
+    // than applied.  The cameras, points and visibility lists they changed are then set again before the next entry is applied.
+    bool m_bSkippedGeometry;
 };
 
 #endif
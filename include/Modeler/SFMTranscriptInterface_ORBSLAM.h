@@ -5,9 +5,13 @@
 #include <string>
 #include <set>
 #include <map>
+#include <unordered_map>
+#include <vector>
+#include <deque>
 #include "MapPoint.h"
 #include "KeyFrame.h"
 #include "Modeler/TextureFrame.h"
+#include "Modeler/TranscriptEventQueue.h"
 
 typedef ORB_SLAM2::MapPoint MapPoint;
 typedef ORB_SLAM2::KeyFrame KeyFrame;
@@ -21,46 +25,61 @@ public:
 
     // Getters
     dlovi::compvis::SFMTranscript * getTranscriptRef();
-    dlovi::compvis::SFMTranscript * getTranscriptToProcessRef();
 
     // Public Methods
+    // Entries are built from ids and from snapshots the modeler thread took of the keyframes and points, never from the
+    // live ones (see TranscriptEvent).
     void addResetEntry();
-    void addPointDeletionEntry(MapPoint *p);
-    void addVisibilityRayInsertionEntry(KeyFrame *k, MapPoint *p);
-    void addVisibilityRayDeletionEntry(KeyFrame *k, MapPoint *p);
-    void addFirstKeyFrameInsertionEntry(KeyFrame *k);
-    void addKeyFrameInsertionEntry(KeyFrame *k);
+    void addPointDeletionEntry(long unsigned int nMPId);
+    void addVisibilityRayInsertionEntry(long unsigned int nKFId, long unsigned int nMPId);
+    void addVisibilityRayDeletionEntry(long unsigned int nKFId, long unsigned int nMPId);
+    void addFirstKeyFrameInsertionEntry(const ORB_SLAM2::KeyFrameSnapshot & kf);
+    void addKeyFrameInsertionEntry(const ORB_SLAM2::KeyFrameSnapshot & kf);
 
-    void addKeyFrameInsertionWithLinesEntry(KeyFrame *k, KeyFrame *kCopy, std::vector<cv::Point3f>& vP);
+    // Points vP seen from a new camera at camCenter (the center of keyframe nKFId) and from keyframe nKFId.  The camera
+    // and the points get transcript indices of their own, not tied to any keyframe or MapPoint.
+    void addKeyFrameInsertionWithLinesEntry(long unsigned int nKFId, const cv::Point3f & camCenter, const std::vector<cv::Point3f> & vP);
 
-    void addBundleAdjustmentEntry(std::set<KeyFrame *> & sAdjustSet, std::set<MapPoint *> & sMapPoints);
+    void addBundleAdjustmentEntry(const ORB_SLAM2::AdjustmentSnapshot & adjustment);
     void writeToFile(const std::string & strFileName) const;
     void suppressBundleAdjustmentLogging();
     void unsuppressBundleAdjustmentLogging();
     void suppressRefindLogging();
     void unsuppressRefindLogging();
+    void setBundleAdjustmentMoveThreshold(float fDepthFraction);
 
-    void UpdateTranscriptToProcess();
-
-    vector<MapPoint *> GetNewPoints(KeyFrame *pKF);
+    // ids of the points first logged with keyframe nKFId, for the most recent keyframes only
+    std::vector<long unsigned int> GetNewPoints(long unsigned int nKFId);
     // Member Variables
     dlovi::compvis::SFMTranscript m_SFMTranscript;
 private:
-
-
-    // transcript that is guarded by mutex
-    dlovi::compvis::SFMTranscript m_SFMTranscriptToProcess;
+    // Entity id -> transcript index lookup (-1 when the logger has no record)
+    int getPointIndex(long unsigned int nMPId) const;
+    int addPointIndex(long unsigned int nMPId);
+    int getCamIndex(long unsigned int nKFId) const;
+    int addCamIndex(long unsigned int nKFId);
+    void addNewPointsList(long unsigned int nKFId, const std::vector<long unsigned int> & vnNewPoints);
 
     bool m_bSuppressRefindLogging;
     bool m_bSuppressBundleAdjustmentLogging;
 
-    std::map<MapPoint *, int> m_mMapPoint_Index;	// TODO: possibly change to hashed?
-    std::map<KeyFrame *, int> m_mKeyFrame_Index;	// TODO: possibly change to hashed?
-    // Store ID instead of pointer
-    std::map<long unsigned int, int> m_mFrame_Index;
+    // Bundle adjustment entries only log the points and cameras that moved by more than this fraction of the
+    // scene median depth since the position last written to the transcript (0 logs everything).
+    float m_fMoveThresholdDepthFraction;
+    std::vector<cv::Point3f> m_vPointLoggedPositions; // indexed by transcript point index
+    std::vector<cv::Point3f> m_vCamLoggedPositions; // indexed by transcript cam index
+
+    // Indices live in dense tables indexed by MapPoint::mnId and KeyFrame::mnId (unique until the next reset entry).
+    // The cameras and points of the semi-dense and line entries only take an index (m_nNumCams, m_nNumPoints).
+    std::vector<int> m_vMapPointId_Index;
+    int m_nNumPoints;
+    std::vector<int> m_vKeyFrameId_Index;
+    int m_nNumCams;
 
-    // correspondence between added keyframes and mappoints
-    std::map<KeyFrame *, std::vector<MapPoint *>> m_mKeyFrame_MapPoint;
+    // new points of the last m_nMaxNewPointsLists keyframes logged
+    std::unordered_map<long unsigned int, std::vector<long unsigned int> > m_mKeyFrame_MapPoint;
+    std::deque<long unsigned int> m_dNewPointsListOrder;
+    size_t m_nMaxNewPointsLists;
 };
 
 #endif
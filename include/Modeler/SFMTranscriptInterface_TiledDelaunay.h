@@ -0,0 +1,88 @@
+#ifndef __SFMTRANSCRIPTINTERFACE_TILEDDELAUNAY_H
+#define __SFMTRANSCRIPTINTERFACE_TILEDDELAUNAY_H
+
+#include "Modeler/SFMTranscript.h"
+#include "Modeler/SFMTranscriptInterface_Delaunay.h"
+#include "Modeler/FreespaceDelaunayAlgorithm.h"
+#include "ThreadPool.h"
+#include <vector>
+#include <list>
+#include <map>
+#include <tuple>
+#include <string>
+#include <utility>
+
+// Carves space in a grid of overlapping cubic tiles, each with its own triangulation, free-space votes and graph cut, so that
+// the tiles are carved concurrently.  A tile only triangulates the points observed inside its cube grown by the overlap, applies
+// only the transcript entries that concern those points, cuts its free-space constraints a tile size past them, and contributes
+// to the model only the triangles centered in its cube; the vertices shared by neighbouring tiles are welded when the model is
+// stitched together.
+class SFMTranscriptInterface_TiledDelaunay{
+public:
+    // Constructors and Destructors
+    SFMTranscriptInterface_TiledDelaunay(dlovi::compvis::SFMTranscript * pTranscript = NULL, size_t nThreads = 0);
+    ~SFMTranscriptInterface_TiledDelaunay();
+
+    // Getters
+    std::pair<std::vector<dlovi::Matrix>, std::list<dlovi::Matrix> > getCurrentModel() const;
+    std::vector<int> getCurrentModelPointIndices() const; // transcript point index of each vertex of the current model
+    dlovi::compvis::SFMTranscript::EntryType getCurrentEntryType() const;
+    int numTiles() const;
+    int numModelUpdates() const;
+
+    // Setters
+    void setTranscriptRef(dlovi::compvis::SFMTranscript * pTranscript);
+    void setTileSize(double dTileSize);
+    void setTileOverlap(double dOverlap);
+    void setModelUpdateInterval(double dSeconds);
+    void setMinVertexDisplacement(double dDepthFraction); // see SFMTranscriptInterface_Delaunay
+
+    // Public Methods
+    void loadTranscriptFromFile(const std::string & strFileName);
+    void runFull();
+    void runRemainder();
+    void step();
+    void rewind();
+    bool isDone();
+    void writeCurrentModelToFile(const std::string & strFileName) const;
+    bool updateModel(bool bForce = false);
+
+private:
+    // Private Types
+    struct Tile{
+        Tile(dlovi::compvis::SFMTranscript * pTranscript) : objInterface(pTranscript, & objAlgorithm) {}
+
+        dlovi::FreespaceDelaunayAlgorithm objAlgorithm;
+        SFMTranscriptInterface_Delaunay objInterface;
+        dlovi::Matrix matCoreMin;
+        dlovi::Matrix matCoreMax;
+    };
+
+    // Private Methods
+    void clearTiles();
+    void addTilesForNewPoints();
+    void addTile(int nX, int nY, int nZ);
+    void computeCurrentModel();
+    double timestamp() const;
+
+    // Member Variables
+    dlovi::compvis::SFMTranscript * m_pTranscript;
+    ORB_SLAM2::ThreadPool m_threadPool;
+    std::vector<Tile *> m_arrTiles;
+    std::map<std::tuple<int, int, int>, int> m_mapCell_Tile; // grid cell -> index into m_arrTiles
+    double m_dTileSize;
+    double m_dTileOverlap; // fraction of the tile size by which a tile's region extends past its cube
+    int m_nNumPointsSeen; // tiles have been created for the cells of the points before this index
+    int m_nCurrentEntryIndex;
+
+    std::vector<dlovi::Matrix> m_arrModelPoints;
+    std::vector<int> m_arrModelPointIndices;
+    std::list<dlovi::Matrix> m_lstModelTris;
+    bool m_bModelOutdated;
+    double m_dModelUpdateInterval;
+    double m_dLastModelUpdate;
+    int m_nNumModelUpdates; // models stitched so far, so that consumers can tell a new one
+    double m_dMinVertexDisplacement; // for the tiles
+};
+
+#endif
@@ -0,0 +1,143 @@
+#ifndef __SFMTRANSCRIPTSTREAM_H
+#define __SFMTRANSCRIPTSTREAM_H
+
+#include <vector>
+#include <string>
+#include <mutex>
+#include <cstddef>
+#include <stdint.h>
+
+// Compact binary encoding of the transcript for remote consumers.
+//
+// The stream is a sequence of frames:
+//     'C' 'V' <version: u8> <payload length: u32 little-endian> <payload>
+// and a payload is a sequence of records, each a type byte followed by its fields.  Indices and counts are unsigned
+// LEB128 varints, coordinates are little-endian float32.  There is one record per transcript body line, so the decoder
+// writes back the same lines and the receiving side rebuilds the same model.  New cameras and points carry their index
+// explicitly, which lets the decoder detect a stream it has not seen from the start (or a lost frame).
+
+namespace dlovi{
+    namespace compvis{
+
+        class SFMTranscript;
+
+        namespace transcriptstream{
+            const uint8_t VERSION = 1;
+            const size_t FRAME_HEADER_SIZE = 7;
+            const size_t MAX_FRAME_PAYLOAD = 1 << 16; // the publisher starts a new frame past this
+
+            enum RecordType {
+                RT_RESET = 1,
+                RT_NEWCAM,           // cam index, [x y z]; opens a keyframe block
+                RT_NEWPOINT,         // point index, [x y z], # cams, cam indices
+                RT_KEYFRAMEOBSERVATION, // point index; in a keyframe block, observed by its new camera
+                RT_OBSERVATION,      // cam index, point index
+                RT_DELPOINT,         // point index
+                RT_DELOBSERVATION,   // cam index, point index
+                RT_BUNDLE,           // opens a bundle adjustment block
+                RT_MOVEPOINT,        // point index, [x y z]
+                RT_MOVECAM,          // cam index, [x y z]
+                RT_ENDBLOCK,
+                RT_KEYFRAMEPOSE      // keyframe id, timestamp (float64), 3x4 camera-to-world matrix row-major (float32)
+            };
+
+            struct KeyFramePose{
+                uint32_t nId;
+                double dTimestamp;
+                float arrTwc[12];
+            };
+        }
+
+        // Where encoded frames go: a pipe, a socket, a file, or a buffer handed to some transport.  write() returns false
+        // if the bytes could not all be written.
+        class ByteSink{
+        public:
+            virtual ~ByteSink() {}
+            virtual bool write(const char * pData, size_t nSize) = 0;
+        };
+
+        // Writes to a file descriptor (pipe, Unix socket or file), retrying on partial writes.  Does not own the descriptor.
+        // Sockets are written with MSG_NOSIGNAL, so a closed peer fails the write instead of raising SIGPIPE.
+        class FileDescriptorSink : public ByteSink{
+        public:
+            FileDescriptorSink(int nFd);
+            bool write(const char * pData, size_t nSize);
+        private:
+            int m_nFd;
+            bool m_bSocket;
+        };
+
+        // Collects frames in memory until the owner takes them, e.g. to send them as one message
+        class BufferSink : public ByteSink{
+        public:
+            bool write(const char * pData, size_t nSize);
+            const std::vector<uint8_t> & getBuffer() const;
+            void clear();
+        private:
+            std::vector<uint8_t> m_arrBuffer;
+        };
+
+        // Turns transcript body lines into records.  Stateful: it numbers new cameras and points the way the transcript
+        // does, so it has to see every line from the beginning of the body.
+        class SFMTranscriptEncoder{
+        public:
+            SFMTranscriptEncoder();
+
+            void encodeLine(const std::string & strLine, std::string & strPayload);
+            void encodeKeyFramePose(const transcriptstream::KeyFramePose & objPose, std::string & strPayload);
+            static void writeFrame(const std::string & strPayload, std::string & strFrame);
+
+        private:
+            int m_nNumCams;
+            int m_nNumPoints;
+            bool m_bInKeyFrameBlock;
+        };
+
+        // Reads frames from arbitrary byte chunks and appends the lines they hold to a transcript, starting with the header.
+        // Throws a dlovi::Exception on a malformed or inconsistent stream.
+        class SFMTranscriptDecoder{
+        public:
+            SFMTranscriptDecoder(SFMTranscript * pTranscript);
+
+            void feed(const char * pData, size_t nSize);
+            void takeKeyFramePoses(std::vector<transcriptstream::KeyFramePose> & arrPoses);
+            int numFramesDecoded() const;
+
+        private:
+            void decodePayload(const char * pData, size_t nSize);
+
+            SFMTranscript * m_pTranscript;
+            std::string m_strPending; // bytes of a frame that is not complete yet
+            int m_nNumCams;
+            int m_nNumPoints;
+            bool m_bInKeyFrameBlock;
+            int m_nNumFramesDecoded;
+            std::vector<transcriptstream::KeyFramePose> m_arrPoses;
+        };
+
+        // Sends the lines added to a transcript since the last call to a sink.  The lines are only copied under the
+        // writer's lock; encoding and writing happen outside of it.  Only one publisher (or getNewCommand() user) may read
+        // a transcript, and only from its first line: the constructor throws once lines were released or compacted away.
+        class SFMTranscriptPublisher{
+        public:
+            SFMTranscriptPublisher(SFMTranscript * pTranscript, std::mutex * pMutex, ByteSink * pSink);
+
+            // Returns the number of lines published, or -1 if the sink failed or a line could not be encoded (logged)
+            int publishNew();
+            bool publishKeyFramePose(const transcriptstream::KeyFramePose & objPose);
+            size_t numBytesPublished() const;
+
+        private:
+            bool sendFrame(std::string & strPayload);
+
+            SFMTranscript * m_pTranscript;
+            std::mutex * m_pMutex;
+            ByteSink * m_pSink;
+            SFMTranscriptEncoder m_objEncoder;
+            std::vector<std::string> m_arrStrLines;
+            size_t m_nNumBytesPublished;
+        };
+    }
+}
+
+#endif
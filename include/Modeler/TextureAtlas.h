@@ -0,0 +1,113 @@
+#ifndef __TEXTUREATLAS_H
+#define __TEXTUREATLAS_H
+
+#include <vector>
+#include <list>
+#include <deque>
+#include <map>
+#include <array>
+#include <tuple>
+#include <string>
+#include <mutex>
+#include <functional>
+#include <opencv2/core/core.hpp>
+
+#include "Modeler/Matrix.h"
+#include "Modeler/TextureFrame.h"
+
+namespace ORB_SLAM2 {
+
+    class KeyFrame;
+
+    // Where the texture of a triangle of the surface is: nPage is -1 if no view sees all of its vertices
+    struct TriangleTexture {
+        int nPage;
+        float arrUV[6]; // u v per vertex, in the order of the triangle, in [0,1] over the page
+        long nFrameId;
+    };
+
+    // Textures of the surface triangles, baked into pages of square slots, one triangle per slot.
+    //
+    // A triangle is baked when it first appears in a surface, from the keyframe facing it most that sees all of its
+    // vertices, and again only if a keyframe added since faces it more or its vertices moved.  Triangles are told apart by the
+    // transcript points at their vertices, so that they keep their texture across surfaces, and their slot is freed once they
+    // are gone.  Only the mnMaxViews most recent keyframes keep their image: the patches baked from older ones stay.
+    class TextureAtlas {
+    public:
+        TextureAtlas(int nPageSize = 2048, int nSlotSize = 32, size_t nMaxViews = 30);
+
+        // pKF and its image are a candidate view of the triangles from the next Bake on
+        void AddView(KeyFrame* pKF, const cv::Mat& im);
+
+        // Texture of each triangle of the surface, in the order of lTris.  vPointIndices holds the transcript point index of
+        // each vertex (see SFMTranscriptInterface_Delaunay::getCurrentModelPointIndices).
+        std::vector<TriangleTexture> Bake(const std::vector<dlovi::Matrix>& vPoints, const std::vector<int>& vPointIndices,
+                                          const std::list<dlovi::Matrix>& lTris);
+
+        // Calls f(page, image, first row, end row) for the rows of each page written since the last call
+        void ForEachDirtyPage(const std::function<void(int, const cv::Mat&, int, int)>& f);
+
+        // Writes the last baked surface as strPrefix.obj, its materials as strPrefix.mtl and the pages as strPrefix_<page>.png
+        bool WriteObj(const std::string& strPrefix);
+
+        // Drops the views and triangles (the pages are reused)
+        void Clear();
+
+    private:
+        typedef std::tuple<double, double, double> Position;
+        typedef std::array<int, 3> TriangleKey; // transcript point indices, sorted
+
+        struct View {
+            View(KeyFrame* pKF, const cv::Mat& im, long nSeq);
+            // takes the current pose of the keyframe, unless it is bad
+            void UpdatePose();
+            void SetPose(); // Rcw, tcw and orientation from the pose held in frame
+            bool Project(const Position& P, cv::Point2f& uv) const;
+
+            TextureFrame frame;
+            cv::Mat im;
+            cv::Matx33f Rcw;
+            cv::Vec3f tcw;
+            dlovi::Matrix orientation;
+            long nSeq;
+        };
+
+        struct BakedTriangle {
+            long nFrameId;
+            double dScore;
+            long nViewsChecked; // views with a smaller sequence number were tried already
+            int nSlot;
+            Position arrPos[3]; // of the points of the key when baked
+            float arrUV[6];     // in the order of the key
+            unsigned int nGeneration;
+        };
+
+        bool BakeSlot(const View& view, BakedTriangle& tri);
+        int AllocateSlot();
+
+        int mnPageSize;
+        int mnSlotSize;
+        int mnSlotsPerRow;
+        size_t mnMaxViews;
+
+        std::deque<View> mdViews;
+        long mnNextViewSeq;
+
+        std::map<TriangleKey, BakedTriangle> mmTriangles;
+        unsigned int mnGeneration;
+
+        std::vector<cv::Mat> mvPages;
+        std::vector<std::pair<int, int> > mvDirtyRows; // per page, empty if first >= second
+        std::vector<int> mvFreeSlots;
+        int mnNextSlot;
+
+        // Last baked surface, for WriteObj
+        std::vector<dlovi::Matrix> mvLastPoints;
+        std::list<dlovi::Matrix> mlLastTris;
+        std::vector<TriangleTexture> mvLastTriTextures;
+
+        std::mutex mMutexAtlas;
+    };
+}
+
+#endif //__TEXTUREATLAS_H
@@ -0,0 +1,118 @@
+//
+// Lock-free hand-off of map changes from the SLAM threads to the modeler.
+//
+
+#ifndef ORB_SLAM2_TRANSCRIPTEVENTQUEUE_H
+#define ORB_SLAM2_TRANSCRIPTEVENTQUEUE_H
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <vector>
+#include <opencv2/core/core.hpp>
+
+namespace ORB_SLAM2 {
+
+    class KeyFrame;
+    class MapPoint;
+
+    // What the transcript needs of a new keyframe, copied by the modeler thread when it logs the keyframe
+    struct KeyFrameSnapshot {
+        struct Point {
+            long unsigned int mnId;
+            cv::Point3f mPos;
+            // ids of the keyframes observing the point
+            std::vector<long unsigned int> mvnObservingKFIds;
+        };
+
+        long unsigned int mnId;
+        cv::Point3f mCamCenter;
+        // the points of the keyframe that were not bad
+        std::vector<Point> mvPoints;
+    };
+
+    // Positions of the keyframes and points of one bundle adjustment, copied by the modeler thread when it logs it
+    struct AdjustmentSnapshot {
+        std::vector<std::pair<long unsigned int, cv::Point3f> > mvKFs;
+        std::vector<std::pair<long unsigned int, cv::Point3f> > mvMPs;
+        // median scene depth seen from the newest adjusted keyframe (0 if unknown)
+        float mfSceneDepth;
+    };
+
+    // The keyframes and points of one bundle adjustment
+    struct AdjustedEntities {
+        std::vector<KeyFrame*> mvpKFs;
+        std::vector<MapPoint*> mvpMPs;
+    };
+
+    // Compact record of one map change. Pushing one only copies pointers and ids, so the reporting threads do not wait
+    // for the snapshot: the modeler thread reads the keyframes and points when it logs the record. Keyframes and points
+    // are only freed by Map::clear, and records pushed before a clear carry the older map generation and are dropped
+    // without being read.
+    struct TranscriptEvent {
+        enum Type {
+            KEYFRAME_INSERTION,
+            POINT_DELETION,
+            OBSERVATION_DELETION,
+            BUNDLE_ADJUSTMENT
+        };
+
+        Type mType;
+        int mnMapGeneration;
+        long unsigned int mnKFId;
+        long unsigned int mnMPId;
+
+        // KEYFRAME_INSERTION: the keyframe, pinned (KeyFrame::SetModelerPin) until it is logged and handed to the
+        // modeler's stages (NULL otherwise)
+        KeyFrame* mpKF;
+
+        // BUNDLE_ADJUSTMENT: owned by the record (NULL otherwise)
+        AdjustedEntities* mpAdjusted;
+    };
+
+    // Bounded multi-producer single-consumer ring with a sequence number per cell, so Push and Pop never take a lock.
+    // When the ring is full, Push spills into an overflow list instead of waiting for the consumer; the producers
+    // never block on a slow modeler step.
+    class TranscriptEventQueue {
+    public:
+        // nCapacity is rounded up to a power of two
+        TranscriptEventQueue(size_t nCapacity = 1 << 16);
+        ~TranscriptEventQueue();
+
+        // Any thread
+        void Push(const TranscriptEvent& event);
+
+        // Consumer thread only. Records come out in push order for each producer.
+        bool Pop(TranscriptEvent& event);
+
+        // number of records that did not fit in the ring so far
+        size_t NumOverflowed();
+
+    protected:
+
+        bool TryPushRing(const TranscriptEvent& event);
+        bool TryPopRing(TranscriptEvent& event);
+
+        struct Cell {
+            std::atomic<size_t> mnSequence;
+            TranscriptEvent mEvent;
+        };
+
+        Cell* mpCells;
+        size_t mnMask;
+
+        // producers and consumer positions on separate cache lines
+        alignas(64) std::atomic<size_t> mnEnqueuePos;
+        alignas(64) size_t mnDequeuePos;
+
+        // Once a record has spilled, later records go to the overflow list too until the consumer has emptied it,
+        // so that a producer's records are never reordered.
+        alignas(64) std::atomic<bool> mbOverflowing;
+        std::deque<TranscriptEvent> mdOverflow;
+        size_t mnNumOverflowed;
+        std::mutex mMutexOverflow;
+    };
+}
+
+#endif //ORB_SLAM2_TRANSCRIPTEVENTQUEUE_H
@@ -0,0 +1,98 @@
+#ifndef __DLOVI_WIREFORMAT_H
+#define __DLOVI_WIREFORMAT_H
+
+#include <string>
+#include <cstring>
+#include <cstddef>
+#include <stdint.h>
+#include "Modeler/Exception.h"
+
+// Portable binary encoding for the streams sent to remote consumers: unsigned LEB128 varints and little-endian fixed-size
+// values, appended to a std::string.  WireReader throws on a truncated or malformed payload.
+
+namespace dlovi{
+  namespace wireformat{
+    inline void putByte(std::string & str, uint8_t n){
+      str.push_back((char)n);
+    }
+
+    inline void putVarint(std::string & str, uint32_t n){
+      while(n >= 0x80){
+        str.push_back((char)(n | 0x80));
+        n >>= 7;
+      }
+      str.push_back((char)n);
+    }
+
+    inline void putU32(std::string & str, uint32_t n){
+      for(int i = 0; i < 4; i++)
+        str.push_back((char)(n >> (8 * i)));
+    }
+
+    inline void putFloat(std::string & str, float f){
+      uint32_t n;
+      std::memcpy(& n, & f, sizeof(n));
+      putU32(str, n);
+    }
+
+    inline void putDouble(std::string & str, double d){
+      uint64_t n;
+      std::memcpy(& n, & d, sizeof(n));
+      putU32(str, (uint32_t)n);
+      putU32(str, (uint32_t)(n >> 32));
+    }
+
+    class WireReader{
+    public:
+      WireReader(const char * pData, size_t nSize) : m_pData((const uint8_t *)pData), m_nSize(nSize), m_nPos(0) {}
+
+      bool done() const { return m_nPos >= m_nSize; }
+
+      uint8_t getByte(){
+        if(m_nPos >= m_nSize)
+          throw dlovi::Exception("Truncated record in binary stream.");
+        return m_pData[m_nPos++];
+      }
+
+      uint32_t getVarint(){
+        uint32_t n = 0;
+        for(int nShift = 0; nShift < 35; nShift += 7){
+          uint8_t b = getByte();
+          n |= (uint32_t)(b & 0x7f) << nShift;
+          if(! (b & 0x80))
+            return n;
+        }
+        throw dlovi::Exception("Malformed varint in binary stream.");
+      }
+
+      uint32_t getU32(){
+        uint32_t n = 0;
+        for(int i = 0; i < 4; i++)
+          n |= (uint32_t)getByte() << (8 * i);
+        return n;
+      }
+
+      float getFloat(){
+        uint32_t n = getU32();
+        float f;
+        std::memcpy(& f, & n, sizeof(f));
+        return f;
+      }
+
+      double getDouble(){
+        uint64_t n = getU32();
+        n |= (uint64_t)getU32() << 32;
+        double d;
+        std::memcpy(& d, & n, sizeof(d));
+        return d;
+      }
+
+    private:
+      const uint8_t * m_pData;
+      size_t m_nSize;
+      size_t m_nPos;
+    };
+  }
+}
+
+#endif
@@ -82,6 +82,10 @@ public:
     // Project MapPoints into KeyFrame using a given Sim3 and search for duplicated MapPoints.
     int Fuse(KeyFrame* pKF, cv::Mat Scw, const std::vector<MapPoint*> &vpPoints, float th, vector<MapPoint *> &vpReplacePoint);
 
+    // Search part of the previous Fuse: finds the keypoint of pKF each MapPoint would be fused with (-1 if none)
+    // without modifying pKF or the MapPoints, so several KeyFrames can be searched concurrently.
+    int SearchForFuse(KeyFrame* pKF, cv::Mat Scw, const std::vector<MapPoint*> &vpPoints, float th, std::vector<int> &vnMatchedIdx);
+
 public:
 
     static const int TH_LOW;
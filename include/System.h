@@ -40,6 +40,8 @@
 #include "Modeler/Modeler.h"
 #include "Modeler/ModelDrawer.h"
 
+class ProbabilityMapping;
+
 namespace ORB_SLAM2
 {
 
@@ -54,6 +56,7 @@ namespace ORB_SLAM2
     //CARV: Modeler class
     class Modeler;
     class ModelDrawer;
+    class LineMapping;
 
     class System
     {
@@ -135,6 +138,10 @@ namespace ORB_SLAM2
         Map* mpMap;
         //CARV: Modeler that take map logs to create and display the reconstructed model
         Modeler* mpModeler;
+        //CARV: optional semi-dense reconstruction feeding the modeler (NULL unless Modeler.SemiDense is set)
+        ProbabilityMapping* mpProbabilityMapping;
+        //CARV: optional line-crossing points feeding the modeler (NULL unless Modeler.Lines is set)
+        LineMapping* mpLineMapping;
     private:
 
         // Input sensor
@@ -177,6 +184,12 @@ namespace ORB_SLAM2
 
         //CARV: Modeler thread
         std::thread* mptModeler;
+        std::thread* mptProbabilityMapping;
+        std::thread* mptLineMapping;
+
+        //CARV: mesh deltas for a remote viewer (NULL and -1 unless Modeler.MeshDelta is set)
+        dlovi::compvis::FileDescriptorSink* mpMeshDeltaSink;
+        int mnMeshDeltaFd;
 
         // Reset flag
         std::mutex mMutexReset;
@@ -0,0 +1,68 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <vector>
+#include <list>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+namespace ORB_SLAM2
+{
+
+// Fixed set of worker threads used by the mapping threads to split independent
+// per-keyframe / per-candidate work. The calling thread always takes part in
+// ParallelFor, so nested calls and calls from inside a task never dead-lock.
+class ThreadPool
+{
+public:
+
+    // nThreads=0 uses one worker per hardware thread (minus the caller)
+    ThreadPool(size_t nThreads = 0);
+    ~ThreadPool();
+
+    // Queue a task. It will be executed by one of the workers.
+    void Enqueue(const std::function<void()> &task);
+
+    // Call f(i) for every i in [0,n) and return when all calls are done.
+    void ParallelFor(size_t n, const std::function<void(size_t)> &f);
+
+    size_t Size() const { return mvWorkers.size(); }
+
+protected:
+
+    void WorkerLoop();
+
+    std::vector<std::thread> mvWorkers;
+
+    std::list<std::function<void()> > mlTasks;
+    std::mutex mMutexTasks;
+    std::condition_variable mcvTasks;
+
+    bool mbFinishRequested;
+};
+
+} //namespace ORB_SLAM
+
+#endif // THREADPOOL_H
@@ -396,8 +396,8 @@ void Frame::ComputeBoW()
 {
     if(mBowVec.empty())
     {
-        vector<cv::Mat> vCurrentDesc = Converter::toDescriptorVector(mDescriptors);
-        mpORBvocabulary->transform(vCurrentDesc,mBowVec,mFeatVec,4);
+        // All descriptors are transformed at once, straight from the matrix
+        mpORBvocabulary->transform(mDescriptors,mBowVec,mFeatVec,4);
     }
 }
 
@@ -32,7 +32,7 @@ namespace ORB_SLAM2
             mnFrameId(F.mnId),  mTimeStamp(F.mTimeStamp), mnGridCols(FRAME_GRID_COLS), mnGridRows(FRAME_GRID_ROWS),
             mfGridElementWidthInv(F.mfGridElementWidthInv), mfGridElementHeightInv(F.mfGridElementHeightInv),
             mnTrackReferenceForFrame(0), mnFuseTargetForKF(0), mnBALocalForKF(0), mnBAFixedForKF(0),
-            mnLoopQuery(0), mnLoopWords(0), mnRelocQuery(0), mnRelocWords(0), mnBAGlobalForKF(0),
+            mnBAGlobalForKF(0),
             fx(F.fx), fy(F.fy), cx(F.cx), cy(F.cy), invfx(F.invfx), invfy(F.invfy),
             mbf(F.mbf), mb(F.mb), mThDepth(F.mThDepth), N(F.N), mvKeys(F.mvKeys), mvKeysUn(F.mvKeysUn),
             mvuRight(F.mvuRight), mvDepth(F.mvDepth), mDescriptors(F.mDescriptors.clone()),
@@ -41,7 +41,7 @@ namespace ORB_SLAM2
             mvInvLevelSigma2(F.mvInvLevelSigma2), mnMinX(F.mnMinX), mnMinY(F.mnMinY), mnMaxX(F.mnMaxX),
             mnMaxY(F.mnMaxY), mK(F.mK), mvpMapPoints(F.mvpMapPoints), mpKeyFrameDB(pKFDB),
             mpORBvocabulary(F.mpORBvocabulary), mbFirstConnection(true), mpParent(NULL), mbNotErase(false),
-            mbToBeErased(false), mbBad(false), mHalfBaseline(F.mb/2), mpMap(pMap)
+            mbModelerPin(false), mbToBeErased(false), mbBad(false), mHalfBaseline(F.mb/2), mpMap(pMap)
     {
         mnId=nNextId++;
 
@@ -60,10 +60,9 @@ namespace ORB_SLAM2
     {
         if(mBowVec.empty() || mFeatVec.empty())
         {
-            vector<cv::Mat> vCurrentDesc = Converter::toDescriptorVector(mDescriptors);
             // Feature vector associate features with nodes in the 4th level (from leaves up)
             // We assume the vocabulary tree has 6 levels, change the 4 otherwise
-            mpORBvocabulary->transform(vCurrentDesc,mBowVec,mFeatVec,4);
+            mpORBvocabulary->transform(mDescriptors,mBowVec,mFeatVec,4);
         }
     }
 
@@ -450,13 +449,35 @@ namespace ORB_SLAM2
         }
     }
 
+    void KeyFrame::SetModelerPin()
+    {
+        unique_lock<mutex> lock(mMutexConnections);
+        mbModelerPin = true;
+    }
+
+    void KeyFrame::ReleaseModelerPin()
+    {
+        bool bToBeErased;
+        {
+            unique_lock<mutex> lock(mMutexConnections);
+            mbModelerPin = false;
+            bToBeErased = mbToBeErased;
+        }
+
+        // SetBadFlag keeps the keyframe if SetNotErase still holds it
+        if(bToBeErased)
+        {
+            SetBadFlag();
+        }
+    }
+
     void KeyFrame::SetBadFlag()
     {
         {
             unique_lock<mutex> lock(mMutexConnections);
             if(mnId==0)
                 return;
-            else if(mbNotErase)
+            else if(mbNotErase || mbModelerPin)
             {
                 mbToBeErased = true;
                 return;
@@ -700,8 +721,7 @@ namespace ORB_SLAM2
             mfGridElementWidthInv(pKF->mfGridElementWidthInv), mfGridElementHeightInv(pKF->mfGridElementHeightInv),
             mnTrackReferenceForFrame(pKF->mnTrackReferenceForFrame), mnFuseTargetForKF(pKF->mnFuseTargetForKF),
             mnBALocalForKF(pKF->mnBALocalForKF), mnBAFixedForKF(pKF->mnBAFixedForKF),
-            mnLoopQuery(pKF->mnLoopQuery), mnLoopWords(pKF->mnLoopWords), mnRelocQuery(pKF->mnRelocQuery),
-            mnRelocWords(pKF->mnRelocWords), mnBAGlobalForKF(pKF->mnBAGlobalForKF),
+            mnBAGlobalForKF(pKF->mnBAGlobalForKF),
             fx(pKF->fx), fy(pKF->fy), cx(pKF->cx), cy(pKF->cy), invfx(pKF->invfx), invfy(pKF->invfy),
             mbf(pKF->mbf), mb(pKF->mb), mThDepth(pKF->mThDepth), N(pKF->N), mvKeys(pKF->mvKeys), mvKeysUn(pKF->mvKeysUn),
             mvuRight(pKF->mvuRight), mvDepth(pKF->mvDepth), mDescriptors(pKF->mDescriptors.clone()),
@@ -710,7 +730,7 @@ namespace ORB_SLAM2
             mvInvLevelSigma2(pKF->mvInvLevelSigma2), mnMinX(pKF->mnMinX), mnMinY(pKF->mnMinY), mnMaxX(pKF->mnMaxX),
             mnMaxY(pKF->mnMaxY), mK(pKF->mK), mvpMapPoints(pKF->mvpMapPoints), mpKeyFrameDB(pKF->mpKeyFrameDB),
             mpORBvocabulary(pKF->mpORBvocabulary), mbFirstConnection(pKF->mbFirstConnection), mpParent(pKF->mpParent),
-            mbNotErase(pKF->mbNotErase),
+            mbNotErase(pKF->mbNotErase), mbModelerPin(false),
             mbToBeErased(pKF->mbToBeErased), mbBad(pKF->mbBad), mHalfBaseline(pKF->mHalfBaseline), mpMap(pKF->mpMap)
     {
         mnId=pKF->mnId;
@@ -24,6 +24,7 @@
 #include "Thirdparty/DBoW2/DBoW2/BowVector.h"
 
 #include<mutex>
+#include<algorithm>
 
 using namespace std;
 
@@ -41,25 +42,46 @@ void KeyFrameDatabase::add(KeyFrame *pKF)
 {
     unique_lock<mutex> lock(mMutex);
 
+    if(pKF->mnId>=mvpKeyFrames.size())
+        mvpKeyFrames.resize(pKF->mnId+1,static_cast<KeyFrame*>(NULL));
+    else if(mvpKeyFrames[pKF->mnId]==pKF)
+        return;
+
+    mvpKeyFrames[pKF->mnId]=pKF;
+
     for(DBoW2::BowVector::const_iterator vit= pKF->mBowVec.begin(), vend=pKF->mBowVec.end(); vit!=vend; vit++)
-        mvInvertedFile[vit->first].push_back(pKF);
+    {
+        InvertedFileEntry &entry = mvInvertedFile[vit->first];
+        entry.vKFIds.push_back(pKF->mnId);
+        entry.vWeights.push_back(vit->second);
+    }
 }
 
 void KeyFrameDatabase::erase(KeyFrame* pKF)
 {
     unique_lock<mutex> lock(mMutex);
 
+    if(pKF->mnId>=mvpKeyFrames.size() || mvpKeyFrames[pKF->mnId]!=pKF)
+        return;
+
+    mvpKeyFrames[pKF->mnId]=static_cast<KeyFrame*>(NULL);
+
     // Erase elements in the Inverse File for the entry
+    // Order inside a posting list is irrelevant, so the last element takes its place
+    const unsigned int nId = pKF->mnId;
     for(DBoW2::BowVector::const_iterator vit=pKF->mBowVec.begin(), vend=pKF->mBowVec.end(); vit!=vend; vit++)
     {
-        // List of keyframes that share the word
-        list<KeyFrame*> &lKFs =   mvInvertedFile[vit->first];
+        // Keyframes that share the word
+        InvertedFileEntry &entry = mvInvertedFile[vit->first];
 
-        for(list<KeyFrame*>::iterator lit=lKFs.begin(), lend= lKFs.end(); lit!=lend; lit++)
+        for(size_t i=0, iend=entry.vKFIds.size(); i<iend; i++)
         {
-            if(pKF==*lit)
+            if(entry.vKFIds[i]==nId)
             {
-                lKFs.erase(lit);
+                entry.vKFIds[i] = entry.vKFIds.back();
+                entry.vWeights[i] = entry.vWeights.back();
+                entry.vKFIds.pop_back();
+                entry.vWeights.pop_back();
                 break;
             }
         }
@@ -70,69 +92,103 @@ void KeyFrameDatabase::clear()
 {
     mvInvertedFile.clear();
     mvInvertedFile.resize(mpVoc->size());
+    mvpKeyFrames.clear();
+}
+
+vector<KeyFrame*> KeyFrameDatabase::ScoreSharingKeyFrames(const DBoW2::BowVector &BowVec,
+                                                          vector<float> &vScores, vector<int> &vnWords)
+{
+    const size_t nKFs = mvpKeyFrames.size();
+    vScores.assign(nKFs,0.f);
+    vnWords.assign(nKFs,0);
+
+    vector<KeyFrame*> vpKFsSharingWords;
+
+    for(DBoW2::BowVector::const_iterator vit=BowVec.begin(), vend=BowVec.end(); vit != vend; vit++)
+    {
+        const InvertedFileEntry &entry = mvInvertedFile[vit->first];
+        const unsigned int* pIds = entry.vKFIds.data();
+        const size_t nPostings = entry.vKFIds.size();
+
+        for(size_t i=0; i<nPostings; i++)
+        {
+            if(vnWords[pIds[i]]++==0)
+                vpKFsSharingWords.push_back(mvpKeyFrames[pIds[i]]);
+        }
+
+        // With L1 scoring of normalized vectors, |vi-wi|-|vi|-|wi| = -2*min(vi,wi) for every common word,
+        // so the score (Nister, 2006) is the sum of min(vi,wi) and is accumulated straight from the postings.
+        // Other scoring types are computed later only for the retained keyframes.
+        if(mpVoc->getScoringType()==DBoW2::L1_NORM)
+        {
+            const float vi = vit->second;
+            const float* pWeights = entry.vWeights.data();
+            float* pScores = vScores.data();
+            for(size_t i=0; i<nPostings; i++)
+                pScores[pIds[i]] += std::min(vi,pWeights[i]);
+        }
+    }
+
+    return vpKFsSharingWords;
 }
 
 
 vector<KeyFrame*> KeyFrameDatabase::DetectLoopCandidates(KeyFrame* pKF, float minScore)
 {
     set<KeyFrame*> spConnectedKeyFrames = pKF->GetConnectedKeyFrames();
-    list<KeyFrame*> lKFsSharingWords;
+    vector<KeyFrame*> vpKFsSharingWords;
+
+    // Query-local scores and shared words, indexed by keyframe id
+    vector<float> vScores;
+    vector<int> vnWords;
 
     // Search all keyframes that share a word with current keyframes
     // Discard keyframes connected to the query keyframe
     {
         unique_lock<mutex> lock(mMutex);
 
-        for(DBoW2::BowVector::const_iterator vit=pKF->mBowVec.begin(), vend=pKF->mBowVec.end(); vit != vend; vit++)
-        {
-            list<KeyFrame*> &lKFs =   mvInvertedFile[vit->first];
+        const vector<KeyFrame*> vpAllSharingWords = ScoreSharingKeyFrames(pKF->mBowVec,vScores,vnWords);
 
-            for(list<KeyFrame*>::iterator lit=lKFs.begin(), lend= lKFs.end(); lit!=lend; lit++)
-            {
-                KeyFrame* pKFi=*lit;
-                if(pKFi->mnLoopQuery!=pKF->mnId)
-                {
-                    pKFi->mnLoopWords=0;
-                    if(!spConnectedKeyFrames.count(pKFi))
-                    {
-                        pKFi->mnLoopQuery=pKF->mnId;
-                        lKFsSharingWords.push_back(pKFi);
-                    }
-                }
-                pKFi->mnLoopWords++;
-            }
+        vpKFsSharingWords.reserve(vpAllSharingWords.size());
+        for(vector<KeyFrame*>::const_iterator vit=vpAllSharingWords.begin(), vend=vpAllSharingWords.end(); vit!=vend; vit++)
+        {
+            KeyFrame* pKFi = *vit;
+            if(spConnectedKeyFrames.count(pKFi))
+                vnWords[pKFi->mnId]=0;
+            else
+                vpKFsSharingWords.push_back(pKFi);
         }
     }
 
-    if(lKFsSharingWords.empty())
+    if(vpKFsSharingWords.empty())
         return vector<KeyFrame*>();
 
     list<pair<float,KeyFrame*> > lScoreAndMatch;
 
     // Only compare against those keyframes that share enough words
     int maxCommonWords=0;
-    for(list<KeyFrame*>::iterator lit=lKFsSharingWords.begin(), lend= lKFsSharingWords.end(); lit!=lend; lit++)
+    for(vector<KeyFrame*>::iterator vit=vpKFsSharingWords.begin(), vend= vpKFsSharingWords.end(); vit!=vend; vit++)
     {
-        if((*lit)->mnLoopWords>maxCommonWords)
-            maxCommonWords=(*lit)->mnLoopWords;
+        if(vnWords[(*vit)->mnId]>maxCommonWords)
+            maxCommonWords=vnWords[(*vit)->mnId];
     }
 
     int minCommonWords = maxCommonWords*0.8f;
 
-    int nscores=0;
+    const bool bAccumulatedScores = mpVoc->getScoringType()==DBoW2::L1_NORM;
 
-    // Compute similarity score. Retain the matches whose score is higher than minScore
-    for(list<KeyFrame*>::iterator lit=lKFsSharingWords.begin(), lend= lKFsSharingWords.end(); lit!=lend; lit++)
+    // Retain the matches whose score is higher than minScore
+    for(vector<KeyFrame*>::iterator vit=vpKFsSharingWords.begin(), vend= vpKFsSharingWords.end(); vit!=vend; vit++)
     {
-        KeyFrame* pKFi = *lit;
+        KeyFrame* pKFi = *vit;
+        const unsigned int nId = pKFi->mnId;
 
-        if(pKFi->mnLoopWords>minCommonWords)
+        if(vnWords[nId]>minCommonWords)
         {
-            nscores++;
-
-            float si = mpVoc->score(pKF->mBowVec,pKFi->mBowVec);
+            if(!bAccumulatedScores)
+                vScores[nId] = mpVoc->score(pKF->mBowVec,pKFi->mBowVec);
 
-            pKFi->mLoopScore = si;
+            const float si = vScores[nId];
             if(si>=minScore)
                 lScoreAndMatch.push_back(make_pair(si,pKFi));
         }
@@ -156,13 +212,18 @@ vector<KeyFrame*> KeyFrameDatabase::DetectLoopCandidates(KeyFrame* pKF, float mi
         for(vector<KeyFrame*>::iterator vit=vpNeighs.begin(), vend=vpNeighs.end(); vit!=vend; vit++)
         {
             KeyFrame* pKF2 = *vit;
-            if(pKF2->mnLoopQuery==pKF->mnId && pKF2->mnLoopWords>minCommonWords)
+            // Neighbours may be newer than the database
+            if(pKF2->mnId>=vnWords.size())
+                continue;
+
+            if(vnWords[pKF2->mnId]>minCommonWords)
             {
-                accScore+=pKF2->mLoopScore;
-                if(pKF2->mLoopScore>bestScore)
+                const float score2 = vScores[pKF2->mnId];
+                accScore+=score2;
+                if(score2>bestScore)
                 {
                     pBestKF=pKF2;
-                    bestScore = pKF2->mLoopScore;
+                    bestScore = score2;
                 }
             }
         }
@@ -198,57 +259,46 @@ vector<KeyFrame*> KeyFrameDatabase::DetectLoopCandidates(KeyFrame* pKF, float mi
 
 vector<KeyFrame*> KeyFrameDatabase::DetectRelocalizationCandidates(Frame *F)
 {
-    list<KeyFrame*> lKFsSharingWords;
+    vector<KeyFrame*> vpKFsSharingWords;
+
+    // Query-local scores and shared words, indexed by keyframe id
+    vector<float> vScores;
+    vector<int> vnWords;
 
     // Search all keyframes that share a word with current frame
     {
         unique_lock<mutex> lock(mMutex);
 
-        for(DBoW2::BowVector::const_iterator vit=F->mBowVec.begin(), vend=F->mBowVec.end(); vit != vend; vit++)
-        {
-            list<KeyFrame*> &lKFs =   mvInvertedFile[vit->first];
-
-            for(list<KeyFrame*>::iterator lit=lKFs.begin(), lend= lKFs.end(); lit!=lend; lit++)
-            {
-                KeyFrame* pKFi=*lit;
-                if(pKFi->mnRelocQuery!=F->mnId)
-                {
-                    pKFi->mnRelocWords=0;
-                    pKFi->mnRelocQuery=F->mnId;
-                    lKFsSharingWords.push_back(pKFi);
-                }
-                pKFi->mnRelocWords++;
-            }
-        }
+        vpKFsSharingWords = ScoreSharingKeyFrames(F->mBowVec,vScores,vnWords);
     }
-    if(lKFsSharingWords.empty())
+    if(vpKFsSharingWords.empty())
         return vector<KeyFrame*>();
 
     // Only compare against those keyframes that share enough words
     int maxCommonWords=0;
-    for(list<KeyFrame*>::iterator lit=lKFsSharingWords.begin(), lend= lKFsSharingWords.end(); lit!=lend; lit++)
+    for(vector<KeyFrame*>::iterator vit=vpKFsSharingWords.begin(), vend= vpKFsSharingWords.end(); vit!=vend; vit++)
     {
-        if((*lit)->mnRelocWords>maxCommonWords)
-            maxCommonWords=(*lit)->mnRelocWords;
+        if(vnWords[(*vit)->mnId]>maxCommonWords)
+            maxCommonWords=vnWords[(*vit)->mnId];
     }
 
     int minCommonWords = maxCommonWords*0.8f;
 
-    list<pair<float,KeyFrame*> > lScoreAndMatch;
+    const bool bAccumulatedScores = mpVoc->getScoringType()==DBoW2::L1_NORM;
 
-    int nscores=0;
+    list<pair<float,KeyFrame*> > lScoreAndMatch;
 
     // Compute similarity score.
-    for(list<KeyFrame*>::iterator lit=lKFsSharingWords.begin(), lend= lKFsSharingWords.end(); lit!=lend; lit++)
+    for(vector<KeyFrame*>::iterator vit=vpKFsSharingWords.begin(), vend= vpKFsSharingWords.end(); vit!=vend; vit++)
     {
-        KeyFrame* pKFi = *lit;
+        KeyFrame* pKFi = *vit;
+        const unsigned int nId = pKFi->mnId;
 
-        if(pKFi->mnRelocWords>minCommonWords)
+        if(vnWords[nId]>minCommonWords)
         {
-            nscores++;
-            float si = mpVoc->score(F->mBowVec,pKFi->mBowVec);
-            pKFi->mRelocScore=si;
-            lScoreAndMatch.push_back(make_pair(si,pKFi));
+            if(!bAccumulatedScores)
+                vScores[nId] = mpVoc->score(F->mBowVec,pKFi->mBowVec);
+            lScoreAndMatch.push_back(make_pair(vScores[nId],pKFi));
         }
     }
 
@@ -270,14 +320,15 @@ vector<KeyFrame*> KeyFrameDatabase::DetectRelocalizationCandidates(Frame *F)
         for(vector<KeyFrame*>::iterator vit=vpNeighs.begin(), vend=vpNeighs.end(); vit!=vend; vit++)
         {
             KeyFrame* pKF2 = *vit;
-            if(pKF2->mnRelocQuery!=F->mnId)
+            if(pKF2->mnId>=vnWords.size() || vnWords[pKF2->mnId]==0)
                 continue;
 
-            accScore+=pKF2->mRelocScore;
-            if(pKF2->mRelocScore>bestScore)
+            const float score2 = vScores[pKF2->mnId];
+            accScore+=score2;
+            if(score2>bestScore)
             {
                 pBestKF=pKF2;
-                bestScore = pKF2->mRelocScore;
+                bestScore = score2;
             }
 
         }
@@ -30,6 +30,7 @@
 
 #include<mutex>
 #include<thread>
+#include<atomic>
 
 
 namespace ORB_SLAM2
@@ -231,95 +232,61 @@ bool LoopClosing::DetectLoop()
 bool LoopClosing::ComputeSim3()
 {
     // For each consistent loop candidate we try to compute a Sim3
+    // Candidates are independent: matching and RANSAC run concurrently on the
+    // thread pool and all workers stop as soon as one candidate is accepted
 
     const int nInitialCandidates = mvpEnoughConsistentCandidates.size();
 
-    // We compute first ORB matches for each candidate
-    // If enough matches are found, we setup a Sim3Solver
-    ORBmatcher matcher(0.75,true);
-
-    vector<Sim3Solver*> vpSim3Solvers;
-    vpSim3Solvers.resize(nInitialCandidates);
-
-    vector<vector<MapPoint*> > vvpMapPointMatches;
-    vvpMapPointMatches.resize(nInitialCandidates);
-
-    vector<bool> vbDiscarded;
-    vbDiscarded.resize(nInitialCandidates);
+    // avoid that local mapping erase them while they are being processed in this thread
+    for(int i=0; i<nInitialCandidates; i++)
+        mvpEnoughConsistentCandidates[i]->SetNotErase();
 
-    int nCandidates=0; //candidates with enough matches
+    std::atomic<bool> bMatch(false);
+    std::mutex mutexMatch;
 
-    for(int i=0; i<nInitialCandidates; i++)
+    mThreadPool.ParallelFor(nInitialCandidates, [&](size_t i)
     {
         KeyFrame* pKF = mvpEnoughConsistentCandidates[i];
 
-        // avoid that local mapping erase it while it is being processed in this thread
-        pKF->SetNotErase();
+        if(bMatch || pKF->isBad())
+            return;
 
-        if(pKF->isBad())
-        {
-            vbDiscarded[i] = true;
-            continue;
-        }
+        // We compute first ORB matches for each candidate
+        // If enough matches are found, we setup a Sim3Solver
+        ORBmatcher matcher(0.75,true);
 
-        int nmatches = matcher.SearchByBoW(mpCurrentKF,pKF,vvpMapPointMatches[i]);
+        vector<MapPoint*> vpCandidateMatches;
+        int nmatches = matcher.SearchByBoW(mpCurrentKF,pKF,vpCandidateMatches);
 
         if(nmatches<20)
-        {
-            vbDiscarded[i] = true;
-            continue;
-        }
-        else
-        {
-            Sim3Solver* pSolver = new Sim3Solver(mpCurrentKF,pKF,vvpMapPointMatches[i],mbFixScale);
-            pSolver->SetRansacParameters(0.99,20,300);
-            vpSim3Solvers[i] = pSolver;
-        }
-
-        nCandidates++;
-    }
+            return;
 
-    bool bMatch = false;
+        Sim3Solver solver(mpCurrentKF,pKF,vpCandidateMatches,mbFixScale);
+        solver.SetRansacParameters(0.99,20,300);
 
-    // Perform alternatively RANSAC iterations for each candidate
-    // until one is succesful or all fail
-    while(nCandidates>0 && !bMatch)
-    {
-        for(int i=0; i<nInitialCandidates; i++)
+        // Perform RANSAC iterations in rounds of 5
+        // until this candidate is succesful or fails, or another one is accepted
+        bool bNoMore = false;
+        while(!bNoMore && !bMatch)
         {
-            if(vbDiscarded[i])
-                continue;
-
-            KeyFrame* pKF = mvpEnoughConsistentCandidates[i];
-
-            // Perform 5 Ransac Iterations
             vector<bool> vbInliers;
             int nInliers;
-            bool bNoMore;
-
-            Sim3Solver* pSolver = vpSim3Solvers[i];
-            cv::Mat Scm  = pSolver->iterate(5,bNoMore,vbInliers,nInliers);
 
-            // If Ransac reachs max. iterations discard keyframe
-            if(bNoMore)
-            {
-                vbDiscarded[i]=true;
-                nCandidates--;
-            }
+            cv::Mat Scm  = solver.iterate(5,bNoMore,vbInliers,nInliers);
 
             // If RANSAC returns a Sim3, perform a guided matching and optimize with all correspondences
             if(!Scm.empty())
             {
-                vector<MapPoint*> vpMapPointMatches(vvpMapPointMatches[i].size(), static_cast<MapPoint*>(NULL));
+                vector<MapPoint*> vpMapPointMatches(vpCandidateMatches.size(), static_cast<MapPoint*>(NULL));
                 for(size_t j=0, jend=vbInliers.size(); j<jend; j++)
                 {
                     if(vbInliers[j])
-                       vpMapPointMatches[j]=vvpMapPointMatches[i][j];
+                       vpMapPointMatches[j]=vpCandidateMatches[j];
                 }
 
-                cv::Mat R = pSolver->GetEstimatedRotation();
-                cv::Mat t = pSolver->GetEstimatedTranslation();
-                const float s = pSolver->GetEstimatedScale();
+                cv::Mat R = solver.GetEstimatedRotation();
+                cv::Mat t = solver.GetEstimatedTranslation();
+                const float s = solver.GetEstimatedScale();
                 matcher.SearchBySim3(mpCurrentKF,pKF,vpMapPointMatches,s,R,t,7.5);
 
                 g2o::Sim3 gScm(Converter::toMatrix3d(R),Converter::toVector3d(t),s);
@@ -328,6 +295,10 @@ bool LoopClosing::ComputeSim3()
                 // If optimization is succesful stop ransacs and continue
                 if(nInliers>=20)
                 {
+                    unique_lock<mutex> lock(mutexMatch);
+                    if(bMatch)
+                        return;
+
                     bMatch = true;
                     mpMatchedKF = pKF;
                     g2o::Sim3 gSmw(Converter::toMatrix3d(pKF->GetRotation()),Converter::toVector3d(pKF->GetTranslation()),1.0);
@@ -335,11 +306,11 @@ bool LoopClosing::ComputeSim3()
                     mScw = Converter::toCvMat(mg2oScw);
 
                     mvpCurrentMatchedPoints = vpMapPointMatches;
-                    break;
+                    return;
                 }
             }
         }
-    }
+    });
 
     if(!bMatch)
     {
@@ -372,6 +343,7 @@ bool LoopClosing::ComputeSim3()
     }
 
     // Find more matches projecting with the computed Sim3
+    ORBmatcher matcher(0.75,true);
     matcher.SearchByProjection(mpCurrentKF, mScw, mvpLoopMapPoints, mvpCurrentMatchedPoints,10);
 
     // If enough matches accept Loop
@@ -468,15 +440,21 @@ void LoopClosing::CorrectLoop()
         }
 
         // Correct all MapPoints obsrved by current keyframe and neighbors, so that they align with the other side of the loop
+        // Each MapPoint is corrected by the first keyframe that observes it. The assignment is done sequentially,
+        // the correction of each keyframe's points is independent and runs on the thread pool.
+        vector<KeyFrame*> vpKFsToCorrect;
+        vector<vector<MapPoint*> > vvpMPsToCorrect;
+        vpKFsToCorrect.reserve(CorrectedSim3.size());
+        vvpMPsToCorrect.reserve(CorrectedSim3.size());
         for(KeyFrameAndPose::iterator mit=CorrectedSim3.begin(), mend=CorrectedSim3.end(); mit!=mend; mit++)
         {
             KeyFrame* pKFi = mit->first;
-            g2o::Sim3 g2oCorrectedSiw = mit->second;
-            g2o::Sim3 g2oCorrectedSwi = g2oCorrectedSiw.inverse();
-
-            g2o::Sim3 g2oSiw =NonCorrectedSim3[pKFi];
+            vpKFsToCorrect.push_back(pKFi);
+            vvpMPsToCorrect.push_back(vector<MapPoint*>());
+            vector<MapPoint*> &vpMPsToCorrect = vvpMPsToCorrect.back();
 
             vector<MapPoint*> vpMPsi = pKFi->GetMapPointMatches();
+            vpMPsToCorrect.reserve(vpMPsi.size());
             for(size_t iMP=0, endMPi = vpMPsi.size(); iMP<endMPi; iMP++)
             {
                 MapPoint* pMPi = vpMPsi[iMP];
@@ -487,6 +465,23 @@ void LoopClosing::CorrectLoop()
                 if(pMPi->mnCorrectedByKF==mpCurrentKF->mnId)
                     continue;
 
+                pMPi->mnCorrectedByKF = mpCurrentKF->mnId;
+                pMPi->mnCorrectedReference = pKFi->mnId;
+                vpMPsToCorrect.push_back(pMPi);
+            }
+        }
+
+        mThreadPool.ParallelFor(vpKFsToCorrect.size(), [&](size_t i)
+        {
+            KeyFrame* pKFi = vpKFsToCorrect[i];
+            const g2o::Sim3 g2oCorrectedSwi = CorrectedSim3.at(pKFi).inverse();
+            const g2o::Sim3 &g2oSiw = NonCorrectedSim3.at(pKFi);
+
+            const vector<MapPoint*> &vpMPsToCorrect = vvpMPsToCorrect[i];
+            for(size_t iMP=0, endMPi = vpMPsToCorrect.size(); iMP<endMPi; iMP++)
+            {
+                MapPoint* pMPi = vpMPsToCorrect[iMP];
+
                 // Project with non-corrected pose and project back with corrected pose
                 cv::Mat P3Dw = pMPi->GetWorldPos();
                 Eigen::Matrix<double,3,1> eigP3Dw = Converter::toVector3d(P3Dw);
@@ -494,10 +489,13 @@ void LoopClosing::CorrectLoop()
 
                 cv::Mat cvCorrectedP3Dw = Converter::toCvMat(eigCorrectedP3Dw);
                 pMPi->SetWorldPos(cvCorrectedP3Dw);
-                pMPi->mnCorrectedByKF = mpCurrentKF->mnId;
-                pMPi->mnCorrectedReference = pKFi->mnId;
-                pMPi->UpdateNormalAndDepth();
             }
+        });
+
+        for(KeyFrameAndPose::iterator mit=CorrectedSim3.begin(), mend=CorrectedSim3.end(); mit!=mend; mit++)
+        {
+            KeyFrame* pKFi = mit->first;
+            g2o::Sim3 g2oCorrectedSiw = mit->second;
 
             // Update keyframe pose with corrected Sim3. First transform Sim3 to SE3 (scale translation)
             Eigen::Matrix3d eigR = g2oCorrectedSiw.rotation().toRotationMatrix();
@@ -509,11 +507,20 @@ void LoopClosing::CorrectLoop()
             cv::Mat correctedTiw = Converter::toCvSE3(eigR,eigt);
 
             pKFi->SetPose(correctedTiw);
-
-            // Make sure connections are updated
-            pKFi->UpdateConnections();
         }
 
+        // Normals and depths are computed once all the poses have been corrected
+        mThreadPool.ParallelFor(vvpMPsToCorrect.size(), [&](size_t i)
+        {
+            const vector<MapPoint*> &vpMPsToCorrect = vvpMPsToCorrect[i];
+            for(size_t iMP=0, endMPi = vpMPsToCorrect.size(); iMP<endMPi; iMP++)
+                vpMPsToCorrect[iMP]->UpdateNormalAndDepth();
+        });
+
+        // Make sure connections are updated
+        for(size_t i=0; i<vpKFsToCorrect.size(); i++)
+            vpKFsToCorrect[i]->UpdateConnections();
+
         // Start Loop Fusion
         // Update matched map points and replace if duplicated
         for(size_t i=0; i<mvpCurrentMatchedPoints.size(); i++)
@@ -563,7 +570,7 @@ void LoopClosing::CorrectLoop()
     }
 
     // Optimize graph
-    Optimizer::OptimizeEssentialGraph(mpMap, mpMatchedKF, mpCurrentKF, NonCorrectedSim3, CorrectedSim3, LoopConnections, mbFixScale);
+    Optimizer::OptimizeEssentialGraph(mpMap, mpMatchedKF, mpCurrentKF, NonCorrectedSim3, CorrectedSim3, LoopConnections, mbFixScale, &mThreadPool);
 
     mpMap->InformNewBigChange();
 
@@ -585,25 +592,61 @@ void LoopClosing::CorrectLoop()
 
 void LoopClosing::SearchAndFuse(const KeyFrameAndPose &CorrectedPosesMap)
 {
-    ORBmatcher matcher(0.8);
-
+    vector<KeyFrame*> vpKFs;
+    vector<cv::Mat> vScw;
+    vpKFs.reserve(CorrectedPosesMap.size());
+    vScw.reserve(CorrectedPosesMap.size());
     for(KeyFrameAndPose::const_iterator mit=CorrectedPosesMap.begin(), mend=CorrectedPosesMap.end(); mit!=mend;mit++)
     {
-        KeyFrame* pKF = mit->first;
+        vpKFs.push_back(mit->first);
+        vScw.push_back(Converter::toCvMat(mit->second));
+    }
 
-        g2o::Sim3 g2oScw = mit->second;
-        cv::Mat cvScw = Converter::toCvMat(g2oScw);
+    // Projection and matching only read the keyframe and the loop points, so every keyframe
+    // is searched on its own worker. The matches are then fused keyframe by keyframe in order
+    // under the map mutex, each checked against what the keyframes before it fused, so the
+    // result does not depend on scheduling.
+    const int nLP = mvpLoopMapPoints.size();
+    vector<vector<int> > vvnMatchedIdx(vpKFs.size());
 
-        vector<MapPoint*> vpReplacePoints(mvpLoopMapPoints.size(),static_cast<MapPoint*>(NULL));
-        matcher.Fuse(pKF,cvScw,mvpLoopMapPoints,4,vpReplacePoints);
+    mThreadPool.ParallelFor(vpKFs.size(), [&](size_t i)
+    {
+        ORBmatcher matcher(0.8);
+        matcher.SearchForFuse(vpKFs[i],vScw[i],mvpLoopMapPoints,4,vvnMatchedIdx[i]);
+    });
+
+    // Get Map Mutex
+    unique_lock<mutex> lock(mpMap->mMutexMapUpdate);
+    for(size_t iKF=0; iKF<vpKFs.size(); iKF++)
+    {
+        KeyFrame* pKF = vpKFs[iKF];
+        const vector<int> &vnMatchedIdx = vvnMatchedIdx[iKF];
+        vector<MapPoint*> vpReplacePoints(nLP,static_cast<MapPoint*>(NULL));
+        for(int i=0; i<nLP;i++)
+        {
+            const int idx = vnMatchedIdx[i];
+            MapPoint* pMP = mvpLoopMapPoints[i];
+            if(idx<0 || pMP->isBad())
+                continue;
+
+            // An earlier keyframe may have fused pMP into this one already
+            MapPoint* pMPinKF = pKF->GetMapPoint(idx);
+            if(pMPinKF)
+            {
+                if(pMPinKF!=pMP && !pMPinKF->isBad())
+                    vpReplacePoints[i] = pMPinKF;
+            }
+            else if(!pMP->IsInKeyFrame(pKF))
+            {
+                pMP->AddObservation(pKF,idx);
+                pKF->AddMapPoint(pMP,idx);
+            }
+        }
 
-        // Get Map Mutex
-        unique_lock<mutex> lock(mpMap->mMutexMapUpdate);
-        const int nLP = mvpLoopMapPoints.size();
         for(int i=0; i<nLP;i++)
         {
             MapPoint* pRep = vpReplacePoints[i];
-            if(pRep)
+            if(pRep && !pRep->isBad())
             {
                 pRep->Replace(mvpLoopMapPoints[i]);
             }
@@ -28,7 +28,7 @@
 namespace ORB_SLAM2
 {
 
-Map::Map():mnMaxKFid(0),mnBigChangeIdx(0)
+Map::Map():mnMaxKFid(0),mnBigChangeIdx(0),mnGeneration(0)
 {
 }
 
@@ -148,6 +148,12 @@ void Map::clear()
     mnMaxKFid = 0;
     mvpReferenceMapPoints.clear();
     mvpKeyFrameOrigins.clear();
+    mnGeneration++;
+}
+
+int Map::GetGeneration()
+{
+    return mnGeneration;
 }
 
 } //namespace ORB_SLAM
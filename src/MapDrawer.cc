@@ -21,6 +21,7 @@
 #include "MapDrawer.h"
 #include "MapPoint.h"
 #include "KeyFrame.h"
+#include "Modeler/ProbabilityMapping.h"
 #include <pangolin/pangolin.h>
 #include <mutex>
 
@@ -80,6 +81,21 @@ void MapDrawer::DrawMapPoints()
     glEnd();
 }
 
+void MapDrawer::DrawSemiDensePoints(ProbabilityMapping* pProbabilityMapping)
+{
+    glPointSize(1);
+    glBegin(GL_POINTS);
+    glColor3f(0.3,0.3,0.3);
+
+    pProbabilityMapping->ForEachSemiDensePointSet([](const vector<cv::Point3f> &vPw)
+    {
+        for(size_t i=0, iend=vPw.size(); i<iend; i++)
+            glVertex3f(vPw[i].x,vPw[i].y,vPw[i].z);
+    });
+
+    glEnd();
+}
+
 void MapDrawer::DrawKeyFrames(const bool bDrawKF, const bool bDrawGraph)
 {
     const float &w = mKeyFrameSize;
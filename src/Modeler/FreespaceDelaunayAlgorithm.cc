@@ -26,6 +26,7 @@
 #define __FREESPACEDELAUNAYALGORITHM_CPP
 
 #include "Modeler/FreespaceDelaunayAlgorithm.h"
+#include "Modeler/BinaryIO.h"
 #include <sys/time.h>
 #include <algorithm>
 
@@ -33,18 +34,18 @@ namespace dlovi {
 
     // Constructors
 
-    FreespaceDelaunayAlgorithm::FreespaceDelaunayAlgorithm() {
+    FreespaceDelaunayAlgorithm::FreespaceDelaunayAlgorithm() : m_bClipConstraints(false) {
         calculateBoundsValues();
     }
 
     FreespaceDelaunayAlgorithm::FreespaceDelaunayAlgorithm(const vector<Matrix> & points, const vector<Matrix> & cams, const vector<Matrix> & camCenters,
-                                                           const vector<Matrix> & principleRays, const vector<vector<int> > & visibilityList) {
+                                                           const vector<Matrix> & principleRays, const vector<vector<int> > & visibilityList) : m_bClipConstraints(false) {
         copy(points, cams, camCenters, principleRays, visibilityList);
         calculateBoundsValues();
     }
 
     FreespaceDelaunayAlgorithm::FreespaceDelaunayAlgorithm(const vector<Matrix> & points, const vector<Matrix> & cams, const vector<Matrix> & camCenters,
-                                                           const vector<Matrix> & principleRays, const vector<Matrix> & normals) {
+                                                           const vector<Matrix> & principleRays, const vector<Matrix> & normals) : m_bClipConstraints(false) {
         vector<vector<int> > visibilityList;
         copy(points, cams, camCenters, principleRays, visibilityList);
         calculateBoundsValues();
@@ -56,6 +57,9 @@ namespace dlovi {
     FreespaceDelaunayAlgorithm::FreespaceDelaunayAlgorithm(const FreespaceDelaunayAlgorithm & ref) {
         copy(ref.getPoints(), ref.getCams(), ref.getCamCenters(), ref.getPrincipleRays(), ref.getVisibilityList());
         m_mapPoint_VertexHandle = ref.m_mapPoint_VertexHandle;
+        m_bClipConstraints = ref.m_bClipConstraints;
+        m_vecClipMin = ref.m_vecClipMin;
+        m_vecClipMax = ref.m_vecClipMax;
         calculateBoundsValues();
     }
 
@@ -65,7 +69,7 @@ namespace dlovi {
         return m_points;
     }
 
-    Matrix FreespaceDelaunayAlgorithm::getPoint(const int index) const {
+    const Matrix & FreespaceDelaunayAlgorithm::getPoint(const int index) const {
         return m_points[index];
     }
 
@@ -77,7 +81,7 @@ namespace dlovi {
         return m_cams;
     }
 
-    Matrix FreespaceDelaunayAlgorithm::getCam(const int index) const {
+    const Matrix & FreespaceDelaunayAlgorithm::getCam(const int index) const {
         return m_cams[index];
     }
 
@@ -85,7 +89,7 @@ namespace dlovi {
         return m_camCenters;
     }
 
-    Matrix FreespaceDelaunayAlgorithm::getCamCenter(const int index) const {
+    const Matrix & FreespaceDelaunayAlgorithm::getCamCenter(const int index) const {
         return m_camCenters[index];
     }
 
@@ -93,7 +97,7 @@ namespace dlovi {
         return m_principleRays;
     }
 
-    Matrix FreespaceDelaunayAlgorithm::getPrincipleRay(const int index) const {
+    const Matrix & FreespaceDelaunayAlgorithm::getPrincipleRay(const int index) const {
         return m_principleRays[index];
     }
 
@@ -139,6 +143,17 @@ namespace dlovi {
         m_visibilityList = ref;
     }
 
+    void FreespaceDelaunayAlgorithm::setBounds(const double nBoundsMin, const double nBoundsMax) {
+        m_nBoundsMin = nBoundsMin;
+        m_nBoundsMax = nBoundsMax;
+    }
+
+    void FreespaceDelaunayAlgorithm::setConstraintClipBox(const Matrix & matMin, const Matrix & matMax) {
+        m_vecClipMin = FixedVector3(matMin);
+        m_vecClipMax = FixedVector3(matMax);
+        m_bClipConstraints = true;
+    }
+
     void FreespaceDelaunayAlgorithm::addPoint(const Matrix & ref) {
         m_points.push_back(ref);
     }
@@ -162,6 +177,9 @@ namespace dlovi {
         if (this != & rhs) {
             copy(rhs.getPoints(), rhs.getCams(), rhs.getCamCenters(), rhs.getPrincipleRays(), rhs.getVisibilityList());
             m_mapPoint_VertexHandle = rhs.m_mapPoint_VertexHandle;
+            m_bClipConstraints = rhs.m_bClipConstraints;
+            m_vecClipMin = rhs.m_vecClipMin;
+            m_vecClipMax = rhs.m_vecClipMax;
             calculateBoundsValues();
         }
         return *this;
@@ -217,7 +235,7 @@ namespace dlovi {
                 vector<int>::const_iterator itOriginalLocalVisList;
                 for (itOriginalLocalVisList = getVisibilityList(frameIndex).begin(); itOriginalLocalVisList != getVisibilityList(frameIndex).end(); itOriginalLocalVisList++) {
                     int originalIndex = *itOriginalLocalVisList;
-                    Matrix matTmpPoint = getPoint(originalIndex);
+                    const Matrix & matTmpPoint = getPoint(originalIndex);
                     PointD3 pd3TmpPoint(matTmpPoint(0), matTmpPoint(1), matTmpPoint(2));
 
                     map<int, int>::iterator itVertHandleIndex = m_mapPoint_VertexHandle.find(originalIndex);
@@ -241,11 +259,9 @@ namespace dlovi {
                 const vector<int> & localVisList = getVisibilityList(i);
                 for (int j = 0; j < (int)localVisList.size(); j++) {
                     // let Q be the point & O the optic center.
-                    Matrix matQ = getPoint(localVisList[j]);
-                    Matrix matO = getCamCenter(i);
+                    const Matrix & matQ = getPoint(localVisList[j]);
                     PointD3 Q(matQ(0), matQ(1), matQ(2));
-                    PointD3 O(matO(0), matO(1), matO(2));
-                    Segment QO = Segment(Q, O);
+                    Segment QO = constraintSegment(Q, i);
                     Delaunay3::Vertex_handle hndlQ = vecVertexHandles[localVisList[j]];
 
                     // Increment the voting counts of all tetrahedra that intersect the constraint QO
@@ -257,10 +273,8 @@ namespace dlovi {
             for (int i = 0; i < numCams(); i++) {
                 for (int j = 0; j < (int)localVisLists[i].size(); j++) {
                     // let Q be the point & O the optic center.
-                    Matrix matO = getCamCenter(i);
                     PointD3 Q(vecVertexHandles[localVisLists[i][j]]->point());
-                    PointD3 O(matO(0), matO(1), matO(2));
-                    Segment QO = Segment(Q, O);
+                    Segment QO = constraintSegment(Q, i);
                     Delaunay3::Vertex_handle hndlQ = vecVertexHandles[localVisLists[i][j]];
 
                     // Increment the voting counts of all tetrahedra that intersect the constraint QO
@@ -283,8 +297,6 @@ namespace dlovi {
         addNewlyObservedFeatures(dt, vecVertexHandles, localVisList, getVisibilityList(frameIndex));
 
         // Apply the current view's freespace constraints to the triangulation
-        Matrix matO = getCamCenter(frameIndex);
-        PointD3 O(matO(0), matO(1), matO(2));
         for (int j = 0; j < (int)localVisList.size(); j++) {
             // let Q be the point & O the optic center.
             Delaunay3::Vertex_handle hndlQ = vecVertexHandles[localVisList[j]];
@@ -293,7 +305,7 @@ namespace dlovi {
             if (! dt.is_vertex(hndlQ))
                 continue;
 
-            Segment QO = Segment(hndlQ->point(), O);
+            Segment QO = constraintSegment(hndlQ->point(), frameIndex);
 
             // Increment the voting counts of all tetrahedra that intersect the constraint QO & keep track of which constraints crossed which tetrahedra.
             markTetrahedraCrossingConstraintWithBookKeeping(dt, vecVertexHandles, hndlQ, QO, frameIndex, localVisList[j]);
@@ -360,60 +372,69 @@ namespace dlovi {
 
         // Step 4:
         for (set<pair<int, int>, Delaunay3CellInfo::LtConstraint>::iterator itConstraint = setUnionedConstraints.begin(); itConstraint != setUnionedConstraints.end(); itConstraint++) {
-            Segment QO = Segment(vecVertexHandles[itConstraint->second]->point(),
-                                 PointD3(getCamCenter(itConstraint->first)(0), getCamCenter(itConstraint->first)(1), getCamCenter(itConstraint->first)(2)));
+            Segment QO = constraintSegment(vecVertexHandles[itConstraint->second]->point(), itConstraint->first);
             markTetrahedraCrossingConstraintWithBookKeeping(dt, vecVertexHandles, vecVertexHandles[itConstraint->second], QO, itConstraint->first, itConstraint->second, true);
         }
         for (set<Delaunay3::Cell_handle>::iterator itCell = setNewCells.begin(); itCell != setNewCells.end(); itCell++)
             (*itCell)->info().markOld();
     }
 
-    // TODO: The following function is both buggy and untested.  We've used the single-vertex-deletion version of this function in our testing and experiments.
     void FreespaceDelaunayAlgorithm::removeVertex(Delaunay3 & dt, vector<Delaunay3::Vertex_handle> & vecVertexHandles, const set<int> & setPointIndices) const {
-        // Vertex Deletion Algorithm:
+        // Batch Vertex Deletion Algorithm:
         // ~~~~~~~~~~~~~~~~~~~~
-        // Step 1: Collect FS constraints into a unioned set from incident cells.  Don't add FS constraints containing the vertex to be deleted.
-        // Step 2: Delete the vertex (this retriangulates).
-        // Step 3: Iterate steps 1 and 2 for each vertex to be deleted
-        // Step 4: Iterate over all cells and remove any FS constraints containing the deleted vertices.  Meanwhile determine the set of new cells.
-        // Step 5: Process the FS Constraints in the unioned set.  Mark new cells as old.
+        // Step 1: Collect FS constraints into a unioned set from the cells incident to any of the vertices.  Don't add FS constraints containing
+        //				any of the vertices to be deleted.
+        // Step 2: Delete the vertices (this retriangulates).
+        // Step 3: Iterate over all cells once and remove any FS constraints containing the deleted vertices.  Meanwhile determine the set of new cells.
+        // Step 4: Process the FS Constraints in the unioned set.  Mark new cells as old.
 
-        Delaunay3::Vertex_handle hndlQ;
+        vector<Delaunay3::Vertex_handle> arrHndlQ;
+        vector<bool> arrIsRemovedVertex(vecVertexHandles.size(), false); // constant time test of whether a constraint refers to a deleted vertex
         set<pair<int, int>, Delaunay3CellInfo::LtConstraint> setUnionedConstraints;
-        set<int> setRemovedVertexIndices;
 
         for (set<int>::const_iterator itPointIndex = setPointIndices.begin(); itPointIndex != setPointIndices.end(); itPointIndex++) {
-            int pointIndex = *itPointIndex;
-            int vertexIndex = m_mapPoint_VertexHandle[pointIndex];
-            hndlQ = vecVertexHandles[vertexIndex];
-
-            // Step 1:
-            set<Delaunay3::Cell_handle> setIncidentCells;
-            dt.incident_cells(hndlQ, std::inserter(setIncidentCells, setIncidentCells.begin()));
-
-            for (set<Delaunay3::Cell_handle>::iterator itCell = setIncidentCells.begin(); itCell != setIncidentCells.end(); itCell++) {
-                for (set<Delaunay3CellInfo::FSConstraint, Delaunay3CellInfo::LtFSConstraint>::const_iterator itConstraint = (*itCell)->info().getIntersections().begin();
-                     itConstraint != (*itCell)->info().getIntersections().end(); itConstraint++) {
-                    // TODO: BUG: The following conditional doesn't test against all vertexIndices that will be removed, just the current one.  Wrong!  Should prune this set.
-                    if(itConstraint->second != vertexIndex)
-                        setUnionedConstraints.insert(*itConstraint);
-                }
+            int vertexIndex = m_mapPoint_VertexHandle[*itPointIndex];
+            // TODO：DEBUG data corruption
+            if (! dt.is_vertex(vecVertexHandles[vertexIndex]) || arrIsRemovedVertex[vertexIndex])
+                continue;
+            arrIsRemovedVertex[vertexIndex] = true;
+            arrHndlQ.push_back(vecVertexHandles[vertexIndex]);
+        }
+        if (arrHndlQ.size() == 0)
+            return;
+
+        // Step 1:
+        vector<Delaunay3::Cell_handle> arrIncidentCells;
+        for (vector<Delaunay3::Vertex_handle>::iterator itHndlQ = arrHndlQ.begin(); itHndlQ != arrHndlQ.end(); itHndlQ++)
+            dt.incident_cells(*itHndlQ, std::back_inserter(arrIncidentCells));
+        std::sort(arrIncidentCells.begin(), arrIncidentCells.end());
+        arrIncidentCells.erase(std::unique(arrIncidentCells.begin(), arrIncidentCells.end()), arrIncidentCells.end());
+
+        for (vector<Delaunay3::Cell_handle>::iterator itCell = arrIncidentCells.begin(); itCell != arrIncidentCells.end(); itCell++) {
+            for (set<Delaunay3CellInfo::FSConstraint, Delaunay3CellInfo::LtFSConstraint>::const_iterator itConstraint = (*itCell)->info().getIntersections().begin();
+                 itConstraint != (*itCell)->info().getIntersections().end(); itConstraint++) {
+                if (! arrIsRemovedVertex[itConstraint->second])
+                    setUnionedConstraints.insert(*itConstraint);
             }
+        }
 
-            // Step 2:
-            dt.remove(hndlQ);
-            setRemovedVertexIndices.insert(setRemovedVertexIndices.end(), vertexIndex);
+        // Step 2:
+        for (vector<Delaunay3::Vertex_handle>::iterator itHndlQ = arrHndlQ.begin(); itHndlQ != arrHndlQ.end(); itHndlQ++)
+            dt.remove(*itHndlQ);
+        for (int vertexIndex = 0; vertexIndex < (int) vecVertexHandles.size(); vertexIndex++) {
+            if (arrIsRemovedVertex[vertexIndex])
+                vecVertexHandles[vertexIndex] = Delaunay3::Vertex_handle();
         }
 
-        // Step 4:
-        set<Delaunay3::Cell_handle> setNewCells;
+        // Step 3:
+        vector<Delaunay3::Cell_handle> arrNewCells;
         for (Delaunay3::Finite_cells_iterator itCell = dt.finite_cells_begin(); itCell != dt.finite_cells_end(); itCell++) {
             if (itCell->info().isNew())
-                setNewCells.insert(itCell);
+                arrNewCells.push_back(itCell);
             // Linear search:
             for (set<Delaunay3CellInfo::FSConstraint, Delaunay3CellInfo::LtFSConstraint>::const_iterator itDelete = itCell->info().getIntersections().begin();
                  itDelete != itCell->info().getIntersections().end(); ) {
-                if (setRemovedVertexIndices.count(itDelete->second) > 0) {
+                if (arrIsRemovedVertex[itDelete->second]) {
                     // invalidates iterator, so careful about incrementing it:
                     set<Delaunay3CellInfo::FSConstraint, Delaunay3CellInfo::LtFSConstraint>::const_iterator itNext = itDelete;
                     itNext++;
@@ -426,13 +447,12 @@ namespace dlovi {
             }
         }
 
-        // Step 5:
+        // Step 4:
         for (set<pair<int, int>, Delaunay3CellInfo::LtConstraint>::iterator itConstraint = setUnionedConstraints.begin(); itConstraint != setUnionedConstraints.end(); itConstraint++) {
-            Segment QO = Segment(vecVertexHandles[itConstraint->second]->point(),
-                                 PointD3(getCamCenter(itConstraint->first)(0), getCamCenter(itConstraint->first)(1), getCamCenter(itConstraint->first)(2)));
+            Segment QO = constraintSegment(vecVertexHandles[itConstraint->second]->point(), itConstraint->first);
             markTetrahedraCrossingConstraintWithBookKeeping(dt, vecVertexHandles, vecVertexHandles[itConstraint->second], QO, itConstraint->first, itConstraint->second, true);
         }
-        for (set<Delaunay3::Cell_handle>::iterator itCell = setNewCells.begin(); itCell != setNewCells.end(); itCell++)
+        for (vector<Delaunay3::Cell_handle>::iterator itCell = arrNewCells.begin(); itCell != arrNewCells.end(); itCell++)
             (*itCell)->info().markOld();
     }
 
@@ -534,15 +554,13 @@ namespace dlovi {
         // Step 7
         for (set<pair<int, int>, Delaunay3CellInfo::LtConstraint>::iterator itConstraint = setUnionedStationaryConstraints.begin();
              itConstraint != setUnionedStationaryConstraints.end(); itConstraint++) {
-            Segment QO = Segment(vecVertexHandles[itConstraint->second]->point(),
-                                 PointD3(getCamCenter(itConstraint->first)(0), getCamCenter(itConstraint->first)(1), getCamCenter(itConstraint->first)(2)));
+            Segment QO = constraintSegment(vecVertexHandles[itConstraint->second]->point(), itConstraint->first);
             markTetrahedraCrossingConstraintWithBookKeeping(dt, vecVertexHandles, vecVertexHandles[itConstraint->second], QO,
                                                             itConstraint->first, itConstraint->second, true);
         }
         for (set<pair<int, int>, Delaunay3CellInfo::LtConstraint>::iterator itConstraint = setUnionedMovedConstraints.begin();
              itConstraint != setUnionedMovedConstraints.end(); itConstraint++) {
-            Segment QO = Segment(vecVertexHandles[itConstraint->second]->point(),
-                                 PointD3(getCamCenter(itConstraint->first)(0), getCamCenter(itConstraint->first)(1), getCamCenter(itConstraint->first)(2)));
+            Segment QO = constraintSegment(vecVertexHandles[itConstraint->second]->point(), itConstraint->first);
             markTetrahedraCrossingConstraintWithBookKeeping(dt, vecVertexHandles, vecVertexHandles[itConstraint->second], QO,
                                                             itConstraint->first, itConstraint->second, false);
         }
@@ -550,51 +568,68 @@ namespace dlovi {
             (*itCell)->info().markOld();
     }
 
-    void FreespaceDelaunayAlgorithm::moveVertex(Delaunay3 & dt, vector<Delaunay3::Vertex_handle> & vecVertexHandles, const vector<int> & arrPointIndices) const {
-        // Vertex Moving Algorithm:
+    void FreespaceDelaunayAlgorithm::moveVertex(Delaunay3 & dt, vector<Delaunay3::Vertex_handle> & vecVertexHandles, const vector<int> & arrPointIndices,
+                                                const double dMinDisplacement) const {
+        // Bulk Vertex Moving Algorithm:
         // ~~~~~~~~~~~~~~~~~~~~
+        // Step 0: Skip the vertices that moved by dMinDisplacement or less.  Bundle adjustment nudges most points by a negligible amount, and those
+        //				are left in place along with all the constraints through them.
         // Step 1: Collect FS constraints into two unioned sets from incident cells.  FS constraints containing the vertices to be moved go to their own set.
         //				(Since they will refer to a new point locations)
         // Step 2: Delete the vertices (this retriangulates).
         // Note: Steps 3 and 4 should be done as one combined step as the sets in step 3 make no sense without point insertion in between.
         // Step 3: As in point insertion, find the set of Delaunay-conflicting cells for the moved points, and add their FS constraints to the unioned sets.
-        //				(Again same division between sets)
+        //				(Again same division between sets)  The new locations are spatially sorted, and each one is located starting from the cell
+        //				of the previously inserted vertex, so that the walks are short.
         // Step 4: Insert the points into the triangulation (this retriangulates).
-        // Step 5: (nevermind...)  Used to be a "repeat steps 1-4" for each vertex
         // Step 6: Iterate over all cells in the DT and remove any FS constraints containing the deleted vertices.  Meanwhile determine the set of new cells.
         // Step 7: Process the FS constraints in the unioned sets.  Normal constraints only mark new cells.  Special constraints containing the moved
         //				points mark all crossed cells (as they were explicitly deleted in step 6).  Mark new cells as old.
 
+        typedef CGAL::Spatial_sort_traits_adapter_3<K, CGAL::Pointer_property_map<PointD3>::type> SpatialSortTraits;
+
         vector<Delaunay3::Vertex_handle> arrHndlQ;
         vector<int> arrVertexIndices;
         vector<PointD3> arrPd3NewPoints;
+        vector<bool> arrIsMovedVertex(vecVertexHandles.size(), false); // constant time test of whether a constraint refers to a moved vertex
         set<pair<int, int>, Delaunay3CellInfo::LtConstraint> setUnionedStationaryConstraints;
         set<pair<int, int>, Delaunay3CellInfo::LtConstraint> setUnionedMovedConstraints;
-        set<Delaunay3::Cell_handle> setNewCells;
+        vector<Delaunay3::Cell_handle> arrNewCells;
 
-        // TODO: DEBUG: PTAM has minor data corruption bugs, and this hack handles the bad data being passed to our code.  Should fix PTAM instead.
+        // Step 0:
+        const double dMinDisplacementSq = dMinDisplacement * dMinDisplacement;
         for (vector<int>::const_iterator it = arrPointIndices.begin(); it != arrPointIndices.end(); it++) {
             int vertexIndex = m_mapPoint_VertexHandle[*it];
             Delaunay3::Vertex_handle hndlQ = vecVertexHandles[vertexIndex];
+            // TODO: DEBUG: PTAM has minor data corruption bugs, and this hack handles the bad data being passed to our code.  Should fix PTAM instead.
             if (! dt.is_vertex(hndlQ))
                 continue;
+            if (arrIsMovedVertex[vertexIndex])
+                continue; // listed twice
 
+            PointD3 pd3NewPoint(getPoint(*it)(0), getPoint(*it)(1), getPoint(*it)(2));
+            if (CGAL::squared_distance(hndlQ->point(), pd3NewPoint) <= dMinDisplacementSq)
+                continue;
+
+            arrIsMovedVertex[vertexIndex] = true;
             arrVertexIndices.push_back(vertexIndex);
             arrHndlQ.push_back(hndlQ);
-            arrPd3NewPoints.push_back(PointD3(getPoint(*it)(0), getPoint(*it)(1), getPoint(*it)(2)));
+            arrPd3NewPoints.push_back(pd3NewPoint);
         }
         if (arrVertexIndices.size() == 0)
             return;
 
         // Step 1:
-        set<Delaunay3::Cell_handle> setIncidentCells;
+        vector<Delaunay3::Cell_handle> arrIncidentCells;
         for (vector<Delaunay3::Vertex_handle>::iterator itHndlQ = arrHndlQ.begin(); itHndlQ != arrHndlQ.end(); itHndlQ++)
-            dt.incident_cells(*itHndlQ, std::inserter(setIncidentCells, setIncidentCells.begin()));
+            dt.incident_cells(*itHndlQ, std::back_inserter(arrIncidentCells));
+        std::sort(arrIncidentCells.begin(), arrIncidentCells.end());
+        arrIncidentCells.erase(std::unique(arrIncidentCells.begin(), arrIncidentCells.end()), arrIncidentCells.end());
 
-        for (set<Delaunay3::Cell_handle>::iterator itCell = setIncidentCells.begin(); itCell != setIncidentCells.end(); itCell++) {
+        for (vector<Delaunay3::Cell_handle>::iterator itCell = arrIncidentCells.begin(); itCell != arrIncidentCells.end(); itCell++) {
             for (set<Delaunay3CellInfo::FSConstraint, Delaunay3CellInfo::LtFSConstraint>::const_iterator itConstraint = (*itCell)->info().getIntersections().begin();
                  itConstraint != (*itCell)->info().getIntersections().end(); itConstraint++) {
-                if (std::find(arrVertexIndices.begin(), arrVertexIndices.end(), itConstraint->second) != arrVertexIndices.end()) // linear search in std::find()
+                if (arrIsMovedVertex[itConstraint->second])
                     setUnionedMovedConstraints.insert(*itConstraint);
                 else
                     setUnionedStationaryConstraints.insert(*itConstraint);
@@ -602,20 +637,23 @@ namespace dlovi {
         }
 
         // Step 2:
-        for (int nLoop = 0; nLoop < (int) arrHndlQ.size(); nLoop++) {
-            Delaunay3::Vertex_handle hndlQ = arrHndlQ[nLoop];
-            if (! dt.is_vertex(hndlQ))
-                continue;
-            dt.remove(hndlQ);
-        }
+        for (int nLoop = 0; nLoop < (int) arrHndlQ.size(); nLoop++)
+            dt.remove(arrHndlQ[nLoop]);
 
         // Steps 3 & 4:
+        vector<size_t> arrInsertionOrder(arrPd3NewPoints.size());
+        for (size_t nLoop = 0; nLoop < arrInsertionOrder.size(); nLoop++)
+            arrInsertionOrder[nLoop] = nLoop;
+        CGAL::spatial_sort(arrInsertionOrder.begin(), arrInsertionOrder.end(), SpatialSortTraits(CGAL::make_property_map(arrPd3NewPoints)));
+
+        Delaunay3::Cell_handle hndlHint;
+        for (vector<size_t>::const_iterator itOrder = arrInsertionOrder.begin(); itOrder != arrInsertionOrder.end(); itOrder++) {
+            const int nLoop = (int) *itOrder;
 
-        for (int nLoop = 0; nLoop < (int)arrHndlQ.size(); nLoop++) {
             // Locate the point
             Delaunay3::Locate_type lt;
             int li, lj;
-            Delaunay3::Cell_handle c = dt.locate(arrPd3NewPoints[nLoop], lt, li, lj);
+            Delaunay3::Cell_handle c = dt.locate(arrPd3NewPoints[nLoop], lt, li, lj, hndlHint);
             if (lt == Delaunay3::VERTEX) {
                 // TODO: handle better than just returning here!
                 cerr << "Error in FreespaceDelaunayAlgorithm::moveVertex(): Attempted to move a vertex to an already existing vertex location" << endl;
@@ -631,7 +669,7 @@ namespace dlovi {
             for (vector<Delaunay3::Cell_handle>::const_iterator it = vecConflictCells.begin(); it != vecConflictCells.end(); it++) {
                 for (set<Delaunay3CellInfo::FSConstraint, Delaunay3CellInfo::LtFSConstraint>::const_iterator itConstraint = (*it)->info().getIntersections().begin();
                      itConstraint != (*it)->info().getIntersections().end(); itConstraint++) {
-                    if (std::find(arrVertexIndices.begin(), arrVertexIndices.end(), itConstraint->second) != arrVertexIndices.end()) // linear search in std::find()
+                    if (arrIsMovedVertex[itConstraint->second])
                         setUnionedMovedConstraints.insert(*itConstraint);
                     else
                         setUnionedStationaryConstraints.insert(*itConstraint);
@@ -641,16 +679,16 @@ namespace dlovi {
             // Step 4's stuff:
             arrHndlQ[nLoop] = dt.insert_in_hole(arrPd3NewPoints[nLoop], vecConflictCells.begin(), vecConflictCells.end(), f.first, f.second);
             vecVertexHandles[arrVertexIndices[nLoop]] = arrHndlQ[nLoop];
+            hndlHint = arrHndlQ[nLoop]->cell();
         }
 
         // Step 6
         for (Delaunay3::Finite_cells_iterator itCell = dt.finite_cells_begin(); itCell != dt.finite_cells_end(); itCell++) {
             if (itCell->info().isNew())
-                setNewCells.insert(itCell);
-            // Linear search:
+                arrNewCells.push_back(itCell);
             for (set<Delaunay3CellInfo::FSConstraint, Delaunay3CellInfo::LtFSConstraint>::const_iterator itDelete = itCell->info().getIntersections().begin();
                  itDelete != itCell->info().getIntersections().end(); ) {
-                if (std::find(arrVertexIndices.begin(), arrVertexIndices.end(), itDelete->second) != arrVertexIndices.end()) { // linear search in std::find()
+                if (arrIsMovedVertex[itDelete->second]) {
                     // invalidates iterator, so careful about incrementing it:
                     set<Delaunay3CellInfo::FSConstraint, Delaunay3CellInfo::LtFSConstraint>::const_iterator itNext = itDelete;
                     itNext++;
@@ -666,19 +704,17 @@ namespace dlovi {
         // Step 7
         for (set<pair<int, int>, Delaunay3CellInfo::LtConstraint>::iterator itConstraint = setUnionedStationaryConstraints.begin();
              itConstraint != setUnionedStationaryConstraints.end(); itConstraint++) {
-            Segment QO = Segment(vecVertexHandles[itConstraint->second]->point(),
-                                 PointD3(getCamCenter(itConstraint->first)(0), getCamCenter(itConstraint->first)(1), getCamCenter(itConstraint->first)(2)));
+            Segment QO = constraintSegment(vecVertexHandles[itConstraint->second]->point(), itConstraint->first);
             markTetrahedraCrossingConstraintWithBookKeeping(dt, vecVertexHandles, vecVertexHandles[itConstraint->second], QO,
                                                             itConstraint->first, itConstraint->second, true);
         }
         for (set<pair<int, int>, Delaunay3CellInfo::LtConstraint>::iterator itConstraint = setUnionedMovedConstraints.begin();
              itConstraint != setUnionedMovedConstraints.end(); itConstraint++) {
-            Segment QO = Segment(vecVertexHandles[itConstraint->second]->point(),
-                                 PointD3(getCamCenter(itConstraint->first)(0), getCamCenter(itConstraint->first)(1), getCamCenter(itConstraint->first)(2)));
+            Segment QO = constraintSegment(vecVertexHandles[itConstraint->second]->point(), itConstraint->first);
             markTetrahedraCrossingConstraintWithBookKeeping(dt, vecVertexHandles, vecVertexHandles[itConstraint->second], QO,
                                                             itConstraint->first, itConstraint->second, false);
         }
-        for (set<Delaunay3::Cell_handle>::iterator itCell = setNewCells.begin(); itCell != setNewCells.end(); itCell++)
+        for (vector<Delaunay3::Cell_handle>::iterator itCell = arrNewCells.begin(); itCell != arrNewCells.end(); itCell++)
             (*itCell)->info().markOld();
     }
 
@@ -689,7 +725,7 @@ namespace dlovi {
         if (! dt.is_vertex(vecVertexHandles[vertexIndex]))
             return;
 
-        Segment QO = Segment(vecVertexHandles[vertexIndex]->point(), PointD3(getCamCenter(camIndex)(0), getCamCenter(camIndex)(1), getCamCenter(camIndex)(2)));
+        Segment QO = constraintSegment(vecVertexHandles[vertexIndex]->point(), camIndex);
         markTetrahedraCrossingConstraintWithBookKeeping(dt, vecVertexHandles, vecVertexHandles[vertexIndex], QO, camIndex, vertexIndex, false);
     }
 
@@ -731,6 +767,27 @@ namespace dlovi {
         // tetsToTris_naive(dt, points, tris, nVoteThresh);
     }
 
+    void FreespaceDelaunayAlgorithm::tetsToTris(const Delaunay3 & dt, const vector<Delaunay3::Vertex_handle> & vecVertexHandles, vector<Matrix> & points,
+                                                vector<int> & pointIndices, list<Matrix> & tris, const int nVoteThresh) const {
+        vector<Delaunay3::Vertex_handle> vecModelVertexHandles;
+        tetsToTris_maxFlowSimple(dt, points, tris, nVoteThresh, & vecModelVertexHandles);
+
+        // The handles of removed points are null, so each live vertex is found from the one point it holds
+        std::unordered_map<Delaunay3::Vertex_handle, int, HashVertHandle, EqVertHandle> hmapVertexHandleToPointIndex;
+        for (map<int, int>::const_iterator it = m_mapPoint_VertexHandle.begin(); it != m_mapPoint_VertexHandle.end(); it++) {
+            if (it->second >= 0 && it->second < (int) vecVertexHandles.size() && vecVertexHandles[it->second] != Delaunay3::Vertex_handle())
+                hmapVertexHandleToPointIndex[vecVertexHandles[it->second]] = it->first;
+        }
+
+        pointIndices.assign(vecModelVertexHandles.size(), -1);
+        for (int i = 0; i < (int) vecModelVertexHandles.size(); i++) {
+            std::unordered_map<Delaunay3::Vertex_handle, int, HashVertHandle, EqVertHandle>::const_iterator itIndex =
+                    hmapVertexHandleToPointIndex.find(vecModelVertexHandles[i]);
+            if (itIndex != hmapVertexHandleToPointIndex.end())
+                pointIndices[i] = itIndex->second;
+        }
+    }
+
     int FreespaceDelaunayAlgorithm::writeObj(const string filename, const vector<Matrix> & points, const list<Matrix> & tris) const {
         // TODO: handle better for invalid files (e.g. throw exception).
         ofstream outfile;
@@ -744,9 +801,9 @@ namespace dlovi {
 
         // Write out lines one by one.
         for (vector<Matrix>::const_iterator itPoints = points.begin(); itPoints != points.end(); itPoints++)
-            outfile << "v " << itPoints->at(0) << " " << itPoints->at(1) << " " << itPoints->at(2) << endl;
+            outfile << "v " << itPoints->at(0) << " " << itPoints->at(1) << " " << itPoints->at(2) << "\n";
         for (list<Matrix>::const_iterator itTris = tris.begin(); itTris != tris.end(); itTris++)
-            outfile << "f " << (round(itTris->at(0)) + 1) << " " << (round(itTris->at(1)) + 1) << " " << (round(itTris->at(2)) + 1) << endl;
+            outfile << "f " << (round(itTris->at(0)) + 1) << " " << (round(itTris->at(1)) + 1) << " " << (round(itTris->at(2)) + 1) << "\n";
 
         // Close the file and return
         outfile.close();
@@ -756,9 +813,184 @@ namespace dlovi {
     void FreespaceDelaunayAlgorithm::writeObj(ostream & outfile, const vector<Matrix> & points, const list<Matrix> & tris) const {
         // Write out lines one by one.
         for (vector<Matrix>::const_iterator itPoints = points.begin(); itPoints != points.end(); itPoints++)
-            outfile << "v " << itPoints->at(0) << " " << itPoints->at(1) << " " << itPoints->at(2) << endl;
+            outfile << "v " << itPoints->at(0) << " " << itPoints->at(1) << " " << itPoints->at(2) << "\n";
         for (list<Matrix>::const_iterator itTris = tris.begin(); itTris != tris.end(); itTris++)
-            outfile << "f " << (round(itTris->at(0)) + 1) << " " << (round(itTris->at(1)) + 1) << " " << (round(itTris->at(2)) + 1) << endl;
+            outfile << "f " << (round(itTris->at(0)) + 1) << " " << (round(itTris->at(1)) + 1) << " " << (round(itTris->at(2)) + 1) << "\n";
+    }
+
+    void FreespaceDelaunayAlgorithm::writeCheckpoint(ostream & out, const Delaunay3 & dt, const vector<Delaunay3::Vertex_handle> & vecVertexHandles) const {
+        // Checkpoint Layout:
+        // ~~~~~~~~~~~~~~~~~~~~
+        // 1: Points, cam centers, visibility lists, bounds, and the point index -> vertex index map.
+        // 2: The finite vertices of dt (bounding box corners included), numbered in iteration order.
+        // 3: vecVertexHandles, as vertex numbers (-1 for handles of removed points).
+        // 4: The cells carrying votes or FS constraints, as their 4 vertex numbers (-1 for the infinite vertex), followed by the vote
+        //    count and the constraints.  All other cells are plain old cells.
+        using namespace binaryio;
+
+        // Part 1:
+        writeVec3Array(out, m_points);
+        writeVec3Array(out, m_camCenters);
+        writeIndexLists(out, m_visibilityList);
+        write<double>(out, m_nBoundsMin);
+        write<double>(out, m_nBoundsMax);
+        write<int>(out, (int) m_mapPoint_VertexHandle.size());
+        for (map<int, int>::const_iterator it = m_mapPoint_VertexHandle.begin(); it != m_mapPoint_VertexHandle.end(); it++) {
+            write<int>(out, it->first);
+            write<int>(out, it->second);
+        }
+
+        // Part 2:
+        unordered_map<Delaunay3::Vertex_handle, int, HashVertHandle, EqVertHandle> mapVertexNumber;
+        int nVertexNumber = 0;
+        write<int>(out, (int) dt.number_of_vertices());
+        for (Delaunay3::Finite_vertices_iterator itVertex = dt.finite_vertices_begin(); itVertex != dt.finite_vertices_end(); itVertex++) {
+            mapVertexNumber[itVertex] = nVertexNumber++;
+            write<double>(out, itVertex->point().x());
+            write<double>(out, itVertex->point().y());
+            write<double>(out, itVertex->point().z());
+        }
+        mapVertexNumber[dt.infinite_vertex()] = -1;
+
+        // Part 3:
+        write<int>(out, (int) vecVertexHandles.size());
+        for (vector<Delaunay3::Vertex_handle>::const_iterator itHndl = vecVertexHandles.begin(); itHndl != vecVertexHandles.end(); itHndl++) {
+            int nNumber = -1;
+            if (*itHndl != Delaunay3::Vertex_handle()) {
+                unordered_map<Delaunay3::Vertex_handle, int, HashVertHandle, EqVertHandle>::const_iterator itNumber = mapVertexNumber.find(*itHndl);
+                if (itNumber != mapVertexNumber.end())
+                    nNumber = itNumber->second;
+            }
+            write<int>(out, nNumber);
+        }
+
+        // Part 4:
+        int nNumCells = 0;
+        for (Delaunay3::All_cells_iterator itCell = dt.all_cells_begin(); itCell != dt.all_cells_end(); itCell++) {
+            if (itCell->info().getVoteCount() != 0 || ! itCell->info().getIntersections().empty())
+                nNumCells++;
+        }
+        write<int>(out, nNumCells);
+        for (Delaunay3::All_cells_iterator itCell = dt.all_cells_begin(); itCell != dt.all_cells_end(); itCell++) {
+            if (itCell->info().getVoteCount() == 0 && itCell->info().getIntersections().empty())
+                continue;
+            for (int i = 0; i < 4; i++)
+                write<int>(out, mapVertexNumber[itCell->vertex(i)]);
+            write<int>(out, itCell->info().getVoteCount());
+            write<int>(out, (int) itCell->info().getIntersections().size());
+            for (set<Delaunay3CellInfo::FSConstraint, Delaunay3CellInfo::LtFSConstraint>::const_iterator itConstraint = itCell->info().getIntersections().begin();
+                 itConstraint != itCell->info().getIntersections().end(); itConstraint++) {
+                write<int>(out, itConstraint->first);
+                write<int>(out, itConstraint->second);
+            }
+        }
+
+        if (! out)
+            throw Exception("Could not write checkpoint.");
+    }
+
+    void FreespaceDelaunayAlgorithm::readCheckpoint(istream & in, Delaunay3 & dt, vector<Delaunay3::Vertex_handle> & vecVertexHandles) {
+        // Restoring the Triangulation:
+        // ~~~~~~~~~~~~~~~~~~~~
+        // The Delaunay triangulation of a point set is unique (CGAL breaks ties in degenerate configurations by symbolic perturbation), so
+        // re-inserting the saved vertices, in any order, gives back the same cells.  The vertices are spatially sorted and inserted with the
+        // previous vertex as the hint, and each saved cell is then found from its 4 vertices to restore its votes and FS constraints.
+        using namespace binaryio;
+        typedef CGAL::Spatial_sort_traits_adapter_3<K, CGAL::Pointer_property_map<PointD3>::type> SpatialSortTraits;
+
+        // Part 1:
+        readVec3Array(in, m_points);
+        readVec3Array(in, m_camCenters);
+        readIndexLists(in, m_visibilityList);
+        if (m_visibilityList.size() != m_camCenters.size())
+            throw Exception("Checkpoint visibility lists do not match its cameras.");
+        for (vector<vector<int> >::const_iterator itList = m_visibilityList.begin(); itList != m_visibilityList.end(); itList++) {
+            for (vector<int>::const_iterator itPoint = itList->begin(); itPoint != itList->end(); itPoint++) {
+                if (*itPoint < 0 || *itPoint >= (int) m_points.size())
+                    throw Exception("Bad point index in checkpoint.");
+            }
+        }
+        m_cams.clear();
+        m_principleRays.clear();
+        m_nBoundsMin = read<double>(in);
+        m_nBoundsMax = read<double>(in);
+        m_mapPoint_VertexHandle.clear();
+        int nMapSize = readCount(in, 2 * sizeof(int));
+        for (int i = 0; i < nMapSize; i++) {
+            int nPointIndex = read<int>(in);
+            m_mapPoint_VertexHandle[nPointIndex] = read<int>(in);
+        }
+
+        // Part 2:
+        int nNumVertices = readCount(in, 3 * sizeof(double));
+        vector<PointD3> arrPoints;
+        arrPoints.reserve(nNumVertices);
+        for (int i = 0; i < nNumVertices; i++) {
+            double x = read<double>(in);
+            double y = read<double>(in);
+            double z = read<double>(in);
+            arrPoints.push_back(PointD3(x, y, z));
+        }
+
+        vector<size_t> arrInsertionOrder(arrPoints.size());
+        for (size_t nLoop = 0; nLoop < arrInsertionOrder.size(); nLoop++)
+            arrInsertionOrder[nLoop] = nLoop;
+        CGAL::spatial_sort(arrInsertionOrder.begin(), arrInsertionOrder.end(), SpatialSortTraits(CGAL::make_property_map(arrPoints)));
+
+        dt.clear();
+        vector<Delaunay3::Vertex_handle> arrVertices(arrPoints.size());
+        Delaunay3::Cell_handle hndlHint;
+        for (vector<size_t>::const_iterator itOrder = arrInsertionOrder.begin(); itOrder != arrInsertionOrder.end(); itOrder++) {
+            arrVertices[*itOrder] = dt.insert(arrPoints[*itOrder], hndlHint);
+            hndlHint = arrVertices[*itOrder]->cell();
+        }
+        if ((int) dt.number_of_vertices() != nNumVertices)
+            throw Exception("Checkpoint vertices are not distinct.");
+
+        for (Delaunay3::All_cells_iterator itCell = dt.all_cells_begin(); itCell != dt.all_cells_end(); itCell++)
+            itCell->info().markOld();
+
+        // Part 3:
+        int nNumHandles = readCount(in, sizeof(int));
+        vecVertexHandles.assign(nNumHandles, Delaunay3::Vertex_handle());
+        for (int i = 0; i < nNumHandles; i++) {
+            int nNumber = read<int>(in);
+            if (nNumber >= nNumVertices)
+                throw Exception("Bad vertex number in checkpoint.");
+            if (nNumber >= 0)
+                vecVertexHandles[i] = arrVertices[nNumber];
+        }
+        for (map<int, int>::const_iterator it = m_mapPoint_VertexHandle.begin(); it != m_mapPoint_VertexHandle.end(); it++) {
+            if (it->first < 0 || it->first >= (int) m_points.size() || it->second < 0 || it->second >= nNumHandles)
+                throw Exception("Bad point index in checkpoint.");
+        }
+
+        // Part 4:
+        int nNumCells = readCount(in, 6 * sizeof(int));
+        for (int nLoop = 0; nLoop < nNumCells; nLoop++) {
+            Delaunay3::Vertex_handle arrCellVertices[4];
+            for (int i = 0; i < 4; i++) {
+                int nNumber = read<int>(in);
+                if (nNumber >= nNumVertices)
+                    throw Exception("Bad vertex number in checkpoint.");
+                arrCellVertices[i] = nNumber < 0 ? dt.infinite_vertex() : arrVertices[nNumber];
+            }
+
+            Delaunay3::Cell_handle hndlCell;
+            if (! dt.is_cell(arrCellVertices[0], arrCellVertices[1], arrCellVertices[2], arrCellVertices[3], hndlCell))
+                throw Exception("Checkpoint cell is missing from the rebuilt triangulation.");
+
+            hndlCell->info().setVoteCount(read<int>(in));
+            int nNumConstraints = readCount(in, 2 * sizeof(int));
+            for (int i = 0; i < nNumConstraints; i++) {
+                int nCamIndex = read<int>(in);
+                int nFeatureIndex = read<int>(in);
+                if (nCamIndex < 0 || nCamIndex >= (int) m_camCenters.size() || nFeatureIndex < 0 || nFeatureIndex >= nNumHandles ||
+                    vecVertexHandles[nFeatureIndex] == Delaunay3::Vertex_handle())
+                    throw Exception("Bad free-space constraint in checkpoint.");
+                hndlCell->info().addIntersection(nCamIndex, nFeatureIndex, vecVertexHandles, getCamCenters());
+            }
+        }
     }
 
     // Private Methods
@@ -829,19 +1061,47 @@ namespace dlovi {
         dt.insert(PointD3(nLargeNegDouble, nLargeNegDouble, nLargeNegDouble)); // - - -
     }
 
+    FreespaceDelaunayAlgorithm::Segment FreespaceDelaunayAlgorithm::constraintSegment(const PointD3 & Q, const int camIndex) const {
+        const Matrix & matO = getCamCenter(camIndex);
+        PointD3 O(matO(0), matO(1), matO(2));
+        if (! m_bClipConstraints)
+            return Segment(Q, O);
+
+        // The segment from Q towards the camera is cut where it leaves the clip box, or failing that (Q outside the box) the bounds, so
+        // that a camera far from the triangulation still casts a constraint that ends inside it.  The walk along a constraint
+        // (markTetrahedraCrossingConstraintWithBookKeeping) stops in the cell holding its end, and would run off the hull otherwise.
+        const double dInset = 1e-3 * (getBoundsMax() - getBoundsMin());
+        FixedVector3 vecMin(getBoundsMin() + dInset), vecMax(getBoundsMax() - dInset);
+        bool bQInClipBox = true;
+        for (int i = 0; i < 3; i++)
+            bQInClipBox = bQInClipBox && Q[i] >= m_vecClipMin(i) && Q[i] <= m_vecClipMax(i);
+        if (bQInClipBox) {
+            for (int i = 0; i < 3; i++) {
+                vecMin(i) = std::max(vecMin(i), m_vecClipMin(i));
+                vecMax(i) = std::min(vecMax(i), m_vecClipMax(i));
+            }
+        }
+
+        double t = 1.0;
+        for (int i = 0; i < 3; i++) {
+            const double dDelta = O[i] - Q[i];
+            if (O[i] > vecMax(i) && dDelta > 0.0)
+                t = std::min(t, (vecMax(i) - Q[i]) / dDelta);
+            else if (O[i] < vecMin(i) && dDelta < 0.0)
+                t = std::min(t, (vecMin(i) - Q[i]) / dDelta);
+        }
+        if (t >= 1.0 || t <= 0.0) // O inside, or Q already outside the bounds (a point about to be dropped as giant)
+            return Segment(Q, O);
+        return Segment(Q, PointD3(Q[0] + t * (O[0] - Q[0]), Q[1] + t * (O[1] - Q[1]), Q[2] + t * (O[2] - Q[2])));
+    }
+
     void FreespaceDelaunayAlgorithm::markTetrahedraCrossingConstraint(Delaunay3 & dt, const Delaunay3::Vertex_handle hndlQ, const Segment & constraint) const {
         Delaunay3::Cell_handle tetPrev;
         Delaunay3::Cell_handle tetCur;
         Delaunay3::Locate_type lt; int li, lj;
 
-        Matrix matQ(3, 1, 1.0);
-        Matrix matO(3, 1, 1.0);
-        matQ(0) = constraint.source().x();
-        matQ(1) = constraint.source().y();
-        matQ(2) = constraint.source().z();
-        matO(0) = constraint.target().x();
-        matO(1) = constraint.target().y();
-        matO(2) = constraint.target().z();
+        FixedVector3 matQ(constraint.source().x(), constraint.source().y(), constraint.source().z());
+        FixedVector3 matO(constraint.target().x(), constraint.target().y(), constraint.target().z());
 
         // For all tetrahedra t incident to Q:
         vector<Delaunay3::Cell_handle> vecQCells;
@@ -916,14 +1176,8 @@ namespace dlovi {
         Delaunay3::Cell_handle tetCur;
         Delaunay3::Locate_type lt; int li, lj;
 
-        Matrix matQ(3, 1);
-        Matrix matO(3, 1);
-        matQ(0) = constraint.source().x();
-        matQ(1) = constraint.source().y();
-        matQ(2) = constraint.source().z();
-        matO(0) = constraint.target().x();
-        matO(1) = constraint.target().y();
-        matO(2) = constraint.target().z();
+        FixedVector3 matQ(constraint.source().x(), constraint.source().y(), constraint.source().z());
+        FixedVector3 matO(constraint.target().x(), constraint.target().y(), constraint.target().z());
 
         // For all tetrahedra t incident to Q:
         vector<Delaunay3::Cell_handle> vecQCells;
@@ -1051,7 +1305,7 @@ namespace dlovi {
                 // We didn't find a match, so this is a new feature.  Add it to the point set and the visibility list.
                 // This involves properly deleting & staring off a connected subset of tetrahedra that violate the Delaunay constraint
                 // after the addition, while marking the new tetrahedra with the deleted tetrahedra's freespace constraints.
-                Matrix matTmpPoint = getPoint(originalIndex);
+                const Matrix & matTmpPoint = getPoint(originalIndex);
                 PointD3 pd3TmpPoint(matTmpPoint(0), matTmpPoint(1), matTmpPoint(2));
                 addNewlyObservedFeature(dt, vecVertexHandles, setUnionedConstraints, pd3TmpPoint, originalIndex);
                 localVisList.push_back((int)vecVertexHandles.size() - 1);
@@ -1078,8 +1332,7 @@ namespace dlovi {
         for (i = oldNumVertices; i < (int)vecVertexHandles.size(); i++)
             dt.incident_cells(vecVertexHandles[i], std::inserter(setNewCells, setNewCells.begin()));
         for (set<pair<int, int>, Delaunay3CellInfo::LtConstraint>::iterator itConstraint = setUnionedConstraints.begin(); itConstraint != setUnionedConstraints.end(); itConstraint++) {
-            Segment QO = Segment(vecVertexHandles[itConstraint->second]->point(),
-                                 PointD3(getCamCenter(itConstraint->first)(0), getCamCenter(itConstraint->first)(1), getCamCenter(itConstraint->first)(2)));
+            Segment QO = constraintSegment(vecVertexHandles[itConstraint->second]->point(), itConstraint->first);
             markTetrahedraCrossingConstraintWithBookKeeping(dt, vecVertexHandles, vecVertexHandles[itConstraint->second], QO, itConstraint->first, itConstraint->second, true);
         }
         for (set<Delaunay3::Cell_handle>::iterator itCell = setNewCells.begin(); itCell != setNewCells.end(); itCell++)
@@ -1130,17 +1383,8 @@ namespace dlovi {
         m_mapPoint_VertexHandle[nPointIndex] = (int)vecVertexHandles.size() - 1;
     }
 
-    bool FreespaceDelaunayAlgorithm::triangleConstraintIntersectionTest(const Delaunay3::Facet & tri, const Matrix & segSrc, const Matrix & segDest) const {
-        // A custom implementation of the ray-triangle intersection test at http://jgt.akpeters.com/papers/MollerTrumbore97/code.html
-        // Follows the back-face culling branch (ie: a triangle won't intersect the ray if the ray pierces the backside of it.)
-        Matrix edge1, edge2, tvec, pvec, qvec;
-        double det, inv_det;
-        double t, u, v;
-
-        // Get the 3 triangle vertices
-        Matrix v0(3, 1);
-        Matrix v1(3, 1);
-        Matrix v2(3, 1);
+    bool FreespaceDelaunayAlgorithm::triangleConstraintIntersectionTest(const Delaunay3::Facet & tri, const FixedVector3 & segSrc, const FixedVector3 & segDest) const {
+        bool bCrossesInteriorOfConstraint;
 
         // Note:
         // tri.first = the Cell_handle containing the triangle
@@ -1150,99 +1394,46 @@ namespace dlovi {
         // f == 1 -> (0, 2, 3)
         // f == 2 -> (3, 1, 0)
         // f == 3 -> (0, 1, 2)
+        int arrOrder[3];
         if (tri.second == 3) {
-            v0(0) = tri.first->vertex(0)->point().x(); v0(1) = tri.first->vertex(0)->point().y(); v0(2) = tri.first->vertex(0)->point().z();
-            v1(0) = tri.first->vertex(1)->point().x(); v1(1) = tri.first->vertex(1)->point().y(); v1(2) = tri.first->vertex(1)->point().z();
-            v2(0) = tri.first->vertex(2)->point().x(); v2(1) = tri.first->vertex(2)->point().y(); v2(2) = tri.first->vertex(2)->point().z();
+            arrOrder[0] = 0; arrOrder[1] = 1; arrOrder[2] = 2;
         }
         else if (tri.second == 2) {
-            v0(0) = tri.first->vertex(3)->point().x(); v0(1) = tri.first->vertex(3)->point().y(); v0(2) = tri.first->vertex(3)->point().z();
-            v1(0) = tri.first->vertex(1)->point().x(); v1(1) = tri.first->vertex(1)->point().y(); v1(2) = tri.first->vertex(1)->point().z();
-            v2(0) = tri.first->vertex(0)->point().x(); v2(1) = tri.first->vertex(0)->point().y(); v2(2) = tri.first->vertex(0)->point().z();
+            arrOrder[0] = 3; arrOrder[1] = 1; arrOrder[2] = 0;
         }
         else if (tri.second == 1) {
-            v0(0) = tri.first->vertex(0)->point().x(); v0(1) = tri.first->vertex(0)->point().y(); v0(2) = tri.first->vertex(0)->point().z();
-            v1(0) = tri.first->vertex(2)->point().x(); v1(1) = tri.first->vertex(2)->point().y(); v1(2) = tri.first->vertex(2)->point().z();
-            v2(0) = tri.first->vertex(3)->point().x(); v2(1) = tri.first->vertex(3)->point().y(); v2(2) = tri.first->vertex(3)->point().z();
+            arrOrder[0] = 0; arrOrder[1] = 2; arrOrder[2] = 3;
         }
         else if (tri.second == 0) { // f == 0
-            v0(0) = tri.first->vertex(1)->point().x(); v0(1) = tri.first->vertex(1)->point().y(); v0(2) = tri.first->vertex(1)->point().z();
-            v1(0) = tri.first->vertex(3)->point().x(); v1(1) = tri.first->vertex(3)->point().y(); v1(2) = tri.first->vertex(3)->point().z();
-            v2(0) = tri.first->vertex(2)->point().x(); v2(1) = tri.first->vertex(2)->point().y(); v2(2) = tri.first->vertex(2)->point().z();
+            arrOrder[0] = 1; arrOrder[1] = 3; arrOrder[2] = 2;
         }
         else {
             cerr << "whaomg" << endl;
-        }
-
-        // Get the constraint ray's normalized direction vector
-        Matrix dir = segDest - segSrc;
-        double dirNorm = dir.norm();
-        dir /= dirNorm;
-
-        // Find vectors for two edges sharing v0:
-        edge1 = v1 - v0;
-        edge2 = v2 - v0;
-
-        // Begin calculating determinant - also used to calculate U parameter
-        pvec = dir.cross(edge2);
-
-        // If determinant is near zero, ray lies in plane of triangle.  We do backface culling for the intersection test,
-        // so only need to check 1 halfspace
-        det = edge1.dot(pvec);
-        if (det < sqrt_eps_d)
-            return false;
-
-        // Calculate distance from v0 to ray origin
-        tvec = segSrc - v0;
-
-        // Calculate U parameter and test bounds
-        u = tvec.dot(pvec);
-        if (u < 0.0 || u > det)
             return false;
+        }
 
-        // Prepare to test V parameter
-        qvec = tvec.cross(edge1);
-
-        // Calculate V parameter and test bounds
-        v = dir.dot(qvec);
-        if (v < 0.0 || (u + v) > det)
-            return false;
-
-        // Calculate t, scale parameters, ray intersects triangle
-        t = edge2.dot(qvec);
-        inv_det = 1.0 / det;
-        t *= inv_det;
-        // u *= inv_det;
-        // v *= inv_det;
-
-        // Test if distance to plane t is too large and return false if so
-        if (t < 0.0 || t > dirNorm)
-            return false;
+        // Get the 3 triangle vertices
+        FixedVector3 v0(tri.first->vertex(arrOrder[0])->point().x(), tri.first->vertex(arrOrder[0])->point().y(), tri.first->vertex(arrOrder[0])->point().z());
+        FixedVector3 v1(tri.first->vertex(arrOrder[1])->point().x(), tri.first->vertex(arrOrder[1])->point().y(), tri.first->vertex(arrOrder[1])->point().z());
+        FixedVector3 v2(tri.first->vertex(arrOrder[2])->point().x(), tri.first->vertex(arrOrder[2])->point().y(), tri.first->vertex(arrOrder[2])->point().z());
 
-        return true;
+        return triangleConstraintIntersectionTest(bCrossesInteriorOfConstraint, v0, v1, v2, segSrc, segDest);
     }
 
-    bool FreespaceDelaunayAlgorithm::triangleConstraintIntersectionTest(bool & bCrossesInteriorOfConstraint, const vector<Matrix> & points, const Matrix & tri, const pair<Matrix, Matrix> & constraint) const {
+    bool FreespaceDelaunayAlgorithm::triangleConstraintIntersectionTest(bool & bCrossesInteriorOfConstraint, const FixedVector3 & v0, const FixedVector3 & v1, const FixedVector3 & v2,
+                                                                        const FixedVector3 & segSrc, const FixedVector3 & segDest) const {
         // A custom implementation of the ray-triangle intersection test at http://jgt.akpeters.com/papers/MollerTrumbore97/code.html
         // Follows the back-face culling branch (ie: a triangle won't intersect the ray if the ray pierces the backside of it.)
-        Matrix edge1, edge2, tvec, pvec, qvec;
+        // All temporaries are fixed-size: this runs for every facet crossed by every ray, so must not touch the heap.
+        FixedVector3 edge1, edge2, tvec, pvec, qvec;
         double det, inv_det;
         double t, u, v;
 
         // Set default for interiorOfConstraint = false return value (in the case that there is no intersection for quick returns)
         bCrossesInteriorOfConstraint = false;
 
-        // Get the two segment points:
-        const Matrix & segSrc = constraint.first;
-        const Matrix & segDest = constraint.second;
-
-        // Get the 3 triangle vertices
-        const Matrix & v0 = points[round(tri(0))];
-        const Matrix & v1 = points[round(tri(1))];
-        const Matrix & v2 = points[round(tri(2))];
-
         // Get the constraint ray's normalized direction vector
-        Matrix dir = segDest - segSrc;
+        FixedVector3 dir = segDest - segSrc;
         double dirNorm = dir.norm();
         dir /= dirNorm;
 
@@ -1291,14 +1482,11 @@ namespace dlovi {
         return true;
     }
 
-    bool FreespaceDelaunayAlgorithm::cellTraversalExitTest(int & f, const Delaunay3::Cell_handle tetCur, const Delaunay3::Cell_handle tetPrev, const Matrix & matQ,
-                                                           const Matrix & matO) const {
+    bool FreespaceDelaunayAlgorithm::cellTraversalExitTest(int & f, const Delaunay3::Cell_handle tetCur, const Delaunay3::Cell_handle tetPrev, const FixedVector3 & matQ,
+                                                           const FixedVector3 & matO) const {
         // TODO: See if we can optimize this by reuse: we use the same constraint QO in all 3 face tests.  Faces also share edges and points.
-        vector<Matrix> points;
-        Matrix tri(3, 1);
-        pair<Matrix, Matrix> constraint(matQ, matO);
+        FixedVector3 points[4];
         bool bCrossesInteriorOfConstraint;
-        Matrix tmpMat(3, 1);
 
         // Let f be the entry face's index.
         if (tetCur->neighbor(0) == tetPrev) f = 0;
@@ -1307,97 +1495,39 @@ namespace dlovi {
         else if (tetCur->neighbor(3) == tetPrev) f = 3;
 
         // Collect the tetrahedra's 4 vertices into the variable points
-        tmpMat(0) = tetCur->vertex(0)->point().x(); tmpMat(1) = tetCur->vertex(0)->point().y(); tmpMat(2) = tetCur->vertex(0)->point().z();
-        points.push_back(tmpMat);
-        tmpMat(0) = tetCur->vertex(1)->point().x(); tmpMat(1) = tetCur->vertex(1)->point().y(); tmpMat(2) = tetCur->vertex(1)->point().z();
-        points.push_back(tmpMat);
-        tmpMat(0) = tetCur->vertex(2)->point().x(); tmpMat(1) = tetCur->vertex(2)->point().y(); tmpMat(2) = tetCur->vertex(2)->point().z();
-        points.push_back(tmpMat);
-        tmpMat(0) = tetCur->vertex(3)->point().x(); tmpMat(1) = tetCur->vertex(3)->point().y(); tmpMat(2) = tetCur->vertex(3)->point().z();
-        points.push_back(tmpMat);
-
-        // Construct the indices for the triangles to test, and test them as needed.
+        for (int i = 0; i < 4; i++)
+            points[i] = FixedVector3(tetCur->vertex(i)->point().x(), tetCur->vertex(i)->point().y(), tetCur->vertex(i)->point().z());
+
+        // Test the triangles as needed.
         // We want all normals pointing inward, ie positive halfspace of a triangle contains the 4th point of the tetrahedron.  So:
         // f == 0 -> (1, 3, 2)
         // f == 1 -> (0, 2, 3)
         // f == 2 -> (3, 1, 0)
         // f == 3 -> (0, 1, 2)
-        if (f == 3) {
+        if (f != 0) {
             // Test face 0
-            tri(0) = 1; tri(1) = 3; tri(2) = 2;
-            if (triangleConstraintIntersectionTest(bCrossesInteriorOfConstraint, points, tri, constraint)) {
+            if (triangleConstraintIntersectionTest(bCrossesInteriorOfConstraint, points[1], points[3], points[2], matQ, matO)) {
                 f = 0;
                 return bCrossesInteriorOfConstraint;
             }
-            // Test face 1
-            tri(0) = 0; tri(1) = 2; tri(2) = 3;
-            if (triangleConstraintIntersectionTest(bCrossesInteriorOfConstraint, points, tri, constraint)) {
-                f = 1;
-                return bCrossesInteriorOfConstraint;
-            }
-            // Test face 2
-            tri(0) = 3; tri(1) = 1; tri(2) = 0;
-            if (triangleConstraintIntersectionTest(bCrossesInteriorOfConstraint, points, tri, constraint)) {
-                f = 2;
-                return bCrossesInteriorOfConstraint;
-            }
         }
-        else if (f == 2) {
-            // Test face 0
-            tri(0) = 1; tri(1) = 3; tri(2) = 2;
-            if (triangleConstraintIntersectionTest(bCrossesInteriorOfConstraint, points, tri, constraint)) {
-                f = 0;
-                return bCrossesInteriorOfConstraint;
-            }
+        if (f != 1) {
             // Test face 1
-            tri(0) = 0; tri(1) = 2; tri(2) = 3;
-            if (triangleConstraintIntersectionTest(bCrossesInteriorOfConstraint, points, tri, constraint)) {
+            if (triangleConstraintIntersectionTest(bCrossesInteriorOfConstraint, points[0], points[2], points[3], matQ, matO)) {
                 f = 1;
                 return bCrossesInteriorOfConstraint;
             }
-            // Test face 3
-            tri(0) = 0; tri(1) = 1; tri(2) = 2;
-            if (triangleConstraintIntersectionTest(bCrossesInteriorOfConstraint, points, tri, constraint)) {
-                f = 3;
-                return bCrossesInteriorOfConstraint;
-            }
         }
-        else if (f == 1) {
-            // Test face 0
-            tri(0) = 1; tri(1) = 3; tri(2) = 2;
-            if (triangleConstraintIntersectionTest(bCrossesInteriorOfConstraint, points, tri, constraint)) {
-                f = 0;
-                return bCrossesInteriorOfConstraint;
-            }
+        if (f != 2) {
             // Test face 2
-            tri(0) = 3; tri(1) = 1; tri(2) = 0;
-            if (triangleConstraintIntersectionTest(bCrossesInteriorOfConstraint, points, tri, constraint)) {
+            if (triangleConstraintIntersectionTest(bCrossesInteriorOfConstraint, points[3], points[1], points[0], matQ, matO)) {
                 f = 2;
                 return bCrossesInteriorOfConstraint;
             }
-            // Test face 3
-            tri(0) = 0; tri(1) = 1; tri(2) = 2;
-            if (triangleConstraintIntersectionTest(bCrossesInteriorOfConstraint, points, tri, constraint)) {
-                f = 3;
-                return bCrossesInteriorOfConstraint;
-            }
         }
-        else { // f == 0
-            // Test face 1
-            tri(0) = 0; tri(1) = 2; tri(2) = 3;
-            if (triangleConstraintIntersectionTest(bCrossesInteriorOfConstraint, points, tri, constraint)) {
-                f = 1;
-                return bCrossesInteriorOfConstraint;
-            }
-            // Test face 2
-            tri(0) = 3; tri(1) = 1; tri(2) = 0;
-            if (triangleConstraintIntersectionTest(bCrossesInteriorOfConstraint, points, tri, constraint)) {
-                f = 2;
-                return bCrossesInteriorOfConstraint;
-            }
+        if (f != 3) {
             // Test face 3
-            tri(0) = 0; tri(1) = 1; tri(2) = 2;
-            if (triangleConstraintIntersectionTest(bCrossesInteriorOfConstraint, points, tri, constraint)) {
+            if (triangleConstraintIntersectionTest(bCrossesInteriorOfConstraint, points[0], points[1], points[2], matQ, matO)) {
                 f = 3;
                 return bCrossesInteriorOfConstraint;
             }
@@ -1514,7 +1644,8 @@ namespace dlovi {
         }
     }
 
-    void FreespaceDelaunayAlgorithm::tetsToTris_maxFlowSimple(const Delaunay3 & dt, vector<Matrix> & points, list<Matrix> & tris, const int nVoteThresh) const {
+    void FreespaceDelaunayAlgorithm::tetsToTris_maxFlowSimple(const Delaunay3 & dt, vector<Matrix> & points, list<Matrix> & tris, const int nVoteThresh,
+                                                              vector<Delaunay3::Vertex_handle> * pModelVertexHandles) const {
         vector<Delaunay3::Vertex_handle> vecBoundsHandles;
         vector<Delaunay3::Vertex_handle> vecVertexHandles;
         std::unordered_map<Delaunay3::Vertex_handle, int, HashVertHandle, EqVertHandle> hmapVertexHandleToIndex;
@@ -1658,6 +1789,9 @@ namespace dlovi {
                 }
             }
         }
+
+        if (pModelVertexHandles != NULL)
+            pModelVertexHandles->swap(vecVertexHandles);
     }
 }
 
@@ -0,0 +1,526 @@
+#include "Modeler/LineMapping.h"
+
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <iostream>
+#include <unistd.h>
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include "KeyFrame.h"
+#include "MapPoint.h"
+
+/// Function prototype for DetectEdgesByED exported by EDLinesLib.a
+LS *DetectLinesByED(unsigned char *srcImg, int width, int height, int *pNoLines);
+
+namespace ORB_SLAM2 {
+
+    namespace {
+        // distance between keyframes to match, relative to the median depth of the scene
+        const float TH_KF_DIST = 0.1;
+        // distance between a supporting point and its segment, in pixels, times the square root of the median depth
+        const float TH_MP_LINE = 10.0;
+        const size_t NUM_KF_MATCH = 3;
+        const int NUM_KF_VERIFIED = 3;
+        const float TH_LS_LENGTH_SQR = 100.0;
+        const double MAX_LS_ANGLE = 60.0;
+        const float TH_MP_RATIO_DIST = 0.3;
+        const int MIN_OBSERVATIONS = 5;
+        const int NUM_POINTS_PER_LINE = 5;
+
+        std::mutex gMutexEDLines;
+
+        // distance from xy to the segment, and the position t in [0,1] of its projection on it
+        float DistanceToSegment(const cv::Point2f& xy, const cv::Point2f& start, const cv::Point2f& diff, float l2, float& t)
+        {
+            t = std::max(0.0f, std::min(1.0f, (xy - start).dot(diff) / l2));
+            cv::Point2f d = xy - (start + t * diff);
+            return std::sqrt(d.x * d.x + d.y * d.y);
+        }
+    }
+
+    LineMapping::CellGrid::CellGrid():
+            mnGridCols(0), mnGridRows(0)
+    {
+    }
+
+    void LineMapping::CellGrid::Reset(int nCols, int nRows)
+    {
+        mnGridCols = std::max(1, (nCols + CELL_SIZE - 1) / CELL_SIZE);
+        mnGridRows = std::max(1, (nRows + CELL_SIZE - 1) / CELL_SIZE);
+        mvCells.assign(mnGridCols * mnGridRows, std::vector<int>());
+    }
+
+    cv::Point LineMapping::CellGrid::GetCell(const cv::Point2f& pt) const
+    {
+        int x = (int)std::floor(pt.x / CELL_SIZE);
+        int y = (int)std::floor(pt.y / CELL_SIZE);
+        return cv::Point(std::max(0, std::min(mnGridCols - 1, x)), std::max(0, std::min(mnGridRows - 1, y)));
+    }
+
+    void LineMapping::CellGrid::GetCellsOnSegment(const cv::Point2f& start, const cv::Point2f& end, std::vector<cv::Point>& vCells) const
+    {
+        // cells crossed by the segment, walked from one cell border to the next
+        cv::Point cell = GetCell(start);
+        cv::Point cellEnd = GetCell(end);
+        vCells.push_back(cell);
+
+        const float dx = (end.x - start.x) / CELL_SIZE;
+        const float dy = (end.y - start.y) / CELL_SIZE;
+        const int stepX = dx > 0 ? 1 : -1;
+        const int stepY = dy > 0 ? 1 : -1;
+        const float inf = std::numeric_limits<float>::infinity();
+        const float tDeltaX = dx != 0 ? std::abs(1 / dx) : inf;
+        const float tDeltaY = dy != 0 ? std::abs(1 / dy) : inf;
+        const float fx = start.x / CELL_SIZE - cell.x;
+        const float fy = start.y / CELL_SIZE - cell.y;
+        float tMaxX = dx > 0 ? (1 - fx) * tDeltaX : (dx < 0 ? fx * tDeltaX : inf);
+        float tMaxY = dy > 0 ? (1 - fy) * tDeltaY : (dy < 0 ? fy * tDeltaY : inf);
+
+        int nSteps = std::abs(cellEnd.x - cell.x) + std::abs(cellEnd.y - cell.y);
+        for (int i = 0; i < nSteps; i++) {
+            if (tMaxX < tMaxY && cell.x != cellEnd.x) {
+                cell.x += stepX;
+                tMaxX += tDeltaX;
+            } else if (cell.y != cellEnd.y) {
+                cell.y += stepY;
+                tMaxY += tDeltaY;
+            } else {
+                cell.x += stepX;
+                tMaxX += tDeltaX;
+            }
+            vCells.push_back(cell);
+        }
+    }
+
+    void LineMapping::CellGrid::AddPoint(const cv::Point2f& pt, int nIndex)
+    {
+        cv::Point cell = GetCell(pt);
+        mvCells[cell.y * mnGridCols + cell.x].push_back(nIndex);
+    }
+
+    void LineMapping::CellGrid::AddSegment(const cv::Point2f& start, const cv::Point2f& end, int nIndex)
+    {
+        std::vector<cv::Point> vCells;
+        GetCellsOnSegment(start, end, vCells);
+        for (size_t i = 0; i < vCells.size(); i++)
+            mvCells[vCells[i].y * mnGridCols + vCells[i].x].push_back(nIndex);
+    }
+
+    void LineMapping::CellGrid::GetNear(const cv::Point2f& start, const cv::Point2f& end, float fRadius, std::vector<int>& vIndices) const
+    {
+        // an entry within fRadius has its closest point in a cell at most nReach cells away from one crossed by the segment
+        const int nReach = (int)(fRadius / CELL_SIZE) + 1;
+
+        std::vector<cv::Point> vCells;
+        GetCellsOnSegment(start, end, vCells);
+
+        vIndices.clear();
+        for (size_t i = 0; i < vCells.size(); i++) {
+            for (int y = std::max(0, vCells[i].y - nReach); y <= std::min(mnGridRows - 1, vCells[i].y + nReach); y++) {
+                for (int x = std::max(0, vCells[i].x - nReach); x <= std::min(mnGridCols - 1, vCells[i].x + nReach); x++) {
+                    const std::vector<int>& vCell = mvCells[y * mnGridCols + x];
+                    vIndices.insert(vIndices.end(), vCell.begin(), vCell.end());
+                }
+            }
+        }
+        std::sort(vIndices.begin(), vIndices.end());
+        vIndices.erase(std::unique(vIndices.begin(), vIndices.end()), vIndices.end());
+    }
+
+    void LineMapping::KeyFrameView::Set(KeyFrame* pKeyFrame)
+    {
+        pKF = pKeyFrame;
+        cv::Mat Tcw = pKF->GetPose();
+        for (int i = 0; i < 3; i++) {
+            for (int j = 0; j < 3; j++)
+                Rcw(i,j) = Tcw.at<float>(i,j);
+            tcw(i) = Tcw.at<float>(i,3);
+        }
+        fx = pKF->fx;
+        fy = pKF->fy;
+        cx = pKF->cx;
+        cy = pKF->cy;
+        fMinX = pKF->mnMinX;
+        fMinY = pKF->mnMinY;
+        fMaxX = pKF->mnMaxX;
+        fMaxY = pKF->mnMaxY;
+        fThreshold = TH_MP_LINE * std::sqrt(std::max(0.0f, pKF->ComputeSceneMedianDepth(2)));
+    }
+
+    bool LineMapping::KeyFrameView::Project(const cv::Vec3f& Pw, cv::Point2f& xy) const
+    {
+        cv::Vec3f Pc = Rcw * Pw + tcw;
+        if (Pc(2) <= 0)
+            return false;
+        xy.x = fx * Pc(0) / Pc(2) + cx;
+        xy.y = fy * Pc(1) / Pc(2) + cy;
+        return xy.x >= fMinX && xy.x < fMaxX && xy.y >= fMinY && xy.y < fMaxY;
+    }
+
+    LineMapping::LineMapping(size_t nThreads):
+            mpModeler(NULL), mThreadPool(nThreads), mnMaxKeyFrames(500),
+            mbResetRequested(false), mbFinishRequested(false), mbFinished(true)
+    {
+    }
+
+    void LineMapping::SetModeler(Modeler* pModeler)
+    {
+        mpModeler = pModeler;
+    }
+
+    void LineMapping::InsertKeyFrame(KeyFrame* pKF, const cv::Mat& im)
+    {
+        if (im.empty())
+            return;
+        unique_lock<mutex> lock(mMutexNewKFs);
+        mlNewKeyFrames.push_back(make_pair(pKF, im.clone()));
+    }
+
+    void LineMapping::Run()
+    {
+        mbFinished = false;
+
+        while (1) {
+            LineLoop();
+
+            ResetIfRequested();
+
+            if (CheckFinish())
+                break;
+
+            usleep(5000);
+        }
+
+        SetFinish();
+    }
+
+    std::vector<LineSegment> LineMapping::DetectLineSegments(const cv::Mat& imGray)
+    {
+        // the library wants a packed buffer it may scribble on
+        cv::Mat im = imGray.clone();
+
+        int noLines = 0;
+        LS *lines;
+        {
+            unique_lock<mutex> lock(gMutexEDLines);
+            lines = DetectLinesByED(im.data, im.cols, im.rows, &noLines);
+        }
+
+        std::vector<LineSegment> vLines;
+        vLines.reserve(noLines);
+        for (int k = 0; k < noLines; k++)
+            vLines.push_back(LineSegment(lines + k));
+
+        delete lines;
+
+        return vLines;
+    }
+
+    void LineMapping::LineLoop()
+    {
+        // pick up the keyframes logged by the modeler
+        std::vector<std::pair<KeyFrame*, cv::Mat> > vNewKeyFrames;
+        {
+            unique_lock<mutex> lock(mMutexNewKFs);
+            vNewKeyFrames.assign(mlNewKeyFrames.begin(), mlNewKeyFrames.end());
+            mlNewKeyFrames.clear();
+        }
+        if (vNewKeyFrames.empty())
+            return;
+
+        // detect the segments of each keyframe on the pool
+        std::vector<KeyFrameLines> vNewLines(vNewKeyFrames.size());
+        std::vector<cv::Mat> vGray(vNewKeyFrames.size());
+        mThreadPool.ParallelFor(vNewKeyFrames.size(), [&](size_t i)
+        {
+            if (vNewKeyFrames[i].first->isBad())
+                return;
+            cv::Mat& im = vNewKeyFrames[i].second;
+            if (im.channels() > 1)
+                cv::cvtColor(im, vGray[i], CV_RGB2GRAY);
+            else
+                vGray[i] = im;
+
+            std::vector<LineSegment> vLines = DetectLineSegments(vGray[i]);
+            KeyFrameLines& lines = vNewLines[i];
+            lines.grid.Reset(vGray[i].cols, vGray[i].rows);
+            for (size_t j = 0; j < vLines.size(); j++) {
+                cv::Point2f diff = vLines[j].mEnd - vLines[j].mStart;
+                // short segments are not matched reliably
+                if (diff.dot(diff) < TH_LS_LENGTH_SQR)
+                    continue;
+                vLines[j].mpRefKF = vNewKeyFrames[i].first;
+                lines.grid.AddSegment(vLines[j].mStart, vLines[j].mEnd, lines.vLines.size());
+                lines.vLines.push_back(vLines[j]);
+            }
+        });
+
+        for (size_t i = 0; i < vNewKeyFrames.size(); i++) {
+            if (vGray[i].empty() || mmKeyFrameLines.count(vNewKeyFrames[i].first))
+                continue;
+            mmKeyFrameLines[vNewKeyFrames[i].first] = vNewLines[i];
+            mlKeyFrameOrder.push_back(vNewKeyFrames[i].first);
+        }
+        while (mlKeyFrameOrder.size() > mnMaxKeyFrames) {
+            mmKeyFrameLines.erase(mlKeyFrameOrder.front());
+            mlKeyFrameOrder.pop_front();
+        }
+
+        // then match them against the keyframes already in, one keyframe at a time with its segments on the pool
+        for (size_t i = 0; i < vNewKeyFrames.size(); i++) {
+            KeyFrame* pKF = vNewKeyFrames[i].first;
+            std::map<KeyFrame*, KeyFrameLines>::iterator it = mmKeyFrameLines.find(pKF);
+            if (vGray[i].empty() || it == mmKeyFrameLines.end() || pKF->isBad())
+                continue;
+
+            std::vector<cv::Point3f> vPOnLine = GetPointsOnLineSegments(pKF, it->second);
+
+            if (mpModeler != NULL) {
+                mpModeler->SetImageWithLines(it->second.vLines, vGray[i]);
+                mpModeler->AddLinePoints(pKF, vPOnLine);
+            }
+        }
+    }
+
+    std::vector<cv::Point3f> LineMapping::GetPointsOnLineSegments(KeyFrame* pKF, KeyFrameLines& lines)
+    {
+        std::vector<cv::Point3f> vPOnLine;
+
+        KeyFrameView view;
+        view.Set(pKF);
+        const float medianDepth = pKF->ComputeSceneMedianDepth(2);
+        if (medianDepth <= 0)
+            return vPOnLine;
+
+        // keyframes to match with: the best covisible ones with segments, away from this one and from each other
+        std::vector<KeyFrameView> vViewMatch;
+        std::vector<KeyFrame*> vKFBestCov = pKF->GetBestCovisibilityKeyFrames(10);
+        cv::Mat Ow = pKF->GetCameraCenter();
+        std::vector<cv::Mat> vOwMatch;
+        for (size_t i = 0; i < vKFBestCov.size() && vViewMatch.size() < NUM_KF_MATCH; i++) {
+            KeyFrame* pKFCov = vKFBestCov[i];
+            if (pKFCov->isBad() || mmKeyFrameLines.count(pKFCov) == 0)
+                continue;
+            cv::Mat OwCov = pKFCov->GetCameraCenter();
+            if (cv::norm(Ow - OwCov) < TH_KF_DIST * medianDepth)
+                continue;
+            bool notNear = true;
+            for (size_t j = 0; j < vOwMatch.size(); j++) {
+                if (cv::norm(vOwMatch[j] - OwCov) < TH_KF_DIST * medianDepth)
+                    notNear = false;
+            }
+            if (!notNear)
+                continue;
+
+            KeyFrameView viewCov;
+            viewCov.Set(pKFCov);
+            vViewMatch.push_back(viewCov);
+            vOwMatch.push_back(OwCov);
+        }
+        if (vViewMatch.size() < NUM_KF_MATCH)
+            return vPOnLine;
+
+        // confident map points seen and projected in all of them
+        std::vector<MapPoint*> vpMP;
+        std::vector<cv::Vec3f> vPw;
+        std::vector<cv::Point2f> vXY;
+        std::vector<std::vector<cv::Point2f> > vvXYMatch(vViewMatch.size());
+        std::set<MapPoint*> spMPKF = pKF->GetMapPoints();
+        for (std::set<MapPoint*>::iterator it = spMPKF.begin(); it != spMPKF.end(); it++) {
+            MapPoint* pMP = *it;
+            if (pMP->isBad() || pMP->Observations() < MIN_OBSERVATIONS)
+                continue;
+            bool seenInAll = true;
+            for (size_t k = 0; k < vViewMatch.size() && seenInAll; k++)
+                seenInAll = pMP->IsInKeyFrame(vViewMatch[k].pKF);
+            if (!seenInAll)
+                continue;
+
+            cv::Vec3f Pw(pMP->GetWorldPos());
+            cv::Point2f xy;
+            if (!view.Project(Pw, xy))
+                continue;
+            std::vector<cv::Point2f> vXYPoint(vViewMatch.size());
+            bool projectedInAll = true;
+            for (size_t k = 0; k < vViewMatch.size() && projectedInAll; k++)
+                projectedInAll = vViewMatch[k].Project(Pw, vXYPoint[k]);
+            if (!projectedInAll)
+                continue;
+
+            vpMP.push_back(pMP);
+            vPw.push_back(Pw);
+            vXY.push_back(xy);
+            for (size_t k = 0; k < vViewMatch.size(); k++)
+                vvXYMatch[k].push_back(vXYPoint[k]);
+        }
+
+        std::vector<const KeyFrameLines*> vpLinesMatch;
+        for (size_t k = 0; k < vViewMatch.size(); k++)
+            vpLinesMatch.push_back(&mmKeyFrameLines[vViewMatch[k].pKF]);
+
+        CellGrid gridMP;
+        gridMP.Reset((int)view.fMaxX + 1, (int)view.fMaxY + 1);
+        for (size_t i = 0; i < vXY.size(); i++)
+            gridMP.AddPoint(vXY[i], i);
+
+        // each segment is verified on its own
+        std::vector<std::vector<cv::Point3f> > vvPOnLine(lines.vLines.size());
+        mThreadPool.ParallelFor(lines.vLines.size(), [&](size_t indexLines)
+        {
+            LineSegment& line = lines.vLines[indexLines];
+            line.mmpMPProj.clear();
+
+            // supporting points: the points near the segment, with the position of their projection along it
+            const cv::Point2f diff = line.mEnd - line.mStart;
+            const float l2 = diff.dot(diff);
+            std::vector<int> vCandidates;
+            gridMP.GetNear(line.mStart, line.mEnd, view.fThreshold, vCandidates);
+            std::vector<std::pair<int, float> > vSupport;
+            for (size_t i = 0; i < vCandidates.size(); i++) {
+                float t;
+                if (DistanceToSegment(vXY[vCandidates[i]], line.mStart, diff, l2, t) < view.fThreshold)
+                    vSupport.push_back(std::make_pair(vCandidates[i], t));
+            }
+            if (vSupport.size() < 2)
+                return;
+
+            // in each keyframe to match, the segment near the most supporting points has to be near 2 of them at least;
+            // the points it is not near are dropped
+            int verifiedKF = 0;
+            for (size_t k = 0; k < vViewMatch.size(); k++) {
+                const KeyFrameView& viewMatch = vViewMatch[k];
+                const std::vector<LineSegment>& vLSMatch = vpLinesMatch[k]->vLines;
+                const CellGrid& gridLSMatch = vpLinesMatch[k]->grid;
+
+                std::map<int, std::vector<size_t> > mSegmentSupport;
+                std::vector<int> vSegments;
+                for (size_t i = 0; i < vSupport.size(); i++) {
+                    const cv::Point2f& xy = vvXYMatch[k][vSupport[i].first];
+                    gridLSMatch.GetNear(xy, xy, viewMatch.fThreshold, vSegments);
+                    for (size_t j = 0; j < vSegments.size(); j++) {
+                        const LineSegment& lineMatch = vLSMatch[vSegments[j]];
+                        const cv::Point2f diffMatch = lineMatch.mEnd - lineMatch.mStart;
+                        float t;
+                        if (DistanceToSegment(xy, lineMatch.mStart, diffMatch, diffMatch.dot(diffMatch), t) < viewMatch.fThreshold)
+                            mSegmentSupport[vSegments[j]].push_back(i);
+                    }
+                }
+
+                const std::vector<size_t>* pBest = NULL;
+                for (std::map<int, std::vector<size_t> >::iterator it = mSegmentSupport.begin(); it != mSegmentSupport.end(); it++) {
+                    if (pBest == NULL || it->second.size() > pBest->size())
+                        pBest = &it->second;
+                }
+                if (pBest != NULL && pBest->size() >= 2) {
+                    verifiedKF++;
+                    std::vector<std::pair<int, float> > vSupportKept;
+                    for (size_t i = 0; i < pBest->size(); i++)
+                        vSupportKept.push_back(vSupport[(*pBest)[i]]);
+                    vSupport.swap(vSupportKept);
+                }
+            }
+
+            if (verifiedKF < NUM_KF_VERIFIED || vSupport.size() < 2)
+                return;
+
+            for (size_t i = 0; i < vSupport.size(); i++)
+                line.mmpMPProj[vpMP[vSupport[i].first]] = vSupport[i].second;
+
+            // interpolate between the outermost supporting points
+            size_t first = 0, last = 0;
+            for (size_t i = 1; i < vSupport.size(); i++) {
+                if (vSupport[i].second > vSupport[last].second)
+                    last = i;
+                if (vSupport[i].second < vSupport[first].second)
+                    first = i;
+            }
+            if (vSupport[last].second - vSupport[first].second <= TH_MP_RATIO_DIST)
+                return;
+
+            const cv::Vec3f& p1 = vPw[vSupport[first].first];
+            const cv::Vec3f& p2 = vPw[vSupport[last].first];
+
+            // skip lines running away from the camera, their depth is poorly constrained
+            cv::Vec3f diffC = view.Rcw * (p2 - p1);
+            double angleToCamera = cv::fastAtan2(std::abs(diffC(2)), std::sqrt(diffC(0)*diffC(0) + diffC(1)*diffC(1)));
+            if (angleToCamera > MAX_LS_ANGLE)
+                return;
+
+            const cv::Point3f start3f(p1);
+            const cv::Point3f dt(p2 - p1);
+            for (int i = 0; i < NUM_POINTS_PER_LINE; i++)
+                vvPOnLine[indexLines].push_back(start3f + (i / (float)NUM_POINTS_PER_LINE) * dt);
+        });
+
+        size_t nLines = 0;
+        for (size_t i = 0; i < vvPOnLine.size(); i++) {
+            if (vvPOnLine[i].empty())
+                continue;
+            vPOnLine.insert(vPOnLine.end(), vvPOnLine[i].begin(), vvPOnLine[i].end());
+            nLines++;
+        }
+
+        cout << vPOnLine.size() << " points are generated from " << nLines << " lines. " << lines.vLines.size()
+             << " lines are detected from keyframe with " << vpMP.size() << " tracked points." << endl;
+
+        return vPOnLine;
+    }
+
+    void LineMapping::RequestReset()
+    {
+        {
+            unique_lock<mutex> lock(mMutexReset);
+            mbResetRequested = true;
+        }
+
+        while (1) {
+            {
+                unique_lock<mutex> lock2(mMutexReset);
+                if (!mbResetRequested)
+                    break;
+            }
+            usleep(100);
+        }
+    }
+
+    void LineMapping::ResetIfRequested()
+    {
+        unique_lock<mutex> lock(mMutexReset);
+        if (mbResetRequested) {
+            // the keyframes of the old map are about to be deleted
+            {
+                unique_lock<mutex> lock2(mMutexNewKFs);
+                mlNewKeyFrames.clear();
+            }
+            mmKeyFrameLines.clear();
+            mlKeyFrameOrder.clear();
+
+            mbResetRequested = false;
+        }
+    }
+
+    void LineMapping::RequestFinish()
+    {
+        unique_lock<mutex> lock(mMutexFinish);
+        mbFinishRequested = true;
+    }
+
+    bool LineMapping::CheckFinish()
+    {
+        unique_lock<mutex> lock(mMutexFinish);
+        return mbFinishRequested;
+    }
+
+    void LineMapping::SetFinish()
+    {
+        unique_lock<mutex> lock(mMutexFinish);
+        mbFinished = true;
+    }
+
+    bool LineMapping::isFinished()
+    {
+        unique_lock<mutex> lock(mMutexFinish);
+        return mbFinished;
+    }
+}
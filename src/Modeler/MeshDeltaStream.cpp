@@ -0,0 +1,376 @@
+#ifndef __MESHDELTASTREAM_CPP
+#define __MESHDELTASTREAM_CPP
+
+#include <iostream>
+#include <set>
+#include <cmath>
+#include "Modeler/MeshDeltaStream.h"
+#include "Modeler/Exception.h"
+#include "Modeler/WireFormat.h"
+
+namespace dlovi{
+    namespace compvis{
+
+        using namespace dlovi::compvis::meshdelta;
+        using namespace dlovi::wireformat;
+
+        namespace{
+            void writeFrame(const std::string & strPayload, std::string & strFrame){
+                strFrame.clear();
+                strFrame.reserve(FRAME_HEADER_SIZE + strPayload.size());
+                putByte(strFrame, 'C');
+                putByte(strFrame, 'M');
+                putByte(strFrame, VERSION);
+                putU32(strFrame, (uint32_t)strPayload.size());
+                strFrame += strPayload;
+            }
+
+            // Rotates the vertex ids so the smallest comes first, which keeps the winding
+            std::tuple<uint32_t, uint32_t, uint32_t> triangleKey(uint32_t a, uint32_t b, uint32_t c){
+                if(a <= b && a <= c)
+                    return std::make_tuple(a, b, c);
+                if(b <= a && b <= c)
+                    return std::make_tuple(b, c, a);
+                return std::make_tuple(c, a, b);
+            }
+        }
+
+        // MeshDeltaPublisher
+
+        MeshDeltaPublisher::MeshDeltaPublisher(ByteSink * pSink){
+            try{
+                m_pSink = pSink;
+                m_bPending = false;
+                m_bSending = false;
+                m_bStop = false;
+                m_bResync = true; // the first delta is a full snapshot
+                m_nNumModelsSent = 0;
+                m_nNumModelsCoalesced = 0;
+                m_nNumBytesSent = 0;
+                m_nNextVertexId = 0;
+                m_nNextTriangleId = 0;
+                m_nSequence = 0;
+                m_thread = std::thread(&MeshDeltaPublisher::run, this);
+            }
+            catch(std::exception & ex){
+                dlovi::Exception ex2(ex.what()); ex2.tag("MeshDeltaPublisher", "MeshDeltaPublisher"); std::cerr << ex2.what() << std::endl; //ex2.raise();
+            }
+        }
+
+        MeshDeltaPublisher::~MeshDeltaPublisher(){
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_bStop = true;
+            }
+            m_condition.notify_all();
+            if(m_thread.joinable())
+                m_thread.join();
+        }
+
+        // Getters
+
+        int MeshDeltaPublisher::numModelsSent() const{
+            std::unique_lock<std::mutex> lock(m_mutex);
+            return m_nNumModelsSent;
+        }
+
+        int MeshDeltaPublisher::numModelsCoalesced() const{
+            std::unique_lock<std::mutex> lock(m_mutex);
+            return m_nNumModelsCoalesced;
+        }
+
+        size_t MeshDeltaPublisher::numBytesSent() const{
+            std::unique_lock<std::mutex> lock(m_mutex);
+            return m_nNumBytesSent;
+        }
+
+        // Public Methods
+
+        void MeshDeltaPublisher::publish(const std::vector<dlovi::Matrix> & arrPoints, const std::list<dlovi::Matrix> & lstTris,
+                                         const std::vector<long> & arrTriTextureFrames){
+            try{
+                {
+                    std::unique_lock<std::mutex> lock(m_mutex);
+                    if(m_bPending)
+                        m_nNumModelsCoalesced++; // the consumer never gets the surface that is replaced here
+                    m_objPending.arrPoints = arrPoints;
+                    m_objPending.lstTris = lstTris;
+                    m_objPending.arrTriTextureFrames = arrTriTextureFrames;
+                    m_bPending = true;
+                }
+                m_condition.notify_all();
+            }
+            catch(std::exception & ex){
+                dlovi::Exception ex2(ex.what()); ex2.tag("MeshDeltaPublisher", "publish"); std::cerr << ex2.what() << std::endl; //ex2.raise();
+            }
+        }
+
+        void MeshDeltaPublisher::requestResync(){
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_bResync = true;
+        }
+
+        void MeshDeltaPublisher::flush(){
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_condition.wait(lock, [this]{ return (! m_bPending && ! m_bSending) || m_bStop; });
+        }
+
+        // Private Methods
+
+        void MeshDeltaPublisher::run(){
+            Model objModel;
+            while(true){
+                bool bResync;
+                {
+                    std::unique_lock<std::mutex> lock(m_mutex);
+                    m_condition.wait(lock, [this]{ return m_bPending || m_bStop; });
+                    if(! m_bPending)
+                        return; // stopped, and the latest surface has been sent
+                    std::swap(objModel, m_objPending);
+                    m_bPending = false;
+                    m_bSending = true;
+                    bResync = m_bResync;
+                    m_bResync = false;
+                }
+
+                bool bSent = false;
+                std::string strPayload, strFrame;
+                try{
+                    if(bResync){
+                        // The consumer starts over from an empty mesh
+                        putByte(strPayload, MR_RESET);
+                        m_mapPosition_Vertex.clear();
+                        m_mapVertex_PositionRefs.clear();
+                        m_mapTriangles.clear();
+                    }
+                    encodeDelta(objModel, strPayload);
+                    writeFrame(strPayload, strFrame);
+                    bSent = m_pSink->write(strFrame.data(), strFrame.size());
+                }
+                catch(std::exception & ex){
+                    dlovi::Exception ex2(ex.what()); ex2.tag("MeshDeltaPublisher", "run"); std::cerr << ex2.what() << std::endl; //ex2.raise();
+                }
+
+                {
+                    std::unique_lock<std::mutex> lock(m_mutex);
+                    m_bSending = false;
+                    if(bSent){
+                        m_nNumModelsSent++;
+                        m_nNumBytesSent += strFrame.size();
+                    }
+                    else
+                        m_bResync = true; // what the consumer has is unknown now
+                }
+                m_condition.notify_all();
+            }
+        }
+
+        void MeshDeltaPublisher::encodeDelta(const Model & objModel, std::string & strPayload){
+            try{
+                // 1: Name the vertices of the new surface, adding the ones at new positions
+                std::map<std::tuple<uint32_t, uint32_t, uint32_t>, long> mapNewTriangles;
+                std::vector<long>::const_iterator itTexture = objModel.arrTriTextureFrames.begin();
+                for(std::list<dlovi::Matrix>::const_iterator itTri = objModel.lstTris.begin(); itTri != objModel.lstTris.end(); itTri++){
+                    uint32_t arrVertices[3];
+                    for(int i = 0; i < 3; i++)
+                        arrVertices[i] = addVertexRef(objModel.arrPoints[(int)round((*itTri)(i))], strPayload);
+                    long nTextureFrame = -1;
+                    if(itTexture != objModel.arrTriTextureFrames.end())
+                        nTextureFrame = *itTexture++;
+                    mapNewTriangles[triangleKey(arrVertices[0], arrVertices[1], arrVertices[2])] = nTextureFrame;
+                }
+
+                // 2: Remove the triangles that are gone (or are textured from another frame now)
+                std::set<uint32_t> setReleasedVertices;
+                for(std::map<std::tuple<uint32_t, uint32_t, uint32_t>, SentTriangle>::iterator it = m_mapTriangles.begin(); it != m_mapTriangles.end();){
+                    std::map<std::tuple<uint32_t, uint32_t, uint32_t>, long>::const_iterator itNew = mapNewTriangles.find(it->first);
+                    if(itNew != mapNewTriangles.end() && itNew->second == it->second.nTextureFrame){
+                        it++;
+                        continue;
+                    }
+                    putByte(strPayload, MR_REMOVETRIANGLE);
+                    putVarint(strPayload, it->second.nId);
+                    uint32_t arrVertices[3] = {std::get<0>(it->first), std::get<1>(it->first), std::get<2>(it->first)};
+                    for(int i = 0; i < 3; i++){
+                        if(--m_mapVertex_PositionRefs[arrVertices[i]].second == 0)
+                            setReleasedVertices.insert(arrVertices[i]);
+                    }
+                    m_mapTriangles.erase(it++);
+                }
+
+                // 3: Add the new triangles
+                for(std::map<std::tuple<uint32_t, uint32_t, uint32_t>, long>::const_iterator it = mapNewTriangles.begin(); it != mapNewTriangles.end(); it++){
+                    if(m_mapTriangles.count(it->first) > 0)
+                        continue;
+                    SentTriangle objTriangle = {m_nNextTriangleId++, it->second};
+                    m_mapTriangles[it->first] = objTriangle;
+                    putByte(strPayload, MR_ADDTRIANGLE);
+                    putVarint(strPayload, objTriangle.nId);
+                    putVarint(strPayload, std::get<0>(it->first));
+                    putVarint(strPayload, std::get<1>(it->first));
+                    putVarint(strPayload, std::get<2>(it->first));
+                    putVarint(strPayload, (uint32_t)(it->second + 1));
+                    m_mapVertex_PositionRefs[std::get<0>(it->first)].second++;
+                    m_mapVertex_PositionRefs[std::get<1>(it->first)].second++;
+                    m_mapVertex_PositionRefs[std::get<2>(it->first)].second++;
+                }
+
+                // 4: Remove the vertices no triangle uses anymore
+                for(std::set<uint32_t>::const_iterator it = setReleasedVertices.begin(); it != setReleasedVertices.end(); it++)
+                    removeVertexRef(*it, strPayload);
+
+                putByte(strPayload, MR_END);
+                putVarint(strPayload, ++m_nSequence);
+            }
+            catch(std::exception & ex){
+                dlovi::Exception ex2(ex.what()); ex2.tag("MeshDeltaPublisher", "encodeDelta"); ex2.raise();
+            }
+        }
+
+        uint32_t MeshDeltaPublisher::addVertexRef(const dlovi::Matrix & matPoint, std::string & strPayload){
+            // Only looks the vertex up (adding it if its position is new); the triangles using it count the references
+            std::tuple<double, double, double> position(matPoint(0), matPoint(1), matPoint(2));
+            std::map<std::tuple<double, double, double>, uint32_t>::const_iterator it = m_mapPosition_Vertex.find(position);
+            if(it != m_mapPosition_Vertex.end())
+                return it->second;
+
+            uint32_t nVertexId = m_nNextVertexId++;
+            m_mapPosition_Vertex[position] = nVertexId;
+            m_mapVertex_PositionRefs[nVertexId] = std::make_pair(position, 0);
+            putByte(strPayload, MR_ADDVERTEX);
+            putVarint(strPayload, nVertexId);
+            putFloat(strPayload, (float)matPoint(0));
+            putFloat(strPayload, (float)matPoint(1));
+            putFloat(strPayload, (float)matPoint(2));
+            return nVertexId;
+        }
+
+        void MeshDeltaPublisher::removeVertexRef(uint32_t nVertexId, std::string & strPayload){
+            std::unordered_map<uint32_t, std::pair<std::tuple<double, double, double>, int> >::iterator it = m_mapVertex_PositionRefs.find(nVertexId);
+            if(it == m_mapVertex_PositionRefs.end() || it->second.second > 0)
+                return; // used again by a new triangle
+            m_mapPosition_Vertex.erase(it->second.first);
+            m_mapVertex_PositionRefs.erase(it);
+            putByte(strPayload, MR_REMOVEVERTEX);
+            putVarint(strPayload, nVertexId);
+        }
+
+        // MeshDeltaDecoder
+
+        MeshDeltaDecoder::MeshDeltaDecoder(){
+            m_nNumModelsDecoded = 0;
+            m_nSequence = 0;
+        }
+
+        int MeshDeltaDecoder::numModelsDecoded() const{
+            return m_nNumModelsDecoded;
+        }
+
+        uint32_t MeshDeltaDecoder::getSequence() const{
+            return m_nSequence;
+        }
+
+        void MeshDeltaDecoder::getModel(std::vector<dlovi::Matrix> & arrPoints, std::list<dlovi::Matrix> & lstTris,
+                                        std::vector<long> * pTriTextureFrames) const{
+            try{
+                arrPoints.clear();
+                lstTris.clear();
+                if(pTriTextureFrames != NULL)
+                    pTriTextureFrames->clear();
+
+                std::unordered_map<uint32_t, int> mapVertex_Index;
+                for(std::map<uint32_t, dlovi::Matrix>::const_iterator it = m_mapVertices.begin(); it != m_mapVertices.end(); it++){
+                    mapVertex_Index[it->first] = (int)arrPoints.size();
+                    arrPoints.push_back(it->second);
+                }
+                for(std::map<uint32_t, Triangle>::const_iterator it = m_mapTriangles.begin(); it != m_mapTriangles.end(); it++){
+                    dlovi::Matrix matTri(3, 1);
+                    for(int i = 0; i < 3; i++)
+                        matTri(i) = mapVertex_Index[it->second.arrVertices[i]];
+                    lstTris.push_back(matTri);
+                    if(pTriTextureFrames != NULL)
+                        pTriTextureFrames->push_back(it->second.nTextureFrame);
+                }
+            }
+            catch(std::exception & ex){
+                dlovi::Exception ex2(ex.what()); ex2.tag("MeshDeltaDecoder", "getModel"); ex2.raise();
+            }
+        }
+
+        void MeshDeltaDecoder::feed(const char * pData, size_t nSize){
+            try{
+                m_strPending.append(pData, nSize);
+
+                size_t nPos = 0;
+                while(m_strPending.size() - nPos >= FRAME_HEADER_SIZE){
+                    const char * pFrame = m_strPending.data() + nPos;
+                    if(pFrame[0] != 'C' || pFrame[1] != 'M')
+                        throw dlovi::Exception("Bad frame magic in mesh delta stream.");
+                    if((uint8_t)pFrame[2] != VERSION)
+                        throw dlovi::Exception("Unsupported mesh delta stream version.");
+                    uint32_t nPayloadSize = WireReader(pFrame + 3, 4).getU32();
+                    if(m_strPending.size() - nPos - FRAME_HEADER_SIZE < nPayloadSize)
+                        break;
+
+                    decodePayload(pFrame + FRAME_HEADER_SIZE, nPayloadSize);
+                    nPos += FRAME_HEADER_SIZE + nPayloadSize;
+                }
+                m_strPending.erase(0, nPos);
+            }
+            catch(std::exception & ex){
+                dlovi::Exception ex2(ex.what()); ex2.tag("MeshDeltaDecoder", "feed"); ex2.raise();
+            }
+        }
+
+        void MeshDeltaDecoder::decodePayload(const char * pData, size_t nSize){
+            try{
+                WireReader objReader(pData, nSize);
+                while(! objReader.done()){
+                    switch(objReader.getByte()){
+                    case MR_RESET:
+                        m_mapVertices.clear();
+                        m_mapTriangles.clear();
+                        break;
+                    case MR_ADDVERTEX:{
+                        uint32_t nVertexId = objReader.getVarint();
+                        dlovi::Matrix matPoint(3, 1);
+                        for(int i = 0; i < 3; i++)
+                            matPoint(i) = objReader.getFloat();
+                        m_mapVertices[nVertexId] = matPoint;
+                        break;
+                    }
+                    case MR_REMOVEVERTEX:
+                        m_mapVertices.erase(objReader.getVarint());
+                        break;
+                    case MR_ADDTRIANGLE:{
+                        uint32_t nTriangleId = objReader.getVarint();
+                        Triangle objTriangle;
+                        for(int i = 0; i < 3; i++){
+                            objTriangle.arrVertices[i] = objReader.getVarint();
+                            if(m_mapVertices.count(objTriangle.arrVertices[i]) == 0)
+                                throw dlovi::Exception("Triangle uses an unknown vertex: the stream was not received from a snapshot on.");
+                        }
+                        objTriangle.nTextureFrame = (long)objReader.getVarint() - 1;
+                        m_mapTriangles[nTriangleId] = objTriangle;
+                        break;
+                    }
+                    case MR_REMOVETRIANGLE:
+                        m_mapTriangles.erase(objReader.getVarint());
+                        break;
+                    case MR_END:
+                        m_nSequence = objReader.getVarint();
+                        m_nNumModelsDecoded++;
+                        break;
+                    default:
+                        throw dlovi::Exception("Unknown record type in mesh delta stream.");
+                    }
+                }
+            }
+            catch(std::exception & ex){
+                dlovi::Exception ex2(ex.what()); ex2.tag("MeshDeltaDecoder", "decodePayload"); ex2.raise();
+            }
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,231 @@
+#ifndef __MESHWRITER_CPP
+#define __MESHWRITER_CPP
+
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <limits>
+#include <cmath>
+#include <cctype>
+#include <cstdio>
+#include "Modeler/MeshWriter.h"
+#include "Modeler/Exception.h"
+#include "Modeler/WireFormat.h"
+
+namespace dlovi{
+    namespace compvis{
+
+        using namespace dlovi::wireformat;
+
+        namespace{
+            const size_t CHUNK_SIZE = 1 << 16;
+
+            // Appends to a buffer and hands it to the stream once it is CHUNK_SIZE long
+            class ChunkWriter{
+            public:
+                ChunkWriter(std::ostream & out) : m_out(out) { m_strBuffer.reserve(CHUNK_SIZE + 64); }
+                ~ChunkWriter() { flush(); }
+
+                std::string & buffer(){
+                    if(m_strBuffer.size() >= CHUNK_SIZE)
+                        flush();
+                    return m_strBuffer;
+                }
+
+                void flush(){
+                    m_out.write(m_strBuffer.data(), m_strBuffer.size());
+                    m_strBuffer.clear();
+                }
+
+            private:
+                std::ostream & m_out;
+                std::string m_strBuffer;
+            };
+
+            inline uint32_t vertexIndex(const dlovi::Matrix & matTri, int i){
+                return (uint32_t)std::lround(matTri(i));
+            }
+
+            void padTo4(std::string & str, char c){
+                while(str.size() % 4 != 0)
+                    str.push_back(c);
+            }
+        }
+
+        MeshWriter::Format MeshWriter::formatFromFileName(const std::string & strFileName){
+            size_t nDot = strFileName.find_last_of('.');
+            if(nDot == std::string::npos)
+                return MF_OBJ;
+            std::string strExtension = strFileName.substr(nDot + 1);
+            std::transform(strExtension.begin(), strExtension.end(), strExtension.begin(), ::tolower);
+            if(strExtension == "ply")
+                return MF_PLY;
+            if(strExtension == "glb")
+                return MF_GLB;
+            return MF_OBJ;
+        }
+
+        void MeshWriter::writePly(std::ostream & out, const std::vector<dlovi::Matrix> & arrPoints, const std::list<dlovi::Matrix> & lstTris,
+                                  const std::vector<uint8_t> & arrColors){
+            bool bColors = arrColors.size() == 3 * arrPoints.size() && ! arrPoints.empty();
+
+            out << "ply\nformat binary_little_endian 1.0\ncomment CARV surface\n";
+            out << "element vertex " << arrPoints.size() << "\nproperty float x\nproperty float y\nproperty float z\n";
+            if(bColors)
+                out << "property uchar red\nproperty uchar green\nproperty uchar blue\n";
+            out << "element face " << lstTris.size() << "\nproperty list uchar int vertex_indices\nend_header\n";
+
+            ChunkWriter objWriter(out);
+            for(size_t i = 0; i < arrPoints.size(); i++){
+                std::string & strBuffer = objWriter.buffer();
+                putFloat(strBuffer, (float)arrPoints[i](0));
+                putFloat(strBuffer, (float)arrPoints[i](1));
+                putFloat(strBuffer, (float)arrPoints[i](2));
+                if(bColors){
+                    putByte(strBuffer, arrColors[3 * i]);
+                    putByte(strBuffer, arrColors[3 * i + 1]);
+                    putByte(strBuffer, arrColors[3 * i + 2]);
+                }
+            }
+            for(std::list<dlovi::Matrix>::const_iterator it = lstTris.begin(); it != lstTris.end(); it++){
+                std::string & strBuffer = objWriter.buffer();
+                putByte(strBuffer, 3);
+                putU32(strBuffer, vertexIndex(*it, 0));
+                putU32(strBuffer, vertexIndex(*it, 1));
+                putU32(strBuffer, vertexIndex(*it, 2));
+            }
+        }
+
+        void MeshWriter::writeGlb(std::ostream & out, const std::vector<dlovi::Matrix> & arrPoints, const std::list<dlovi::Matrix> & lstTris,
+                                  const std::vector<uint8_t> & arrColors){
+            // glTF accessors cannot be empty: a surface without triangles is a scene without a mesh
+            bool bMesh = ! arrPoints.empty() && ! lstTris.empty();
+            bool bColors = bMesh && arrColors.size() == 3 * arrPoints.size();
+
+            const size_t nPositionBytes = 12 * arrPoints.size();
+            const size_t nIndexBytes = 12 * lstTris.size();
+            const size_t nColorBytes = bColors ? 4 * arrPoints.size() : 0;
+            const size_t nBinBytes = bMesh ? nPositionBytes + nIndexBytes + nColorBytes : 0;
+
+            std::ostringstream ossJson;
+            ossJson << "{\"asset\":{\"version\":\"2.0\",\"generator\":\"CARV\"},\"scene\":0,";
+            if(! bMesh){
+                ossJson << "\"scenes\":[{\"nodes\":[]}]}";
+            }
+            else{
+                // POSITION needs its bounds, in the float values that are written
+                float arrMin[3], arrMax[3];
+                for(int j = 0; j < 3; j++){
+                    arrMin[j] = std::numeric_limits<float>::infinity();
+                    arrMax[j] = -std::numeric_limits<float>::infinity();
+                }
+                for(std::vector<dlovi::Matrix>::const_iterator it = arrPoints.begin(); it != arrPoints.end(); it++){
+                    for(int j = 0; j < 3; j++){
+                        arrMin[j] = std::min(arrMin[j], (float)(*it)(j));
+                        arrMax[j] = std::max(arrMax[j], (float)(*it)(j));
+                    }
+                }
+
+                ossJson << std::setprecision(9);
+                ossJson << "\"scenes\":[{\"nodes\":[0]}],\"nodes\":[{\"mesh\":0}],";
+                ossJson << "\"meshes\":[{\"primitives\":[{\"attributes\":{\"POSITION\":0" << (bColors ? ",\"COLOR_0\":2" : "")
+                        << "},\"indices\":1,\"mode\":4}]}],";
+                ossJson << "\"buffers\":[{\"byteLength\":" << nBinBytes << "}],";
+                ossJson << "\"bufferViews\":[{\"buffer\":0,\"byteOffset\":0,\"byteLength\":" << nPositionBytes << ",\"target\":34962},"
+                        << "{\"buffer\":0,\"byteOffset\":" << nPositionBytes << ",\"byteLength\":" << nIndexBytes << ",\"target\":34963}";
+                if(bColors)
+                    ossJson << ",{\"buffer\":0,\"byteOffset\":" << nPositionBytes + nIndexBytes << ",\"byteLength\":" << nColorBytes << ",\"target\":34962}";
+                ossJson << "],";
+                ossJson << "\"accessors\":[{\"bufferView\":0,\"componentType\":5126,\"count\":" << arrPoints.size() << ",\"type\":\"VEC3\","
+                        << "\"min\":[" << arrMin[0] << "," << arrMin[1] << "," << arrMin[2] << "],"
+                        << "\"max\":[" << arrMax[0] << "," << arrMax[1] << "," << arrMax[2] << "]},"
+                        << "{\"bufferView\":1,\"componentType\":5125,\"count\":" << 3 * lstTris.size() << ",\"type\":\"SCALAR\"}";
+                if(bColors)
+                    ossJson << ",{\"bufferView\":2,\"componentType\":5121,\"normalized\":true,\"count\":" << arrPoints.size() << ",\"type\":\"VEC4\"}";
+                ossJson << "]}";
+            }
+            std::string strJson = ossJson.str();
+            padTo4(strJson, ' ');
+
+            // Header, JSON chunk, BIN chunk: the lengths are known before the data is written
+            std::string strHeader;
+            const size_t nTotalBytes = 12 + 8 + strJson.size() + (bMesh ? 8 + nBinBytes : 0);
+            strHeader.append("glTF", 4);
+            putU32(strHeader, 2);
+            putU32(strHeader, (uint32_t)nTotalBytes);
+            putU32(strHeader, (uint32_t)strJson.size());
+            strHeader.append("JSON", 4);
+            out.write(strHeader.data(), strHeader.size());
+            out.write(strJson.data(), strJson.size());
+            if(! bMesh)
+                return;
+
+            ChunkWriter objWriter(out);
+            std::string & strChunkHeader = objWriter.buffer();
+            putU32(strChunkHeader, (uint32_t)nBinBytes);
+            strChunkHeader.append("BIN\0", 4);
+            for(std::vector<dlovi::Matrix>::const_iterator it = arrPoints.begin(); it != arrPoints.end(); it++){
+                std::string & strBuffer = objWriter.buffer();
+                putFloat(strBuffer, (float)(*it)(0));
+                putFloat(strBuffer, (float)(*it)(1));
+                putFloat(strBuffer, (float)(*it)(2));
+            }
+            for(std::list<dlovi::Matrix>::const_iterator it = lstTris.begin(); it != lstTris.end(); it++){
+                std::string & strBuffer = objWriter.buffer();
+                putU32(strBuffer, vertexIndex(*it, 0));
+                putU32(strBuffer, vertexIndex(*it, 1));
+                putU32(strBuffer, vertexIndex(*it, 2));
+            }
+            if(bColors){
+                for(size_t i = 0; i < arrPoints.size(); i++){
+                    std::string & strBuffer = objWriter.buffer();
+                    putByte(strBuffer, arrColors[3 * i]);
+                    putByte(strBuffer, arrColors[3 * i + 1]);
+                    putByte(strBuffer, arrColors[3 * i + 2]);
+                    putByte(strBuffer, 255);
+                }
+            }
+        }
+
+        void MeshWriter::writeObj(std::ostream & out, const std::vector<dlovi::Matrix> & arrPoints, const std::list<dlovi::Matrix> & lstTris){
+            for(std::vector<dlovi::Matrix>::const_iterator it = arrPoints.begin(); it != arrPoints.end(); it++)
+                out << "v " << (*it)(0) << " " << (*it)(1) << " " << (*it)(2) << "\n";
+            for(std::list<dlovi::Matrix>::const_iterator it = lstTris.begin(); it != lstTris.end(); it++)
+                out << "f " << vertexIndex(*it, 0) + 1 << " " << vertexIndex(*it, 1) + 1 << " " << vertexIndex(*it, 2) + 1 << "\n";
+        }
+
+        bool MeshWriter::writeFile(const std::string & strFileName, const std::vector<dlovi::Matrix> & arrPoints,
+                                   const std::list<dlovi::Matrix> & lstTris, const std::vector<uint8_t> & arrColors){
+            try{
+                std::string strTmpFileName = strFileName + ".tmp";
+                std::ofstream fileOut(strTmpFileName.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+                if(! fileOut)
+                    throw dlovi::Exception("Could not open file " + strTmpFileName);
+
+                switch(formatFromFileName(strFileName)){
+                    case MF_PLY: writePly(fileOut, arrPoints, lstTris, arrColors); break;
+                    case MF_GLB: writeGlb(fileOut, arrPoints, lstTris, arrColors); break;
+                    default: writeObj(fileOut, arrPoints, lstTris); break;
+                }
+
+                fileOut.close();
+                if(fileOut.fail()){
+                    std::remove(strTmpFileName.c_str());
+                    throw dlovi::Exception("Could not write file " + strTmpFileName);
+                }
+                if(std::rename(strTmpFileName.c_str(), strFileName.c_str()) != 0){
+                    std::remove(strTmpFileName.c_str());
+                    throw dlovi::Exception("Could not rename to " + strFileName);
+                }
+                return true;
+            }
+            catch(std::exception & ex){
+                dlovi::Exception ex2(ex.what()); ex2.tag("MeshWriter", "writeFile"); std::cerr << ex2.what() << std::endl; //ex2.raise();
+                return false;
+            }
+        }
+    }
+}
+
+#endif
@@ -4,117 +4,116 @@
 
 #include "Modeler/ModelDrawer.h"
 
+#include <cstring>
+
 namespace ORB_SLAM2
 {
-    ModelDrawer::ModelDrawer():mbModelUpdateRequested(false), mbModelUpdateDone(true)
+    ModelDrawer::ModelDrawer():mbModelUpdateRequested(false), mbModelUpdateDone(true), mbAtlasBatchesStale(false),
+                               mnMaxFrameTextures(4), mnFramePBO(0), mbFrameTexturesReset(false)
     {
     }
 
     void ModelDrawer::DrawModel(bool bRGB)
     {
-        // select 4 KFs
-        int numKFs = 1;
-        vector<pair<cv::Mat,TextureFrame>> imAndTexFrame = mpModeler->GetTextures(numKFs);
+        UpdateModel();
+
+        UploadAtlas(bRGB);
+
+        if (mbAtlasBatchesStale)
+            BuildAtlasBatches();
+
+        // the views were picked and the patches baked by the modeler, drawing is one call per atlas page
+        glEnable(GL_TEXTURE_2D);
+        glColor3f(1.0,1.0,1.0);
+
+        glEnableClientState(GL_VERTEX_ARRAY);
+        glEnableClientState(GL_NORMAL_ARRAY);
+        glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+
+        for (size_t i = 0; i < mvAtlasBatches.size() && i < mvAtlasTextures.size(); i++) {
+            AtlasBatch& batch = mvAtlasBatches[i];
+            if (batch.vVertices.empty())
+                continue;
+            glBindTexture(GL_TEXTURE_2D, mvAtlasTextures[i]);
+            glVertexPointer(3, GL_FLOAT, 0, &batch.vVertices[0]);
+            glNormalPointer(GL_FLOAT, 0, &batch.vNormals[0]);
+            glTexCoordPointer(2, GL_FLOAT, 0, &batch.vTexCoords[0]);
+            glDrawArrays(GL_TRIANGLES, 0, batch.vVertices.size() / 3);
+        }
 
-        if (imAndTexFrame.size() >= numKFs) {
-//            static unsigned int frameTex[4] = {0, 0, 0, 0};
-            static unsigned int frameTex[1] = {0};
-            if (!frameTex[0])
-                glGenTextures(numKFs, frameTex);
+        glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+        glDisableClientState(GL_NORMAL_ARRAY);
+        glDisableClientState(GL_VERTEX_ARRAY);
 
-            cv::Size imSize = imAndTexFrame[0].first.size();
+        glDisable(GL_TEXTURE_2D);
+    }
 
-            for (int i = 0; i < numKFs; i++) {
-                glBindTexture(GL_TEXTURE_2D, frameTex[i]);
+    void ModelDrawer::UploadAtlas(bool bRGB)
+    {
+        // image are saved in RGB format, grayscale images are converted
+        const GLenum format = bRGB ? GL_BGR : GL_RGB;
+
+        mpModeler->mTextureAtlas.ForEachDirtyPage([&](int nPage, const cv::Mat& im, int nRowStart, int nRowEnd)
+        {
+            while ((int)mvAtlasTextures.size() <= nPage) {
+                GLuint texture;
+                glGenTextures(1, &texture);
+                glBindTexture(GL_TEXTURE_2D, texture);
                 glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
                 glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
                 glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);
                 glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
-                // image are saved in RGB format, grayscale images are converted
-                if (bRGB) {
-                    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB,
-                                 imSize.width, imSize.height, 0,
-                                 GL_BGR,
-                                 GL_UNSIGNED_BYTE,
-                                 imAndTexFrame[i].first.data);
-                } else {
-                    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB,
-                                 imSize.width, imSize.height, 0,
-                                 GL_RGB,
-                                 GL_UNSIGNED_BYTE,
-                                 imAndTexFrame[i].first.data);
-                }
+                glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, im.cols, im.rows, 0, format, GL_UNSIGNED_BYTE, NULL);
+                mvAtlasTextures.push_back(texture);
             }
 
-            UpdateModel();
-
-            glEnable(GL_TEXTURE_2D);
-
-            glBegin(GL_TRIANGLES);
-            glColor3f(1.0,1.0,1.0);
-
-            for (list<dlovi::Matrix>::const_iterator it = GetTris().begin(); it != GetTris().end(); it++) {
-
-                dlovi::Matrix point0 = GetPoints()[(*it)(0)];
-                dlovi::Matrix point1 = GetPoints()[(*it)(1)];
-                dlovi::Matrix point2 = GetPoints()[(*it)(2)];
-
-                dlovi::Matrix edge10 = point1 - point0;
-                dlovi::Matrix edge20 = point2 - point0;
-
-                dlovi::Matrix normal = edge20.cross(edge10);
-                normal = normal / normal.norm();
-
-                glNormal3d(normal(0), normal(1), normal(2));
-
-                vector<double> dotProducts;
-                vector<int> indexTex;
-                for (int i = 0; i < numKFs; i++){
-                    cv::Mat texOrient = imAndTexFrame[i].second.GetOrientation();
-                    dlovi::Matrix orientation(3,1);
-                    orientation(0) = texOrient.at<float>(0);
-                    orientation(1) = texOrient.at<float>(1);
-                    orientation(2) = texOrient.at<float>(2);
-
-                    dotProducts.push_back(normal.dot(orientation));
-                    indexTex.push_back(i);
-                }
-
-                sort( begin(indexTex), end(indexTex),
-                      [&](int i1, int i2) { return dotProducts[i1] > dotProducts[i2]; } );
-
-                for (int i = 0; i < numKFs; i++){
-                    int indexCurr = indexTex[i];
-
-                    TextureFrame tex = imAndTexFrame[indexCurr].second;
-                    vector<float> uv0 = tex.GetTexCoordinate(point0(0),point0(1),point0(2),imSize);
-                    vector<float> uv1 = tex.GetTexCoordinate(point1(0),point1(1),point1(2),imSize);
-                    vector<float> uv2 = tex.GetTexCoordinate(point2(0),point2(1),point2(2),imSize);
-
-                    if (uv0.size() == 2 && uv1.size() == 2 && uv2.size() == 2) {
-
-                        // TODO: not the right way to do multi-texturing
-//                        glDisable(GL_TEXTURE_2D);
-//                        glEnable(GL_TEXTURE_2D);
-//                        glBindTexture(GL_TEXTURE_2D, frameTex[indexCurr]);
-
-                        glTexCoord2f(uv0[0], uv0[1]);
-                        glVertex3d(point0(0), point0(1), point0(2));
+            glBindTexture(GL_TEXTURE_2D, mvAtlasTextures[nPage]);
+            GLint nUnpackAlignment;
+            glGetIntegerv(GL_UNPACK_ALIGNMENT, &nUnpackAlignment);
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, nRowStart, im.cols, nRowEnd - nRowStart, format, GL_UNSIGNED_BYTE,
+                            im.ptr(nRowStart));
+            glPixelStorei(GL_UNPACK_ALIGNMENT, nUnpackAlignment);
+        });
+    }
 
-                        glTexCoord2f(uv1[0], uv1[1]);
-                        glVertex3d(point1(0), point1(1), point1(2));
+    void ModelDrawer::BuildAtlasBatches()
+    {
+        for (size_t i = 0; i < mvAtlasBatches.size(); i++) {
+            mvAtlasBatches[i].vVertices.clear();
+            mvAtlasBatches[i].vNormals.clear();
+            mvAtlasBatches[i].vTexCoords.clear();
+        }
 
-                        glTexCoord2f(uv2[0], uv2[1]);
-                        glVertex3d(point2(0), point2(1), point2(2));
+        size_t nTri = 0;
+        for (list<dlovi::Matrix>::const_iterator it = GetTris().begin(); it != GetTris().end() && nTri < mvTriTextures.size(); it++, nTri++) {
+            const TriangleTexture& tex = mvTriTextures[nTri];
+            // triangles no recent keyframe sees all of are left out, as before
+            if (tex.nPage < 0)
+                continue;
+            if ((int)mvAtlasBatches.size() <= tex.nPage)
+                mvAtlasBatches.resize(tex.nPage + 1);
+            AtlasBatch& batch = mvAtlasBatches[tex.nPage];
+
+            const dlovi::Matrix& point0 = GetPoints()[(*it)(0)];
+            const dlovi::Matrix& point1 = GetPoints()[(*it)(1)];
+            const dlovi::Matrix& point2 = GetPoints()[(*it)(2)];
+
+            dlovi::Matrix normal = (point2 - point0).cross(point1 - point0);
+            normal = normal / normal.norm();
 
-                        break;
-                    }
+            const dlovi::Matrix* arrPoints[3] = {&point0, &point1, &point2};
+            for (int j = 0; j < 3; j++) {
+                for (int k = 0; k < 3; k++) {
+                    batch.vVertices.push_back((*arrPoints[j])(k));
+                    batch.vNormals.push_back(normal(k));
                 }
+                batch.vTexCoords.push_back(tex.arrUV[2*j]);
+                batch.vTexCoords.push_back(tex.arrUV[2*j+1]);
             }
-            glEnd();
-
-            glDisable(GL_TEXTURE_2D);
         }
+
+        mbAtlasBatchesStale = false;
     }
 
     void ModelDrawer::DrawModelPoints()
@@ -185,32 +184,93 @@ namespace ORB_SLAM2
 
     void ModelDrawer::DrawFrame(bool bRGB)
     {
+        {
+            unique_lock<mutex> lock(mMutexFrameTextures);
+            if (mbFrameTexturesReset) {
+                for (std::map<long unsigned int, pangolin::GlTexture*>::iterator it = mmFrameTextures.begin(); it != mmFrameTextures.end(); it++)
+                    delete it->second;
+                mmFrameTextures.clear();
+                mlFrameTextureLRU.clear();
+                mbFrameTexturesReset = false;
+            }
+        }
+
         // select the last frame
-        int numKFs = 1;
-        vector<pair<cv::Mat,TextureFrame>> imAndTexFrame = mpModeler->GetTextures(numKFs);
+        long unsigned int nFrameId;
+        if (!mpModeler->GetLastTextureFrameId(nFrameId))
+            return;
 
-        if (imAndTexFrame.size() >= numKFs) {
-            glColor3f(1.0,1.0,1.0);
+        pangolin::GlTexture* pTexture = GetFrameTexture(nFrameId, bRGB);
+        if (pTexture == NULL)
+            return;
 
-            if (imAndTexFrame[0].first.empty()){
-                std::cerr << "ERROR: empty frame image" << endl;
-                return;
-            }
-            cv::Size imSize = imAndTexFrame[0].first.size();
-
-            if(bRGB) {
-                pangolin::GlTexture imageTexture(imSize.width, imSize.height, GL_RGB, false, 0, GL_BGR,
-                                                 GL_UNSIGNED_BYTE);
-                imageTexture.Upload(imAndTexFrame[0].first.data, GL_BGR, GL_UNSIGNED_BYTE);
-                imageTexture.RenderToViewportFlipY();
-            } else {
-                pangolin::GlTexture imageTexture(imSize.width, imSize.height, GL_RGB, false, 0, GL_RGB,
-                                                 GL_UNSIGNED_BYTE);
-                imageTexture.Upload(imAndTexFrame[0].first.data, GL_RGB, GL_UNSIGNED_BYTE);
-                imageTexture.RenderToViewportFlipY();
-            }
+        glColor3f(1.0,1.0,1.0);
+        pTexture->RenderToViewportFlipY();
+    }
+
+    pangolin::GlTexture* ModelDrawer::GetFrameTexture(long unsigned int nFrameId, bool bRGB)
+    {
+        std::map<long unsigned int, pangolin::GlTexture*>::iterator it = mmFrameTextures.find(nFrameId);
+        if (it != mmFrameTextures.end()) {
+            mlFrameTextureLRU.remove(nFrameId);
+            mlFrameTextureLRU.push_front(nFrameId);
+            return it->second;
+        }
 
+        cv::Mat im = mpModeler->GetFrameImage(nFrameId);
+        if (im.empty()){
+            std::cerr << "ERROR: empty frame image" << endl;
+            return NULL;
+        }
+        if (!im.isContinuous())
+            im = im.clone();
+
+        // image are saved in RGB format, grayscale images are converted
+        const GLenum format = bRGB ? GL_BGR : GL_RGB;
+        pangolin::GlTexture* pTexture = new pangolin::GlTexture(im.cols, im.rows, GL_RGB, false, 0, format,
+                                                                GL_UNSIGNED_BYTE);
+        // rows of the image are packed; the alignment the rest of the viewer expects is put back after the upload
+        GLint nUnpackAlignment;
+        glGetIntegerv(GL_UNPACK_ALIGNMENT, &nUnpackAlignment);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+#ifdef HAVE_GLES
+        pTexture->Upload(im.data, format, GL_UNSIGNED_BYTE);
+#else
+        // the draw only waits for the copy into the pixel buffer, the transfer to the texture is left to the driver
+        const size_t nBytes = im.total() * im.elemSize();
+        if (mnFramePBO == 0)
+            glGenBuffers(1, &mnFramePBO);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, mnFramePBO);
+        // a new store each time, the previous upload may still be reading the old one
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, nBytes, NULL, GL_STREAM_DRAW);
+        void* pBuffer = glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
+        if (pBuffer != NULL) {
+            memcpy(pBuffer, im.data, nBytes);
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+            pTexture->Upload(0, format, GL_UNSIGNED_BYTE); // offset in the bound buffer
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        } else {
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            pTexture->Upload(im.data, format, GL_UNSIGNED_BYTE);
         }
+#endif
+        glPixelStorei(GL_UNPACK_ALIGNMENT, nUnpackAlignment);
+
+        mmFrameTextures[nFrameId] = pTexture;
+        mlFrameTextureLRU.push_front(nFrameId);
+        while (mlFrameTextureLRU.size() > mnMaxFrameTextures) {
+            delete mmFrameTextures[mlFrameTextureLRU.back()];
+            mmFrameTextures.erase(mlFrameTextureLRU.back());
+            mlFrameTextureLRU.pop_back();
+        }
+
+        return pTexture;
+    }
+
+    void ModelDrawer::ResetFrameTextures()
+    {
+        unique_lock<mutex> lock(mMutexFrameTextures);
+        mbFrameTexturesReset = true;
     }
 
     cv::Mat ModelDrawer::DrawLines()
@@ -227,6 +287,8 @@ namespace ORB_SLAM2
 
         if(mbModelUpdateRequested && mbModelUpdateDone){
             mModel = mUpdatedModel;
+            mvTriTextures = mvUpdatedTriTextures;
+            mbAtlasBatchesStale = true;
             mbModelUpdateRequested = false;
             return;
         }
@@ -235,10 +297,12 @@ namespace ORB_SLAM2
         mbModelUpdateRequested = true; // implicitly signals SurfaceInferer thread which is polling
     }
 
-    void ModelDrawer::SetUpdatedModel(const vector<dlovi::Matrix> & modelPoints, const list<dlovi::Matrix> & modelTris)
+    void ModelDrawer::SetUpdatedModel(const vector<dlovi::Matrix> & modelPoints, const list<dlovi::Matrix> & modelTris,
+                                      const vector<TriangleTexture> & modelTriTextures)
     {
         mUpdatedModel.first = modelPoints;
         mUpdatedModel.second = modelTris;
+        mvUpdatedTriTextures = modelTriTextures;
     }
 
     vector<dlovi::Matrix> & ModelDrawer::GetPoints()
@@ -0,0 +1,124 @@
+#include "Modeler/ModelExporter.h"
+
+#include <algorithm>
+#include "Modeler/MeshWriter.h"
+
+namespace ORB_SLAM2 {
+
+    ModelExporter::ModelExporter(const std::string& strFileName, bool bRGB):
+            mstrFileName(strFileName), mbRGB(bRGB), mbPending(false), mbWriting(false), mbStop(false), mnSnapshotsWritten(0)
+    {
+        mThread = std::thread(&ModelExporter::Run, this);
+    }
+
+    ModelExporter::~ModelExporter()
+    {
+        {
+            std::unique_lock<std::mutex> lock(mMutexSnapshot);
+            mbStop = true;
+        }
+        mCondSnapshot.notify_all();
+        if (mThread.joinable())
+            mThread.join();
+    }
+
+    void ModelExporter::Snapshot(std::vector<dlovi::Matrix>& vPoints, std::list<dlovi::Matrix>& lTris,
+                                 const std::vector<std::pair<cv::Mat, TextureFrame> >& vTextures)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mMutexSnapshot);
+            mvPendingPoints.swap(vPoints);
+            mlPendingTris.swap(lTris);
+            mvPendingTextures = vTextures;
+            mbPending = true;
+        }
+        mCondSnapshot.notify_all();
+    }
+
+    void ModelExporter::Flush()
+    {
+        std::unique_lock<std::mutex> lock(mMutexSnapshot);
+        while (mbPending || mbWriting)
+            mCondSnapshot.wait(lock);
+    }
+
+    int ModelExporter::NumSnapshotsWritten()
+    {
+        std::unique_lock<std::mutex> lock(mMutexSnapshot);
+        return mnSnapshotsWritten;
+    }
+
+    const std::string& ModelExporter::GetFileName() const
+    {
+        return mstrFileName;
+    }
+
+    void ModelExporter::Run()
+    {
+        std::vector<dlovi::Matrix> vPoints;
+        std::list<dlovi::Matrix> lTris;
+        std::vector<std::pair<cv::Mat, TextureFrame> > vTextures;
+
+        while (1) {
+            {
+                std::unique_lock<std::mutex> lock(mMutexSnapshot);
+                mbWriting = false;
+                mCondSnapshot.notify_all();
+                while (!mbPending && !mbStop)
+                    mCondSnapshot.wait(lock);
+                // the pending snapshot is written before stopping
+                if (!mbPending)
+                    break;
+                vPoints.swap(mvPendingPoints);
+                lTris.swap(mlPendingTris);
+                vTextures.swap(mvPendingTextures);
+                mbPending = false;
+                mbWriting = true;
+            }
+
+            std::vector<uint8_t> vColors;
+            if (!vTextures.empty())
+                vColors = ComputeVertexColors(vPoints, vTextures, mbRGB);
+            bool bWritten = dlovi::compvis::MeshWriter::writeFile(mstrFileName, vPoints, lTris, vColors);
+
+            vPoints.clear();
+            lTris.clear();
+            vTextures.clear();
+
+            std::unique_lock<std::mutex> lock(mMutexSnapshot);
+            if (bWritten)
+                mnSnapshotsWritten++;
+        }
+    }
+
+    std::vector<uint8_t> ModelExporter::ComputeVertexColors(const std::vector<dlovi::Matrix>& vPoints,
+                                                            std::vector<std::pair<cv::Mat, TextureFrame> >& vTextures, bool bRGB)
+    {
+        std::vector<uint8_t> vColors(3 * vPoints.size(), 128);
+        const int nRed = bRGB ? 0 : 2;
+        for (size_t i = 0; i < vPoints.size(); i++) {
+            const dlovi::Matrix& point = vPoints[i];
+            for (size_t j = 0; j < vTextures.size(); j++) {
+                const cv::Mat& im = vTextures[j].first;
+                if (im.empty())
+                    continue;
+                std::vector<float> uv = vTextures[j].second.GetTexCoordinate(point(0), point(1), point(2), im.size());
+                if (uv.size() != 2)
+                    continue;
+
+                const int x = std::min((int)(uv[0] * im.cols), im.cols - 1);
+                const int y = std::min((int)(uv[1] * im.rows), im.rows - 1);
+                if (im.channels() == 3) {
+                    const cv::Vec3b& pixel = im.at<cv::Vec3b>(y, x);
+                    vColors[3*i] = pixel[nRed];
+                    vColors[3*i+1] = pixel[1];
+                    vColors[3*i+2] = pixel[2 - nRed];
+                } else {
+                    vColors[3*i] = vColors[3*i+1] = vColors[3*i+2] = im.at<uchar>(y, x);
+                }
+                break;
+            }
+        }
+        return vColors;
+    }
+}
@@ -3,35 +3,41 @@
 //
 
 #include "Modeler/Modeler.h"
+#include "Modeler/ProbabilityMapping.h"
+#include "Modeler/LineMapping.h"
 
 #include <ctime>
+#include <cmath>
 
 #include <chrono>
 
-// Header files needed by EDLines
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-#include <include/Modeler/Modeler.h>
-
-/// Function prototype for DetectEdgesByED exported by EDLinesLib.a
-LS *DetectLinesByED(unsigned char *srcImg, int width, int height, int *pNoLines);
-
 namespace ORB_SLAM2 {
 
     Modeler::Modeler(ModelDrawer* pModelDrawer):
             mbResetRequested(false), mbFinishRequested(false), mbFinished(true), mpModelDrawer(pModelDrawer),
             mnLastNumLines(2), mbFirstKeyFrame(true), mnMaxTextureQueueSize(10), mnMaxFrameQueueSize(5000),
-            mnMaxToLinesQueueSize(500)
+            mnMaxToLinesQueueSize(500), mnCheckpointInterval(200000), mnLastCheckpointLine(0),
+            mpMeshDeltaPublisher(NULL), mbMeshDeltaTextureFrames(false), mnLastPublishedModel(0),
+            mpModelExporter(NULL), mnExportKeyFrames(0), mdExportSeconds(0), mbExportColors(false),
+            mnKeyFramesSinceExport(0), mnLastExportedModel(0), mpProbabilityMapping(NULL), mpLineMapping(NULL),
+            mpMap(NULL), mnMinMapGeneration(0), mpTiledAlgInterface(NULL)
     {
         mAlgInterface.setAlgorithmRef(&mObjAlgorithm);
-        mAlgInterface.setTranscriptRef(mTranscriptInterface.getTranscriptToProcessRef());
+        // The algorithm reads the transcript in place; consumed lines are spilled to disk and released
+        mTranscriptInterface.getTranscriptRef()->setSpillFile("sfmtranscript_orbslam.spill");
+        mAlgInterface.setTranscriptRef(mTranscriptInterface.getTranscriptRef());
         mAlgInterface.rewind();
     }
 
-    void Modeler::writeToFile(const std::string & strFileName) const{
+    void Modeler::writeToFile(const std::string & strFileName){
+            // The modeler thread compacts the transcript under this lock
+            unique_lock<mutex> lock(mMutexTranscript);
             mTranscriptInterface.writeToFile(strFileName);
     }
+
+    bool Modeler::writeTexturedModel(const std::string & strPrefix){
+        return mTextureAtlas.WriteObj(strPrefix);
+    }
     
     void Modeler::SetTracker(Tracking *pTracker)
     {
@@ -48,22 +54,36 @@ namespace ORB_SLAM2 {
         mpLoopCloser = pLoopCloser;
     }
 
+    void Modeler::SetMap(Map* pMap)
+    {
+        mpMap = pMap;
+    }
+
     void Modeler::Run()
     {
         mbFinished =false;
 
         while(1) {
 
+            ProcessTranscriptEvents();
+
+            AddKeyFramePointEntries();
+
             if (CheckNewTranscriptEntry()) {
 
                 RunRemainder();
 
                 UpdateModelDrawer();
             }
-//            else {
-//
-//                AddPointsOnLineSegments();
-//            }
+            else if (mpTiledAlgInterface != NULL ? mpTiledAlgInterface->updateModel() : mAlgInterface.updateModel()) {
+                // The last group of entries was applied too soon after the previous surface extraction,
+                // extract the surface now so that the viewer gets the current model.
+                UpdateModelDrawer();
+            }
+
+            PublishMeshDelta();
+
+            ExportModel(false);
 
             ResetIfRequested();
 
@@ -93,329 +113,75 @@ namespace ORB_SLAM2 {
 //            std::cout << std::endl << "transcript saved!" << std::endl;
 //        }
 //
+        ExportModel(true);
+
         SetFinish();
 
     }
 
-    void Modeler::AddPointsOnLineSegments(){
-        KeyFrame* pKF;
-        {
-            unique_lock<mutex> lock(mMutexToLines);
-            if(mdToLinesQueue.size() > 0) {
-                pKF = mdToLinesQueue.front();
-                mdToLinesQueue.pop_front();
-            } else {
-                return;
-            }
-        }
-
-        if(pKF->isBad())
-            return;
-
-        // Avoid that a keyframe can be erased while it is being process by this thread
-        pKF->SetNotErase();
+    void Modeler::SetProbabilityMapping(ProbabilityMapping* pProbabilityMapping, bool bSemiDenseToCARV)
+    {
+        mpProbabilityMapping = pProbabilityMapping;
+        if (mpProbabilityMapping != NULL)
+            mpProbabilityMapping->SetModeler(bSemiDenseToCARV ? this : NULL);
+    }
 
-        std::vector<cv::Point3f> vPOnLine = GetPointsOnLineSegments(pKF);
+    void Modeler::AddSemiDensePoints(KeyFrame* pKF, const std::vector<cv::Point3f>& vPoints)
+    {
+        AddKeyFramePoints(pKF, vPoints);
+    }
 
-        {
-            unique_lock<mutex> lock(mMutexTranscript);
-            KeyFrame* pKFcopy = new KeyFrame(pKF);
-            mTranscriptInterface.addKeyFrameInsertionWithLinesEntry(pKF,pKFcopy,vPOnLine);
-        }
+    void Modeler::SetLineMapping(LineMapping* pLineMapping)
+    {
+        mpLineMapping = pLineMapping;
+        if (mpLineMapping != NULL)
+            mpLineMapping->SetModeler(this);
+    }
 
-        pKF->SetErase();
+    void Modeler::AddLinePoints(KeyFrame* pKF, const std::vector<cv::Point3f>& vPoints)
+    {
+        AddKeyFramePoints(pKF, vPoints);
+    }
 
+    void Modeler::SetImageWithLines(const std::vector<LineSegment>& vLines, const cv::Mat& im)
+    {
+        unique_lock<mutex> lock(mMutexLines);
+        mvLines = vLines;
+        im.copyTo(mImLines);
     }
 
-    std::vector<cv::Point3f> Modeler::GetPointsOnLineSegments(KeyFrame* pKF){
+    void Modeler::AddKeyFramePoints(KeyFrame* pKF, const std::vector<cv::Point3f>& vPoints)
+    {
+        if (vPoints.empty() || pKF->isBad())
+            return;
 
-        const double TH_KF_DIST = 0.1;
-        const double TH_MP_LINE = 10.0;
-        const int NUM_KF_MATCH = 3;
-        const int NUM_KF_VERIFIED = 3;
-        const double TH_LS_LENGTH_SQR = 100.0;
-        const double MAX_LS_ANGLE = 60.0;
-        const double TH_MP_RATIO_DIST = 0.3;
+        // The stage still holds the keyframe: what the entry needs of it is copied now
+        KeyFramePoints points;
+        points.mnKFId = pKF->mnId;
+        points.mCamCenter = cv::Point3f(pKF->GetCameraCenter());
+        points.mvPoints = vPoints;
 
-        std::vector<cv::Point3f> vPOnLine;
+        unique_lock<mutex> lock(mMutexKeyFramePoints);
+        mdKeyFramePoints.push_back(points);
+    }
 
-        cv::Mat imGray;
+    void Modeler::AddKeyFramePointEntries()
+    {
+        std::deque<KeyFramePoints> dKeyFramePoints;
         {
-            unique_lock<mutex> lock(mMutexFrame);
-            mmFrameQueue[pKF->mnFrameId].copyTo(imGray);
-        }
-
-        if(imGray.empty()){
-            cout << "Empty image to draw line!" << endl;
-            vPOnLine.clear();
-            return vPOnLine;
-        }
-
-        if (imGray.channels() > 1) // this should be always true
-            cv::cvtColor(imGray,imGray,CV_RGB2GRAY);
-
-        std::vector<LineSegment> lines = DetectLineSegments(imGray);
-
-        // save lines for future usage
-        mmpKFvLS.insert(std::map<KeyFrame*,std::vector<LineSegment>>::value_type(pKF,lines));
-
-        // get a kf to match with
-        std::vector<KeyFrame*> vpKFMatch;
-        std::vector<KeyFrame*> vKFBestCov = pKF->GetBestCovisibilityKeyFrames(10);
-        double medianDepth = pKF->ComputeSceneMedianDepth(2);
-
-        for (auto it = vKFBestCov.begin(); it != vKFBestCov.end(); it++) {
-            if ((*it)->isBad())
-                continue;
-            if (cv::norm(pKF->GetTranslation() - (*it)->GetTranslation()) < TH_KF_DIST * medianDepth)
-                continue;
-            // the kf must be in past
-            auto itFind = mmpKFvLS.find(*it);
-            if (itFind == mmpKFvLS.end())
-                continue;
-
-            bool notNear = true;
-            for (size_t indKFMatch = 0; indKFMatch < vpKFMatch.size(); indKFMatch++){
-                double distFromKF = cv::norm(vpKFMatch[indKFMatch]->GetTranslation() - (*it)->GetTranslation());
-                // make sure the kf are distant from each other
-                if (distFromKF < TH_KF_DIST * medianDepth)
-                    notNear = false;
-            }
-            if (notNear)
-                vpKFMatch.push_back(*it);
-
-            if (vpKFMatch.size() >= NUM_KF_MATCH)
-                break;
-        }
-        if (vpKFMatch.size() < NUM_KF_MATCH){
-            std::cout << "Not enough good KFs to match with!" << endl;
-            vPOnLine.clear();
-            return vPOnLine;
-        }
-
-        // MapPoints and there projection on kf
-        std::map<MapPoint*, cv::Point2f> mpMPonKF;
-
-        // common points among kfs
-        std::set<MapPoint*> spMP;
-        std::set<MapPoint*> spMPKF = pKF->GetMapPoints();
-
-        std::vector<double> vMedianDepthMatch;
-        std::vector<std::set<MapPoint*>> vspMPMatch;
-        for (size_t indKFMatch = 0; indKFMatch < vpKFMatch.size(); indKFMatch++){
-            vspMPMatch.push_back(vpKFMatch[indKFMatch]->GetMapPoints());
-            vMedianDepthMatch.push_back(vpKFMatch[indKFMatch]->ComputeSceneMedianDepth(2));
-        }
-
-        // find all matched points in two keyframes
-        for (std::set<MapPoint*>::iterator it = spMPKF.begin(); it != spMPKF.end(); it++){
-            // filter out bad map points
-            if ((*it)->isBad())
-                continue;
-            // only keep confident points
-            if ((*it)->Observations() < 5)
-                continue;
-
-            bool seemInAll = true;
-            for (size_t indKFMatch = 0; indKFMatch < vpKFMatch.size(); indKFMatch++) {
-                std::set<MapPoint *>::iterator itMatch;
-                itMatch = vspMPMatch[indKFMatch].find(*it);
-
-                if (itMatch == vspMPMatch[indKFMatch].end()) {
-                    seemInAll = false;
-                    break;
-                }
-            }
-            // if a match found
-            if (seemInAll)
-                spMP.insert(*it);
-        }
-
-        std::vector<std::map<MapPoint*, cv::Point2f>> vmpMPonKFMatch;
-        for (size_t indKFMatch = 0; indKFMatch < vpKFMatch.size(); indKFMatch++) {
-            std::map<MapPoint*, cv::Point2f> mpMPonKFMatch;
-            vmpMPonKFMatch.push_back(mpMPonKFMatch);
-        }
-
-        for (std::set<MapPoint*>::iterator it = spMP.begin(); it != spMP.end(); it++){
-            // need to test if xy > 0
-            cv::Point2f xy = pKF->ProjectPointOnCamera((*it)->GetWorldPos());
-            if(xy.x < 0 || xy.y < 0)
-                continue;
-
-            std::vector<cv::Point2f> vXYMatch;
-            for (size_t indKFMatch = 0; indKFMatch < vpKFMatch.size(); indKFMatch++) {
-                cv::Point2f xyMatch = vpKFMatch[indKFMatch]->ProjectPointOnCamera((*it)->GetWorldPos());
-                if (xyMatch.x < 0 || xyMatch.y < 0){
-                    break;
-                }
-                vXYMatch.push_back(xyMatch);
-            }
-            if (vXYMatch.size() != vpKFMatch.size())
-                continue;
-
-            mpMPonKF.insert(std::map<MapPoint*,cv::Point2f>::value_type(*it, xy));
-            for (size_t indKFMatch = 0; indKFMatch < vpKFMatch.size(); indKFMatch++) {
-                cv::Point2f xyMatch = vXYMatch[indKFMatch];
-                vmpMPonKFMatch[indKFMatch].insert(std::map<MapPoint*,cv::Point2f>::value_type(*it,xyMatch));
-            }
+            unique_lock<mutex> lock(mMutexKeyFramePoints);
+            dKeyFramePoints.swap(mdKeyFramePoints);
         }
 
-        for(size_t indexLines = 0; indexLines < lines.size(); indexLines++){
-            LineSegment& line = lines[indexLines];
-            // set reference keyframe of the line segment
-            line.mpRefKF = pKF;
-
-            // calculate distance from point to line, if small enough, assign it to the supporting point list of the line
-            cv::Point2f start = line.mStart;
-            cv::Point2f end = line.mEnd;
-            cv::Point2f diff = end - start;
-            double l2 = diff.x*diff.x + diff.y*diff.y;
-
-            // filter out short line segments
-            if (l2 < TH_LS_LENGTH_SQR)
-                continue;
-
-            for (auto it = mpMPonKF.begin(); it != mpMPonKF.end(); it++) {
-                cv::Point2f xy = it->second;
-                double dist;
-                double t = 0.0;
-                if (l2 == 0.0){
-                    dist = cv::norm(xy - start);
-                } else {
-                    t = std::max(0.0, std::min(1.0, (xy-start).dot(diff) / l2));
-                    cv::Point2f proj = start + t * diff;
-                    dist = cv::norm(xy - proj);
-                }
-                if (dist < TH_MP_LINE * std::sqrt(medianDepth)) {
-                    line.mmpMPProj.insert(std::map<MapPoint*,float>::value_type(it->first, (float)t));
-                }
-            }
-
-//            // count how many times a point is verified
-//            std::map<MapPoint*,int> mpMPSupportedAll;
-//            for (auto it = line.mmpMPProj.begin(); it != line.mmpMPProj.end(); it++) {
-//                mpMPSupportedAll.insert(std::map<MapPoint*,int>::value_type(it->first,0));
-//            }
-            // count how many times the points are verified
-            int verifiedKF = 0;
-            for (size_t indKFMatch = 0; indKFMatch < vpKFMatch.size(); indKFMatch++) {
-                std::vector<LineSegment> &vLSMatch = mmpKFvLS[vpKFMatch[indKFMatch]];
-                std::vector<MapPoint *> vMPSupported;
-                for (size_t indexLinesMatch = 0; indexLinesMatch < vLSMatch.size(); indexLinesMatch++) {
-                    LineSegment &lineMatch = vLSMatch[indexLinesMatch];
-                    cv::Point2f startMatch = lineMatch.mStart;
-                    cv::Point2f endMatch = lineMatch.mEnd;
-                    cv::Point2f diffMatch = endMatch - startMatch;
-                    double l2Match = diffMatch.x * diffMatch.x + diffMatch.y * diffMatch.y;
-                    // filter out short line segments
-                    if (l2Match < TH_LS_LENGTH_SQR)
-                        continue;
-
-                    std::vector<MapPoint *> vMP;
-                    for (auto it = line.mmpMPProj.begin(); it != line.mmpMPProj.end(); it++) {
-                        cv::Point2f xy = vmpMPonKFMatch[indKFMatch][it->first];
-                        double dist;
-                        double t = 0.0;
-                        if (l2Match == 0.0) {
-                            dist = cv::norm(xy - startMatch);
-                        } else {
-                            t = std::max(0.0, std::min(1.0, (xy - startMatch).dot(diffMatch) / l2Match));
-                            cv::Point2f proj = startMatch + t * diffMatch;
-                            dist = cv::norm(xy - proj);
-                        }
-                        if (dist < TH_MP_LINE * std::sqrt(vMedianDepthMatch[indKFMatch])) {
-                            vMP.push_back(it->first);
-                        }
-                    }
-                    if (vMP.size() > vMPSupported.size()) {
-                        vMPSupported = vMP;
-                    }
-                }
-
-                if (vMPSupported.size() >= 2) {
-                    verifiedKF++;
-//                    for (auto it = vMPSupported.begin(); it != vMPSupported.end(); it++) {
-//                        mpMPSupportedAll[*it]++;
-//                    }
-                    for (auto it = line.mmpMPProj.begin(); it != line.mmpMPProj.end(); it++){
-                        if (std::find(vMPSupported.begin(),vMPSupported.end(),it->first) == vMPSupported.end())
-                            line.mmpMPProj.erase(it);
-                    }
-                }
-            }
-
-            if (verifiedKF < NUM_KF_VERIFIED || line.mmpMPProj.size() < 2)
-                continue;
-
-            MapPoint* pMPFirst = line.mmpMPProj.begin()->first;
-            MapPoint* pMPLast = line.mmpMPProj.begin()->first;
-            double tFirst = 1.0;
-            double tLast = 0.0;
-            for (auto it = line.mmpMPProj.begin(); it != line.mmpMPProj.end(); it++){
-                if (it->second > tLast) {
-                    pMPLast = it->first;
-                    tLast = it->second;
-                }
-                if (it->second < tFirst) {
-                    pMPFirst = it->first;
-                    tFirst = it->second;
-                }
-            }
-
-            if (pMPFirst != pMPLast && tLast - tFirst > TH_MP_RATIO_DIST) {
-                //TODO: using the first and last at this time, probably change to svd
-                cv::Mat p1Mat = pMPFirst->GetWorldPos().clone();
-                cv::Mat p2Mat = pMPLast->GetWorldPos().clone();
-
-                cv::Mat p1C = pKF->TransformPointWtoC(p1Mat);
-                cv::Mat p2C = pKF->TransformPointWtoC(p2Mat);
-                cv::Mat diffC = p2C - p1C;
-                float diffx = std::abs(diffC.at<float>(0));
-                float diffy = std::abs(diffC.at<float>(1));
-                float diffz = std::abs(diffC.at<float>(2));
-                double angleToCamera = cv::fastAtan2(diffz, std::sqrt(diffx*diffx + diffy*diffy));
-                std::cout << "angle to camera on KF: " << std::to_string(angleToCamera) << std::endl;
-                if (angleToCamera > MAX_LS_ANGLE)
-                    continue;
-
-                cv::Point3f p1(p1Mat);
-                cv::Point3f p2(p2Mat);
-
-                cv::Point3f dt = p2 - p1;
-                cv::Point3f start3f = p1;
-
-                cout << "dt" << dt << endl;
-                cout << "start3f" << start3f << endl;
-
-                for (float i = 0.0; i <= 1.0; i += 0.2) {
-                    cv::Point3f currP = start3f + i * dt;
-                    cout << "currP" << currP << endl;
-                    vPOnLine.push_back(currP);
-                }
-            }
-        }
-
-        cout << vPOnLine.size() << " points are generated from " << vPOnLine.size()/5 << " lines. " << lines.size()
-             << " lines are detected from keyframe with " << spMP.size()  << " tracked points." << endl;
-
-
-        //find points that are not bad from keyframes that are not bad
-        //which are on the lines (supporting the 3d position calculation)
-        //densify by add points from lines
-
-        // maybe: remove line points from a keyframe if the keyframe is deleted
-        // maybe: remove line points if too many supporting points are deleted
-        // maybe: move line points if supporting points are moved
+        if (dKeyFramePoints.empty())
+            return;
 
-        {
-            //update lines and image to draw
-            unique_lock<mutex> lock(mMutexLines);
-            mvLines = lines;
-            imGray.copyTo(mImLines);
+        // The camera and the points only take transcript indices: no keyframe or map point is made for them
+        unique_lock<mutex> lock(mMutexTranscript);
+        for (size_t i = 0; i < dKeyFramePoints.size(); i++) {
+            const KeyFramePoints& points = dKeyFramePoints[i];
+            mTranscriptInterface.addKeyFrameInsertionWithLinesEntry(points.mnKFId, points.mCamCenter, points.mvPoints);
         }
-
-        return vPOnLine;
     }
 
 
@@ -488,7 +254,7 @@ namespace ORB_SLAM2 {
             if (imGray.channels() > 1) // this should be always true
                 cv::cvtColor(imGray, imGray, CV_RGB2GRAY);
 
-            std::vector<LineSegment> lines = DetectLineSegments(imGray);
+            std::vector<LineSegment> lines = LineMapping::DetectLineSegments(imGray);
 
             for(size_t indexLines = 0; indexLines < lines.size(); indexLines++) {
                 LineSegment &line = lines[indexLines];
@@ -1261,52 +1027,21 @@ namespace ORB_SLAM2 {
 
     }
 
-    std::vector<LineSegment> Modeler::DetectLineSegments(cv::Mat& im) {
-        int width, height;
-        unsigned char *srcImg;
-        int noLines;
-
-        width = im.size().width;
-        height = im.size().height;
-
-        // copy data to a new array
-        int nSize = width*height;
-        srcImg = new unsigned char[nSize];
-        unsigned char *pImCopy = srcImg;
-        unsigned char *pImData = im.data;
-        for (int k = 0; k < nSize; k++) {
-            *pImCopy++ = *pImData++;
-        }
-
-        LS *lines = DetectLinesByED(srcImg, width, height, &noLines);
-
-        std::vector<LineSegment> vLines;
-        for (int k = 0; k < noLines; k++) {
-            LineSegment line(lines + k);
-            vLines.push_back(line);
-        }
-
-        delete lines;
-        delete[] srcImg;
-
-        return vLines;
-    }
-
     void Modeler::UpdateModelDrawer() {
         if(mpModelDrawer->UpdateRequested() && ! mpModelDrawer->UpdateDone()) {
-            std::pair<std::vector<dlovi::Matrix>, std::list<dlovi::Matrix> > objModel = mAlgInterface.getCurrentModel();
-            mpModelDrawer->SetUpdatedModel(objModel.first, objModel.second);
+            std::pair<std::vector<dlovi::Matrix>, std::list<dlovi::Matrix> > objModel = GetCurrentModel();
+            std::vector<TriangleTexture> vTriTextures = mTextureAtlas.Bake(objModel.first, GetCurrentModelPointIndices(), objModel.second);
+            mpModelDrawer->SetUpdatedModel(objModel.first, objModel.second, vTriTextures);
             mpModelDrawer->MarkUpdateDone();
         }
     }
 
     bool Modeler::CheckNewTranscriptEntry()
     {
-        unique_lock<mutex> lock(mMutexTranscript);
+        // The line count is published after the lines are written, no lock and no copy needed
         int numLines = mTranscriptInterface.getTranscriptRef()->numLines();
         if (numLines > mnLastNumLines) {
             mnLastNumLines = numLines;
-            mTranscriptInterface.UpdateTranscriptToProcess();
             return true;
         } else {
             return false;
@@ -1315,56 +1050,403 @@ namespace ORB_SLAM2 {
 
     void Modeler::RunRemainder()
     {
-        mAlgInterface.runRemainder();
+        if (mpTiledAlgInterface != NULL)
+            mpTiledAlgInterface->runRemainder();
+        else
+            mAlgInterface.runRemainder();
+
+        // Give back the chunks of lines the algorithm is done with
+        dlovi::compvis::SFMTranscript* pTranscript = mTranscriptInterface.getTranscriptRef();
+        int nStepLine;
+        {
+            unique_lock<mutex> lock(mMutexTranscript);
+            nStepLine = pTranscript->getStepLineIndex();
+            pTranscript->releaseLinesBefore(nStepLine);
+        }
+        // The tiles keep no checkpoint for the transcript to be compacted against
+        if (mpTiledAlgInterface != NULL || nStepLine - mnLastCheckpointLine < mnCheckpointInterval)
+            return;
+
+        // The checkpoint and the saved transcript are written outside the lock: only this thread changes the lines, and the
+        // viewer only needs the lock held while compaction frees them
+        if (!mAlgInterface.writeCheckpoint("sfmtranscript_orbslam.ckpt"))
+            return;
+        mnLastCheckpointLine = nStepLine;
+        {
+            // Everything up to here is covered by the checkpoint from now on: the saved transcript only keeps the lines after it
+            unique_lock<mutex> lock(mMutexTranscript);
+            pTranscript->compactBefore(mnLastCheckpointLine);
+        }
+        // The saved transcript is replaced right away, so that the pair on disk starts at the same line
+        mTranscriptInterface.writeToFile("sfmtranscript_orbslam.txt");
     }
 
-    void Modeler::AddKeyFrameEntry(KeyFrame* pKF){
-        if(pKF->isBad())
+    void Modeler::SetMinVertexDisplacement(double dDepthFraction)
+    {
+        mAlgInterface.setMinVertexDisplacement(dDepthFraction);
+        if (mpTiledAlgInterface != NULL)
+            mpTiledAlgInterface->setMinVertexDisplacement(dDepthFraction);
+    }
+
+    void Modeler::SetBundleAdjustmentMoveThreshold(float fDepthFraction)
+    {
+        mTranscriptInterface.setBundleAdjustmentMoveThreshold(fDepthFraction);
+    }
+
+    void Modeler::SetWindowRadius(double dRadius)
+    {
+        mAlgInterface.setWindowRadius(dRadius);
+    }
+
+    void Modeler::SetTiling(double dTileSize, size_t nThreads)
+    {
+        delete mpTiledAlgInterface;
+        mpTiledAlgInterface = NULL;
+        if (dTileSize <= 0)
             return;
+        mpTiledAlgInterface = new SFMTranscriptInterface_TiledDelaunay(mTranscriptInterface.getTranscriptRef(), nThreads);
+        mpTiledAlgInterface->setTileSize(dTileSize);
+        mpTiledAlgInterface->setMinVertexDisplacement(mAlgInterface.getMinVertexDisplacement());
+        mpTiledAlgInterface->rewind();
+    }
 
-        // Avoid that a keyframe can be erased while it is being process by this thread
-        pKF->SetNotErase();
+    std::pair<std::vector<dlovi::Matrix>, std::list<dlovi::Matrix> > Modeler::GetCurrentModel() const
+    {
+        if (mpTiledAlgInterface != NULL)
+            return mpTiledAlgInterface->getCurrentModel();
+
+        // The surface frozen outside the sliding window (SetWindowRadius) is shown after the live one
+        std::pair<std::vector<dlovi::Matrix>, std::list<dlovi::Matrix> > objModel = mAlgInterface.getCurrentModel();
+        std::pair<std::vector<dlovi::Matrix>, std::list<dlovi::Matrix> > objFrozen = mAlgInterface.getFrozenModel();
+        double dOffset = (double)objModel.first.size();
+        objModel.first.insert(objModel.first.end(), objFrozen.first.begin(), objFrozen.first.end());
+        for (std::list<dlovi::Matrix>::const_iterator itTri = objFrozen.second.begin(); itTri != objFrozen.second.end(); itTri++) {
+            dlovi::Matrix matTri(3, 1);
+            for (int i = 0; i < 3; i++)
+                matTri(i) = itTri->at(i) + dOffset;
+            objModel.second.push_back(matTri);
+        }
+        return objModel;
+    }
 
-        if (mbFirstKeyFrame) {
-            unique_lock<mutex> lock(mMutexTranscript);
-            mTranscriptInterface.addFirstKeyFrameInsertionEntry(pKF);
-            mbFirstKeyFrame = false;
-        } else {
+    std::vector<int> Modeler::GetCurrentModelPointIndices() const
+    {
+        if (mpTiledAlgInterface != NULL)
+            return mpTiledAlgInterface->getCurrentModelPointIndices();
+
+        // Frozen points (see GetCurrentModel) have left the map: they get no point index, and their triangles no texture
+        std::vector<int> vnPointIndices = mAlgInterface.getCurrentModelPointIndices();
+        vnPointIndices.resize(vnPointIndices.size() + mAlgInterface.getFrozenModel().first.size(), -1);
+        return vnPointIndices;
+    }
+
+    int Modeler::NumModelUpdates() const
+    {
+        return mpTiledAlgInterface != NULL ? mpTiledAlgInterface->numModelUpdates() : mAlgInterface.numModelUpdates();
+    }
+
+    void Modeler::SetMeshDeltaSink(dlovi::compvis::ByteSink* pSink, bool bTextureFrames)
+    {
+        unique_lock<mutex> lock(mMutexMeshDelta);
+        // Deleting the publisher sends the surface it holds before it returns
+        delete mpMeshDeltaPublisher;
+        mpMeshDeltaPublisher = NULL;
+        if (pSink != NULL)
+            mpMeshDeltaPublisher = new dlovi::compvis::MeshDeltaPublisher(pSink);
+        mbMeshDeltaTextureFrames = bTextureFrames;
+        mnLastPublishedModel = 0;
+    }
+
+    void Modeler::PublishMeshDelta()
+    {
+        unique_lock<mutex> lock(mMutexMeshDelta);
+        if (mpMeshDeltaPublisher == NULL || NumModelUpdates() == mnLastPublishedModel)
+            return;
+        mnLastPublishedModel = NumModelUpdates();
+
+        // Only hands the surface over: diffing and sending happen on the publisher's thread, which coalesces the surfaces
+        // a slow consumer could not take in time
+        std::pair<std::vector<dlovi::Matrix>, std::list<dlovi::Matrix> > objModel = GetCurrentModel();
+        if (mbMeshDeltaTextureFrames)
+            mpMeshDeltaPublisher->publish(objModel.first, objModel.second, ComputeTriangleTextureFrames(objModel.first, objModel.second));
+        else
+            mpMeshDeltaPublisher->publish(objModel.first, objModel.second);
+    }
+
+    void Modeler::SetModelExport(const std::string& strFileName, int nKeyFrames, double dSeconds, bool bColors, bool bRGB)
+    {
+        unique_lock<mutex> lock(mMutexModelExport);
+        // Deleting the exporter writes the snapshot it holds before it returns
+        delete mpModelExporter;
+        mpModelExporter = NULL;
+        if (!strFileName.empty())
+            mpModelExporter = new ModelExporter(strFileName, bRGB);
+        mnExportKeyFrames = nKeyFrames;
+        mdExportSeconds = dSeconds;
+        mbExportColors = bColors;
+        mnKeyFramesSinceExport = 0;
+        mLastExportTime = std::chrono::steady_clock::now();
+        mnLastExportedModel = 0;
+    }
+
+    void Modeler::ExportModel(bool bFinal)
+    {
+        unique_lock<mutex> lock(mMutexModelExport);
+        if (mpModelExporter == NULL || NumModelUpdates() == mnLastExportedModel)
+            return;
+
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        if (!bFinal) {
+            bool bKeyFramesDue = mnExportKeyFrames > 0 && mnKeyFramesSinceExport >= mnExportKeyFrames;
+            bool bTimeDue = mdExportSeconds > 0 &&
+                            std::chrono::duration<double>(now - mLastExportTime).count() >= mdExportSeconds;
+            if (!bKeyFramesDue && !bTimeDue)
+                return;
+        }
+        mnLastExportedModel = NumModelUpdates();
+        mnKeyFramesSinceExport = 0;
+        mLastExportTime = now;
+
+        // Only hands the surface over: colouring and writing happen on the exporter's thread, which skips the snapshots
+        // the disk could not take in time
+        std::pair<std::vector<dlovi::Matrix>, std::list<dlovi::Matrix> > objModel = GetCurrentModel();
+        std::vector<pair<cv::Mat,TextureFrame>> vTextures;
+        if (mbExportColors)
+            vTextures = GetTextures(mnMaxTextureQueueSize);
+        mpModelExporter->Snapshot(objModel.first, objModel.second, vTextures);
+
+        if (bFinal) {
+            mpModelExporter->Flush();
+            std::cout << "Surface saved to " << mpModelExporter->GetFileName() << std::endl;
+        }
+    }
+
+    std::vector<long> Modeler::ComputeTriangleTextureFrames(const std::vector<dlovi::Matrix>& vPoints, const std::list<dlovi::Matrix>& lTris)
+    {
+        std::vector<TextureFrame> vTexFrames;
+        {
+            unique_lock<mutex> lock(mMutexTexture);
+            vTexFrames.assign(mdTextureQueue.begin(), mdTextureQueue.end());
+        }
+        std::vector<dlovi::Matrix> vOrientations;
+        for (size_t i = 0; i < vTexFrames.size(); i++) {
+            cv::Mat texOrient = vTexFrames[i].GetOrientation();
+            dlovi::Matrix orientation(3,1);
+            orientation(0) = texOrient.at<float>(0);
+            orientation(1) = texOrient.at<float>(1);
+            orientation(2) = texOrient.at<float>(2);
+            vOrientations.push_back(orientation);
+        }
+
+        // Same choice as ModelDrawer::DrawModel: the frame facing the triangle most that sees all of its vertices
+        std::vector<long> vTriTexFrames;
+        vTriTexFrames.reserve(lTris.size());
+        for (list<dlovi::Matrix>::const_iterator it = lTris.begin(); it != lTris.end(); it++) {
+            const dlovi::Matrix& point0 = vPoints[std::lround((*it)(0))];
+            const dlovi::Matrix& point1 = vPoints[std::lround((*it)(1))];
+            const dlovi::Matrix& point2 = vPoints[std::lround((*it)(2))];
+
+            dlovi::Matrix normal = (point2 - point0).cross(point1 - point0);
+            normal = normal / normal.norm();
+
+            long nBestFrame = -1;
+            double dBestDot = -std::numeric_limits<double>::infinity();
+            for (size_t i = 0; i < vTexFrames.size(); i++) {
+                double dDot = normal.dot(vOrientations[i]);
+                if (dDot <= dBestDot)
+                    continue;
+                if (vTexFrames[i].GetTexCoordinate(point0(0), point0(1), point0(2)).size() == 2 &&
+                    vTexFrames[i].GetTexCoordinate(point1(0), point1(1), point1(2)).size() == 2 &&
+                    vTexFrames[i].GetTexCoordinate(point2(0), point2(1), point2(2)).size() == 2) {
+                    nBestFrame = (long)vTexFrames[i].mFrameID;
+                    dBestDot = dDot;
+                }
+            }
+            vTriTexFrames.push_back(nBestFrame);
+        }
+        return vTriTexFrames;
+    }
+
+    void Modeler::ProcessTranscriptEvents()
+    {
+        // What a record logs, read from the keyframes and points here rather than by the thread that reported it
+        struct LogRecord {
+            TranscriptEvent mEvent;
+            KeyFrameSnapshot mKFSnapshot;
+            AdjustmentSnapshot mAdjustment;
+        };
+
+        // The snapshots are taken outside the transcript lock, so that its readers do not wait on them. A keyframe
+        // snapshot already leaves out the observations erased before it was taken, and the deletions reported for them
+        // are not logged: their rays never made it into the transcript. Those deletions come after the insertion,
+        // so they are popped in this same call.
+        std::vector<LogRecord> vRecords;
+        std::map<long unsigned int, std::set<long unsigned int> > mSnapshotPointIds; // keyframe id -> its logged points
+        TranscriptEvent event;
+        while (mTranscriptEvents.Pop(event)) {
+            // Reported before the last reset: the keyframes and points may be gone, and the ids reused
+            if (event.mnMapGeneration < mnMinMapGeneration) {
+                delete event.mpAdjusted;
+                continue;
+            }
+
+            if (event.mType == TranscriptEvent::OBSERVATION_DELETION) {
+                std::map<long unsigned int, std::set<long unsigned int> >::iterator it = mSnapshotPointIds.find(event.mnKFId);
+                if (it != mSnapshotPointIds.end() && it->second.count(event.mnMPId) == 0)
+                    continue;
+            }
+
+            vRecords.push_back(LogRecord());
+            LogRecord& record = vRecords.back();
+            record.mEvent = event;
+            if (event.mType == TranscriptEvent::KEYFRAME_INSERTION) {
+                SnapshotKeyFrame(event.mpKF, record.mKFSnapshot);
+                std::set<long unsigned int>& sPointIds = mSnapshotPointIds[event.mnKFId];
+                for (size_t i = 0; i < record.mKFSnapshot.mvPoints.size(); i++)
+                    sPointIds.insert(record.mKFSnapshot.mvPoints[i].mnId);
+            } else if (event.mType == TranscriptEvent::BUNDLE_ADJUSTMENT) {
+                SnapshotAdjustment(*event.mpAdjusted, record.mAdjustment);
+                delete event.mpAdjusted;
+                record.mEvent.mpAdjusted = NULL;
+            }
+        }
+
+        std::vector<KeyFrame*> vpLoggedKFs;
+        {
             unique_lock<mutex> lock(mMutexTranscript);
+            for (size_t i = 0; i < vRecords.size(); i++) {
+                const LogRecord& record = vRecords[i];
+                switch (record.mEvent.mType) {
+                    case TranscriptEvent::KEYFRAME_INSERTION:
+                        if (mbFirstKeyFrame) {
+                            mTranscriptInterface.addFirstKeyFrameInsertionEntry(record.mKFSnapshot);
+                            mbFirstKeyFrame = false;
+                        } else {
+                            mTranscriptInterface.addKeyFrameInsertionEntry(record.mKFSnapshot);
+                        }
+                        vpLoggedKFs.push_back(record.mEvent.mpKF);
+                        break;
+                    case TranscriptEvent::POINT_DELETION:
+                        mTranscriptInterface.addPointDeletionEntry(record.mEvent.mnMPId);
+                        break;
+                    case TranscriptEvent::OBSERVATION_DELETION:
+                        mTranscriptInterface.addVisibilityRayDeletionEntry(record.mEvent.mnKFId, record.mEvent.mnMPId);
+                        break;
+                    case TranscriptEvent::BUNDLE_ADJUSTMENT:
+                        mTranscriptInterface.addBundleAdjustmentEntry(record.mAdjustment);
+                        break;
+                }
+            }
+        }
 
-//            auto t1 = std::chrono::high_resolution_clock::now();
-//            std::vector<cv::Point3f> vPOnLine = GetPointsOnLineSegments(pKF);
-//            auto t2 = std::chrono::high_resolution_clock::now();
-//            std::cout << "GetPointsOnLineSegments() took "
-//                      << std::chrono::duration_cast<std::chrono::milliseconds>(t2-t1).count()
-//                      << " milliseconds\n";
-//
-//            mTranscriptInterface.addKeyFrameInsertionWithLinesEntry(pKF,vPOnLine);
+        // The texture atlas, semi-dense and line stages take the keyframes once logged, so that their points can refer
+        // to them
+        for (size_t i = 0; i < vpLoggedKFs.size(); i++) {
+            cv::Mat im;
+            {
+                unique_lock<mutex> lock(mMutexFrame);
+                std::map<long unsigned int, cv::Mat>::iterator it = mmFrameQueue.find(vpLoggedKFs[i]->mnFrameId);
+                if (it != mmFrameQueue.end())
+                    im = it->second;
+            }
+            mTextureAtlas.AddView(vpLoggedKFs[i], im);
+            if (mpProbabilityMapping != NULL)
+                mpProbabilityMapping->InsertKeyFrame(vpLoggedKFs[i], im);
+            if (mpLineMapping != NULL)
+                mpLineMapping->InsertKeyFrame(vpLoggedKFs[i], im);
+        }
+
+        if (!vpLoggedKFs.empty()) {
+            unique_lock<mutex> lock(mMutexModelExport);
+            mnKeyFramesSinceExport += vpLoggedKFs.size();
+        }
 
-            mTranscriptInterface.addKeyFrameInsertionEntry(pKF);
+        // Outside the transcript lock: releasing a keyframe may cull it, which reports observation deletions
+        for (size_t i = 0; i < vpLoggedKFs.size(); i++)
+            vpLoggedKFs[i]->ReleaseModelerPin();
+    }
 
+    void Modeler::SnapshotKeyFrame(KeyFrame* pKF, KeyFrameSnapshot& snapshot)
+    {
+        snapshot.mnId = pKF->mnId;
+        snapshot.mCamCenter = cv::Point3f(pKF->GetCameraCenter());
+        std::set<MapPoint*> spMapPoints = pKF->GetMapPoints();
+        snapshot.mvPoints.reserve(spMapPoints.size());
+        for (std::set<MapPoint*>::iterator it = spMapPoints.begin(); it != spMapPoints.end(); it++) {
+            MapPoint* pMP = *it;
+            if (pMP->isBad())
+                continue;
+            KeyFrameSnapshot::Point point;
+            point.mnId = pMP->mnId;
+            point.mPos = cv::Point3f(pMP->GetWorldPos());
+            std::map<KeyFrame*, size_t> mObservations = pMP->GetObservations();
+            point.mvnObservingKFIds.reserve(mObservations.size());
+            for (std::map<KeyFrame*, size_t>::iterator it2 = mObservations.begin(); it2 != mObservations.end(); it2++)
+                point.mvnObservingKFIds.push_back(it2->first->mnId);
+            snapshot.mvPoints.push_back(point);
         }
+    }
+
+    void Modeler::SnapshotAdjustment(const AdjustedEntities& adjusted, AdjustmentSnapshot& snapshot)
+    {
+        // Later adjustments of the same entities are logged by their own records, so the positions read now are at
+        // least as recent as this one
+        snapshot.mvKFs.reserve(adjusted.mvpKFs.size());
+        KeyFrame* pNewestKF = NULL;
+        for (size_t i = 0; i < adjusted.mvpKFs.size(); i++) {
+            KeyFrame* pKF = adjusted.mvpKFs[i];
+            snapshot.mvKFs.push_back(make_pair(pKF->mnId, cv::Point3f(pKF->GetCameraCenter())));
+            if (pNewestKF == NULL || pKF->mnId > pNewestKF->mnId)
+                pNewestKF = pKF;
+        }
+        snapshot.mvMPs.reserve(adjusted.mvpMPs.size());
+        for (size_t i = 0; i < adjusted.mvpMPs.size(); i++)
+            snapshot.mvMPs.push_back(make_pair(adjusted.mvpMPs[i]->mnId, cv::Point3f(adjusted.mvpMPs[i]->GetWorldPos())));
+        snapshot.mfSceneDepth = 0.0f;
+        if (pNewestKF != NULL && pNewestKF->TrackedMapPoints(1) > 0)
+            snapshot.mfSceneDepth = pNewestKF->ComputeSceneMedianDepth(2);
+    }
+
+    void Modeler::AddKeyFrameEntry(KeyFrame* pKF){
+        if(pKF->isBad())
+            return;
+
+        // Before the pin: if the map is cleared meanwhile, the record is dropped
+        const int nGeneration = mpMap->GetGeneration();
+
+        // Keep the keyframe for the modeler until it is logged and handed to its stages (released in
+        // ProcessTranscriptEvents). A pin of its own, so that it does not cancel a SetNotErase of the loop closer.
+        pKF->SetModelerPin();
+
+        TranscriptEvent event = {TranscriptEvent::KEYFRAME_INSERTION, nGeneration, pKF->mnId, 0, pKF, NULL};
+        mTranscriptEvents.Push(event);
 
         AddTexture(pKF);
 
         //DetectLineSegmentsLater(pKF);
-
-        pKF->SetErase();
     }
 
     void Modeler::AddDeletePointEntry(MapPoint* pMP){
-        unique_lock<mutex> lock(mMutexTranscript);
-        mTranscriptInterface.addPointDeletionEntry(pMP);
+        // Called with the map locked, and the point about to be freed: only its id is kept
+        TranscriptEvent event = {TranscriptEvent::POINT_DELETION, mpMap->GetGeneration(), 0, pMP->mnId, NULL, NULL};
+        mTranscriptEvents.Push(event);
     }
 
     void Modeler::AddDeleteObservationEntry(KeyFrame *pKF, MapPoint *pMP) {
-        unique_lock<mutex> lock(mMutexTranscript);
-        mTranscriptInterface.addVisibilityRayDeletionEntry(pKF, pMP);
+        // Called with the point's features locked: only the ids are kept
+        TranscriptEvent event = {TranscriptEvent::OBSERVATION_DELETION, mpMap->GetGeneration(), pKF->mnId, pMP->mnId,
+                                 NULL, NULL};
+        mTranscriptEvents.Push(event);
     }
 
     void Modeler::AddAdjustmentEntry(std::set<KeyFrame*> & sAdjustSet, std::set<MapPoint*> & sMapPoints){
-        unique_lock<mutex> lock(mMutexTranscript);
-        mTranscriptInterface.addBundleAdjustmentEntry(sAdjustSet, sMapPoints);
+        // Only the pointers are copied: the positions and the scene depth are read by the modeler thread
+        AdjustedEntities* pAdjusted = new AdjustedEntities;
+        pAdjusted->mvpKFs.assign(sAdjustSet.begin(), sAdjustSet.end());
+        pAdjusted->mvpMPs.assign(sMapPoints.begin(), sMapPoints.end());
+
+        TranscriptEvent event = {TranscriptEvent::BUNDLE_ADJUSTMENT, mpMap->GetGeneration(), 0, 0, NULL, pAdjusted};
+        mTranscriptEvents.Push(event);
     }
 
 
@@ -1391,6 +1473,8 @@ namespace ORB_SLAM2 {
         unique_lock<mutex> lock(mMutexReset);
         if(mbResetRequested)
         {
+            // Log what happened to the old map before the reset entry
+            ProcessTranscriptEvents();
             {
                 unique_lock<mutex> lock2(mMutexTranscript);
                 mTranscriptInterface.writeToFile("sfmtranscript_orbslam.txt");
@@ -1422,6 +1506,9 @@ namespace ORB_SLAM2 {
                 unique_lock<mutex> lock2(mMutexFrame);
                 mmFrameQueue.clear();
             }
+            mTextureAtlas.Clear();
+            // frame ids start over with the new map
+            mpModelDrawer->ResetFrameTextures();
             {
                 unique_lock<mutex> lock2(mMutexToLines);
                 mdToLinesQueue.clear();
@@ -1430,9 +1517,21 @@ namespace ORB_SLAM2 {
                 unique_lock<mutex> lock2(mMutexLines);
                 mvLines.clear();
             }
+            // Waits for the semi-dense and line stages to drop the keyframes of the old map
+            if (mpProbabilityMapping != NULL)
+                mpProbabilityMapping->RequestReset();
+            if (mpLineMapping != NULL)
+                mpLineMapping->RequestReset();
+            {
+                unique_lock<mutex> lock2(mMutexKeyFramePoints);
+                mdKeyFramePoints.clear();
+            }
 
             mbFirstKeyFrame = true;
 
+            // The map is cleared once the reset returns: what is reported until then belongs to the old map
+            mnMinMapGeneration = mpMap->GetGeneration() + 1;
+
             mbResetRequested=false;
         }
 
@@ -1517,19 +1616,45 @@ namespace ORB_SLAM2 {
     // get last n keyframes for texturing
     std::vector<pair<cv::Mat,TextureFrame>> Modeler::GetTextures(int n)
     {
-        unique_lock<mutex> lock(mMutexTexture);
-        unique_lock<mutex> lock2(mMutexFrame);
-        int nLastKF = mdTextureQueue.size() - 1;
         std::vector<pair<cv::Mat,TextureFrame>> imAndTexFrame;
-        // n most recent KFs
-        for (int i = 0; i < n && i <= nLastKF; i++){
-            TextureFrame texFrame = mdTextureQueue[std::max(0,nLastKF-i)];
-            imAndTexFrame.push_back(make_pair(mmFrameQueue[texFrame.mFrameID],texFrame));
+        {
+            unique_lock<mutex> lock(mMutexTexture);
+            int nLastKF = mdTextureQueue.size() - 1;
+            // n most recent KFs
+            for (int i = 0; i < n && i <= nLastKF; i++){
+                imAndTexFrame.push_back(make_pair(cv::Mat(),mdTextureQueue[nLastKF-i]));
+            }
+        }
+
+        // the tracking thread adds a frame image each frame: the texture queue is not held meanwhile
+        unique_lock<mutex> lock(mMutexFrame);
+        for (size_t i = 0; i < imAndTexFrame.size(); i++){
+            std::map<long unsigned int, cv::Mat>::iterator it = mmFrameQueue.find(imAndTexFrame[i].second.mFrameID);
+            if (it != mmFrameQueue.end())
+                imAndTexFrame[i].first = it->second;
         }
 
         return imAndTexFrame;
     }
 
+    bool Modeler::GetLastTextureFrameId(long unsigned int & nFrameId)
+    {
+        unique_lock<mutex> lock(mMutexTexture);
+        if (mdTextureQueue.empty())
+            return false;
+        nFrameId = mdTextureQueue.back().mFrameID;
+        return true;
+    }
+
+    cv::Mat Modeler::GetFrameImage(const long unsigned int & nFrameId)
+    {
+        unique_lock<mutex> lock(mMutexFrame);
+        std::map<long unsigned int, cv::Mat>::iterator it = mmFrameQueue.find(nFrameId);
+        if (it == mmFrameQueue.end())
+            return cv::Mat();
+        return it->second;
+    }
+
     cv::Mat Modeler::GetImageWithLines()
     {
         unique_lock<mutex> lock(mMutexLines);
@@ -26,459 +26,678 @@
  */
 
 #include <cmath>
+#include <algorithm>
+#include <iostream>
 #include <opencv2/opencv.hpp>
 #include <numeric>
+#include <unordered_map>
+#include <eigen3/Eigen/Dense>
 #include "Modeler/ProbabilityMapping.h"
+#include "Modeler/Modeler.h"
 #include "KeyFrame.h"
 #include "MapPoint.h"
-#include "ORBmatcher.h"
-#include "LocalMapping.h"
+#include "Map.h"
 #include <stdint.h>
 #include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 
-template<typename T>
-float bilinear(const cv::Mat& img, const float& y, const float& x)
-{
-    int x0 = (int)std::floor(x);
-    int y0 = (int )std::floor(y);
-    int x1 = x0 + 1;
-    int y1 =  y0 + 1;
-
-    float x0_weight = x1 - x;
-    float y0_weight = y1 - y;
-    float x1_weight = 1.0f - x0_weight;
-    float y1_weight = 1.0f - y0_weight;
-
-    float interpolated = img.at<T>(y0,x0) * x0_weight * y0_weight +
-                         img.at<T>(y0,x1) * x1_weight * y0_weight +
-                         img.at<T>(y1,x0) * x0_weight * y1_weight +
-                         img.at<T>(y1,x1) * x1_weight * y1_weight;
-
-    return interpolated;
-}
-
-ProbabilityMapping::ProbabilityMapping(ORB_SLAM2::Map* pMap):mpMap(pMap)
-{
-}
+namespace {
 
-void ProbabilityMapping::Run()
-{
-    while(1)
+    Eigen::Matrix3f toMatrix3f(const cv::Mat& m)
     {
-        if(CheckFinish()) break;
-        //TestSemiDenseViewer();
-#ifdef OnlineLoop
-//        struct timespec start, finish;
-//        double duration;
-//        clock_gettime(CLOCK_MONOTONIC, &start);
-
-        SemiDenseLoop();
+        Eigen::Matrix3f M;
+        M << m.at<float>(0,0), m.at<float>(0,1), m.at<float>(0,2),
+             m.at<float>(1,0), m.at<float>(1,1), m.at<float>(1,2),
+             m.at<float>(2,0), m.at<float>(2,1), m.at<float>(2,2);
+        return M;
+    }
 
-        //make point position dependent to kf position
-        UpdateAllSemiDensePointSet();
+    Eigen::Vector3f toVector3f(const cv::Mat& v)
+    {
+        return Eigen::Vector3f(v.at<float>(0), v.at<float>(1), v.at<float>(2));
+    }
 
-//        clock_gettime(CLOCK_MONOTONIC, &finish);
-//        duration = ( finish.tv_sec - start.tv_sec );
-//        duration += ( finish.tv_nsec - start.tv_nsec ) / 1000000000.0;
-//        std::cout<<"semi dense mapping took: "<< duration << "s" << std::endl;
-#endif
-        usleep(5000);
+    // Pixel planes of the keyframe searched along the epipolar line
+    struct EpipolarImage {
+        const uchar* im;
+        size_t im_step;     // bytes per row
+        const float* grad;
+        const float* theta;
+        size_t grad_step;   // floats per row, for grad and theta
+        int rows;
+    };
+
+    // Candidates are sampled at integer u, where bilinear interpolation reduces to interpolation along v
+    inline float SampleColumn(const uchar* p, size_t step, float v, int u)
+    {
+        const int v0 = (int)v;
+        const float w1 = v - v0;
+        const uchar* p0 = p + v0 * step + u;
+        return p0[0] + (p0[step] - p0[0]) * w1;
     }
 
-#ifndef OnlineLoop
+    inline float SampleColumn(const float* p, size_t step, float v, int u)
+    {
+        const int v0 = (int)v;
+        const float w1 = v - v0;
+        const float* p0 = p + v0 * step + u;
+        return p0[0] + (p0[step] - p0[0]) * w1;
+    }
 
+    // Angle between a gradient orientation and a reference in [0,360), folded to [0,180]
+    inline float AngleDistance(float theta, float ref)
+    {
+        float d = theta - ref;
+        if (d < 0) d += 360;
+        return std::min(d, 360 - d);
+    }
 
-    SemiDenseLoop();
+    const int EPIPOLAR_BLOCK = 64; // candidates gathered at a time
 
-    clock_gettime(CLOCK_MONOTONIC, &finish);
-    duration = ( finish.tv_sec - start.tv_sec );
-    duration += ( finish.tv_nsec - start.tv_nsec ) / 1000000000.0;
-    std::cout<<"semi dense mapping took: "<< duration << "s" << std::endl;
+    // Best candidate on the epipolar line v = -(m u + k), u in [u0,u1]: the smallest photometric error plus gradient
+    // modulus error over THETA among the candidates that pass the three gradient conditions (first one on ties).
+    // Returns the column of the best candidate, or -1, and its photometric and gradient modulus errors.
+    //
+    // The planes are read once per candidate into small struct-of-arrays blocks; the conditions and the costs are then
+    // evaluated four candidates at a time with SSE2 (baseline on x86-64), and one at a time elsewhere.
+    int SearchEpipolarSegment(const EpipolarImage& img, float m, float k, int u0, int u1, float pixel, float grad1,
+                              float th_epipolar_line, float th_pi_rot, float& best_photometric_err, float& best_gradient_modulo_err)
+    {
+        const float vmin = 4, vmax = img.rows - 5; // the sub-pixel step samples the line up to 4 rows away (|m| <= 4)
+        float bufTheta[EPIPOLAR_BLOCK], bufGrad0[EPIPOLAR_BLOCK], bufGrad1[EPIPOLAR_BLOCK];
+        float bufIm0[EPIPOLAR_BLOCK], bufIm1[EPIPOLAR_BLOCK], bufW[EPIPOLAR_BLOCK];
+
+        float best_err = 1000000.0;
+        float best_u = -1;
+
+#if defined(__SSE2__)
+        __m128 vBestErr = _mm_set1_ps(best_err);
+        __m128 vBestU = _mm_set1_ps(-1);
+        const __m128 v0 = _mm_setzero_ps();
+        const __m128 v180 = _mm_set1_ps(180);
+        const __m128 v360 = _mm_set1_ps(360);
+        const __m128 vThEpi = _mm_set1_ps(th_epipolar_line);
+        const __m128 vThPiRot = _mm_set1_ps(th_pi_rot);
+        const __m128 vLambdaG = _mm_set1_ps(lambdaG);
+        const __m128 vLambdaL = _mm_set1_ps(lambdaL);
+        const __m128 vLambdaTheta = _mm_set1_ps(lambdaTheta);
+        const __m128 vPixel = _mm_set1_ps(pixel);
+        const __m128 vGrad1 = _mm_set1_ps(grad1);
+        const __m128 vInvTheta = _mm_set1_ps(1 / THETA);
+        const __m128 vLane = _mm_set_ps(3, 2, 1, 0);
 #endif
 
-    std::string strFileName("semi_pointcloud.obj");
-    std::ofstream fileOut(strFileName.c_str(), std::ios::out);
-    if(!fileOut){
-        std::cerr << "Failed to save points on line" << std::endl;
-        return;
-    }
-    vector<ORB_SLAM2::KeyFrame*> vpKFs = mpMap->GetAllKeyFrames();
+        for (int ub = u0; ub <= u1; ub += EPIPOLAR_BLOCK) {
+            const int n = std::min(EPIPOLAR_BLOCK, u1 - ub + 1);
 
-    for (size_t indKF = 0; indKF < vpKFs.size(); indKF++) {
-        ORB_SLAM2::KeyFrame* kf = vpKFs[indKF];
-        if( kf->isBad() ) continue;
-        if(! kf->semidense_flag_) continue;
-        if(! kf->interKF_depth_flag_) continue;
-
-        for(size_t y = 0; y< (size_t)kf->im_.rows; y++) {
-            for (size_t x = 0; x < (size_t) kf->im_.cols; x++) {
+            // gather; candidates off the image get a gradient below lambdaG, which fails condition 1
+            for (int i = 0; i < n; i++) {
+                const int u = ub + i;
+                const float v = -(m * u + k);
+                if (!(v >= vmin && v < vmax)) {
+                    bufGrad0[i] = -1; bufTheta[i] = 0; bufGrad1[i] = 0; bufIm0[i] = 0; bufIm1[i] = 0; bufW[i] = 0;
+                    continue;
+                }
+                const int v0i = (int)v;
+                const float* g = img.grad + v0i * img.grad_step + u;
+                const uchar* p = img.im + v0i * img.im_step + u;
+                bufTheta[i] = img.theta[v0i * img.grad_step + u];
+                bufGrad0[i] = g[0];
+                bufGrad1[i] = g[img.grad_step];
+                bufIm0[i] = p[0];
+                bufIm1[i] = p[img.im_step];
+                bufW[i] = v - v0i;
+            }
 
-                Eigen::Vector3f Pw(kf->SemiDensePointSets_.at<float>(y, 3 * x),
-                                   kf->SemiDensePointSets_.at<float>(y, 3 * x + 1),
-                                   kf->SemiDensePointSets_.at<float>(y, 3 * x + 2));
-                if (kf->depth_sigma_.at<float>(y,x) > 0.01) continue;
-                if (kf->depth_map_.at<float>(y,x) > 0.000001) {
-                    fileOut << "v " + std::to_string(Pw[0]) + " " + std::to_string(Pw[1]) + " " + std::to_string(Pw[2])
-                            << std::endl;
+            int i = 0;
+#if defined(__SSE2__)
+            for (; i + 4 <= n; i += 4) {
+                const __m128 vTheta = _mm_loadu_ps(bufTheta + i);
+                const __m128 vG0 = _mm_loadu_ps(bufGrad0 + i);
+                const __m128 vW = _mm_loadu_ps(bufW + i);
+
+                // condition 1: gradient modulus
+                __m128 valid = _mm_cmpge_ps(vG0, vLambdaG);
+
+                // condition 2: gradient not too close to perpendicular to the epipolar line
+                __m128 d = _mm_sub_ps(vTheta, vThEpi);
+                d = _mm_add_ps(d, _mm_and_ps(_mm_cmplt_ps(d, v0), v360));
+                d = _mm_min_ps(d, _mm_sub_ps(v360, d));
+                d = _mm_min_ps(d, _mm_sub_ps(v180, d));
+                valid = _mm_and_ps(valid, _mm_cmple_ps(d, vLambdaL));
+
+                // condition 3: gradient orientation consistent with the in-plane rotation between the keyframes
+                d = _mm_sub_ps(vTheta, vThPiRot);
+                d = _mm_add_ps(d, _mm_and_ps(_mm_cmplt_ps(d, v0), v360));
+                d = _mm_min_ps(d, _mm_sub_ps(v360, d));
+                valid = _mm_and_ps(valid, _mm_cmple_ps(d, vLambdaTheta));
+
+                const __m128 vIm0 = _mm_loadu_ps(bufIm0 + i);
+                const __m128 vG1 = _mm_loadu_ps(bufGrad1 + i);
+                const __m128 vPe = _mm_sub_ps(vPixel, _mm_add_ps(vIm0, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(bufIm1 + i), vIm0), vW)));
+                const __m128 vGe = _mm_sub_ps(vGrad1, _mm_add_ps(vG0, _mm_mul_ps(_mm_sub_ps(vG1, vG0), vW)));
+                const __m128 vErr = _mm_add_ps(_mm_mul_ps(vPe, vPe), _mm_mul_ps(_mm_mul_ps(vGe, vGe), vInvTheta));
+
+                // per lane, the first of the smallest errors wins, as in the scalar scan
+                const __m128 better = _mm_and_ps(valid, _mm_cmplt_ps(vErr, vBestErr));
+                const __m128 vU = _mm_add_ps(_mm_set1_ps((float)(ub + i)), vLane);
+                vBestErr = _mm_or_ps(_mm_and_ps(better, vErr), _mm_andnot_ps(better, vBestErr));
+                vBestU = _mm_or_ps(_mm_and_ps(better, vU), _mm_andnot_ps(better, vBestU));
+            }
+#endif
+            for (; i < n; i++) {
+                if (bufGrad0[i] < lambdaG) continue;
+                const float dl = AngleDistance(bufTheta[i], th_epipolar_line);
+                if (std::min(dl, 180 - dl) > lambdaL) continue;
+                if (AngleDistance(bufTheta[i], th_pi_rot) > lambdaTheta) continue;
+
+                const float pe = pixel - (bufIm0[i] + (bufIm1[i] - bufIm0[i]) * bufW[i]);
+                const float ge = grad1 - (bufGrad0[i] + (bufGrad1[i] - bufGrad0[i]) * bufW[i]);
+                const float err = pe * pe + ge * ge * (1 / THETA);
+                if (err < best_err) {
+                    best_err = err;
+                    best_u = ub + i;
                 }
             }
         }
 
+#if defined(__SSE2__)
+        float arrErr[4], arrU[4];
+        _mm_storeu_ps(arrErr, vBestErr);
+        _mm_storeu_ps(arrU, vBestU);
+        for (int l = 0; l < 4; l++) {
+            if (arrU[l] < 0) continue;
+            if (arrErr[l] < best_err || (arrErr[l] == best_err && (best_u < 0 || arrU[l] < best_u))) {
+                best_err = arrErr[l];
+                best_u = arrU[l];
+            }
+        }
+#endif
+        if (best_u < 0)
+            return -1;
+
+        // errors of the winner
+        const int u = (int)best_u;
+        const float v = -(m * u + k);
+        best_photometric_err = pixel - SampleColumn(img.im, img.im_step, v, u);
+        best_gradient_modulo_err = grad1 - SampleColumn(img.grad, img.grad_step, v, u);
+        return u;
     }
 
-    fileOut.flush();
-    fileOut.close();
-    std::cout << "saved semi dense point cloud" << std::endl;
-
-    mbFinished = true;
 }
 
-void ProbabilityMapping::SemiDenseLoop(ORB_SLAM2::KeyFrame* pKF){
+ProbabilityMapping::ProbabilityMapping(ORB_SLAM2::Map* pMap, size_t nThreads):
+        mpMap(pMap), mpModeler(NULL), mThreadPool(nThreads), mnMaxKeyFrames(50), mfMoveThresholdDepthFraction(0.005),
+        mbResetRequested(false), mbFinishRequested(false), mbFinished(true)
+{
+}
 
-    {
-        ORB_SLAM2::KeyFrame *kf = pKF;
-        if (kf->isBad() || kf->semidense_flag_)
-            return;
-//        // 10 keyframe delay
-//        if (!kf->MappingIdDelay())
-//            continue;
-
-//        std::vector<ORB_SLAM2::KeyFrame*> closestMatches = kf->GetBestCovisibilityKeyFrames(covisN);
-//        if(closestMatches.size() < covisN) {continue;}
-
-        // use covisN good neighbor kfs
-        std::vector<ORB_SLAM2::KeyFrame *> closestMatchesAll = kf->GetVectorCovisibleKeyFrames();
-        std::vector<ORB_SLAM2::KeyFrame *> closestMatches;
-        for (size_t idxCov = 0; idxCov < closestMatchesAll.size(); idxCov++) {
-            if (closestMatches.size() >= covisN)
-                break;
-            if (closestMatchesAll[idxCov]->isBad()) continue;
-            if (!closestMatchesAll[idxCov]->Mapped()) continue;
-            closestMatches.push_back(closestMatchesAll[idxCov]);
-        }
-        if (closestMatches.size() < covisN) { continue; }
+void ProbabilityMapping::SetModeler(ORB_SLAM2::Modeler* pModeler)
+{
+    mpModeler = pModeler;
+}
 
-        // start timing
+void ProbabilityMapping::InsertKeyFrame(ORB_SLAM2::KeyFrame* pKF, const cv::Mat& im)
+{
+    if(im.empty())
+        return;
+    std::unique_lock<std::mutex> lock(mMutexNewKFs);
+    mlNewKeyFrames.push_back(std::make_pair(pKF, im.clone()));
+}
 
-        struct timespec start, finish;
-        double duration;
-        clock_gettime(CLOCK_MONOTONIC, &start);
+void ProbabilityMapping::Run()
+{
+    mbFinished = false;
 
-        cout << "semidense_Info:    vpKFs.size()--> " << vpKFs.size() << std::endl;
+    while(1)
+    {
+        SemiDenseLoop();
 
-        std::map<ORB_SLAM2::KeyFrame *, float> rotIs;
-        for (size_t j = 0; j < closestMatches.size(); j++) {
-            std::vector<float> rot = GetRotInPlane(kf, closestMatches[j]);
-            std::sort(rot.begin(), rot.end());
-            // 0 rotation for kf pair without covisibility
-            float medianRot = 0;
-            if (rot.size() > 0)
-                medianRot = rot[(rot.size() - 1) / 2];
-            rotIs.insert(std::map<ORB_SLAM2::KeyFrame *, float>::value_type(closestMatches[j], medianRot));
-        }
+        ResetIfRequested();
 
-        float max_depth;
-        float min_depth;
-        // get max_depth and min_depth in current key frame to limit search range
-        StereoSearchConstraints(kf, &min_depth, &max_depth);
+        if(CheckFinish()) break;
 
-        cv::Mat image = kf->GetImage();
-        cv::Mat image_debug = image.clone();
+        usleep(5000);
+    }
 
-        std::vector<cv::Mat> F;
-        F.clear();
-        for (size_t j = 0; j < closestMatches.size(); j++) {
-            ORB_SLAM2::KeyFrame *kf2 = closestMatches[j];
-            cv::Mat F12 = ComputeFundamental(kf, kf2);
-            F.push_back(F12);
-        }
+    if(SaveSemiDensePointCloud("semi_pointcloud.obj"))
+        std::cout << "saved semi dense point cloud" << std::endl;
 
-#pragma omp parallel for schedule(dynamic) collapse(2)
-        for (int y = 0 + 2; y < image.rows - 2; y++) {
-            for (int x = 0 + 2; x < image.cols - 2; x++) {
+    SetFinish();
+}
 
-                if (kf->GradImg.at<float>(y, x) < lambdaG) { continue; }
-                float pixel = (float) image.at<uchar>(y, x); //maybe it should be cv::Mat
+void ProbabilityMapping::SemiDenseLoop(){
 
-                std::vector<depthHo> depth_ho;
-                depth_ho.clear();
-                for (size_t j = 0; j < closestMatches.size(); j++) {
-                    ORB_SLAM2::KeyFrame *kf2 = closestMatches[j];
-                    cv::Mat F12 = F[j];
+    // pick up the keyframes logged by the modeler
+    std::list<std::pair<ORB_SLAM2::KeyFrame*, cv::Mat> > lNewKeyFrames;
+    {
+        std::unique_lock<std::mutex> lock(mMutexNewKFs);
+        lNewKeyFrames.swap(mlNewKeyFrames);
+    }
+    for (std::list<std::pair<ORB_SLAM2::KeyFrame*, cv::Mat> >::iterator it = lNewKeyFrames.begin(); it != lNewKeyFrames.end(); it++) {
+        if (mmSemiDense.count(it->first)) continue;
+        SemiDenseKeyFrame& sd = mmSemiDense[it->first];
+        if (it->second.channels() > 1)
+            cv::cvtColor(it->second, sd.im_, CV_RGB2GRAY);
+        else
+            sd.im_ = it->second;
+        ComputeGradient(&sd);
+        sd.depth_map_ = cv::Mat::zeros(sd.im_.rows, sd.im_.cols, CV_32F);
+        sd.depth_sigma_ = cv::Mat::zeros(sd.im_.rows, sd.im_.cols, CV_32F);
+        mlKeyFrameOrder.push_back(it->first);
+    }
+    while (mlKeyFrameOrder.size() > mnMaxKeyFrames) {
+        mmSemiDense.erase(mlKeyFrameOrder.front());
+        mlKeyFrameOrder.pop_front();
+    }
 
-                    float rot = rotIs[kf2];
-                    float best_u(0.0), best_v(0.0);
-                    depthHo dh;
-                    EpipolarSearch(kf, kf2, x, y, pixel, min_depth, max_depth, &dh, F12, best_u, best_v,
-                                   kf->GradTheta.at<float>(y, x), rot);
+    // depth maps of the keyframes with enough neighbours in
+    for (std::list<ORB_SLAM2::KeyFrame*>::iterator it = mlKeyFrameOrder.begin(); it != mlKeyFrameOrder.end(); it++) {
+        ORB_SLAM2::KeyFrame* kf = *it;
+        SemiDenseKeyFrame* sd = &mmSemiDense[kf];
+        if (kf->isBad() || sd->semidense_flag_) continue;
 
-                    if (dh.supported && 1 / dh.depth > 0.0) {
-                        depth_ho.push_back(dh);
-                    }
-                }
+        std::vector<NeighbourPair> closestMatches;
+        if (!GetNeighbors(kf, closestMatches)) continue;
 
-                if (depth_ho.size() > lambdaN) {
-                    depthHo dh_temp;
-                    InverseDepthHypothesisFusion(depth_ho, dh_temp);
-                    if (dh_temp.supported) {
-                        kf->depth_map_.at<float>(y, x) = dh_temp.depth;   //  used to do IntraKeyFrameDepthChecking
-                        kf->depth_sigma_.at<float>(y, x) = dh_temp.sigma;
-                    }
-                }
+        SemiDenseRecon(kf, sd, closestMatches);
+    }
 
-            }
-        }
-        //cv::imwrite("grad2_image.png",image2_debug);
-        // cv::imwrite("depth_image.png",depth_image);
-        // saveMatToCsv(depth_image,"depth.csv");
+    // check the depth maps against the neighbours' once those are reconstructed as well
+    for (std::list<ORB_SLAM2::KeyFrame*>::iterator it = mlKeyFrameOrder.begin(); it != mlKeyFrameOrder.end(); it++) {
+        ORB_SLAM2::KeyFrame* kf = *it;
+        SemiDenseKeyFrame* sd = &mmSemiDense[kf];
+        if (kf->isBad() || !sd->semidense_flag_ || sd->interKF_depth_flag_) continue;
 
-        std::cout << "IntraKeyFrameDepthChecking " << i << std::endl;
-        IntraKeyFrameDepthChecking(kf->depth_map_, kf->depth_sigma_, kf->GradImg);
-        IntraKeyFrameDepthGrowing(kf->depth_map_, kf->depth_sigma_, kf->GradImg);
+        std::vector<NeighbourPair> neighbors;
+        if (!GetNeighbors(kf, neighbors)) continue;
 
-//        UpdateSemiDensePointSet(kf);
+        int num_depth_kf = 0;
+        for (size_t j = 0; j < neighbors.size(); j++){
+            if (neighbors[j].pSD2->semidense_flag_) {num_depth_kf++;}
+        }
+        if (num_depth_kf < covisN) continue;
 
-//        ApplySigmaThreshold(kf);
+        InterKeyFrameDepthChecking(kf, sd, neighbors);
+        sd->interKF_depth_flag_ = true;
 
-        kf->semidense_flag_ = true;
+        EmitPoints(kf, sd);
+    }
+}
 
-        // timing
-        clock_gettime(CLOCK_MONOTONIC, &finish);
-        duration = (finish.tv_sec - start.tv_sec);
-        duration += (finish.tv_nsec - start.tv_nsec) / 1000000000.0;
-        std::cout << "depth reconstruction took: " << duration << "s" << std::endl;
+bool ProbabilityMapping::GetNeighbors(ORB_SLAM2::KeyFrame* kf, std::vector<NeighbourPair>& neighbors){
+    // use covisN good neighbor kfs that we have an image of
+    std::vector<ORB_SLAM2::KeyFrame*> neighborsAll = kf->GetVectorCovisibleKeyFrames();
+    neighbors.clear();
+    for (size_t idxCov = 0; idxCov < neighborsAll.size(); idxCov++){
+        if (neighbors.size() >= covisN)
+            break;
+        if (neighborsAll[idxCov]->isBad()) continue;
+        std::map<ORB_SLAM2::KeyFrame*, SemiDenseKeyFrame>::iterator itSD = mmSemiDense.find(neighborsAll[idxCov]);
+        if (itSD == mmSemiDense.end()) continue;
+
+        NeighbourPair pair;
+        pair.pKF2 = neighborsAll[idxCov];
+        pair.pSD2 = &itSD->second;
+        pair.rot = 0;
+        neighbors.push_back(pair);
+    }
+    if (neighbors.size() < covisN) return false;
 
-        //cv::imwrite("image.png",image);
-        //pcl::io::savePLYFileBinary ("kf.ply", *cloudPtr);
-        //cv::imwrite("grad_image.png",image_debug);
+    // relative poses, read once for all the pixels
+    Eigen::Matrix3f Rcw1 = toMatrix3f(kf->GetRotation());
+    Eigen::Vector3f tcw1 = toVector3f(kf->GetTranslation());
+    for (size_t j = 0; j < neighbors.size(); j++){
+        Eigen::Matrix3f Rcw2 = toMatrix3f(neighbors[j].pKF2->GetRotation());
+        Eigen::Vector3f tcw2 = toVector3f(neighbors[j].pKF2->GetTranslation());
 
+        neighbors[j].R21 = Rcw2*Rcw1.transpose();
+        neighbors[j].t21 = -neighbors[j].R21*tcw1+tcw2;
     }
+    return true;
+}
 
+void ProbabilityMapping::ComputeGradient(SemiDenseKeyFrame* sd){
+    cv::Mat gradx, grady;
+    cv::Scharr(sd->im_, gradx, CV_32F, 1, 0, 1/32.0);
+    cv::Scharr(sd->im_, grady, CV_32F, 0, 1, 1/32.0);
+    cv::magnitude(gradx, grady, sd->GradImg);
+    cv::phase(gradx, grady, sd->GradTheta, true);
 
-    int num_inter_checked = 0;
-    int num_all_neigbors = 0;
-
-    for(size_t i =0;i < vpKFs.size(); i++ )
-    {
-        ORB_SLAM2::KeyFrame* kf = vpKFs[i];
-        if (kf->isBad() || kf->interKF_depth_flag_)continue;
+    cv::Mat image_mean, image_stddev;
+    cv::meanStdDev(sd->im_, image_mean, image_stddev);
+    sd->I_stddev = image_stddev.at<double>(0,0);
+}
 
-        if (!kf->semidense_flag_) continue;
+void ProbabilityMapping::SemiDenseRecon(ORB_SLAM2::KeyFrame* kf, SemiDenseKeyFrame* sd, std::vector<NeighbourPair>& closestMatches){
+
+    // start timing
+    struct timespec start, finish;
+    double duration;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    float max_depth;
+    float min_depth;
+    // get max_depth and min_depth in current key frame to limit search range
+    StereoSearchConstraints(kf, &min_depth, &max_depth);
+    if (max_depth <= 0) return;
+
+    // fundamental matrices and in-plane rotations of the pairs, shared by all the pixels
+    for (size_t j = 0; j < closestMatches.size(); j++) {
+        ORB_SLAM2::KeyFrame *kf2 = closestMatches[j].pKF2;
+        closestMatches[j].F12 = ComputeFundamental(kf, kf2);
+
+        std::vector<float> rot = GetRotInPlane(kf, kf2);
+        std::sort(rot.begin(), rot.end());
+        // 0 rotation for kf pair without covisibility
+        float medianRot = 0;
+        if (rot.size() > 0)
+            medianRot = rot[(rot.size() - 1) / 2];
+        closestMatches[j].rot = medianRot;
+    }
 
-        // option1: could just be the best covisibility keyframes
-//        std::vector<ORB_SLAM2::KeyFrame*> neighbors = kf->GetBestCovisibilityKeyFrames(covisN);
-//        if(neighbors.size() < covisN) {continue;}
+    const cv::Mat& image = sd->im_;
 
-        std::vector<ORB_SLAM2::KeyFrame*> neighbors;
-        std::vector<ORB_SLAM2::KeyFrame*> neighborsAll = kf->GetVectorCovisibleKeyFrames();
-        for (size_t idxCov = 0; idxCov < neighborsAll.size(); idxCov++){
-            if (neighbors.size() >= covisN)
-                break;
-            if (neighborsAll[idxCov]->isBad()) continue;
-            if (!neighborsAll[idxCov]->Mapped()) continue;
-            neighbors.push_back(neighborsAll[idxCov]);
+    // rows of high-gradient pixels, searched in parallel
+    std::vector<std::vector<int> > vRowPixels(image.rows);
+    std::vector<int> vRows;
+    for (int y = 0 + 2; y < image.rows - 2; y++) {
+        const float* pGrad = sd->GradImg.ptr<float>(y);
+        for (int x = 0 + 2; x < image.cols - 2; x++) {
+            if (pGrad[x] >= lambdaG)
+                vRowPixels[y].push_back(x);
         }
-        if(neighbors.size() < covisN) {continue;}
-
-
-        // start timing
-        struct timespec start, finish;
-        double duration;
-        clock_gettime(CLOCK_MONOTONIC, &start);
+        if (!vRowPixels[y].empty())
+            vRows.push_back(y);
+    }
 
+    mThreadPool.ParallelFor(vRows.size(), [&](size_t i)
+    {
+        const int y = vRows[i];
+        const std::vector<int>& vPixels = vRowPixels[y];
+        std::vector<depthHo> depth_ho;
+        for (size_t k = 0; k < vPixels.size(); k++) {
+            const int x = vPixels[k];
+            float pixel = (float) image.at<uchar>(y, x);
+
+            depth_ho.clear();
+            for (size_t j = 0; j < closestMatches.size(); j++) {
+                float best_u(0.0), best_v(0.0);
+                depthHo dh;
+                EpipolarSearch(kf, sd, closestMatches[j], x, y, pixel, min_depth, max_depth, &dh, best_u, best_v,
+                               sd->GradTheta.at<float>(y, x));
+
+                if (dh.supported && 1 / dh.depth > 0.0) {
+                    depth_ho.push_back(dh);
+                }
+            }
 
-        // neighbors have depth reconstructed
-        int num_depth_kf = 0;
-        for (size_t j = 0; j < neighbors.size(); j++){
-            if (neighbors[j]->semidense_flag_) {num_depth_kf++;}
+            if (depth_ho.size() > lambdaN) {
+                depthHo dh_temp;
+                InverseDepthHypothesisFusion(depth_ho, dh_temp);
+                if (dh_temp.supported) {
+                    sd->depth_map_.at<float>(y, x) = dh_temp.depth;   //  used to do IntraKeyFrameDepthChecking
+                    sd->depth_sigma_.at<float>(y, x) = dh_temp.sigma;
+                }
+            }
         }
+    });
 
-        num_inter_checked++;
-        if (num_depth_kf < covisN) continue;
-        num_all_neigbors++;
-
-        std::cout << "InterKeyFrameDepthChecking " << i << std::endl;
-        InterKeyFrameDepthChecking(kf,neighbors);
-
-        UpdateSemiDensePointSet(kf);
-
-        kf->interKF_depth_flag_ = true;
-
-
-        //timing
-        clock_gettime(CLOCK_MONOTONIC, &finish);
-        duration = ( finish.tv_sec - start.tv_sec );
-        duration += ( finish.tv_nsec - start.tv_nsec ) / 1000000000.0;
-        std::cout<<"depth checking took: "<< duration << "s" << std::endl;
-
-    }
+    IntraKeyFrameDepthChecking(sd->depth_map_, sd->depth_sigma_, sd->GradImg);
+    IntraKeyFrameDepthGrowing(sd->depth_map_, sd->depth_sigma_, sd->GradImg);
 
+    sd->semidense_flag_ = true;
 
+    // timing
+    clock_gettime(CLOCK_MONOTONIC, &finish);
+    duration = (finish.tv_sec - start.tv_sec);
+    duration += (finish.tv_nsec - start.tv_nsec) / 1000000000.0;
+    std::cout << "semi dense: keyframe " << kf->mnId << " depth reconstruction took " << duration << "s" << std::endl;
 }
 
+std::vector<cv::Point3f> ProbabilityMapping::GetSemiDensePoints(ORB_SLAM2::KeyFrame* kf, SemiDenseKeyFrame* sd, float fMaxSigma, int nCellSize){
+    std::vector<cv::Point3f> vPoints;
+    const int nCell = std::max(nCellSize, 1);
+
+    for (int y0 = 0; y0 < sd->depth_map_.rows; y0 += nCell) {
+        for (int x0 = 0; x0 < sd->depth_map_.cols; x0 += nCell) {
+
+            // most certain pixel of the cell
+            int best_x = -1, best_y = -1;
+            float best_sigma = fMaxSigma;
+            for (int y = y0; y < std::min(y0 + nCell, sd->depth_map_.rows); y++) {
+                for (int x = x0; x < std::min(x0 + nCell, sd->depth_map_.cols); x++) {
+                    if (sd->depth_map_.at<float>(y,x) < 0.000001) continue;
+                    if (sd->depth_sigma_.at<float>(y,x) >= best_sigma) continue;
+                    best_sigma = sd->depth_sigma_.at<float>(y,x);
+                    best_x = x;
+                    best_y = y;
+                }
+            }
+            if (best_x < 0) continue;
 
-void ProbabilityMapping::UpdateAllSemiDensePointSet(){
-    vector<ORB_SLAM2::KeyFrame*> vpKFs = mpMap->GetAllKeyFrames();
-    if(vpKFs.size() < 10){return;}
-
-    for (size_t i = 0; i < vpKFs.size(); i++){
-        ORB_SLAM2::KeyFrame* kf = vpKFs[i];
-        if (kf->isBad() || !kf->interKF_depth_flag_)
-            continue;
-        if (kf->poseChanged) {
-            UpdateSemiDensePointSet(kf);
-            kf->poseChanged = false;
+            float inv_d = sd->depth_map_.at<float>(best_y,best_x);
+            float Z = 1/inv_d ;
+            float X = Z *(best_x- kf->cx ) / kf->fx;
+            float Y = Z *(best_y- kf->cy ) / kf->fy;
+            vPoints.push_back(cv::Point3f(X, Y, Z));
         }
     }
+    return vPoints;
 }
 
+void ProbabilityMapping::TransformToWorld(const cv::Mat& Tcw, const std::vector<cv::Point3f>& vPc, std::vector<cv::Point3f>& vPw){
+    cv::Mat Rwc = Tcw.rowRange(0,3).colRange(0,3).t();
+    cv::Mat Ow = -Rwc*Tcw.rowRange(0,3).col(3);
+    const float r00 = Rwc.at<float>(0,0), r01 = Rwc.at<float>(0,1), r02 = Rwc.at<float>(0,2);
+    const float r10 = Rwc.at<float>(1,0), r11 = Rwc.at<float>(1,1), r12 = Rwc.at<float>(1,2);
+    const float r20 = Rwc.at<float>(2,0), r21 = Rwc.at<float>(2,1), r22 = Rwc.at<float>(2,2);
+    const float ox = Ow.at<float>(0), oy = Ow.at<float>(1), oz = Ow.at<float>(2);
+
+    vPw.resize(vPc.size());
+    for (size_t i = 0; i < vPc.size(); i++) {
+        const cv::Point3f& p = vPc[i];
+        vPw[i] = cv::Point3f(r00*p.x + r01*p.y + r02*p.z + ox,
+                             r10*p.x + r11*p.y + r12*p.z + oy,
+                             r20*p.x + r21*p.y + r22*p.z + oz);
+    }
+}
 
-void ProbabilityMapping::UpdateSemiDensePointSet(ORB_SLAM2::KeyFrame* kf){
+void ProbabilityMapping::EmitPoints(ORB_SLAM2::KeyFrame* kf, SemiDenseKeyFrame* sd){
+    // every confident pixel is kept for export and display, a sparser set goes to CARV: the triangulation grows with
+    // each point
+    SemiDensePointSet set;
+    set.vPc = GetSemiDensePoints(kf, sd, 0.01, 1);
+    if (!set.vPc.empty()) {
+        std::vector<float> vDepths(set.vPc.size());
+        for (size_t i = 0; i < set.vPc.size(); i++)
+            vDepths[i] = set.vPc[i].z;
+        std::nth_element(vDepths.begin(), vDepths.begin() + vDepths.size() / 2, vDepths.end());
+        set.fMedianDepth = vDepths[vDepths.size() / 2];
+
+        std::unique_lock<std::mutex> lock(mMutexPointSets);
+        mmPointSets[kf] = set; // world positions are computed on first access
+    }
 
-#pragma omp parallel for schedule(dynamic) collapse(2)
-    for(int y = 0+2; y < kf->im_.rows-2; y++)
-    {
-        for(int x = 0+2; x< kf->im_.cols-2; x++)
-        {
+    if (mpModeler != NULL) {
+        std::vector<cv::Point3f> vPw;
+        TransformToWorld(kf->GetPose(), GetSemiDensePoints(kf, sd, 0.01, 8), vPw);
+        mpModeler->AddSemiDensePoints(kf, vPw);
+    }
+}
 
-            if (kf->depth_map_.at<float>(y,x) < 0.000001) {
-                kf->SemiDensePointSets_.at<float>(y,3*x+0) = 0.0;
-                kf->SemiDensePointSets_.at<float>(y,3*x+1) = 0.0;
-                kf->SemiDensePointSets_.at<float>(y,3*x+2) = 0.0;
-                continue;
-            }
+bool ProbabilityMapping::UpdateSemiDensePointSet(ORB_SLAM2::KeyFrame* kf, SemiDensePointSet& set){
+    cv::Mat Tcw = kf->GetPose();
+    if (!set.Tcw.empty()) {
+        // displacement of a point at the median depth: camera centre shift plus rotation angle times the depth
+        cv::Mat dR = Tcw.rowRange(0,3).colRange(0,3) * set.Tcw.rowRange(0,3).colRange(0,3).t();
+        float cos_angle = std::max(-1.0f, std::min(1.0f, (dR.at<float>(0,0) + dR.at<float>(1,1) + dR.at<float>(2,2) - 1) / 2));
+        cv::Mat Ow = -Tcw.rowRange(0,3).colRange(0,3).t() * Tcw.rowRange(0,3).col(3);
+        cv::Mat Ow_old = -set.Tcw.rowRange(0,3).colRange(0,3).t() * set.Tcw.rowRange(0,3).col(3);
+        float displacement = cv::norm(Ow - Ow_old) + std::acos(cos_angle) * set.fMedianDepth;
+        if (displacement <= mfMoveThresholdDepthFraction * set.fMedianDepth)
+            return false;
+    }
 
-            float inv_d = kf->depth_map_.at<float>(y,x);
-            float Z = 1/inv_d ;
-            float X = Z *(x- kf->cx ) / kf->fx;
-            float Y = Z *(y- kf->cy ) / kf->fy;
+    TransformToWorld(Tcw, set.vPc, set.vPw);
+    set.Tcw = Tcw;
+    return true;
+}
 
-            cv::Mat Pc = (cv::Mat_<float>(4,1) << X, Y , Z, 1); // point in camera frame.
-            cv::Mat Twc = kf->GetPoseInverse();
-            cv::Mat pos = Twc * Pc;
+size_t ProbabilityMapping::UpdateAllSemiDensePointSet(){
+    std::unique_lock<std::mutex> lock(mMutexPointSets);
+    size_t nUpdated = 0;
+    for (std::map<ORB_SLAM2::KeyFrame*, SemiDensePointSet>::iterator it = mmPointSets.begin(); it != mmPointSets.end(); it++) {
+        if (it->first->isBad()) continue;
+        if (UpdateSemiDensePointSet(it->first, it->second))
+            nUpdated++;
+    }
+    return nUpdated;
+}
 
-            kf->SemiDensePointSets_.at<float>(y,3*x+0) = pos.at<float>(0);
-            kf->SemiDensePointSets_.at<float>(y,3*x+1) = pos.at<float>(1);
-            kf->SemiDensePointSets_.at<float>(y,3*x+2) = pos.at<float>(2);
-        }
+void ProbabilityMapping::ForEachSemiDensePointSet(const std::function<void(const std::vector<cv::Point3f>&)>& f){
+    std::unique_lock<std::mutex> lock(mMutexPointSets);
+    for (std::map<ORB_SLAM2::KeyFrame*, SemiDensePointSet>::iterator it = mmPointSets.begin(); it != mmPointSets.end(); it++) {
+        if (it->first->isBad()) continue;
+        UpdateSemiDensePointSet(it->first, it->second);
+        f(it->second.vPw);
     }
+}
 
+bool ProbabilityMapping::SaveSemiDensePointCloud(const std::string& strFileName){
+    std::ofstream fileOut(strFileName.c_str(), std::ios::out);
+    if(!fileOut){
+        std::cerr << "Failed to save the semi dense point cloud to " << strFileName << std::endl;
+        return false;
+    }
+    ForEachSemiDensePointSet([&](const std::vector<cv::Point3f>& vPw)
+    {
+        for (size_t i = 0; i < vPw.size(); i++)
+            fileOut << "v " << vPw[i].x << " " << vPw[i].y << " " << vPw[i].z << "\n";
+    });
+    fileOut.close();
+    return !fileOut.fail();
 }
 
 
 void ProbabilityMapping::StereoSearchConstraints(ORB_SLAM2::KeyFrame* kf, float* min_depth, float* max_depth){
-    std::vector<float> orb_depths = kf->GetAllPointDepths();
+    std::vector<ORB_SLAM2::MapPoint*> vpMPs = kf->GetMapPointMatches();
+    cv::Mat Rcw2 = kf->GetRotation().row(2);
+    float zcw = kf->GetTranslation().at<float>(2);
+
+    std::vector<float> orb_depths;
+    orb_depths.reserve(vpMPs.size());
+    for (size_t i = 0; i < vpMPs.size(); i++) {
+        if (vpMPs[i] == NULL || vpMPs[i]->isBad()) continue;
+        cv::Mat x3Dw = vpMPs[i]->GetWorldPos();
+        float z = Rcw2.dot(x3Dw.t()) + zcw;
+        if (z > 0) orb_depths.push_back(z);
+    }
+
+    *max_depth = 0;
+    *min_depth = 0;
+    if (orb_depths.empty()) return;
 
     float sum = std::accumulate(orb_depths.begin(), orb_depths.end(), 0.0);
     float mean = sum / orb_depths.size();
 
-    std::vector<float> diff(orb_depths.size());
-    std::transform(orb_depths.begin(), orb_depths.end(), diff.begin(), std::bind2nd(std::minus<float>(), mean));
-    float variance = std::inner_product(diff.begin(), diff.end(), diff.begin(), 0.0)/orb_depths.size();
+    float variance = 0;
+    for (size_t i = 0; i < orb_depths.size(); i++)
+        variance += (orb_depths[i] - mean) * (orb_depths[i] - mean);
+    variance /= orb_depths.size();
     float stdev = std::sqrt(variance);
 
+    // inverse depths: max_depth is the farthest point, min_depth the nearest
     *max_depth = 1/(mean + 2 * stdev);
-    *min_depth = 1/(mean - 2 * stdev);
+    if (mean - 2 * stdev > 0)
+        *min_depth = 1/(mean - 2 * stdev);
+    else
+        *min_depth = 1/(*std::min_element(orb_depths.begin(), orb_depths.end()));
 }
 
-void ProbabilityMapping::EpipolarSearch(ORB_SLAM2::KeyFrame* kf1, ORB_SLAM2::KeyFrame *kf2, const int x, const int y, float pixel,
-                                        float min_depth, float max_depth, depthHo *dh,cv::Mat F12,float& best_u,float& best_v,float th_pi,float rot)
+void ProbabilityMapping::EpipolarSearch(ORB_SLAM2::KeyFrame* kf1, SemiDenseKeyFrame* sd1, const NeighbourPair& pair, const int x, const int y, float pixel,
+                                        float min_depth, float max_depth, depthHo *dh, float& best_u, float& best_v, float th_pi)
 {
+    const Eigen::Matrix3f& F12 = pair.F12;
+    const SemiDenseKeyFrame* kf2 = pair.pSD2;
 
-    float a = x*F12.at<float>(0,0)+y*F12.at<float>(1,0)+F12.at<float>(2,0);
-    float b = x*F12.at<float>(0,1)+y*F12.at<float>(1,1)+F12.at<float>(2,1);
-    float c = x*F12.at<float>(0,2)+y*F12.at<float>(1,2)+F12.at<float>(2,2);
+    float a = x*F12(0,0)+y*F12(1,0)+F12(2,0);
+    float b = x*F12(0,1)+y*F12(1,1)+F12(2,1);
+    float c = x*F12(0,2)+y*F12(1,2)+F12(2,2);
 
-    if((a/b)< -4 || a/b> 4) return;   // if epipolar direction is approximate to perpendicular, we discard it.  May be product wrong match.
+    if(b == 0 || (a/b)< -4 || a/b> 4) return;   // if epipolar direction is approximate to perpendicular, we discard it.  May be product wrong match.
 
-    float old_err = 1000000.0;
-    float best_photometric_err = 0.0;
-    float best_gradient_modulo_err = 0.0;
-    int best_pixel = 0;
+    // epipolar line v = -(m*u + k)
+    const float m = a/b;
+    const float k = c/b;
 
-    int vj,uj_plus,vj_plus,uj_minus,vj_minus;
-    float g, q,denomiator ,ustar , ustar_var;
+    // the pixel on the normalized plane, rotated into kf2: shared by the search range and the depth of the hypothesis
+    const Eigen::Vector3f xp((x-kf1->cx)/kf1->fx, (y-kf1->cy)/kf1->fy, 1.0f);  // inverse project on the undistorted image
+    const Eigen::Vector3f Rxp = pair.R21 * xp;
 
     float umin(0.0),umax(0.0);
-    GetSearchRange(umin,umax,x,y,min_depth,max_depth,kf1,kf2);
-    for(int uj = std::ceil(umin); uj <= std::floor(umax); uj++)
-    {
-        vj =-(int)( (a/b)*uj+(c/b));
-        if(vj<=0 || vj >= kf2->im_.rows ){continue;}
-
-        // condition 1:
-        if( kf2->GradImg.at<float>(vj,uj) < lambdaG){continue;}
-
-        // condition 2:
-        float th_epipolar_line = cv::fastAtan2(-a/b,1);
-        float temp_gradth =  kf2->GradTheta.at<float>(vj,uj);
-        float ang_diff = temp_gradth - th_epipolar_line;
-        if(ang_diff >= 360) { ang_diff -= 360; }
-        if(ang_diff < 0) { ang_diff += 360; }
-        if(ang_diff > 180) ang_diff = 360 - ang_diff;
-        if(ang_diff > 90) ang_diff = 180 - ang_diff;
-        if(ang_diff > lambdaL) { continue; }
-
-        // condition 3:
-        float ang_pi_rot = th_pi + rot;
-        if(ang_pi_rot >= 360) { ang_pi_rot -= 360; }
-        if(ang_pi_rot < 0) { ang_pi_rot += 360; }
-        float th_diff = kf2->GradTheta.at<float>(vj,uj) - ang_pi_rot;
-        if(th_diff >= 360) { th_diff -= 360; }
-        if(th_diff < 0) { th_diff += 360; }
-        if(th_diff > 180) th_diff = 360 - th_diff;
-        if(th_diff > lambdaTheta) continue;
-
-        float photometric_err = pixel - bilinear<uchar>(kf2->im_,-((a/b)*uj+(c/b)),uj);
-        float gradient_modulo_err = kf1->GradImg.at<float>(y,x)  - bilinear<float>( kf2->GradImg,-((a/b)*uj+(c/b)),uj);
-
-        float err = (photometric_err*photometric_err  + (gradient_modulo_err*gradient_modulo_err)/THETA);
-        if(err < old_err)
-        {
-            best_pixel = uj;
-            old_err = err;
-            best_photometric_err = photometric_err;
-            best_gradient_modulo_err = gradient_modulo_err;
-        }
-    }
+    GetSearchRange(umin,umax,Rxp,min_depth,max_depth,kf1,pair,sd1->im_.cols);
 
-    if(old_err < 1000000.0)
-    {
+    float th_epipolar_line = cv::fastAtan2(-m,1);
+    float ang_pi_rot = th_pi + pair.rot;
+    if(ang_pi_rot >= 360) { ang_pi_rot -= 360; }
+    if(ang_pi_rot < 0) { ang_pi_rot += 360; }
+
+    EpipolarImage img;
+    img.im = kf2->im_.ptr<uchar>(0);
+    img.im_step = kf2->im_.step[0];
+    img.grad = kf2->GradImg.ptr<float>(0);
+    img.theta = kf2->GradTheta.ptr<float>(0);
+    img.grad_step = kf2->GradImg.step[0] / sizeof(float);
+    img.rows = kf2->im_.rows;
 
-        uj_plus = best_pixel + 1;
-        uj_minus = best_pixel - 1;
+    float best_photometric_err = 0.0;
+    float best_gradient_modulo_err = 0.0;
+    int best_pixel = SearchEpipolarSegment(img, m, k, (int)std::ceil(umin), (int)std::floor(umax), pixel, sd1->GradImg.at<float>(y,x),
+                                           th_epipolar_line, ang_pi_rot, best_photometric_err, best_gradient_modulo_err);
+    if(best_pixel < 0) return;
 
-        g = (bilinear<uchar>(kf2->im_,-((a/b)*uj_plus+(c/b)),uj_plus) - bilinear<uchar>(kf2->im_,-((a/b)*uj_minus+(c/b)),uj_minus)) / 2;
-        q = (bilinear<float>(kf2->GradImg,-((a/b)*uj_plus+(c/b)),uj_plus) -  bilinear<float>(kf2->GradImg,-((a/b)*uj_minus+(c/b)),uj_minus)) / 2;
+    int uj_plus = best_pixel + 1;
+    int uj_minus = best_pixel - 1;
 
-        denomiator = (g*g + (1/THETA)*q*q);
-        ustar = best_pixel + (g*best_photometric_err + (1/THETA)*q*best_gradient_modulo_err)/denomiator;
-        ustar_var = (2*kf2->I_stddev*kf2->I_stddev/denomiator);
+    float g = (SampleColumn(img.im,img.im_step,-(m*uj_plus+k),uj_plus) - SampleColumn(img.im,img.im_step,-(m*uj_minus+k),uj_minus)) / 2;
+    float q = (SampleColumn(img.grad,img.grad_step,-(m*uj_plus+k),uj_plus) - SampleColumn(img.grad,img.grad_step,-(m*uj_minus+k),uj_minus)) / 2;
 
-        best_u = ustar;
-        best_v =  -( (a/b)*best_u + (c/b) );
+    float denomiator = (g*g + (1/THETA)*q*q);
+    if(denomiator <= 0) return;
+    float ustar = best_pixel + (g*best_photometric_err + (1/THETA)*q*best_gradient_modulo_err)/denomiator;
+    float ustar_var = (2*kf2->I_stddev*kf2->I_stddev/denomiator);
 
-        ComputeInvDepthHypothesis(kf1, kf2, ustar, ustar_var, a, b, c, dh,x,y);
-    }
+    best_u = ustar;
+    best_v = -( m*best_u + k );
 
+    ComputeInvDepthHypothesis(kf1, pair, Rxp, ustar, ustar_var, dh);
 }
 
 std::vector<float> ProbabilityMapping::GetRotInPlane(ORB_SLAM2::KeyFrame* kf1, ORB_SLAM2::KeyFrame* kf2){
     std::vector<ORB_SLAM2::MapPoint*> vMPs1 = kf1->GetMapPointMatches();
     std::vector<ORB_SLAM2::MapPoint*> vMPs2 = kf2->GetMapPointMatches();
+
+    std::unordered_map<ORB_SLAM2::MapPoint*, size_t> mMP_Idx2;
+    for (size_t idx2 = 0; idx2 < vMPs2.size(); idx2++) {
+        if (vMPs2[idx2])
+            mMP_Idx2[vMPs2[idx2]] = idx2;
+    }
+
     std::vector<float> rotInPlane;
     for (size_t idx1 = 0; idx1 < vMPs1.size(); idx1++){
-        if (vMPs1[idx1]){
-            for (size_t idx2 = 0; idx2 < vMPs2.size(); idx2++) {
-                if (vMPs2[idx2] == vMPs1[idx1]) {
-                    float angle1 = kf1->GetKeyPointsUn()[idx1].angle;
-                    float angle2 = kf2->GetKeyPointsUn()[idx2].angle;
-                    if (angle1 < 0 || angle2 < 0) continue;
-                    rotInPlane.push_back(angle2 - angle1);
-                }
-            }
-        }
+        if (!vMPs1[idx1]) continue;
+        std::unordered_map<ORB_SLAM2::MapPoint*, size_t>::iterator it = mMP_Idx2.find(vMPs1[idx1]);
+        if (it == mMP_Idx2.end()) continue;
+        float angle1 = kf1->mvKeysUn[idx1].angle;
+        float angle2 = kf2->mvKeysUn[it->second].angle;
+        if (angle1 < 0 || angle2 < 0) continue;
+        rotInPlane.push_back(angle2 - angle1);
     }
     return rotInPlane;
 }
@@ -488,9 +707,9 @@ void ProbabilityMapping::IntraKeyFrameDepthChecking(cv::Mat& depth_map, cv::Mat&
     cv::Mat depth_map_new = depth_map.clone();
     cv::Mat depth_sigma_new = depth_sigma.clone();
 
-#pragma omp parallel for schedule(dynamic) collapse(2)
-    for (int py = 2; py < (depth_map.rows - 2); py++)
+    mThreadPool.ParallelFor(std::max(depth_map.rows - 4, 0), [&](size_t i)
     {
+        const int py = 2 + i;
         for (int px = 2; px < (depth_map.cols - 2); px++)
         {
 
@@ -539,10 +758,10 @@ void ProbabilityMapping::IntraKeyFrameDepthChecking(cv::Mat& depth_map, cv::Mat&
 
             }
         }
-    }
+    });
 
-    depth_map = depth_map_new.clone();
-    depth_sigma = depth_sigma_new.clone();
+    depth_map = depth_map_new;
+    depth_sigma = depth_sigma_new;
 
 }
 
@@ -551,32 +770,37 @@ void ProbabilityMapping::IntraKeyFrameDepthGrowing(cv::Mat& depth_map, cv::Mat&
     cv::Mat depth_map_new = depth_map.clone();
     cv::Mat depth_sigma_new = depth_sigma.clone();
 
-#pragma omp parallel for schedule(dynamic) collapse(2)
-    for (int py = 2; py < (depth_map.rows - 2); py++)
+    mThreadPool.ParallelFor(std::max(depth_map.rows - 4, 0), [&](size_t i)
     {
+        const int py = 2 + i;
         for (int px = 2; px < (depth_map.cols - 2); px++)
         {
 
             if (depth_map.at<float>(py,px) < 0.000001)  // if  d ==0.0 : grow the reconstruction getting more density
             {
                 if(gradimg.at<float>(py,px)<lambdaG) continue;
-                //search supported  by at least 2 of its 8 neighbours pixels
-                std::vector< std::pair<float,float> > supported;
-
+                //search supported  by at least 2 of its 8 neighbours pixels, compatible with each other
+                std::vector< std::pair<float,float> > neighbours;
                 for( int  y = py - 1 ; y <= py+1; y++)
                     for( int  x = px - 1 ; x <= px+1; x++)
                     {
                         if(x == px && y == py) continue;
+                        if(depth_map.at<float>(y,x) > 0.000001)
+                            neighbours.push_back(std::make_pair(depth_map.at<float>(y,x), depth_sigma.at<float>(y,x)));
+                    }
 
-                        if(ChiTest(depth_map.at<float>(y,x),depth_map.at<float>(py,px),depth_sigma.at<float>(y,x),depth_sigma.at<float>(py,px)))
-                        {
-                            std::pair<float, float> depth;
-                            depth.first = depth_map.at<float>(y,x);
-                            depth.second = depth_sigma.at<float>(y,x);
-                            supported.push_back(depth);
-                        }
-
+                std::vector< std::pair<float,float> > supported;
+                for(size_t a = 0; a < neighbours.size(); a++)
+                {
+                    std::vector< std::pair<float,float> > supported_a;
+                    for(size_t b = 0; b < neighbours.size(); b++)
+                    {
+                        if(ChiTest(neighbours[a].first,neighbours[b].first,neighbours[a].second,neighbours[b].second))
+                            supported_a.push_back(neighbours[b]);
                     }
+                    if(supported_a.size() > supported.size())
+                        supported.swap(supported_a);
+                }
 
                 if(supported.size() >= 2)
                 {
@@ -588,10 +812,10 @@ void ProbabilityMapping::IntraKeyFrameDepthGrowing(cv::Mat& depth_map, cv::Mat&
             }
 
         }
-    }
+    });
 
-    depth_map = depth_map_new.clone();
-    depth_sigma = depth_sigma_new.clone();
+    depth_map = depth_map_new;
+    depth_sigma = depth_sigma_new;
 
 }
 
@@ -614,8 +838,7 @@ void ProbabilityMapping::InverseDepthHypothesisFusion(const std::vector<depthHo>
         }
 
         if (compatible_ho_temp.size() > compatible_ho.size()){
-            compatible_ho.clear();
-            compatible_ho.insert(compatible_ho.end(),compatible_ho_temp.begin(),compatible_ho_temp.end());
+            compatible_ho.swap(compatible_ho_temp);
         }
     }
 
@@ -625,135 +848,81 @@ void ProbabilityMapping::InverseDepthHypothesisFusion(const std::vector<depthHo>
     }
 }
 
-void ProbabilityMapping::InterKeyFrameDepthChecking(ORB_SLAM2::KeyFrame* currentKf, std::vector<ORB_SLAM2::KeyFrame*> neighbors) {
+void ProbabilityMapping::InterKeyFrameDepthChecking(ORB_SLAM2::KeyFrame* currentKf, SemiDenseKeyFrame* sd, std::vector<NeighbourPair>& neighbors) {
 
     // for each pixel of keyframe_i, project it onto each neighbor keyframe keyframe_j
     // and propagate inverse depth
 
-    std::vector <cv::Mat> Rji,tji;
-    for(size_t j=0; j<neighbors.size(); j++)
-    {
-        ORB_SLAM2::KeyFrame* kf2 = neighbors[ j ];
-
-        cv::Mat Rcw1 = currentKf->GetRotation();
-        cv::Mat tcw1 = currentKf->GetTranslation();
-        cv::Mat Rcw2 = kf2->GetRotation();
-        cv::Mat tcw2 = kf2->GetTranslation();
-
-        cv::Mat R21 = Rcw2*Rcw1.t();
-        cv::Mat t21 = -Rcw2*Rcw1.t()*tcw1+tcw2;
-
-        Rji.push_back(R21);
-        tji.push_back(t21);
-
-    }
-
-    int cols = currentKf->im_.cols;
-    int rows = currentKf->im_.rows;
+    int cols = sd->im_.cols;
+    int rows = sd->im_.rows;
     float fx = currentKf->fx;
     float fy = currentKf->fy;
     float cx = currentKf->cx;
     float cy = currentKf->cy;
 
-#pragma omp parallel for schedule(dynamic) collapse(2)
-    for (int py = 2; py <rows-2; py++) {
+    mThreadPool.ParallelFor(std::max(rows - 4, 0), [&](size_t i)
+    {
+        const int py = 2 + i;
+
+        // keep track of compatible pixels for the gauss-newton step
+        std::vector<std::vector<depthHo>> compatible_pixels_by_frame(neighbors.size());
+        std::vector<float> rzxp(neighbors.size());
+
         for (int px = 2; px < cols-2; px++) {
 
-            if (currentKf->depth_map_.at<float>(py,px) < 0.000001) continue;   //  if d == 0.0  continue;
+            if (sd->depth_map_.at<float>(py,px) < 0.000001) continue;   //  if d == 0.0  continue;
 
-            float depthp = currentKf->depth_map_.at<float>(py,px);
+            float depthp = sd->depth_map_.at<float>(py,px);
             // count of neighboring keyframes in which there is at least one compatible pixel
             int compatible_neighbor_keyframes_count = 0;
-
-            // keep track of compatible pixels for the gauss-newton step
-            std::vector<std::vector<depthHo>> compatible_pixels_by_frame;
             int num_compatible_pixels = 0;
 
+            const Eigen::Vector3f xp((px-cx)/fx, (py-cy)/fy, 1.0f);// inverse project on the undistorted image
+
             for(size_t j=0; j<neighbors.size(); j++) {
 
-                ORB_SLAM2::KeyFrame* pKFj = neighbors[j];
-                cv::Mat K = pKFj->GetCalibrationMatrix();
+                const Eigen::Matrix3f& Rji = neighbors[j].R21;
+                const Eigen::Vector3f& tji = neighbors[j].t21;
+                const SemiDenseKeyFrame* pSDj = neighbors[j].pSD2;
+                const ORB_SLAM2::KeyFrame* pKFj = neighbors[j].pKF2;
+                std::vector<depthHo>& compatible_pixels_J = compatible_pixels_by_frame[j];
+                compatible_pixels_J.clear();
 
-                cv::Mat xp=(cv::Mat_<float>(3,1) << (px-cx)/fx, (py-cy)/fy,1.0);// inverse project.    if has distortion, this code shoud fix
-                cv::Mat temp = Rji[j] * xp /depthp + tji[j];
-                cv::Mat Xj = K*temp;
-                Xj = Xj/Xj.at<float>(2);   //   u = u'/z   ,  v = v'/z
+                Eigen::Vector3f Rxp = Rji * xp;
+                rzxp[j] = Rxp(2);
+                Eigen::Vector3f Xj = Rxp / depthp + tji;
 
                 // Eq (12)
                 // compute the projection matrix to map 3D point from original image to 2D point in neighbor keyframe
-                temp = Rji[j].row(2) * xp;
-                float denom1 = temp.at<float>(0,0);
-                temp = depthp * tji[j].at<float>(2);
-                float denom2 = temp.at<float>(0,0);
-                float depthj = depthp / (denom1 + denom2);
+                float depthj = depthp / (Rxp(2) + depthp * tji(2));
 
-                float xj = Xj.at<float>(0);
-                float yj = Xj.at<float>(1);
+                float xj = pKFj->fx * Xj(0) / Xj(2) + pKFj->cx;   //   u = u'/z   ,  v = v'/z
+                float yj = pKFj->fy * Xj(1) / Xj(2) + pKFj->cy;
 
                 // look in 4-neighborhood pixel p_j,n around xj for compatible inverse depth
-                std::vector<depthHo> compatible_pixels_J;
-                if (xj<0 || xj>=cols-1 || yj<0 || yj>=rows-1) {
-                    // make sure kf j correspondence
-                    compatible_pixels_by_frame.push_back(compatible_pixels_J);
-                    continue;
-                }
+                if (!(xj>=0 && xj<cols-1 && yj>=0 && yj<rows-1)) continue;
                 int x0 = (int)std::floor(xj);
                 int y0 = (int )std::floor(yj);
-                int x1 = x0 + 1;
-                int y1 =  y0 + 1;
 
-                float d = pKFj->depth_map_.at<float>(y0,x0);
-                float sigma = pKFj->depth_sigma_.at<float>(y0,x0);
-                if(d>0.000001)
-                {
-                    float test = pow((depthj - d),2)/pow(sigma,2);
-                    if (test < 3.84) {
-                        depthHo dHo;
-                        dHo.depth = d;
-                        dHo.sigma = sigma;
-                        compatible_pixels_J.push_back(dHo);
-                    }
-                }
-                d = pKFj->depth_map_.at<float>(y1,x0);
-                sigma = pKFj->depth_sigma_.at<float>(y1,x0);
-                if(d>0.000001)
-                {
-                    float test = pow((depthj - d),2)/pow(sigma,2);
-                    if (test < 3.84) {
-                        depthHo dHo;
-                        dHo.depth = d;
-                        dHo.sigma = sigma;
-                        compatible_pixels_J.push_back(dHo);
-                    }
-                }
-                d = pKFj->depth_map_.at<float>(y0,x1);
-                sigma = pKFj->depth_sigma_.at<float>(y0,x1);
-                if(d>0.000001)
-                {
-                    float test = pow((depthj - d),2)/pow(sigma,2);
-                    if (test < 3.84) {
-                        depthHo dHo;
-                        dHo.depth = d;
-                        dHo.sigma = sigma;
-                        compatible_pixels_J.push_back(dHo);
-                    }
-                }
-                d = pKFj->depth_map_.at<float>(y1,x1);
-                sigma = pKFj->depth_sigma_.at<float>(y1,x1);
-                if(d>0.000001)
-                {
-                    float test = pow((depthj - d),2)/pow(sigma,2);
-                    if (test < 3.84) {
-                        depthHo dHo;
-                        dHo.depth = d;
-                        dHo.sigma = sigma;
-                        compatible_pixels_J.push_back(dHo);
+                for (int yn = y0; yn <= y0 + 1; yn++) {
+                    for (int xn = x0; xn <= x0 + 1; xn++) {
+                        float d = pSDj->depth_map_.at<float>(yn,xn);
+                        float sigma = pSDj->depth_sigma_.at<float>(yn,xn);
+                        if(d>0.000001)
+                        {
+                            float test = (depthj - d)*(depthj - d)/(sigma*sigma);
+                            if (test < 3.84) {
+                                depthHo dHo;
+                                dHo.depth = d;
+                                dHo.sigma = sigma;
+                                compatible_pixels_J.push_back(dHo);
+                            }
+                        }
                     }
                 }
 
                 // at least one compatible pixel p_j,n must be found in at least lambdaN neighbor keyframes
                 if (compatible_pixels_J.size() >= 1) {compatible_neighbor_keyframes_count++;}
-                compatible_pixels_by_frame.push_back(compatible_pixels_J);
                 num_compatible_pixels += compatible_pixels_J.size();
 
             } // for j = 0...neighbors.size()-1
@@ -761,40 +930,35 @@ void ProbabilityMapping::InterKeyFrameDepthChecking(ORB_SLAM2::KeyFrame* current
             // don't retain the inverse depth distribution of this pixel if not enough support in neighbor keyframes
             if (compatible_neighbor_keyframes_count < lambdaN )
             {
-                currentKf->depth_map_.at<float>(py,px) = 0.0;
+                sd->depth_map_.at<float>(py,px) = 0.0;
             }
             else {
-                // gauss newton smoothing
-                cv::Mat xp=(cv::Mat_<float>(3,1) << (px-cx)/fx, (py-cy)/fy,1.0);
+                // gauss newton smoothing, a single unknown: dpDelta = -(J'r0) / (J'J)
                 float dp = 1/depthp;
 
-                cv::Mat J = cv::Mat(num_compatible_pixels,1,CV_32F);
-                cv::Mat r0 = cv::Mat(num_compatible_pixels,1,CV_32F);
-                int idxJN = 0;
+                float JtJ = 0;
+                float Jtr0 = 0;
                 for (size_t j = 0; j < compatible_pixels_by_frame.size(); j++){
-                    std::vector<depthHo>& compatibleJ = compatible_pixels_by_frame[j];
+                    const std::vector<depthHo>& compatibleJ = compatible_pixels_by_frame[j];
                     for (size_t n = 0; n < compatibleJ.size(); n++){
-                        cv::Mat rzxp = Rji[j].row(2) * xp;
                         float djn = 1/compatibleJ[n].depth;
                         float sigmajn = compatibleJ[n].sigma;
                         float d2sigma = djn*djn * sigmajn;
 
-                        J.at<float>(idxJN,0) = - rzxp.at<float>(0,0) / d2sigma;
-                        r0.at<float>(idxJN,0) = (djn - dp*rzxp.at<float>(0,0) - tji[j].at<float>(2,0)) / d2sigma;
-
-                        idxJN++;
+                        float J = - rzxp[j] / d2sigma;
+                        float r0 = (djn - dp*rzxp[j] - neighbors[j].t21(2)) / d2sigma;
+                        JtJ += J*J;
+                        Jtr0 -= J*r0;
                     }
                 }
-                cv::Mat Jtr0 = - J.t() * r0;
-                cv::Mat JtJ = J.t() * J;
 
-                float dpDelta = Jtr0.at<float>(0,0) / JtJ.at<float>(0,0);
+                float dpDelta = Jtr0 / JtJ;
 
-                currentKf->depth_map_.at<float>(py,px) = 1/ (dp + dpDelta);
+                sd->depth_map_.at<float>(py,px) = 1/ (dp + dpDelta);
             }
 
-        } // for py = 0...im.cols-1
-    } // for px = 0...im.rows-1
+        } // for px = 0...im.cols-1
+    }); // for py = 0...im.rows-1
 
 }
 
@@ -803,24 +967,24 @@ void ProbabilityMapping::InterKeyFrameDepthChecking(ORB_SLAM2::KeyFrame* current
 // Utility functions
 ////////////////////////
 
-void ProbabilityMapping::ComputeInvDepthHypothesis(ORB_SLAM2::KeyFrame* kf, ORB_SLAM2::KeyFrame* kf2, float ustar, float ustar_var,
-                                                   float a, float b, float c,ProbabilityMapping::depthHo *dh, int x,int y) {
+void ProbabilityMapping::ComputeInvDepthHypothesis(ORB_SLAM2::KeyFrame* kf, const NeighbourPair& pair, const Eigen::Vector3f& Rxp,
+                                                   float ustar, float ustar_var, ProbabilityMapping::depthHo *dh) {
 
     float inv_pixel_depth =  0.0;
 
     // equation 8 comput depth
-    GetPixelDepth(ustar, x , y,kf, kf2,inv_pixel_depth);
+    GetPixelDepth(ustar, Rxp, kf, pair, inv_pixel_depth);
 
     float ustar_min = ustar - sqrt(ustar_var);
     float inv_depth_min = 0.0;
-    GetPixelDepth(ustar_min,x,y,kf,kf2, inv_depth_min);
+    GetPixelDepth(ustar_min, Rxp, kf, pair, inv_depth_min);
 
     float ustar_max = ustar +  sqrt(ustar_var);
     float inv_depth_max = 0.0;
-    GetPixelDepth(ustar_max,x,y,kf, kf2,inv_depth_max);
+    GetPixelDepth(ustar_max, Rxp, kf, pair, inv_depth_max);
 
     // Equation 9
-    float sigma_depth = cv::max(abs(inv_depth_max-inv_pixel_depth), abs(inv_depth_min-inv_pixel_depth));
+    float sigma_depth = std::max(std::fabs(inv_depth_max-inv_pixel_depth), std::fabs(inv_depth_min-inv_pixel_depth));
 
     dh->depth = inv_pixel_depth;
     dh->sigma = sigma_depth;
@@ -828,74 +992,37 @@ void ProbabilityMapping::ComputeInvDepthHypothesis(ORB_SLAM2::KeyFrame* kf, ORB_
 
 }
 
-//Xp = K-1 * xp (below Equation 8)
-// map 2D pixel coordinate to 3D point
-void ProbabilityMapping::GetXp(const cv::Mat& k, int px, int py, cv::Mat* xp) {
-
-    cv::Mat xp2d = cv::Mat(3,1,CV_32F);
-
-    xp2d.at<float>(0,0) = px;
-    xp2d.at<float>(1,0) = py;
-    xp2d.at<float>(2,0) = 1;
-
-    *xp = k.inv() * xp2d;
-}
-
 // Equation (8)
-void ProbabilityMapping::GetPixelDepth(float uj, int px, int py, ORB_SLAM2::KeyFrame* kf,ORB_SLAM2::KeyFrame* kf2, float &p) {
+void ProbabilityMapping::GetPixelDepth(float uj, const Eigen::Vector3f& Rxp, ORB_SLAM2::KeyFrame* kf, const NeighbourPair& pair, float &p) {
 
     float fx = kf->fx;
     float cx = kf->cx;
-    float fy = kf->fy;
-    float cy = kf->cy;
 
     float ucx = uj - cx;
 
-    cv::Mat Rcw1 = kf->GetRotation();
-    cv::Mat tcw1 = kf->GetTranslation();
-    cv::Mat Rcw2 = kf2->GetRotation();
-    cv::Mat tcw2 = kf2->GetTranslation();
-
-    cv::Mat R21 = Rcw2*Rcw1.t();
-    cv::Mat t21 = -Rcw2*Rcw1.t()*tcw1+tcw2;
-
-    cv::Mat xp=(cv::Mat_<float>(3,1) << (px-cx)/fx, (py-cy)/fy,1.0);// inverse project.    if has distortion, this code shoud fix
+    const Eigen::Vector3f& t21 = pair.t21;
 
-    //GetXp(kf->GetCalibrationMatrix(), px, py, &xp);
-
-    cv::Mat temp = R21.row(2) * xp * ucx;
-    float num1 = temp.at<float>(0,0);
-    temp = fx * (R21.row(0) * xp);
-    float num2 = temp.at<float>(0,0);
-    float denom1 = -t21.at<float>(2) * ucx;
-    float denom2 = fx * t21.at<float>(0);
+    float num1 = Rxp(2) * ucx;
+    float num2 = fx * Rxp(0);
+    float denom1 = -t21(2) * ucx;
+    float denom2 = fx * t21(0);
 
     p = (num1 - num2) / (denom1 + denom2);
 
 }
 
-void ProbabilityMapping::GetSearchRange(float& umin, float& umax, int px, int py,float mind,float maxd,
-                                        ORB_SLAM2::KeyFrame* kf,ORB_SLAM2::KeyFrame* kf2)
+void ProbabilityMapping::GetSearchRange(float& umin, float& umax, const Eigen::Vector3f& Rxp, float mind, float maxd,
+                                        ORB_SLAM2::KeyFrame* kf, const NeighbourPair& pair, int cols)
 {
     float fx = kf->fx;
     float cx = kf->cx;
-    float fy = kf->fy;
-    float cy = kf->cy;
-
-    cv::Mat Rcw1 = kf->GetRotation();
-    cv::Mat tcw1 = kf->GetTranslation();
-    cv::Mat Rcw2 = kf2->GetRotation();
-    cv::Mat tcw2 = kf2->GetTranslation();
 
-    cv::Mat R21 = Rcw2*Rcw1.t();
-    cv::Mat t21 = -Rcw2*Rcw1.t()*tcw1+tcw2;
+    // mind and maxd are inverse depths
+    Eigen::Vector3f xp2_min = Rxp/mind + pair.t21;
+    Eigen::Vector3f xp2_max = Rxp/maxd + pair.t21;
 
-    cv::Mat xp1=(cv::Mat_<float>(3,1) << (px-cx)/fx, (py-cy)/fy,1.0);  // inverse project.    if has distortion, this code shoud fix
-    cv::Mat xp2_min = R21*xp1*mind+t21;
-    cv::Mat xp2_max = R21*xp1*maxd+t21;
-
-    umin = fx*xp2_min.at<float>(0)/xp2_min.at<float>(2) + cx;
-    umax = fx*xp2_max.at<float>(0)/xp2_max.at<float>(2) + cx;
+    umin = fx*xp2_min(0)/xp2_min(2) + cx;
+    umax = fx*xp2_max(0)/xp2_max(2) + cx;
 
     if (umin > umax){
         float temp = umax;
@@ -903,10 +1030,11 @@ void ProbabilityMapping::GetSearchRange(float& umin, float& umax, int px, int py
         umin = temp;
     }
 
-    if(umin<0) umin = 0;
-    if(umax<0) umax = 0;
-    if(umin>kf->im_.cols ) umin = kf->im_.cols;
-    if(umax>kf->im_.cols)  umax = kf->im_.cols;
+    // one pixel of margin on each side for the sub-pixel step
+    if(umin<1) umin = 1;
+    if(umax<1) umax = 1;
+    if(umin>cols-2) umin = cols-2;
+    if(umax>cols-2) umax = cols-2;
 }
 
 bool ProbabilityMapping::ChiTest(const depthHo& ha, const depthHo& hb, float* chi_val) {
@@ -969,19 +1097,96 @@ void ProbabilityMapping::GetFusion(const std::vector<depthHo>& compatible_ho, de
     }
 }
 
-cv::Mat ProbabilityMapping::ComputeFundamental( ORB_SLAM2::KeyFrame *&pKF1,  ORB_SLAM2::KeyFrame *&pKF2) {
-    cv::Mat R1w = pKF1->GetRotation();
-    cv::Mat t1w = pKF1->GetTranslation();
-    cv::Mat R2w = pKF2->GetRotation();
-    cv::Mat t2w = pKF2->GetTranslation();
+Eigen::Matrix3f ProbabilityMapping::ComputeFundamental( ORB_SLAM2::KeyFrame *&pKF1,  ORB_SLAM2::KeyFrame *&pKF2) {
+    Eigen::Matrix3f R1w = toMatrix3f(pKF1->GetRotation());
+    Eigen::Vector3f t1w = toVector3f(pKF1->GetTranslation());
+    Eigen::Matrix3f R2w = toMatrix3f(pKF2->GetRotation());
+    Eigen::Vector3f t2w = toVector3f(pKF2->GetTranslation());
+
+    Eigen::Matrix3f R12 = R1w*R2w.transpose();
+    Eigen::Vector3f t12 = -R12*t2w+t1w;
+
+    Eigen::Matrix3f t12x = GetSkewSymmetricMatrix(t12);
+
+    Eigen::Matrix3f K1 = toMatrix3f(pKF1->mK);
+    Eigen::Matrix3f K2 = toMatrix3f(pKF2->mK);
+
+    return K1.transpose().inverse()*t12x*R12*K2.inverse();
+}
+
+Eigen::Matrix3f ProbabilityMapping::GetSkewSymmetricMatrix(const Eigen::Vector3f &v)
+{
+    Eigen::Matrix3f S;
+    S <<     0, -v(2),  v(1),
+          v(2),     0, -v(0),
+         -v(1),  v(0),     0;
+    return S;
+}
+
+
+////////////////////////
+// Thread synch
+////////////////////////
+
+void ProbabilityMapping::RequestReset()
+{
+    {
+        std::unique_lock<std::mutex> lock(mMutexReset);
+        mbResetRequested = true;
+    }
+
+    while(1)
+    {
+        {
+            std::unique_lock<std::mutex> lock2(mMutexReset);
+            if(!mbResetRequested)
+                break;
+        }
+        usleep(100);
+    }
+}
+
+void ProbabilityMapping::ResetIfRequested()
+{
+    std::unique_lock<std::mutex> lock(mMutexReset);
+    if(mbResetRequested)
+    {
+        // the keyframes of the old map are about to be deleted
+        {
+            std::unique_lock<std::mutex> lock2(mMutexNewKFs);
+            mlNewKeyFrames.clear();
+        }
+        mmSemiDense.clear();
+        mlKeyFrameOrder.clear();
+        {
+            std::unique_lock<std::mutex> lock2(mMutexPointSets);
+            mmPointSets.clear();
+        }
+
+        mbResetRequested = false;
+    }
+}
 
-    cv::Mat R12 = R1w*R2w.t();
-    cv::Mat t12 = -R1w*R2w.t()*t2w+t1w;
+void ProbabilityMapping::RequestFinish()
+{
+    std::unique_lock<std::mutex> lock(mMutexFinish);
+    mbFinishRequested = true;
+}
 
-    cv::Mat t12x = GetSkewSymmetricMatrix(t12);
+bool ProbabilityMapping::CheckFinish()
+{
+    std::unique_lock<std::mutex> lock(mMutexFinish);
+    return mbFinishRequested;
+}
 
-    cv::Mat K1 = pKF1->GetCalibrationMatrix();
-    cv::Mat K2 = pKF2->GetCalibrationMatrix();
+void ProbabilityMapping::SetFinish()
+{
+    std::unique_lock<std::mutex> lock(mMutexFinish);
+    mbFinished = true;
+}
 
-    return K1.t().inv()*t12x*R12*K2.inv();
+bool ProbabilityMapping::isFinished()
+{
+    std::unique_lock<std::mutex> lock(mMutexFinish);
+    return mbFinished;
 }
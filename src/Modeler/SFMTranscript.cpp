@@ -10,6 +10,7 @@
 #include "Modeler/StringFunctions.h"
 #include "Modeler/Exception.h"
 #include "Modeler/Matrix.h"
+#include "Modeler/BinaryIO.h"
 
 namespace dlovi{
     namespace compvis{
@@ -22,11 +23,19 @@ namespace dlovi{
             m_enumTranscriptType = TT_UNKNOWN;
             m_bValid = false;
             m_nNumEntries = 0;
-            currentNum = 0;
+            m_arrLineChunks.assign(MAX_CHUNKS, NULL);
+            m_nNumLines = 0;
+            m_nFirstRetainedLine = 0;
+            m_nCompactedLine = 0;
+            m_nLineOffset = 0;
+            m_nStepLineIndex = 0;
+            m_nNewCommandLine = 0;
+            m_bNewCommandsTracked = false;
         }
 
         SFMTranscript::~SFMTranscript(){
-            // NOP
+            for(int nChunk = 0; nChunk < MAX_CHUNKS; nChunk++)
+                delete[] m_arrLineChunks[nChunk];
         }
 
         // Getters
@@ -51,16 +60,27 @@ namespace dlovi{
 
         int SFMTranscript::numLines() const{
             try{
-                return (int)m_arrStrLine.size();
+                return m_nNumLines.load(std::memory_order_acquire);
             }
             catch(std::exception & ex){
                 dlovi::Exception ex2(ex.what()); ex2.tag("SFMTranscript", "numLines"); ex2.raise();
             }
         }
 
-        std::string SFMTranscript::getLine(const int nLineIndex) const{
+        int SFMTranscript::firstRetainedLine() const{
             try{
-                return m_arrStrLine[nLineIndex];
+                return m_nFirstRetainedLine;
+            }
+            catch(std::exception & ex){
+                dlovi::Exception ex2(ex.what()); ex2.tag("SFMTranscript", "firstRetainedLine"); ex2.raise();
+            }
+        }
+
+        const std::string & SFMTranscript::getLine(const int nLineIndex) const{
+            try{
+                if(nLineIndex < m_nFirstRetainedLine || nLineIndex >= numLines())
+                    throw dlovi::Exception("Line index out of range or already released.");
+                return m_arrLineChunks[nLineIndex >> LINES_PER_CHUNK_LOG2][nLineIndex & (LINES_PER_CHUNK - 1)];
             }
             catch(std::exception & ex){
                 dlovi::Exception ex2(ex.what()); ex2.tag("SFMTranscript", "getLine"); ex2.raise();
@@ -157,6 +177,15 @@ namespace dlovi{
             }
         }
 
+        int SFMTranscript::getStepLineIndex() const{
+            try{
+                return m_nStepLineIndex;
+            }
+            catch(std::exception & ex){
+                dlovi::Exception ex2(ex.what()); ex2.tag("SFMTranscript", "getStepLineIndex"); ex2.raise();
+            }
+        }
+
         bool SFMTranscript::isIncrementalSFM() const{
             try{
                 bool retVal;
@@ -187,8 +216,32 @@ namespace dlovi{
             }
         }
 
+        bool SFMTranscript::hasAllLines() const{
+            try{
+                return m_nFirstRetainedLine == 0 && m_nCompactedLine == 0 && m_nLineOffset == 0;
+            }
+            catch(std::exception & ex){
+                dlovi::Exception ex2(ex.what()); ex2.tag("SFMTranscript", "hasAllLines"); ex2.raise();
+            }
+        }
+
         // Setters
 
+        void SFMTranscript::setSpillFile(const std::string & strFileName){
+            try{
+                m_strSpillFileName = strFileName;
+                if(! m_strSpillFileName.empty()){
+                    // Start from an empty file
+                    std::ofstream fileOut(m_strSpillFileName.c_str(), std::ios::out | std::ios::trunc);
+                    if(!fileOut)
+                        throw dlovi::Exception("Could not open spill file");
+                }
+            }
+            catch(std::exception & ex){
+                dlovi::Exception ex2(ex.what()); ex2.tag("SFMTranscript", "setSpillFile"); ex2.raise();
+            }
+        }
+
         // Public Methods
 
         void SFMTranscript::readFromFile(const std::string & strFileName){
@@ -217,7 +270,25 @@ namespace dlovi{
                 if(!fileOut)
                     throw dlovi::Exception("Could not open file");
 
-                for(int i = 0; i < numLines(); i++)
+                // The header is gone from the line storage once the transcript has been compacted.  It is written back
+                // with the absolute index of the first body line, which must match the checkpoint's (see writeStepState).
+                if(m_nCompactedLine > 0){
+                    for(std::vector<std::string>::const_iterator it = m_arrStrHeaderLines.begin(); it != m_arrStrHeaderLines.end(); it++)
+                        fileOut << *it << "\n";
+                    fileOut << "Compacted: " << m_nCompactedLine + m_nLineOffset << "\n";
+                    fileOut << "*** BODY ***" << "\n";
+                }
+
+                // Released lines next
+                if(m_nFirstRetainedLine > m_nCompactedLine && ! m_strSpillFileName.empty()){
+                    std::ifstream fileSpill(m_strSpillFileName.c_str(), std::ios::in);
+                    if(!fileSpill)
+                        throw dlovi::Exception("Could not open spill file");
+                    fileOut << fileSpill.rdbuf();
+                }
+
+                int nNumLines = numLines();
+                for(int i = std::max(m_nFirstRetainedLine, m_nCompactedLine); i < nNumLines; i++)
                     fileOut << getLine(i) << "\n";
                 fileOut.flush();
                 fileOut.close();
@@ -240,14 +311,12 @@ namespace dlovi{
 
         void SFMTranscript::stepTranscriptText(bool bFirstEntry){
             try{
-                static int nLineIndex = 0;
-
                 if(bFirstEntry)
-                    nLineIndex = parseTranscriptHeader();
+                    m_nStepLineIndex = parseTranscriptHeader();
 
-                nLineIndex = stepTranscriptBody(m_enumStepEntryType, m_objStepEntryData, m_arrStepPoints, m_arrStepCamCenters, m_arrStepVisLists, nLineIndex);
+                m_nStepLineIndex = stepTranscriptBody(m_enumStepEntryType, m_objStepEntryData, m_arrStepPoints, m_arrStepCamCenters, m_arrStepVisLists, m_nStepLineIndex);
 
-                if(nLineIndex >= numLines())
+                if(m_nStepLineIndex >= numLines())
                     markAsValid(); // we're done.
             }
             catch(std::exception & ex){
@@ -257,8 +326,15 @@ namespace dlovi{
 
         void SFMTranscript::addLine(const std::string & line){
             try{
-                m_arrStrLine.push_back(line);
-                bufferCommand.push_back(line);
+                int nLineIndex = m_nNumLines.load(std::memory_order_relaxed);
+                int nChunk = nLineIndex >> LINES_PER_CHUNK_LOG2;
+                if(nChunk >= MAX_CHUNKS)
+                    throw dlovi::Exception("Transcript is full.");
+                if(m_arrLineChunks[nChunk] == NULL)
+                    m_arrLineChunks[nChunk] = new std::string[LINES_PER_CHUNK];
+
+                m_arrLineChunks[nChunk][nLineIndex & (LINES_PER_CHUNK - 1)] = line;
+                m_nNumLines.store(nLineIndex + 1, std::memory_order_release); // publish
                 invalidate();
             }
             catch(std::exception & ex){
@@ -266,38 +342,123 @@ namespace dlovi{
             }
         }
 
-        std::string SFMTranscript::getNewCommand()
-        {
-          std::stringstream ssTmp;
-          if (bufferCommand.size()>0)
-          {
-            for(int i = 0; i<bufferCommand.size(); i++)
-            {
-              if(bufferCommand[i].find("SFM Transcript:") == std::string::npos && bufferCommand[i].find("*** BODY ***") == std::string::npos)
-                  ssTmp<<bufferCommand[i]<<"@";
+        void SFMTranscript::releaseLinesBefore(int nLineIndex){
+            try{
+                if(m_bNewCommandsTracked)
+                    nLineIndex = std::min(nLineIndex, m_nNewCommandLine);
+                nLineIndex = std::min(nLineIndex, numLines());
+
+                // Only whole chunks are released
+                int nFirstChunk = m_nFirstRetainedLine >> LINES_PER_CHUNK_LOG2;
+                int nEndChunk = nLineIndex >> LINES_PER_CHUNK_LOG2;
+                if(nEndChunk <= nFirstChunk)
+                    return;
+
+                std::ofstream fileSpill;
+                if(! m_strSpillFileName.empty()){
+                    fileSpill.open(m_strSpillFileName.c_str(), std::ios::out | std::ios::app);
+                    if(!fileSpill)
+                        throw dlovi::Exception("Could not open spill file");
+                }
+
+                for(int nChunk = nFirstChunk; nChunk < nEndChunk; nChunk++){
+                    if(fileSpill.is_open()){
+                        for(int i = 0; i < LINES_PER_CHUNK; i++){
+                            if((nChunk << LINES_PER_CHUNK_LOG2) + i >= m_nCompactedLine)
+                                fileSpill << m_arrLineChunks[nChunk][i] << "\n";
+                        }
+                    }
+                    delete[] m_arrLineChunks[nChunk];
+                    m_arrLineChunks[nChunk] = NULL;
+                }
+                m_nFirstRetainedLine = nEndChunk << LINES_PER_CHUNK_LOG2;
             }
+            catch(std::exception & ex){
+                dlovi::Exception ex2(ex.what()); ex2.tag("SFMTranscript", "releaseLinesBefore"); ex2.raise();
+            }
+        }
+
+        void SFMTranscript::compactBefore(int nLineIndex){
+            try{
+                // Whatever was spilled so far lies before nLineIndex (lines are only released once consumed)
+                m_nCompactedLine = std::max(m_nCompactedLine, std::min(nLineIndex, numLines()));
+                if(! m_strSpillFileName.empty()){
+                    std::ofstream fileSpill(m_strSpillFileName.c_str(), std::ios::out | std::ios::trunc);
+                    if(!fileSpill)
+                        throw dlovi::Exception("Could not open spill file");
+                }
+                releaseLinesBefore(m_nCompactedLine);
+            }
+            catch(std::exception & ex){
+                dlovi::Exception ex2(ex.what()); ex2.tag("SFMTranscript", "compactBefore"); ex2.raise();
+            }
+        }
+
+        void SFMTranscript::writeStepState(std::ostream & out) const{
+            try{
+                binaryio::write<int>(out, (int)getTranscriptType());
+                binaryio::write<int>(out, m_nStepLineIndex + m_nLineOffset);
+                binaryio::writeVec3Array(out, m_arrStepPoints);
+                binaryio::writeVec3Array(out, m_arrStepCamCenters);
+                binaryio::writeIndexLists(out, m_arrStepVisLists);
+            }
+            catch(std::exception & ex){
+                dlovi::Exception ex2(ex.what()); ex2.tag("SFMTranscript", "writeStepState"); ex2.raise();
+            }
+        }
 
-            std::string rtStr = ssTmp.str();
-            rtStr = rtStr.substr(0, rtStr.size()-1);//remove the last @
-            bufferCommand.clear();
-            return rtStr;
+        void SFMTranscript::resumeFromStepState(std::istream & in){
+            try{
+                // The body of a compacted transcript continues right after its header
+                m_nStepLineIndex = parseTranscriptHeader();
+                if((int)getTranscriptType() != binaryio::read<int>(in))
+                    throw dlovi::Exception("Transcript type does not match the checkpoint.");
+                // Lines are counted from the start of the whole transcript, whatever was compacted away since
+                if(m_nStepLineIndex + m_nLineOffset != binaryio::read<int>(in))
+                    throw dlovi::Exception("Transcript does not start at the line the checkpoint covers.");
+                binaryio::readVec3Array(in, m_arrStepPoints);
+                binaryio::readVec3Array(in, m_arrStepCamCenters);
+                binaryio::readIndexLists(in, m_arrStepVisLists);
+                m_enumStepEntryType = ET_INVALID;
+                m_objStepEntryData.clear();
+
+                if(m_nStepLineIndex >= numLines())
+                    markAsValid();
+                else
+                    invalidate();
+            }
+            catch(std::exception & ex){
+                dlovi::Exception ex2(ex.what()); ex2.tag("SFMTranscript", "resumeFromStepState"); ex2.raise();
+            }
+        }
+
+        void SFMTranscript::trackNewLines()
+        {
+          m_bNewCommandsTracked = true;
+        }
+
+        void SFMTranscript::getNewLines(std::vector<std::string> & arrLines)
+        {
+          m_bNewCommandsTracked = true;
+
+          arrLines.clear();
+          int nNumLines = numLines();
+          if (m_nNewCommandLine < m_nFirstRetainedLine)
+            m_nNewCommandLine = m_nFirstRetainedLine; // released before the first call
+          for(int i = m_nNewCommandLine; i<nNumLines; i++)
+          {
+            const std::string & strLine = getLine(i);
+            if(strLine.find("SFM Transcript:") == std::string::npos && strLine.find("*** BODY ***") == std::string::npos)
+              arrLines.push_back(strLine);
           }
-          else
-            return "";
-          // if(currentNum < m_arrStrLine.size())
-          // {
-          //   std::stringstream ssTmp;
-          //   for(int i = currentNum; i<m_arrStrLine.size(); i++){
-          //     if(m_arrStrLine[i].find("SFM Transcript: ") == std::string::npos && m_arrStrLine[i].find("SFM Transcript: ") == std::string::npos)
-          //       ssTmp<<m_arrStrLine[i]<<"@";
-          //   }
-          //   std::string rtStr = ssTmp.str();
-          //   rtStr = rtStr.substr(0, rtStr.size()-1);//remove the last @
-          //   currentNum = m_arrStrLine.size();
-          //   return rtStr;
-          // }
-          // else
-          //   return "";
+          m_nNewCommandLine = nNumLines;
+        }
+
+        std::string SFMTranscript::getNewCommand()
+        {
+          std::vector<std::string> arrLines;
+          getNewLines(arrLines);
+          return join(arrLines, "@");
         }
 
         void SFMTranscript::invalidate(){
@@ -365,14 +526,28 @@ namespace dlovi{
             try{
                 std::string strCurrentLine;
                 bool bInHeader = true;
+                int nCompactedLine = -1;
+
+                // Kept for writing out a compacted transcript (without the lines rewritten then)
+                m_arrStrHeaderLines.clear();
 
                 for( ; nLoop < numLines() && bInHeader; nLoop++){
                     strCurrentLine = trim(getLine(nLoop));
 
                     if(strCurrentLine.empty())
                         continue;
-                    else if(strCurrentLine == "*** BODY ***")
+                    else if(strCurrentLine == "*** BODY ***"){
                         bInHeader = false;
+                        continue;
+                    }
+                    else if(strCurrentLine.find("Compacted: ") == 0){
+                        // The body starts at this line of the whole transcript
+                        std::vector<std::string> arrStr = split(strCurrentLine, " ");
+                        nCompactedLine = atoi(arrStr[1].c_str());
+                        if(nCompactedLine <= 0)
+                            throw dlovi::Exception("Bad compacted line in transcript header.");
+                        continue;
+                    }
                     else if(strCurrentLine.find("SFM Transcript: ") != std::string::npos){
                         std::vector<std::string> arrStr = split(strCurrentLine, " ");
                         if(arrStr[2] == "PTAM")
@@ -383,6 +558,7 @@ namespace dlovi{
                             setTranscriptType(TT_UNKNOWN);
                             throw dlovi::Exception("Transcript type not recognized.");
                         }
+                        m_arrStrHeaderLines.push_back(getLine(nLoop));
                     }
                     else{
                         setTranscriptType(TT_UNKNOWN);
@@ -393,6 +569,9 @@ namespace dlovi{
                 if(getTranscriptType() == TT_UNKNOWN)
                     throw dlovi::Exception("Empty Header.");
 
+                // Line i of a compacted transcript is line i + m_nLineOffset of the whole transcript
+                m_nLineOffset = nCompactedLine > 0 ? nCompactedLine - nLoop : 0;
+
                 return nLoop;
             }
             catch(std::exception & ex){
@@ -5,6 +5,15 @@
 #include <set>
 #include "Modeler/Exception.h"
 #include "Modeler/Matrix.h"
+#include "Modeler/FixedMatrix.h"
+#include "Modeler/BinaryIO.h"
+#include "Modeler/MeshWriter.h"
+#include <fstream>
+#include <sstream>
+#include <cstring>
+#include <cstdio>
+#include <cmath>
+#include <algorithm>
 #include <sys/time.h>
 
 //#include "FreespaceDelaunayAlgorithm.h"
@@ -16,6 +25,8 @@
 using namespace std;
 using namespace dlovi;
 
+static const char CHECKPOINT_MAGIC[8] = {'C', 'A', 'R', 'V', 'C', 'K', 'P', '2'};
+
 // Constructors and Destructors
 
 SFMTranscriptInterface_Delaunay::SFMTranscriptInterface_Delaunay(){
@@ -23,6 +34,18 @@ SFMTranscriptInterface_Delaunay::SFMTranscriptInterface_Delaunay(){
         setTranscriptRef(NULL);
         setAlgorithmRef(NULL);
         m_nCurrentEntryIndex = 0;
+        m_bModelOutdated = false;
+        m_nEntriesSinceModelUpdate = 0;
+        m_nModelUpdateBatchSize = 500;
+        m_dModelUpdateInterval = 5.0;
+        m_dLastModelUpdate = 0.0;
+        m_nNumModelUpdates = 0;
+        m_dMinVertexDisplacement = 1e-3;
+        m_dWindowRadius = 0.0;
+        m_bWindowCenterSet = false;
+        m_nNumWindowTiles = 0;
+        m_bRegionSet = false;
+        m_bSkippedGeometry = false;
     }
     catch(std::exception & ex){
         dlovi::Exception ex2(ex.what()); ex2.tag("SFMTranscriptInterface_Delaunay", "SFMTranscriptInterface_Delaunay"); cerr << ex2.what() << endl; //ex2.raise();
@@ -34,6 +57,18 @@ SFMTranscriptInterface_Delaunay::SFMTranscriptInterface_Delaunay(dlovi::compvis:
         setTranscriptRef(pTranscript);
         setAlgorithmRef(pAlgorithm);
         m_nCurrentEntryIndex = 0;
+        m_bModelOutdated = false;
+        m_nEntriesSinceModelUpdate = 0;
+        m_nModelUpdateBatchSize = 500;
+        m_dModelUpdateInterval = 5.0;
+        m_dLastModelUpdate = 0.0;
+        m_nNumModelUpdates = 0;
+        m_dMinVertexDisplacement = 1e-3;
+        m_dWindowRadius = 0.0;
+        m_bWindowCenterSet = false;
+        m_nNumWindowTiles = 0;
+        m_bRegionSet = false;
+        m_bSkippedGeometry = false;
     }
     catch(std::exception & ex){
         dlovi::Exception ex2(ex.what()); ex2.tag("SFMTranscriptInterface_Delaunay", "SFMTranscriptInterface_Delaunay"); cerr << ex2.what() << endl; //ex2.raise();
@@ -56,6 +91,26 @@ std::pair<vector<Matrix>, list<Matrix> > SFMTranscriptInterface_Delaunay::getCur
     }
 }
 
+std::vector<int> SFMTranscriptInterface_Delaunay::getCurrentModelPointIndices() const{
+    try{
+        return m_arrModelPointIndices;
+    }
+    catch(std::exception & ex){
+        dlovi::Exception ex2(ex.what()); ex2.tag("SFMTranscriptInterface_Delaunay", "getCurrentModelPointIndices"); cerr << ex2.what() << endl; //ex2.raise();
+        return std::vector<int>();
+    }
+}
+
+std::pair<vector<Matrix>, list<Matrix> > SFMTranscriptInterface_Delaunay::getFrozenModel() const{
+    try{
+        return std::make_pair(m_arrFrozenPoints, m_lstFrozenTris);
+    }
+    catch(std::exception & ex){
+        dlovi::Exception ex2(ex.what()); ex2.tag("SFMTranscriptInterface_Delaunay", "getFrozenModel"); cerr << ex2.what() << endl; //ex2.raise();
+        return std::pair<vector<Matrix>, list<Matrix> >();
+    }
+}
+
 dlovi::compvis::SFMTranscript::EntryType SFMTranscriptInterface_Delaunay::getCurrentEntryType() const{
     try{
         return m_pTranscript->getEntryType_Step();
@@ -136,6 +191,26 @@ int SFMTranscriptInterface_Delaunay::numFreeSpaceConstraintsInTriangulation() co
     }
 }
 
+int SFMTranscriptInterface_Delaunay::numModelUpdates() const{
+    try{
+        return m_nNumModelUpdates;
+    }
+    catch(std::exception & ex){
+        dlovi::Exception ex2(ex.what()); ex2.tag("SFMTranscriptInterface_Delaunay", "numModelUpdates"); cerr << ex2.what() << endl; //ex2.raise();
+        return -1;
+    }
+}
+
+double SFMTranscriptInterface_Delaunay::getMinVertexDisplacement() const{
+    try{
+        return m_dMinVertexDisplacement;
+    }
+    catch(std::exception & ex){
+        dlovi::Exception ex2(ex.what()); ex2.tag("SFMTranscriptInterface_Delaunay", "getMinVertexDisplacement"); cerr << ex2.what() << endl; //ex2.raise();
+        return 0.0;
+    }
+}
+
 // Setters
 
 void SFMTranscriptInterface_Delaunay::setTranscriptRef(dlovi::compvis::SFMTranscript * pTranscript){
@@ -156,6 +231,62 @@ void SFMTranscriptInterface_Delaunay::setAlgorithmRef(dlovi::FreespaceDelaunayAl
     }
 }
 
+void SFMTranscriptInterface_Delaunay::setModelUpdateInterval(double dSeconds){
+    try{
+        m_dModelUpdateInterval = dSeconds;
+    }
+    catch(std::exception & ex){
+        dlovi::Exception ex2(ex.what()); ex2.tag("SFMTranscriptInterface_Delaunay", "setModelUpdateInterval"); cerr << ex2.what() << endl; //ex2.raise();
+    }
+}
+
+void SFMTranscriptInterface_Delaunay::setModelUpdateBatchSize(int nEntries){
+    try{
+        m_nModelUpdateBatchSize = nEntries;
+    }
+    catch(std::exception & ex){
+        dlovi::Exception ex2(ex.what()); ex2.tag("SFMTranscriptInterface_Delaunay", "setModelUpdateBatchSize"); cerr << ex2.what() << endl; //ex2.raise();
+    }
+}
+
+void SFMTranscriptInterface_Delaunay::setMinVertexDisplacement(double dDepthFraction){
+    try{
+        m_dMinVertexDisplacement = dDepthFraction;
+    }
+    catch(std::exception & ex){
+        dlovi::Exception ex2(ex.what()); ex2.tag("SFMTranscriptInterface_Delaunay", "setMinVertexDisplacement"); cerr << ex2.what() << endl; //ex2.raise();
+    }
+}
+
+void SFMTranscriptInterface_Delaunay::setWindowRadius(double dRadius){
+    try{
+        m_dWindowRadius = dRadius;
+    }
+    catch(std::exception & ex){
+        dlovi::Exception ex2(ex.what()); ex2.tag("SFMTranscriptInterface_Delaunay", "setWindowRadius"); cerr << ex2.what() << endl; //ex2.raise();
+    }
+}
+
+void SFMTranscriptInterface_Delaunay::setRegion(const dlovi::Matrix & matMin, const dlovi::Matrix & matMax){
+    try{
+        m_matRegionMin = matMin;
+        m_matRegionMax = matMax;
+        m_bRegionSet = true;
+    }
+    catch(std::exception & ex){
+        dlovi::Exception ex2(ex.what()); ex2.tag("SFMTranscriptInterface_Delaunay", "setRegion"); cerr << ex2.what() << endl; //ex2.raise();
+    }
+}
+
+void SFMTranscriptInterface_Delaunay::setWindowTilePrefix(const std::string & strPrefix){
+    try{
+        m_strWindowTilePrefix = strPrefix;
+    }
+    catch(std::exception & ex){
+        dlovi::Exception ex2(ex.what()); ex2.tag("SFMTranscriptInterface_Delaunay", "setWindowTilePrefix"); cerr << ex2.what() << endl; //ex2.raise();
+    }
+}
+
 // Public Methods
 
 void SFMTranscriptInterface_Delaunay::loadTranscriptFromFile(const std::string & strFileName){
@@ -191,6 +322,7 @@ void SFMTranscriptInterface_Delaunay::runFull(){
         rewind();
         while(!isDone())
             step();
+        updateModel(true);
 
         // TODO: Debug: Remove Me.
         cerr << "numGiantPoints: " << m_setGiantPoints.size() << endl;
@@ -220,7 +352,8 @@ void SFMTranscriptInterface_Delaunay::runOnlyFinalState(){
             m_pAlgorithm->IterateTetrahedronMethod(m_objDelaunay, m_arrVertexHandles, i);
 
         // Finally, compute the isosurface model
-        computeCurrentModel();
+        m_bModelOutdated = true;
+        updateModel(true);
     }
     catch(std::exception & ex){
         dlovi::Exception ex2(ex.what()); ex2.tag("SFMTranscriptInterface_Delaunay", "runOnlyFinalState"); cerr << ex2.what() << endl; //ex2.raise();
@@ -229,8 +362,11 @@ void SFMTranscriptInterface_Delaunay::runOnlyFinalState(){
 
 void SFMTranscriptInterface_Delaunay::runRemainder(){
     try{
+        // All pending entries are applied to the triangulation as one group, and the surface is extracted once at
+        // the end (e.g. a bundle of point deletions costs one graph cut instead of one per deletion).
         while(!isDone())
             step();
+        updateModel();
     }
     catch(std::exception & ex){
         dlovi::Exception ex2(ex.what()); ex2.tag("SFMTranscriptInterface_Delaunay", "runRemainder"); cerr << ex2.what() << endl; //ex2.raise();
@@ -241,118 +377,199 @@ void SFMTranscriptInterface_Delaunay::step(bool bRunAlgorithm){
     try{
         stepTranscript(m_nCurrentEntryIndex == 0);
 
-        if(bRunAlgorithm){
-            if(getCurrentEntryType() == dlovi::compvis::SFMTranscript::ET_RESET){
-                m_arrVertexHandles.clear();
-                m_objDelaunay.clear();
-                *m_pAlgorithm = dlovi::FreespaceDelaunayAlgorithm();
-                m_lstModelTris.clear();
-                m_arrModelPoints.clear();
-                m_setGiantPoints.clear();
-            }
-            else if(getCurrentEntryType() == dlovi::compvis::SFMTranscript::ET_POINTDELETION){
-                // m_pAlgorithm->setPoints(getCurrentEntryPoints()); // The point is left as a ghost entry, so no modification to the points array takes place.
-                m_pAlgorithm->setVisibilityList(getCurrentEntryVisList()); // The visibility list, however, changes to remove refs to this point.
-                int nPointIndex = getCurrentEntryData().nPointIndex;
-
-                if(m_setGiantPoints.count(nPointIndex) == 0){
-                    m_pAlgorithm->removeVertex(m_objDelaunay, m_arrVertexHandles, nPointIndex);
-                    computeCurrentModel();
-                }
+        if(bRunAlgorithm)
+            applyCurrentEntry();
+
+        // Long groups still refresh the model every so often
+        if(m_bModelOutdated && ++m_nEntriesSinceModelUpdate >= m_nModelUpdateBatchSize)
+            updateModel();
+
+        m_nCurrentEntryIndex++;
+    }
+    catch(std::exception & ex){
+        m_nCurrentEntryIndex++;
+        dlovi::Exception ex2(ex.what()); ex2.tag("SFMTranscriptInterface_Delaunay", "step"); cerr << ex2.what() << endl; //ex2.raise();
+    }
+}
+
+void SFMTranscriptInterface_Delaunay::applyCurrentEntry(){
+    try{
+        if(getCurrentEntryType() == dlovi::compvis::SFMTranscript::ET_RESET){
+            m_arrVertexHandles.clear();
+            m_objDelaunay.clear();
+            *m_pAlgorithm = dlovi::FreespaceDelaunayAlgorithm();
+            m_lstModelTris.clear();
+            m_arrModelPoints.clear();
+            m_arrModelPointIndices.clear();
+            m_setGiantPoints.clear();
+            m_setFrozenPoints.clear();
+            m_setRegionPoints.clear();
+            m_bWindowCenterSet = false;
+            m_bSkippedGeometry = false;
+            m_bModelOutdated = false;
+            m_nEntriesSinceModelUpdate = 0;
+            return;
+        }
+
+        // A keyframe insertion sets everything itself, and needs the points from before it to tell the new ones
+        if(m_bSkippedGeometry && getCurrentEntryType() != dlovi::compvis::SFMTranscript::ET_KEYFRAMEINSERTION)
+            refreshSkippedGeometry();
+
+        if(getCurrentEntryType() == dlovi::compvis::SFMTranscript::ET_POINTDELETION){
+            // m_pAlgorithm->setPoints(getCurrentEntryPoints()); // The point is left as a ghost entry, so no modification to the points array takes place.
+            m_pAlgorithm->setVisibilityList(getCurrentEntryVisList()); // The visibility list, however, changes to remove refs to this point.
+            int nPointIndex = getCurrentEntryData().nPointIndex;
+
+            if(! isPointExcluded(nPointIndex)){
+                m_pAlgorithm->removeVertex(m_objDelaunay, m_arrVertexHandles, nPointIndex);
+                m_bModelOutdated = true;
             }
-            else if(getCurrentEntryType() == dlovi::compvis::SFMTranscript::ET_VISIBILITYRAYINSERTION){
-                m_pAlgorithm->setVisibilityList(getCurrentEntryVisList());
-                int nCamIndex = getCurrentEntryData().nCamIndex;
-                int nPointIndex = getCurrentEntryData().nPointIndex;
-
-                if(m_setGiantPoints.count(nPointIndex) == 0){
-                    m_pAlgorithm->applyConstraint(m_objDelaunay, m_arrVertexHandles, nCamIndex, nPointIndex);
-                    computeCurrentModel();
-                }
+        }
+        else if(getCurrentEntryType() == dlovi::compvis::SFMTranscript::ET_VISIBILITYRAYINSERTION){
+            m_pAlgorithm->setVisibilityList(getCurrentEntryVisList());
+            int nCamIndex = getCurrentEntryData().nCamIndex;
+            int nPointIndex = getCurrentEntryData().nPointIndex;
+
+            if(! isPointExcluded(nPointIndex)){
+                m_pAlgorithm->applyConstraint(m_objDelaunay, m_arrVertexHandles, nCamIndex, nPointIndex);
+                m_bModelOutdated = true;
             }
-            else if(getCurrentEntryType() == dlovi::compvis::SFMTranscript::ET_VISIBILITYRAYDELETION){
-                m_pAlgorithm->setVisibilityList(getCurrentEntryVisList());
-                int nCamIndex = getCurrentEntryData().nCamIndex;
-                int nPointIndex = getCurrentEntryData().nPointIndex;
-
-                if(m_setGiantPoints.count(nPointIndex) == 0){
-                    m_pAlgorithm->removeConstraint(m_objDelaunay, m_arrVertexHandles, nCamIndex, nPointIndex);
-                    computeCurrentModel();
-                }
+        }
+        else if(getCurrentEntryType() == dlovi::compvis::SFMTranscript::ET_VISIBILITYRAYDELETION){
+            m_pAlgorithm->setVisibilityList(getCurrentEntryVisList());
+            int nCamIndex = getCurrentEntryData().nCamIndex;
+            int nPointIndex = getCurrentEntryData().nPointIndex;
+
+            if(! isPointExcluded(nPointIndex)){
+                m_pAlgorithm->removeConstraint(m_objDelaunay, m_arrVertexHandles, nCamIndex, nPointIndex);
+                m_bModelOutdated = true;
             }
-            else if(getCurrentEntryType() == dlovi::compvis::SFMTranscript::ET_KEYFRAMEINSERTION){
-                // TODO: modify the point addition algorithm to carve away the new points' FULL vis lists,
-                // not just the current KF. (it's missing the epipolar match visibility ray)
-                int nStartPointIndex = m_pAlgorithm->numPoints();
+        }
+        else if(getCurrentEntryType() == dlovi::compvis::SFMTranscript::ET_KEYFRAMEINSERTION){
+            // TODO: modify the point addition algorithm to carve away the new points' FULL vis lists,
+            // not just the current KF. (it's missing the epipolar match visibility ray)
+            int nStartPointIndex = m_pAlgorithm->numPoints();
 
-                m_pAlgorithm->setCamCenters(getCurrentEntryCamCenters());
-                m_pAlgorithm->setPoints(getCurrentEntryPoints());
-                int nCamIndex = getCurrentEntryData().nCamIndex;
+            m_pAlgorithm->setCamCenters(getCurrentEntryCamCenters());
+            m_pAlgorithm->setPoints(getCurrentEntryPoints());
+            int nCamIndex = getCurrentEntryData().nCamIndex;
 
-                int nEndPointIndex = m_pAlgorithm->numPoints() - 1;
+            int nEndPointIndex = m_pAlgorithm->numPoints() - 1;
 
-                // Test if any of the new points are too large, and if so handle them specially
-                for(int nLoop = nStartPointIndex; nLoop <= nEndPointIndex; nLoop++){
-                    if(isPointTooLarge(m_pAlgorithm->getPoint(nLoop)))
-                        m_setGiantPoints.insert(nLoop);
-                }
+            // Test if any of the new points are too large, and if so handle them specially
+            for(int nLoop = nStartPointIndex; nLoop <= nEndPointIndex; nLoop++){
+                if(isPointTooLarge(m_pAlgorithm->getPoint(nLoop)))
+                    m_setGiantPoints.insert(nLoop);
+            }
 
 
-                // Filter giant points out of the current view's visibility list, so that the KF-addition alg. doesn't add them
-                std::vector<std::vector<int> > arrTmpVisList = getCurrentEntryVisList();
-                m_pAlgorithm->setVisibilityList(filterOutGiantPointsFromCurrentVisList(arrTmpVisList));
+            // Filter giant points out of the current view's visibility list, so that the KF-addition alg. doesn't add them
+            std::vector<std::vector<int> > arrTmpVisList = getCurrentEntryVisList();
+            if(m_bRegionSet && ! arrTmpVisList.empty())
+                claimRegionPoints(arrTmpVisList.back());
+            m_pAlgorithm->setVisibilityList(filterOutGiantPointsFromCurrentVisList(arrTmpVisList));
+            m_bSkippedGeometry = false;
 
+            // (Nothing to carve if none of the observed points are ours, e.g. in a tile the keyframe does not see)
+            if(! arrTmpVisList.empty() && ! arrTmpVisList.back().empty()){
                 m_pAlgorithm->IterateTetrahedronMethod(m_objDelaunay, m_arrVertexHandles, nCamIndex);
-                computeCurrentModel();
+                m_bModelOutdated = true;
             }
-            else if(getCurrentEntryType() == dlovi::compvis::SFMTranscript::ET_BUNDLEADJUSTMENT){
-                m_pAlgorithm->setCamCenters(getCurrentEntryCamCenters());
-                m_pAlgorithm->setPoints(getCurrentEntryPoints());
-
-                // Test if any of the moved points become (or are) too large, and if so handle them specially
-                std::vector<int> arrTmpFilteredPointIndices = getCurrentEntryData().arrPointIndices;
-                filterOutGiantPoints(arrTmpFilteredPointIndices);
-                std::vector<int> arrNewlyGiantPointIndices;
-                std::vector<int> arrFilteredPointIndices;
-                for(int nLoop = 0; nLoop < (int)arrTmpFilteredPointIndices.size(); nLoop++){
-                    if(isPointTooLarge(m_pAlgorithm->getPoint(arrTmpFilteredPointIndices[nLoop]))){
-                        m_setGiantPoints.insert(arrTmpFilteredPointIndices[nLoop]);
-                        arrNewlyGiantPointIndices.push_back(arrTmpFilteredPointIndices[nLoop]);
-                    }
-                    else
-                        arrFilteredPointIndices.push_back(arrTmpFilteredPointIndices[nLoop]);
+
+            slideWindow(nCamIndex);
+        }
+        else if(getCurrentEntryType() == dlovi::compvis::SFMTranscript::ET_BUNDLEADJUSTMENT){
+            m_pAlgorithm->setCamCenters(getCurrentEntryCamCenters());
+            m_pAlgorithm->setPoints(getCurrentEntryPoints());
+
+            // Test if any of the moved points become (or are) too large, and if so handle them specially
+            std::vector<int> arrTmpFilteredPointIndices = getCurrentEntryData().arrPointIndices;
+            filterOutGiantPoints(arrTmpFilteredPointIndices);
+            std::vector<int> arrNewlyGiantPointIndices;
+            std::vector<int> arrFilteredPointIndices;
+            for(int nLoop = 0; nLoop < (int)arrTmpFilteredPointIndices.size(); nLoop++){
+                if(isPointTooLarge(m_pAlgorithm->getPoint(arrTmpFilteredPointIndices[nLoop]))){
+                    m_setGiantPoints.insert(arrTmpFilteredPointIndices[nLoop]);
+                    arrNewlyGiantPointIndices.push_back(arrTmpFilteredPointIndices[nLoop]);
                 }
+                else
+                    arrFilteredPointIndices.push_back(arrTmpFilteredPointIndices[nLoop]);
+            }
 
-                // Remove any newly giant points from the triangulation (points bundled to giant locations)
-                // TODO: implement a batch-removal algorithm (the current implementation is buggy).
-                for(std::vector<int>::iterator itDel = arrNewlyGiantPointIndices.begin(); itDel != arrNewlyGiantPointIndices.end(); itDel++)
-                    m_pAlgorithm->removeVertex(m_objDelaunay, m_arrVertexHandles, *itDel);
+            // Remove any newly giant points from the triangulation (points bundled to giant locations)
+            for(std::vector<int>::iterator itDel = arrNewlyGiantPointIndices.begin(); itDel != arrNewlyGiantPointIndices.end(); itDel++)
+                m_pAlgorithm->removeVertex(m_objDelaunay, m_arrVertexHandles, *itDel);
 
-                // Perform the bundle adjustment on the triangulation
-                // TODO: implement cam-center-move algorithm for bundle adjustments & call here.
-                // For now, and perhaps good enough in practice, it just does point moves.
-                m_pAlgorithm->moveVertex(m_objDelaunay, m_arrVertexHandles, arrFilteredPointIndices);
+            // Perform the bundle adjustment on the triangulation
+            // TODO: implement cam-center-move algorithm for bundle adjustments & call here.
+            // For now, and perhaps good enough in practice, it just does point moves.  Points that barely moved are left in place.
+            m_pAlgorithm->moveVertex(m_objDelaunay, m_arrVertexHandles, arrFilteredPointIndices, m_dMinVertexDisplacement * sceneDepth());
 
-                // Old Code handles each point in sequence.  Too Slow:
-                //for(std::vector<int>::const_iterator itPointIndex = getCurrentEntryData().arrPointIndices.begin();
-                //itPointIndex != getCurrentEntryData().arrPointIndices.end(); itPointIndex++)
-                //  m_pAlgorithm->moveVertex(m_objDelaunay, m_arrVertexHandles, *itPointIndex);
+            // Old Code handles each point in sequence.  Too Slow:
+            //for(std::vector<int>::const_iterator itPointIndex = getCurrentEntryData().arrPointIndices.begin();
+            //itPointIndex != getCurrentEntryData().arrPointIndices.end(); itPointIndex++)
+            //  m_pAlgorithm->moveVertex(m_objDelaunay, m_arrVertexHandles, *itPointIndex);
 
-                computeCurrentModel();
-            }
-            else if(getCurrentEntryType() == dlovi::compvis::SFMTranscript::ET_INVALID){
-                throw dlovi::Exception("Invalid log entry.");
+            if(! arrFilteredPointIndices.empty() || ! arrNewlyGiantPointIndices.empty())
+                m_bModelOutdated = true;
+        }
+        else if(getCurrentEntryType() == dlovi::compvis::SFMTranscript::ET_INVALID){
+            throw dlovi::Exception("Invalid log entry.");
+        }
+        else{
+            // TODO: Ignore this entry for now (only PTAM subset supported).  Perhaps implement more functionality later.
+        }
+    }
+    catch(std::exception & ex){
+        dlovi::Exception ex2(ex.what()); ex2.tag("SFMTranscriptInterface_Delaunay", "applyCurrentEntry"); cerr << ex2.what() << endl; //ex2.raise();
+    }
+}
+
+bool SFMTranscriptInterface_Delaunay::currentEntryConcernsRegion() const{
+    try{
+        if(! m_bRegionSet)
+            return true;
+
+        // An entry concerns the region if it observes a point inside it, or touches a point already triangulated here
+        const dlovi::compvis::SFMTranscript::EntryData & objData = getCurrentEntryData();
+        if(getCurrentEntryType() == dlovi::compvis::SFMTranscript::ET_KEYFRAMEINSERTION){
+            const std::vector<std::vector<int> > & arrVisLists = m_pTranscript->getEntryVisList_Step();
+            const std::vector<dlovi::Matrix> & arrPoints = m_pTranscript->getEntryPoints_Step();
+            if(arrVisLists.empty())
+                return false;
+            for(std::vector<int>::const_iterator it = arrVisLists.back().begin(); it != arrVisLists.back().end(); it++){
+                if(m_setRegionPoints.count(*it) > 0 || isPointInRegion(arrPoints[*it]))
+                    return true;
             }
-            else{
-                // TODO: Ignore this entry for now (only PTAM subset supported).  Perhaps implement more functionality later.
+            return false;
+        }
+        else if(getCurrentEntryType() == dlovi::compvis::SFMTranscript::ET_POINTDELETION ||
+                getCurrentEntryType() == dlovi::compvis::SFMTranscript::ET_VISIBILITYRAYINSERTION ||
+                getCurrentEntryType() == dlovi::compvis::SFMTranscript::ET_VISIBILITYRAYDELETION){
+            return m_setRegionPoints.count(objData.nPointIndex) > 0;
+        }
+        else if(getCurrentEntryType() == dlovi::compvis::SFMTranscript::ET_BUNDLEADJUSTMENT){
+            for(std::vector<int>::const_iterator it = objData.arrPointIndices.begin(); it != objData.arrPointIndices.end(); it++){
+                if(m_setRegionPoints.count(*it) > 0)
+                    return true;
             }
+            return false;
         }
+        return true;
+    }
+    catch(std::exception & ex){
+        dlovi::Exception ex2(ex.what()); ex2.tag("SFMTranscriptInterface_Delaunay", "currentEntryConcernsRegion"); cerr << ex2.what() << endl; //ex2.raise();
+        return true;
+    }
+}
 
-        m_nCurrentEntryIndex++;
+void SFMTranscriptInterface_Delaunay::skipCurrentEntry(){
+    try{
+        // The triangulation holds nothing of the entry; only the arrays copied from the transcript fall behind
+        m_bSkippedGeometry = true;
     }
     catch(std::exception & ex){
-        m_nCurrentEntryIndex++;
-        dlovi::Exception ex2(ex.what()); ex2.tag("SFMTranscriptInterface_Delaunay", "step"); cerr << ex2.what() << endl; //ex2.raise();
+        dlovi::Exception ex2(ex.what()); ex2.tag("SFMTranscriptInterface_Delaunay", "skipCurrentEntry"); cerr << ex2.what() << endl; //ex2.raise();
     }
 }
 
@@ -363,7 +580,17 @@ void SFMTranscriptInterface_Delaunay::rewind(){
         *m_pAlgorithm = dlovi::FreespaceDelaunayAlgorithm();
         m_lstModelTris.clear();
         m_arrModelPoints.clear();
+        m_arrModelPointIndices.clear();
         m_setGiantPoints.clear();
+        m_setFrozenPoints.clear();
+        m_setRegionPoints.clear();
+        m_bWindowCenterSet = false;
+        m_bSkippedGeometry = false;
+        m_arrFrozenPoints.clear();
+        m_lstFrozenTris.clear();
+        m_bModelOutdated = false;
+        m_nEntriesSinceModelUpdate = 0;
+        m_dLastModelUpdate = 0.0;
         m_nCurrentEntryIndex = 0;
         m_pTranscript->invalidate();
     }
@@ -385,28 +612,124 @@ bool SFMTranscriptInterface_Delaunay::isDone(){
 
 void SFMTranscriptInterface_Delaunay::writeCurrentModelToFile(const std::string & strFileName) const{
     try{
-        m_pAlgorithm->writeObj(strFileName, m_arrModelPoints, m_lstModelTris);
+        compvis::MeshWriter::writeFile(strFileName, m_arrModelPoints, m_lstModelTris);
     }
     catch(std::exception & ex){
         dlovi::Exception ex2(ex.what()); ex2.tag("SFMTranscriptInterface_Delaunay", "writeCurrentModelToFile"); cerr << ex2.what() << endl; //ex2.raise();
     }
 }
 
+bool SFMTranscriptInterface_Delaunay::writeCheckpoint(const std::string & strFileName) const{
+    try{
+        // Written beside the target and renamed over it, so an interrupted write never leaves a truncated checkpoint
+        std::string strTmpFileName = strFileName + ".tmp";
+        std::ofstream fileOut(strTmpFileName.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+        if(!fileOut)
+            throw dlovi::Exception("Could not open file");
+
+        fileOut.write(CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+        binaryio::write<int>(fileOut, m_nCurrentEntryIndex);
+        binaryio::write<int>(fileOut, (int)m_setGiantPoints.size());
+        for(std::set<int>::const_iterator it = m_setGiantPoints.begin(); it != m_setGiantPoints.end(); it++)
+            binaryio::write<int>(fileOut, *it);
+        binaryio::write<int>(fileOut, (int)m_setFrozenPoints.size());
+        for(std::set<int>::const_iterator it = m_setFrozenPoints.begin(); it != m_setFrozenPoints.end(); it++)
+            binaryio::write<int>(fileOut, *it);
+        binaryio::write<char>(fileOut, m_bWindowCenterSet ? 1 : 0);
+        if(m_bWindowCenterSet)
+            binaryio::writeVec3(fileOut, m_matWindowCenter);
+        binaryio::write<int>(fileOut, m_nNumWindowTiles);
+        binaryio::writeVec3Array(fileOut, m_arrFrozenPoints);
+        binaryio::writeVec3Array(fileOut, std::vector<dlovi::Matrix>(m_lstFrozenTris.begin(), m_lstFrozenTris.end()));
+        m_pTranscript->writeStepState(fileOut);
+        m_pAlgorithm->writeCheckpoint(fileOut, m_objDelaunay, m_arrVertexHandles);
+
+        fileOut.close();
+        if(!fileOut)
+            throw dlovi::Exception("Could not write checkpoint");
+        if(std::rename(strTmpFileName.c_str(), strFileName.c_str()) != 0)
+            throw dlovi::Exception("Could not rename checkpoint");
+        return true;
+    }
+    catch(std::exception & ex){
+        dlovi::Exception ex2(ex.what()); ex2.tag("SFMTranscriptInterface_Delaunay", "writeCheckpoint"); cerr << ex2.what() << endl; //ex2.raise();
+        return false;
+    }
+}
+
+bool SFMTranscriptInterface_Delaunay::loadCheckpoint(const std::string & strFileName){
+    try{
+        std::ifstream fileIn(strFileName.c_str(), std::ios::in | std::ios::binary);
+        if(!fileIn)
+            throw dlovi::Exception("Could not open file");
+
+        char arrMagic[sizeof(CHECKPOINT_MAGIC)];
+        if(! fileIn.read(arrMagic, sizeof(arrMagic)) || std::memcmp(arrMagic, CHECKPOINT_MAGIC, sizeof(arrMagic)) != 0)
+            throw dlovi::Exception("Not a CARV checkpoint");
+
+        int nEntryIndex = binaryio::read<int>(fileIn);
+        m_setGiantPoints.clear();
+        int nNumGiantPoints = binaryio::read<int>(fileIn);
+        for(int i = 0; i < nNumGiantPoints; i++)
+            m_setGiantPoints.insert(binaryio::read<int>(fileIn));
+        m_setFrozenPoints.clear();
+        int nNumFrozenPoints = binaryio::read<int>(fileIn);
+        for(int i = 0; i < nNumFrozenPoints; i++)
+            m_setFrozenPoints.insert(binaryio::read<int>(fileIn));
+        m_bWindowCenterSet = binaryio::read<char>(fileIn) != 0;
+        if(m_bWindowCenterSet)
+            m_matWindowCenter = binaryio::readVec3(fileIn);
+        m_nNumWindowTiles = binaryio::read<int>(fileIn);
+        binaryio::readVec3Array(fileIn, m_arrFrozenPoints);
+        std::vector<dlovi::Matrix> arrFrozenTris;
+        binaryio::readVec3Array(fileIn, arrFrozenTris);
+        m_lstFrozenTris.assign(arrFrozenTris.begin(), arrFrozenTris.end());
+        m_pTranscript->resumeFromStepState(fileIn);
+        m_pAlgorithm->readCheckpoint(fileIn, m_objDelaunay, m_arrVertexHandles);
+
+        // A non-zero entry index also keeps step() from parsing the header again
+        m_nCurrentEntryIndex = std::max(nEntryIndex, 1);
+        m_lstModelTris.clear();
+        m_arrModelPoints.clear();
+        m_arrModelPointIndices.clear();
+        m_bModelOutdated = true;
+        m_nEntriesSinceModelUpdate = 0;
+        return true;
+    }
+    catch(std::exception & ex){
+        rewind();
+        dlovi::Exception ex2(ex.what()); ex2.tag("SFMTranscriptInterface_Delaunay", "loadCheckpoint"); cerr << ex2.what() << endl; //ex2.raise();
+        return false;
+    }
+}
+
+bool SFMTranscriptInterface_Delaunay::updateModel(bool bForce){
+    try{
+        // Only recomputes the model if it is outdated and enough time has passed.  Otherwise model updates are too
+        // frequent and bog the cpu.
+        if(! m_bModelOutdated)
+            return false;
+        if(! bForce && timestamp() - m_dLastModelUpdate < m_dModelUpdateInterval)
+            return false;
+
+        computeCurrentModel();
+        return true;
+    }
+    catch(std::exception & ex){
+        dlovi::Exception ex2(ex.what()); ex2.tag("SFMTranscriptInterface_Delaunay", "updateModel"); cerr << ex2.what() << endl; //ex2.raise();
+        return false;
+    }
+}
+
 // Private Methods
 
 void SFMTranscriptInterface_Delaunay::computeCurrentModel(int nVoteThresh){
     try{
-        // Only recomputes the model if enough time has passed.  Otherwise model updates are too frequent and bog the cpu.
-        static double then = timestamp();
-        double now = timestamp();
-        double dt = now - then;
-
-        if(dt > 5.0){ // more than 5 seconds passed
-            //if(dt > 1.0){ // more than 1 second passed
-            //if(dt > 0.033333){ // allows for up to 30 fps
-            m_pAlgorithm->tetsToTris(m_objDelaunay, m_arrModelPoints, m_lstModelTris, nVoteThresh);
-            then = now;
-        }
+        m_pAlgorithm->tetsToTris(m_objDelaunay, m_arrVertexHandles, m_arrModelPoints, m_arrModelPointIndices, m_lstModelTris, nVoteThresh);
+        m_nNumModelUpdates++;
+        m_bModelOutdated = false;
+        m_nEntriesSinceModelUpdate = 0;
+        m_dLastModelUpdate = timestamp();
     }
     catch(std::exception & ex){
         dlovi::Exception ex2(ex.what()); ex2.tag("SFMTranscriptInterface_Delaunay", "computeCurrentModel"); cerr << ex2.what() << endl; //ex2.raise();
@@ -425,12 +748,150 @@ bool SFMTranscriptInterface_Delaunay::isPointTooLarge(const dlovi::Matrix & matP
     }
 }
 
+bool SFMTranscriptInterface_Delaunay::isPointExcluded(int nPointIndex) const{
+    try{
+        // Giant points, points frozen outside the window, and points outside the region are kept out of the triangulation
+        return m_setGiantPoints.count(nPointIndex) > 0 || m_setFrozenPoints.count(nPointIndex) > 0 ||
+               (m_bRegionSet && m_setRegionPoints.count(nPointIndex) == 0);
+    }
+    catch(std::exception & ex){
+        dlovi::Exception ex2(ex.what()); ex2.tag("SFMTranscriptInterface_Delaunay", "isPointExcluded"); cerr << ex2.what() << endl; //ex2.raise()
+        return false;
+    }
+}
+
+bool SFMTranscriptInterface_Delaunay::isPointInRegion(const dlovi::Matrix & matPoint) const{
+    try{
+        for(int i = 0; i < 3; i++){
+            if(matPoint(i) < m_matRegionMin(i) || matPoint(i) > m_matRegionMax(i))
+                return false;
+        }
+        return true;
+    }
+    catch(std::exception & ex){
+        dlovi::Exception ex2(ex.what()); ex2.tag("SFMTranscriptInterface_Delaunay", "isPointInRegion"); cerr << ex2.what() << endl; //ex2.raise()
+        return false;
+    }
+}
+
+void SFMTranscriptInterface_Delaunay::claimRegionPoints(const std::vector<int> & arrPointIndices){
+    try{
+        // A point joins when a keyframe observes it inside the region, and that keyframe inserts it, so every member has a vertex
+        for(std::vector<int>::const_iterator it = arrPointIndices.begin(); it != arrPointIndices.end(); it++){
+            if(m_setGiantPoints.count(*it) == 0 && m_setFrozenPoints.count(*it) == 0 && isPointInRegion(m_pAlgorithm->getPoint(*it)))
+                m_setRegionPoints.insert(*it);
+        }
+    }
+    catch(std::exception & ex){
+        dlovi::Exception ex2(ex.what()); ex2.tag("SFMTranscriptInterface_Delaunay", "claimRegionPoints"); cerr << ex2.what() << endl; //ex2.raise()
+    }
+}
+
+void SFMTranscriptInterface_Delaunay::refreshSkippedGeometry(){
+    try{
+        // The points added by skipped keyframes miss the giant test, which is moot: a point joins only once observed in the region
+        m_pAlgorithm->setCamCenters(getCurrentEntryCamCenters());
+        m_pAlgorithm->setPoints(getCurrentEntryPoints());
+        m_pAlgorithm->setVisibilityList(getCurrentEntryVisList());
+        m_bSkippedGeometry = false;
+    }
+    catch(std::exception & ex){
+        dlovi::Exception ex2(ex.what()); ex2.tag("SFMTranscriptInterface_Delaunay", "refreshSkippedGeometry"); cerr << ex2.what() << endl; //ex2.raise()
+    }
+}
+
+void SFMTranscriptInterface_Delaunay::slideWindow(int nCamIndex){
+    try{
+        if(m_dWindowRadius <= 0.0)
+            return;
+
+        // The window only slides once the keyframes have moved a quarter of its radius, so that freezing is batched
+        const dlovi::Matrix & matCamCenter = m_pAlgorithm->getCamCenter(nCamIndex);
+        if(! m_bWindowCenterSet){
+            m_matWindowCenter = matCamCenter;
+            m_bWindowCenterSet = true;
+            return;
+        }
+        if((matCamCenter - m_matWindowCenter).norm() < 0.25 * m_dWindowRadius)
+            return;
+        m_matWindowCenter = matCamCenter;
+        const dlovi::FixedVector3 vecWindowCenter(m_matWindowCenter);
+
+        std::set<int> setLeavingPoints;
+        for(int nPointIndex = 0; nPointIndex < m_pAlgorithm->numPoints(); nPointIndex++){
+            if(! isPointExcluded(nPointIndex) && (dlovi::FixedVector3(m_pAlgorithm->getPoint(nPointIndex)) - vecWindowCenter).norm() > m_dWindowRadius)
+                setLeavingPoints.insert(nPointIndex);
+        }
+        if(setLeavingPoints.empty())
+            return;
+
+        // Freeze the triangles with all 3 vertices outside the window, from the surface as it is before they are removed
+        computeCurrentModel();
+        std::vector<bool> arrIsFrozenPoint(m_arrModelPoints.size());
+        for(int nLoop = 0; nLoop < (int)m_arrModelPoints.size(); nLoop++)
+            arrIsFrozenPoint[nLoop] = (dlovi::FixedVector3(m_arrModelPoints[nLoop]) - vecWindowCenter).norm() > m_dWindowRadius;
+        freezeTris(m_arrModelPoints, m_lstModelTris, arrIsFrozenPoint);
+
+        m_pAlgorithm->removeVertex(m_objDelaunay, m_arrVertexHandles, setLeavingPoints);
+        m_setFrozenPoints.insert(setLeavingPoints.begin(), setLeavingPoints.end());
+        m_bModelOutdated = true;
+    }
+    catch(std::exception & ex){
+        dlovi::Exception ex2(ex.what()); ex2.tag("SFMTranscriptInterface_Delaunay", "slideWindow"); cerr << ex2.what() << endl; //ex2.raise()
+    }
+}
+
+void SFMTranscriptInterface_Delaunay::freezeTris(const std::vector<dlovi::Matrix> & arrPoints, const std::list<dlovi::Matrix> & lstTris,
+                                                 const std::vector<bool> & arrIsFrozenPoint){
+    try{
+        // Compact indexed mesh of the frozen triangles: only their own vertices, renumbered
+        std::vector<dlovi::Matrix> arrTilePoints;
+        std::list<dlovi::Matrix> lstTileTris;
+        std::vector<int> arrTileIndex(arrPoints.size(), -1);
+        for(std::list<dlovi::Matrix>::const_iterator itTri = lstTris.begin(); itTri != lstTris.end(); itTri++){
+            int arrIndices[3] = {(int)round(itTri->at(0)), (int)round(itTri->at(1)), (int)round(itTri->at(2))};
+            if(! arrIsFrozenPoint[arrIndices[0]] || ! arrIsFrozenPoint[arrIndices[1]] || ! arrIsFrozenPoint[arrIndices[2]])
+                continue;
+
+            dlovi::Matrix matTri(*itTri);
+            for(int i = 0; i < 3; i++){
+                if(arrTileIndex[arrIndices[i]] < 0){
+                    arrTileIndex[arrIndices[i]] = (int)arrTilePoints.size();
+                    arrTilePoints.push_back(arrPoints[arrIndices[i]]);
+                }
+                matTri(i) = arrTileIndex[arrIndices[i]];
+            }
+            lstTileTris.push_back(matTri);
+        }
+        if(lstTileTris.empty())
+            return;
+
+        if(! m_strWindowTilePrefix.empty()){
+            std::stringstream ssFileName;
+            ssFileName << m_strWindowTilePrefix << m_nNumWindowTiles++ << ".obj";
+            m_pAlgorithm->writeObj(ssFileName.str(), arrTilePoints, lstTileTris);
+        }
+        else{
+            const int nOffset = (int)m_arrFrozenPoints.size();
+            m_arrFrozenPoints.insert(m_arrFrozenPoints.end(), arrTilePoints.begin(), arrTilePoints.end());
+            for(std::list<dlovi::Matrix>::iterator itTri = lstTileTris.begin(); itTri != lstTileTris.end(); itTri++){
+                for(int i = 0; i < 3; i++)
+                    (*itTri)(i) += nOffset;
+                m_lstFrozenTris.push_back(*itTri);
+            }
+        }
+    }
+    catch(std::exception & ex){
+        dlovi::Exception ex2(ex.what()); ex2.tag("SFMTranscriptInterface_Delaunay", "freezeTris"); cerr << ex2.what() << endl; //ex2.raise()
+    }
+}
+
 std::vector<int> & SFMTranscriptInterface_Delaunay::filterOutGiantPoints(std::vector<int> & arrPointIndices) const{
     try{
         std::vector<int> arrNewIndices;
 
         for(int nLoop = 0; nLoop < (int)arrPointIndices.size(); nLoop++){
-            if(m_setGiantPoints.count(arrPointIndices[nLoop]) == 0)
+            if(! isPointExcluded(arrPointIndices[nLoop]))
                 arrNewIndices.push_back(arrPointIndices[nLoop]);
         }
 
@@ -455,6 +916,31 @@ std::vector<std::vector<int> > & SFMTranscriptInterface_Delaunay::filterOutGiant
     }
 }
 
+double SFMTranscriptInterface_Delaunay::sceneDepth() const{
+    try{
+        // Median distance from the latest camera that sees points to those points, like KeyFrame::ComputeSceneMedianDepth
+        const std::vector<std::vector<int> > & arrVisLists = m_pTranscript->getEntryVisList_Step();
+        const std::vector<dlovi::Matrix> & arrCamCenters = m_pTranscript->getEntryCamCenters_Step();
+        const std::vector<dlovi::Matrix> & arrPoints = m_pTranscript->getEntryPoints_Step();
+        for(int nCam = (int)arrVisLists.size() - 1; nCam >= 0; nCam--){
+            if(arrVisLists[nCam].empty())
+                continue;
+
+            std::vector<double> arrDists;
+            arrDists.reserve(arrVisLists[nCam].size());
+            for(std::vector<int>::const_iterator it = arrVisLists[nCam].begin(); it != arrVisLists[nCam].end(); it++)
+                arrDists.push_back((arrPoints[*it] - arrCamCenters[nCam]).norm());
+            std::nth_element(arrDists.begin(), arrDists.begin() + arrDists.size() / 2, arrDists.end());
+            return arrDists[arrDists.size() / 2];
+        }
+        return 0.0;
+    }
+    catch(std::exception & ex){
+        dlovi::Exception ex2(ex.what()); ex2.tag("SFMTranscriptInterface_Delaunay", "sceneDepth"); cerr << ex2.what() << endl; //ex2.raise();
+        return 0.0;
+    }
+}
+
 double SFMTranscriptInterface_Delaunay::timestamp() const{
     timeval t;
     gettimeofday(&t, 0);
@@ -4,6 +4,7 @@
 #include "Modeler/SFMTranscriptInterface_ORBSLAM.h"
 #include "Modeler/Exception.h"
 #include "Modeler/Matrix.h"
+#include <algorithm>
 
 // Header files needed by EDLines
 #include <stdio.h>
@@ -16,6 +17,13 @@ LS *DetectLinesByED(unsigned char *srcImg, int width, int height, int *pNoLines)
 using namespace std;
 using namespace dlovi;
 
+// Remember the position last written to the transcript for the point / cam with the given index
+static void setLoggedPosition(std::vector<cv::Point3f> & vLoggedPositions, int nIndex, const cv::Point3f & pos){
+    if((int)vLoggedPositions.size() <= nIndex)
+        vLoggedPositions.resize(nIndex + 1);
+    vLoggedPositions[nIndex] = pos;
+}
+
 // Constructors and Destructors
 
 SFMTranscriptInterface_ORBSLAM::SFMTranscriptInterface_ORBSLAM(){
@@ -23,6 +31,10 @@ SFMTranscriptInterface_ORBSLAM::SFMTranscriptInterface_ORBSLAM(){
         // No suppression of logging by default
         m_bSuppressBundleAdjustmentLogging = false;
         m_bSuppressRefindLogging = false;
+        m_fMoveThresholdDepthFraction = 0.01f;
+        m_nNumPoints = 0;
+        m_nNumCams = 0;
+        m_nMaxNewPointsLists = 256;
 
         // Write transcript header
         m_SFMTranscript.addLine("SFM Transcript: ORBSLAM");
@@ -47,42 +59,38 @@ dlovi::compvis::SFMTranscript * SFMTranscriptInterface_ORBSLAM::getTranscriptRef
     }
 }
 
-dlovi::compvis::SFMTranscript * SFMTranscriptInterface_ORBSLAM::getTranscriptToProcessRef(){
-    try{
-        return & m_SFMTranscriptToProcess;
-    }
-    catch(std::exception & ex){
-        dlovi::Exception ex2(ex.what()); ex2.tag("SFMTranscriptInterface_ORBSLAM", "getTranscriptToProcessRef"); cerr << ex2.what() << endl; //ex2.raise();
-    }
-}
-
 // Public Methods
 
 void SFMTranscriptInterface_ORBSLAM::addResetEntry(){
     try{
         m_SFMTranscript.addLine("reset");
-        // Reset the pointer -> index maps
-        m_mMapPoint_Index.clear();
-        m_mKeyFrame_Index.clear();
+        // Reset the id -> index maps
+        m_vMapPointId_Index.clear();
+        m_nNumPoints = 0;
+        m_vKeyFrameId_Index.clear();
+        m_nNumCams = 0;
+        m_mKeyFrame_MapPoint.clear();
+        m_dNewPointsListOrder.clear();
+        m_vPointLoggedPositions.clear();
+        m_vCamLoggedPositions.clear();
     }
     catch(std::exception & ex){
         dlovi::Exception ex2(ex.what()); ex2.tag("SFMTranscriptInterface_ORBSLAM", "addResetEntry"); cerr << ex2.what() << endl; //ex2.raise();
     }
 }
 
-void SFMTranscriptInterface_ORBSLAM::addPointDeletionEntry(MapPoint *p){
+void SFMTranscriptInterface_ORBSLAM::addPointDeletionEntry(long unsigned int nMPId){
     try{
         std::stringstream ssTmp;
 
         // Set nPointIndex based on argument.
-        std::map<MapPoint *, int>::iterator itMapPoint = m_mMapPoint_Index.find(p);
-        if(itMapPoint == m_mMapPoint_Index.end()) // The logger has no record of this point?  That's bad.
+        int nPointIndex = getPointIndex(nMPId);
+        if(nPointIndex < 0) // The logger has no record of this point?  That's bad.
         {
 //            cout << "Deleting point: no record of MapPoint index." << endl;
             return;
         }
 //            throw dlovi::Exception("Could not compute MapPoint index: no record.");
-        int nPointIndex = itMapPoint->second;
 
         ssTmp << "del point: " << nPointIndex;
         m_SFMTranscript.addLine(ssTmp.str());
@@ -93,22 +101,19 @@ void SFMTranscriptInterface_ORBSLAM::addPointDeletionEntry(MapPoint *p){
     }
 }
 
-void SFMTranscriptInterface_ORBSLAM::addVisibilityRayInsertionEntry(KeyFrame *k, MapPoint *p){
+void SFMTranscriptInterface_ORBSLAM::addVisibilityRayInsertionEntry(long unsigned int nKFId, long unsigned int nMPId){
     try{
         if(! m_bSuppressRefindLogging){
             std::stringstream ssTmp;
 
             // Set nCamIndex and nPointIndex based on arguments.
-            std::map<KeyFrame *, int>::iterator itKeyFrame = m_mKeyFrame_Index.find(k);
-            if(itKeyFrame == m_mKeyFrame_Index.end()) // The logger has no record of this KF?  That's bad.
+            int nCamIndex = getCamIndex(nKFId);
+            if(nCamIndex < 0) // The logger has no record of this KF?  That's bad.
                 throw dlovi::Exception("Could not compute KeyFrame index: no record.");
-            std::map<MapPoint *, int>::iterator itMapPoint = m_mMapPoint_Index.find(p);
-            if(itMapPoint == m_mMapPoint_Index.end()) // The logger has no record of this point?  That's bad.
+            int nPointIndex = getPointIndex(nMPId);
+            if(nPointIndex < 0) // The logger has no record of this point?  That's bad.
                 throw dlovi::Exception("Could not compute MapPoint index: no record.");
 
-            int nCamIndex = itKeyFrame->second;
-            int nPointIndex = itMapPoint->second;
-
             ssTmp << "observation: " << nCamIndex << ", " << nPointIndex;
             m_SFMTranscript.addLine(ssTmp.str());
         }
@@ -119,29 +124,26 @@ void SFMTranscriptInterface_ORBSLAM::addVisibilityRayInsertionEntry(KeyFrame *k,
     }
 }
 
-void SFMTranscriptInterface_ORBSLAM::addVisibilityRayDeletionEntry(KeyFrame *k, MapPoint *p){
+void SFMTranscriptInterface_ORBSLAM::addVisibilityRayDeletionEntry(long unsigned int nKFId, long unsigned int nMPId){
     try{
         std::stringstream ssTmp;
 
         // Set nCamIndex and nPointIndex based on arguments.
-        std::map<KeyFrame *, int>::iterator itKeyFrame = m_mKeyFrame_Index.find(k);
-        if(itKeyFrame == m_mKeyFrame_Index.end()) // The logger has no record of this KF?  That's bad.
+        int nCamIndex = getCamIndex(nKFId);
+        if(nCamIndex < 0) // The logger has no record of this KF?  That's bad.
         {
 //            cout << "Deleting observation: no record of KeyFrame index." << endl;
             return;
         }
         //            throw dlovi::Exception("Could not compute KeyFrame index: no record.");
-        std::map<MapPoint *, int>::iterator itMapPoint = m_mMapPoint_Index.find(p);
-        if(itMapPoint == m_mMapPoint_Index.end()) // The logger has no record of this point?  That's bad.
+        int nPointIndex = getPointIndex(nMPId);
+        if(nPointIndex < 0) // The logger has no record of this point?  That's bad.
         {
 //            cout << "Deleting observation: no record of MapPoint index." << endl;
             return;
         }
         //            throw dlovi::Exception("Could not compute MapPoint index: no record.");
 
-        int nCamIndex = itKeyFrame->second;
-        int nPointIndex = itMapPoint->second;
-
         ssTmp << "del observation: " << nCamIndex << ", " << nPointIndex;
         m_SFMTranscript.addLine(ssTmp.str());
     }
@@ -151,57 +153,38 @@ void SFMTranscriptInterface_ORBSLAM::addVisibilityRayDeletionEntry(KeyFrame *k,
     }
 }
 
-void SFMTranscriptInterface_ORBSLAM::addFirstKeyFrameInsertionEntry(KeyFrame *k){
+void SFMTranscriptInterface_ORBSLAM::addFirstKeyFrameInsertionEntry(const ORB_SLAM2::KeyFrameSnapshot & kf){
     try{
         std::stringstream ssTmp;
-        dlovi::Matrix matNewCam(3, 1);
-        dlovi::Matrix matNewPoint(3, 1);
         int nPointIndex, nCamIndex;
 
-        if(m_mKeyFrame_Index.count(k) > 0)
+        if(getCamIndex(kf.mnId) >= 0)
             throw dlovi::Exception("KeyFrame already has a record.  Double addition.");
 
-        // // TODO: Instead of inverting the whole transform, we should be able to just use the negative translation.
-        // GetPoseInverse, seems camera position need to be inversed
-        cv::Mat se3WfromC = k->GetPoseInverse();
-        matNewCam(0) = se3WfromC.at<float>(0,3);
-        matNewCam(1) = se3WfromC.at<float>(1,3);
-        matNewCam(2) = se3WfromC.at<float>(2,3);
-        ssTmp << "new cam: [" << matNewCam(0) << "; " << matNewCam(1) << "; " << matNewCam(2) << "] {";
+        ssTmp << "new cam: [" << kf.mCamCenter.x << "; " << kf.mCamCenter.y << "; " << kf.mCamCenter.z << "] {";
         m_SFMTranscript.addLine(ssTmp.str()); ssTmp.str("");
 
         // Add a record of the new camera to internal map.
-        nCamIndex = m_mKeyFrame_Index.size();
-        m_mKeyFrame_Index[k] = nCamIndex;
+        nCamIndex = addCamIndex(kf.mnId);
+        setLoggedPosition(m_vCamLoggedPositions, nCamIndex, kf.mCamCenter);
 
-        // Add the keyframe to the coorespondence map
-        vector<MapPoint *> vMP;
-        m_mKeyFrame_MapPoint[k] = vMP;
-
-        std::set<MapPoint*> mvpMapPoints = k->GetMapPoints();
         // Process new points and visibility information in this KF
-        for(std::set<MapPoint*>::iterator it = mvpMapPoints.begin(); it != mvpMapPoints.end(); it++){
-            MapPoint * point = *it;
-            if(point->isBad())
-                continue;
-            if(m_mMapPoint_Index.count(point) == 0){
+        std::vector<long unsigned int> vnNewPoints;
+        for(std::vector<ORB_SLAM2::KeyFrameSnapshot::Point>::const_iterator it = kf.mvPoints.begin(); it != kf.mvPoints.end(); it++){
+            int nExistingPointIndex = getPointIndex(it->mnId);
+            if(nExistingPointIndex < 0){
                 // It's a new point:
-                cv::Mat mWorldPos = point->GetWorldPos();
-                matNewPoint(0) = mWorldPos.at<float>(0);
-                matNewPoint(1) = mWorldPos.at<float>(1);
-                matNewPoint(2) = mWorldPos.at<float>(2);
-
-                ssTmp << "new point: [" << matNewPoint(0) << "; " << matNewPoint(1) << "; " << matNewPoint(2) << "]";
+                ssTmp << "new point: [" << it->mPos.x << "; " << it->mPos.y << "; " << it->mPos.z << "]";
                 // Append this point's vis list with special handling.  (Point initialized from epipolar search: > 1 KF, but only 1 KF in our internal structures.)
                 ssTmp << ", 0"; // KF 0 observed it.
                 m_SFMTranscript.addLine(ssTmp.str()); ssTmp.str("");
 
                 // Add a record of the new point to internal map.
-                nPointIndex = m_mMapPoint_Index.size();
-                m_mMapPoint_Index[point] = nPointIndex;
+                nPointIndex = addPointIndex(it->mnId);
+                setLoggedPosition(m_vPointLoggedPositions, nPointIndex, it->mPos);
 
                 // Add the correspondence to map
-                m_mKeyFrame_MapPoint[k].push_back(point);
+                vnNewPoints.push_back(it->mnId);
             }
             else
                 throw dlovi::Exception("The FIRST KF observed a point that was already added."); // That's bad!  Points are only added through KF-addition.
@@ -209,95 +192,63 @@ void SFMTranscriptInterface_ORBSLAM::addFirstKeyFrameInsertionEntry(KeyFrame *k)
 
         // Close this new-KF entry in the transcript
         m_SFMTranscript.addLine("}");
+
+        addNewPointsList(kf.mnId, vnNewPoints);
     }
     catch(std::exception & ex){
         dlovi::Exception ex2(ex.what()); ex2.tag("SFMTranscriptInterface_ORBSLAM", "addFirstKeyFrameInsertionEntry"); cerr << ex2.what() << endl; //ex2.raise();
     }
 }
 
-void SFMTranscriptInterface_ORBSLAM::addKeyFrameInsertionEntry(KeyFrame *k){
+void SFMTranscriptInterface_ORBSLAM::addKeyFrameInsertionEntry(const ORB_SLAM2::KeyFrameSnapshot & kf){
     try{
         std::stringstream ssTmp;
-        dlovi::Matrix matNewCam(3, 1);
-        dlovi::Matrix matNewPoint(3, 1);
         int nPointIndex, nCamIndex;
 
-        if(m_mKeyFrame_Index.count(k) > 0)
+        if(getCamIndex(kf.mnId) >= 0)
             throw dlovi::Exception("KeyFrame already has a record.  Double addition.");
 
-        // TODO: Instead of inverting the whole transform, we should be able to just use the negative translation.
-        // GetPoseInverse, seems camera position need to be inversed
-        cv::Mat se3WfromC = k->GetPoseInverse();
-        matNewCam(0) = se3WfromC.at<float>(0,3);
-        matNewCam(1) = se3WfromC.at<float>(1,3);
-        matNewCam(2) = se3WfromC.at<float>(2,3);
-        ssTmp << "new cam: [" << matNewCam(0) << "; " << matNewCam(1) << "; " << matNewCam(2) << "] {";
+        ssTmp << "new cam: [" << kf.mCamCenter.x << "; " << kf.mCamCenter.y << "; " << kf.mCamCenter.z << "] {";
         m_SFMTranscript.addLine(ssTmp.str()); ssTmp.str("");
 
         // Add a record of the new camera to internal map.
-        nCamIndex = m_mKeyFrame_Index.size();
-        m_mKeyFrame_Index[k] = nCamIndex;
-
-        // Add the keyframe to the coorespondence map
-        vector<MapPoint *> vMP;
-        m_mKeyFrame_MapPoint[k] = vMP;
+        nCamIndex = addCamIndex(kf.mnId);
+        setLoggedPosition(m_vCamLoggedPositions, nCamIndex, kf.mCamCenter);
 
         // Process new points and visibility information in this KF
+        std::vector<long unsigned int> vnNewPoints;
         std::set<int> sVisListExcludingNewPoints;
-        std::set<MapPoint*> mvpMapPoints = k->GetMapPoints();
-        for(std::set<MapPoint*>::iterator it = mvpMapPoints.begin(); it != mvpMapPoints.end(); it++){
-            MapPoint * point = *it;
-            if(point->isBad())
-                continue;
-            if(m_mMapPoint_Index.count(point) == 0){
-                // add confident points
-//                if (point->Observations() < 5)
-//                    continue;
-
-                // check if it has valid observation first
-                std::map<KeyFrame*, size_t> mObservations = point->GetObservations();
+        for(std::vector<ORB_SLAM2::KeyFrameSnapshot::Point>::const_iterator it = kf.mvPoints.begin(); it != kf.mvPoints.end(); it++){
+            int nExistingPointIndex = getPointIndex(it->mnId);
+            if(nExistingPointIndex < 0){
+                // It's a new point:
+                ssTmp << "new point: [" << it->mPos.x << "; " << it->mPos.y << "; " << it->mPos.z << "]";
 
+                // Append this point's vis list: the logged keyframes observing it.  (Point initialized from epipolar
+                // search: > 1 KF.)  If none is logged, this KF alone.
                 bool hasObservation = false;
-                for(std::map<KeyFrame *,size_t>::iterator it2 = mObservations.begin(); it2 != mObservations.end(); it2++){
-                    if(m_mKeyFrame_Index.count(it2->first) != 0) {
+                for(std::vector<long unsigned int>::const_iterator it2 = it->mvnObservingKFIds.begin(); it2 != it->mvnObservingKFIds.end(); it2++){
+                    int nObservingCamIndex = getCamIndex(*it2);
+                    if(nObservingCamIndex >= 0){
+                        ssTmp << ", " << nObservingCamIndex;
                         hasObservation = true;
-                        break;
                     }
                 }
-
-                // It's a new point:
-                cv::Mat mWorldPos = point->GetWorldPos();
-                matNewPoint(0) = mWorldPos.at<float>(0);
-                matNewPoint(1) = mWorldPos.at<float>(1);
-                matNewPoint(2) = mWorldPos.at<float>(2);
-
-                ssTmp << "new point: [" << matNewPoint(0) << "; " << matNewPoint(1) << "; " << matNewPoint(2)
-                      << "]";
-
-                if (hasObservation) {
-                    // Append this point's vis list.  (Point initialized from epipolar search: > 1 KF)
-                    for (std::map<KeyFrame *, size_t>::iterator it2 = mObservations.begin();
-                         it2 != mObservations.end(); it2++) {
-                        if (m_mKeyFrame_Index.count(it2->first) != 0) {
-                            ssTmp << ", " << m_mKeyFrame_Index[it2->first];
-                        }
-                    }
-                } else {
+                if(! hasObservation)
                     ssTmp << ", " << nCamIndex;
-                }
 
                 m_SFMTranscript.addLine(ssTmp.str()); ssTmp.str("");
 
                 // Add a record of the new point to internal map.
-                nPointIndex = m_mMapPoint_Index.size();
-                m_mMapPoint_Index[point] = nPointIndex;
+                nPointIndex = addPointIndex(it->mnId);
+                setLoggedPosition(m_vPointLoggedPositions, nPointIndex, it->mPos);
 
                 // Add the correspondence to map
-                m_mKeyFrame_MapPoint[k].push_back(point);
+                vnNewPoints.push_back(it->mnId);
             }
             else{
                 // It's not a new point:
-                sVisListExcludingNewPoints.insert(m_mMapPoint_Index[point]); // To be added after the new points in the following loop
+                sVisListExcludingNewPoints.insert(nExistingPointIndex); // To be added after the new points in the following loop
             }
         }
 
@@ -309,6 +260,8 @@ void SFMTranscriptInterface_ORBSLAM::addKeyFrameInsertionEntry(KeyFrame *k){
 
         // Close this new-KF entry in the transcript
         m_SFMTranscript.addLine("}");
+
+        addNewPointsList(kf.mnId, vnNewPoints);
     }
     catch(std::exception & ex){
         dlovi::Exception ex2(ex.what()); ex2.tag("SFMTranscriptInterface_ORBSLAM", "addKeyFrameInsertionEntry"); cerr << ex2.what() << endl; //ex2.raise();
@@ -316,99 +269,97 @@ void SFMTranscriptInterface_ORBSLAM::addKeyFrameInsertionEntry(KeyFrame *k){
 }
 
 
-void SFMTranscriptInterface_ORBSLAM::addKeyFrameInsertionWithLinesEntry(KeyFrame *k, KeyFrame *kCopy, std::vector<cv::Point3f>& vP) {
+void SFMTranscriptInterface_ORBSLAM::addKeyFrameInsertionWithLinesEntry(long unsigned int nKFId, const cv::Point3f & camCenter, const std::vector<cv::Point3f> & vP) {
     try{
         std::stringstream ssTmp;
-        dlovi::Matrix matNewCam(3, 1);
-        dlovi::Matrix matNewPoint(3, 1);
         int nPointIndex, nCamIndex, nCamIndexOriginal;
 
-        if(m_mKeyFrame_Index.count(kCopy) > 0)
-            throw dlovi::Exception("KeyFrame already has a record.  Double addition.");
-
-        // TODO: Instead of inverting the whole transform, we should be able to just use the negative translation.
-        // GetPoseInverse, seems camera position need to be inversed
-        cv::Mat se3WfromC = kCopy->GetPoseInverse();
-        matNewCam(0) = se3WfromC.at<float>(0,3);
-        matNewCam(1) = se3WfromC.at<float>(1,3);
-        matNewCam(2) = se3WfromC.at<float>(2,3);
-        ssTmp << "new cam: [" << matNewCam(0) << "; " << matNewCam(1) << "; " << matNewCam(2) << "] {";
-        m_SFMTranscript.addLine(ssTmp.str()); ssTmp.str("");
-
-        // Add a record of the new camera to internal map.
-        nCamIndex = m_mKeyFrame_Index.size();
-        m_mKeyFrame_Index[kCopy] = nCamIndex;
-
-        if(m_mKeyFrame_Index.count(k) == 0)
+        nCamIndexOriginal = getCamIndex(nKFId);
+        if(nCamIndexOriginal < 0)
             throw dlovi::Exception("Original KeyFrame not found.");
 
-        nCamIndexOriginal = m_mKeyFrame_Index[k];
-
-        for(std::vector<cv::Point3f>::iterator it = vP.begin(); it != vP.end(); it++){
-            cv::Point3f pointcv = *it;
-
-            const cv::Mat pos = (cv::Mat_<float>(3, 1) << pointcv.x, pointcv.y, pointcv.z);
-            MapPoint* point = new MapPoint(pos, kCopy, kCopy->GetMap());
+        ssTmp << "new cam: [" << camCenter.x << "; " << camCenter.y << "; " << camCenter.z << "] {";
+        m_SFMTranscript.addLine(ssTmp.str()); ssTmp.str("");
 
-            cv::Mat mWorldPos = point->GetWorldPos();
-            matNewPoint(0) = mWorldPos.at<float>(0);
-            matNewPoint(1) = mWorldPos.at<float>(1);
-            matNewPoint(2) = mWorldPos.at<float>(2);
+        // The camera only takes an index: no keyframe refers to it
+        nCamIndex = m_nNumCams++;
+        setLoggedPosition(m_vCamLoggedPositions, nCamIndex, camCenter);
 
-            ssTmp << "new point: [" << matNewPoint(0) << "; " << matNewPoint(1) << "; " << matNewPoint(2)
-                  << "]";
+        for(std::vector<cv::Point3f>::const_iterator it = vP.begin(); it != vP.end(); it++){
+            ssTmp << "new point: [" << it->x << "; " << it->y << "; " << it->z << "]";
             ssTmp << ", " << nCamIndex << ", " << nCamIndexOriginal;
-
             m_SFMTranscript.addLine(ssTmp.str()); ssTmp.str("");
-            // Add a record of the new point to internal map.
-            nPointIndex = m_mMapPoint_Index.size();
-            m_mMapPoint_Index[point] = nPointIndex;
 
+            // Nor does any MapPoint refer to the point
+            nPointIndex = m_nNumPoints++;
+            setLoggedPosition(m_vPointLoggedPositions, nPointIndex, *it);
         }
         // Close this new-KF entry in the transcript
         m_SFMTranscript.addLine("}");
     }
     catch(std::exception & ex){
-        dlovi::Exception ex2(ex.what()); ex2.tag("SFMTranscriptInterface_ORBSLAM", "addKeyFrameInsertionEntry"); cerr << ex2.what() << endl; //ex2.raise();
+        dlovi::Exception ex2(ex.what()); ex2.tag("SFMTranscriptInterface_ORBSLAM", "addKeyFrameInsertionWithLinesEntry"); cerr << ex2.what() << endl; //ex2.raise();
     }
 }
 
-void SFMTranscriptInterface_ORBSLAM::addBundleAdjustmentEntry(set<KeyFrame *> & sAdjustSet, set<MapPoint *> & sMapPoints){
+void SFMTranscriptInterface_ORBSLAM::addBundleAdjustmentEntry(const ORB_SLAM2::AdjustmentSnapshot & adjustment){
     try{
         if(! m_bSuppressBundleAdjustmentLogging){
             std::stringstream ssTmp;
             int nPointIndex, nCamIndex;
+            std::vector<std::string> vMoveLines;
 
-            // TODO: stub
-
-            m_SFMTranscript.addLine("bundle {");
+            // Displacement threshold, relative to the scene depth seen from the newest adjusted keyframe.  Steady-state
+            // local BA only nudges most of the window, and those entities are not logged again.
+            const float fMinDisplacement = m_fMoveThresholdDepthFraction * adjustment.mfSceneDepth;
+            const float fMinDisplacementSq = fMinDisplacement * fMinDisplacement;
 
             // Log point-move entries
-            for(set<MapPoint *>::iterator it = sMapPoints.begin(); it != sMapPoints.end(); it++){
-                if(m_mMapPoint_Index.count(*it) == 0)
+            for(std::vector<std::pair<long unsigned int, cv::Point3f> >::const_iterator it = adjustment.mvMPs.begin(); it != adjustment.mvMPs.end(); it++){
+                nPointIndex = getPointIndex(it->first);
+                if(nPointIndex < 0)
                     continue;
 //                    throw dlovi::Exception("Could not compute MapPoint index: no record.");
-                nPointIndex = m_mMapPoint_Index[*it];
-                ssTmp << "move point: " << nPointIndex << ", [" << (*it)->GetWorldPos().at<float>(0) << "; " << (*it)->GetWorldPos().at<float>(1)
-                      << "; " << (*it)->GetWorldPos().at<float>(2) << "]";
-                m_SFMTranscript.addLine(ssTmp.str()); ssTmp.str("");
+
+                const cv::Point3f & pos = it->second;
+                if(fMinDisplacement > 0.0f && nPointIndex < (int)m_vPointLoggedPositions.size()){
+                    cv::Point3f d = pos - m_vPointLoggedPositions[nPointIndex];
+                    if(d.dot(d) <= fMinDisplacementSq)
+                        continue;
+                }
+                setLoggedPosition(m_vPointLoggedPositions, nPointIndex, pos);
+
+                ssTmp << "move point: " << nPointIndex << ", [" << pos.x << "; " << pos.y << "; " << pos.z << "]";
+                vMoveLines.push_back(ssTmp.str()); ssTmp.str("");
             }
 
             // Log KF-move entries
-            for(set<KeyFrame *>::iterator it = sAdjustSet.begin(); it != sAdjustSet.end(); it++){
-                if(m_mKeyFrame_Index.count(*it) == 0)
+            for(std::vector<std::pair<long unsigned int, cv::Point3f> >::const_iterator it = adjustment.mvKFs.begin(); it != adjustment.mvKFs.end(); it++){
+                nCamIndex = getCamIndex(it->first);
+                if(nCamIndex < 0)
                     continue;
 //                    throw dlovi::Exception("Could not compute KeyFrame index: no record.");
-                nCamIndex = m_mKeyFrame_Index[*it];
 
-                // TODO: Instead of inverting the whole transform, we should be able to just use the negative translation.
-                cv::Mat se3WfromC = (*it)->GetPose();
-                se3WfromC = se3WfromC.inv();
-                ssTmp << "move cam: " << nCamIndex << ", [" << se3WfromC.at<float>(0,3) << "; " << se3WfromC.at<float>(1,3) << "; "
-                      << se3WfromC.at<float>(2,3) << "]";
-                m_SFMTranscript.addLine(ssTmp.str()); ssTmp.str("");
+                const cv::Point3f & pos = it->second;
+                if(fMinDisplacement > 0.0f && nCamIndex < (int)m_vCamLoggedPositions.size()){
+                    cv::Point3f d = pos - m_vCamLoggedPositions[nCamIndex];
+                    if(d.dot(d) <= fMinDisplacementSq)
+                        continue;
+                }
+                setLoggedPosition(m_vCamLoggedPositions, nCamIndex, pos);
+
+                ssTmp << "move cam: " << nCamIndex << ", [" << pos.x << "; " << pos.y << "; " << pos.z << "]";
+                vMoveLines.push_back(ssTmp.str()); ssTmp.str("");
             }
 
+            // Nothing moved enough: no bundle-adjust entry at all
+            if(vMoveLines.empty())
+                return;
+
+            m_SFMTranscript.addLine("bundle {");
+            for(std::vector<std::string>::iterator it = vMoveLines.begin(); it != vMoveLines.end(); it++)
+                m_SFMTranscript.addLine(*it);
+
             // Close this bundle-adjust entry in the transcript
             m_SFMTranscript.addLine("}");
         }
@@ -463,26 +414,92 @@ void SFMTranscriptInterface_ORBSLAM::unsuppressRefindLogging(){
     }
 }
 
+void SFMTranscriptInterface_ORBSLAM::setBundleAdjustmentMoveThreshold(float fDepthFraction){
+    try{
+        m_fMoveThresholdDepthFraction = fDepthFraction;
+    }
+    catch(std::exception & ex){
+        dlovi::Exception ex2(ex.what()); ex2.tag("SFMTranscriptInterface_ORBSLAM", "setBundleAdjustmentMoveThreshold"); cerr << ex2.what() << endl; //ex2.raise();
+    }
+}
 
-void SFMTranscriptInterface_ORBSLAM::UpdateTranscriptToProcess(){
+std::vector<long unsigned int> SFMTranscriptInterface_ORBSLAM::GetNewPoints(long unsigned int nKFId) {
     try{
-        int numToProcess = m_SFMTranscriptToProcess.numLines();
-        int numUpdated = m_SFMTranscript.numLines();
-        for (int i = numToProcess; i < numUpdated; i++){
-            m_SFMTranscriptToProcess.addLine(m_SFMTranscript.getLine(i));
-        }
+        std::unordered_map<long unsigned int, std::vector<long unsigned int> >::const_iterator it = m_mKeyFrame_MapPoint.find(nKFId);
+        if(it == m_mKeyFrame_MapPoint.end())
+            return std::vector<long unsigned int>();
+        return it->second;
     }
     catch(std::exception & ex){
-        dlovi::Exception ex2(ex.what()); ex2.tag("SFMTranscriptInterface_ORBSLAM", "UpdateTranscriptToProcess"); cerr << ex2.what() << endl; //ex2.raise();
+        dlovi::Exception ex2(ex.what()); ex2.tag("SFMTranscriptInterface_ORBSLAM", "GetNewPoints"); cerr << ex2.what() << endl; //ex2.raise();
+        return std::vector<long unsigned int>();
     }
 }
 
-std::vector<MapPoint *> SFMTranscriptInterface_ORBSLAM::GetNewPoints(KeyFrame *pKF) {
+// Private Methods
+
+int SFMTranscriptInterface_ORBSLAM::getPointIndex(long unsigned int nMPId) const{
     try{
-        return m_mKeyFrame_MapPoint[pKF];
+        if(nMPId >= m_vMapPointId_Index.size())
+            return -1;
+        return m_vMapPointId_Index[nMPId];
+    }
+    catch(std::exception & ex){
+        dlovi::Exception ex2(ex.what()); ex2.tag("SFMTranscriptInterface_ORBSLAM", "getPointIndex"); cerr << ex2.what() << endl; //ex2.raise();
+        return -1;
+    }
+}
+
+int SFMTranscriptInterface_ORBSLAM::addPointIndex(long unsigned int nMPId){
+    try{
+        if(nMPId >= m_vMapPointId_Index.size())
+            m_vMapPointId_Index.resize(std::max<size_t>(nMPId + 1, 2 * m_vMapPointId_Index.size()), -1);
+        m_vMapPointId_Index[nMPId] = m_nNumPoints;
+        return m_nNumPoints++;
+    }
+    catch(std::exception & ex){
+        dlovi::Exception ex2(ex.what()); ex2.tag("SFMTranscriptInterface_ORBSLAM", "addPointIndex"); cerr << ex2.what() << endl; //ex2.raise();
+        return -1;
+    }
+}
+
+int SFMTranscriptInterface_ORBSLAM::getCamIndex(long unsigned int nKFId) const{
+    try{
+        if(nKFId >= m_vKeyFrameId_Index.size())
+            return -1;
+        return m_vKeyFrameId_Index[nKFId];
+    }
+    catch(std::exception & ex){
+        dlovi::Exception ex2(ex.what()); ex2.tag("SFMTranscriptInterface_ORBSLAM", "getCamIndex"); cerr << ex2.what() << endl; //ex2.raise();
+        return -1;
+    }
+}
+
+int SFMTranscriptInterface_ORBSLAM::addCamIndex(long unsigned int nKFId){
+    try{
+        if(nKFId >= m_vKeyFrameId_Index.size())
+            m_vKeyFrameId_Index.resize(std::max<size_t>(nKFId + 1, 2 * m_vKeyFrameId_Index.size()), -1);
+        m_vKeyFrameId_Index[nKFId] = m_nNumCams;
+        return m_nNumCams++;
+    }
+    catch(std::exception & ex){
+        dlovi::Exception ex2(ex.what()); ex2.tag("SFMTranscriptInterface_ORBSLAM", "addCamIndex"); cerr << ex2.what() << endl; //ex2.raise();
+        return -1;
+    }
+}
+
+void SFMTranscriptInterface_ORBSLAM::addNewPointsList(long unsigned int nKFId, const std::vector<long unsigned int> & vnNewPoints){
+    try{
+        // Only the lists of the most recent keyframes are kept, so they take bounded memory however large the map gets
+        m_mKeyFrame_MapPoint[nKFId] = vnNewPoints;
+        m_dNewPointsListOrder.push_back(nKFId);
+        while(m_dNewPointsListOrder.size() > m_nMaxNewPointsLists){
+            m_mKeyFrame_MapPoint.erase(m_dNewPointsListOrder.front());
+            m_dNewPointsListOrder.pop_front();
+        }
     }
     catch(std::exception & ex){
-        dlovi::Exception ex2(ex.what()); ex2.tag("SFMTranscriptInterface_ORBSLAM", "GetReferenceKeyFrame"); cerr << ex2.what() << endl; //ex2.raise();
+        dlovi::Exception ex2(ex.what()); ex2.tag("SFMTranscriptInterface_ORBSLAM", "addNewPointsList"); cerr << ex2.what() << endl; //ex2.raise();
     }
 }
 
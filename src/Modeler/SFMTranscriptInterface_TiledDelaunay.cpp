@@ -0,0 +1,395 @@
+#ifndef __SFMTRANSCRIPTINTERFACE_TILEDDELAUNAY_CPP
+#define __SFMTRANSCRIPTINTERFACE_TILEDDELAUNAY_CPP
+
+#include "Modeler/SFMTranscriptInterface_TiledDelaunay.h"
+#include "Modeler/Exception.h"
+#include "Modeler/Matrix.h"
+#include "Modeler/MeshWriter.h"
+#include <cmath>
+#include <climits>
+#include <algorithm>
+#include <sys/time.h>
+
+#ifndef NULL
+#define NULL 0
+#endif
+
+using namespace std;
+using namespace dlovi;
+
+// Constructors and Destructors
+
+SFMTranscriptInterface_TiledDelaunay::SFMTranscriptInterface_TiledDelaunay(dlovi::compvis::SFMTranscript * pTranscript, size_t nThreads) :
+        m_threadPool(nThreads){
+    try{
+        setTranscriptRef(pTranscript);
+        m_dTileSize = 4.0;
+        m_dTileOverlap = 0.25;
+        m_nNumPointsSeen = 0;
+        m_nCurrentEntryIndex = 0;
+        m_bModelOutdated = false;
+        m_dModelUpdateInterval = 5.0;
+        m_dLastModelUpdate = 0.0;
+        m_nNumModelUpdates = 0;
+        m_dMinVertexDisplacement = 1e-3;
+    }
+    catch(std::exception & ex){
+        dlovi::Exception ex2(ex.what()); ex2.tag("SFMTranscriptInterface_TiledDelaunay", "SFMTranscriptInterface_TiledDelaunay"); cerr << ex2.what() << endl; //ex2.raise();
+    }
+}
+
+SFMTranscriptInterface_TiledDelaunay::~SFMTranscriptInterface_TiledDelaunay(){
+    clearTiles();
+}
+
+// Getters
+
+std::pair<vector<Matrix>, list<Matrix> > SFMTranscriptInterface_TiledDelaunay::getCurrentModel() const{
+    try{
+        return std::make_pair(m_arrModelPoints, m_lstModelTris);
+    }
+    catch(std::exception & ex){
+        dlovi::Exception ex2(ex.what()); ex2.tag("SFMTranscriptInterface_TiledDelaunay", "getCurrentModel"); cerr << ex2.what() << endl; //ex2.raise();
+        return std::pair<vector<Matrix>, list<Matrix> >();
+    }
+}
+
+dlovi::compvis::SFMTranscript::EntryType SFMTranscriptInterface_TiledDelaunay::getCurrentEntryType() const{
+    try{
+        return m_pTranscript->getEntryType_Step();
+    }
+    catch(std::exception & ex){
+        dlovi::Exception ex2(ex.what()); ex2.tag("SFMTranscriptInterface_TiledDelaunay", "getCurrentEntryType"); cerr << ex2.what() << endl; //ex2.raise();
+        return dlovi::compvis::SFMTranscript::EntryType();
+    }
+}
+
+int SFMTranscriptInterface_TiledDelaunay::numTiles() const{
+    try{
+        return (int)m_arrTiles.size();
+    }
+    catch(std::exception & ex){
+        dlovi::Exception ex2(ex.what()); ex2.tag("SFMTranscriptInterface_TiledDelaunay", "numTiles"); cerr << ex2.what() << endl; //ex2.raise();
+        return 0;
+    }
+}
+
+int SFMTranscriptInterface_TiledDelaunay::numModelUpdates() const{
+    try{
+        return m_nNumModelUpdates;
+    }
+    catch(std::exception & ex){
+        dlovi::Exception ex2(ex.what()); ex2.tag("SFMTranscriptInterface_TiledDelaunay", "numModelUpdates"); cerr << ex2.what() << endl; //ex2.raise();
+        return 0;
+    }
+}
+
+std::vector<int> SFMTranscriptInterface_TiledDelaunay::getCurrentModelPointIndices() const{
+    try{
+        return m_arrModelPointIndices;
+    }
+    catch(std::exception & ex){
+        dlovi::Exception ex2(ex.what()); ex2.tag("SFMTranscriptInterface_TiledDelaunay", "getCurrentModelPointIndices"); cerr << ex2.what() << endl; //ex2.raise();
+        return std::vector<int>();
+    }
+}
+
+// Setters
+
+void SFMTranscriptInterface_TiledDelaunay::setTranscriptRef(dlovi::compvis::SFMTranscript * pTranscript){
+    try{
+        m_pTranscript = pTranscript;
+    }
+    catch(std::exception & ex){
+        dlovi::Exception ex2(ex.what()); ex2.tag("SFMTranscriptInterface_TiledDelaunay", "setTranscriptRef"); cerr << ex2.what() << endl; //ex2.raise();
+    }
+}
+
+void SFMTranscriptInterface_TiledDelaunay::setTileSize(double dTileSize){
+    try{
+        // Only takes effect for tiles created afterwards, so set it before running
+        m_dTileSize = dTileSize;
+    }
+    catch(std::exception & ex){
+        dlovi::Exception ex2(ex.what()); ex2.tag("SFMTranscriptInterface_TiledDelaunay", "setTileSize"); cerr << ex2.what() << endl; //ex2.raise();
+    }
+}
+
+void SFMTranscriptInterface_TiledDelaunay::setTileOverlap(double dOverlap){
+    try{
+        m_dTileOverlap = dOverlap;
+    }
+    catch(std::exception & ex){
+        dlovi::Exception ex2(ex.what()); ex2.tag("SFMTranscriptInterface_TiledDelaunay", "setTileOverlap"); cerr << ex2.what() << endl; //ex2.raise();
+    }
+}
+
+void SFMTranscriptInterface_TiledDelaunay::setModelUpdateInterval(double dSeconds){
+    try{
+        m_dModelUpdateInterval = dSeconds;
+    }
+    catch(std::exception & ex){
+        dlovi::Exception ex2(ex.what()); ex2.tag("SFMTranscriptInterface_TiledDelaunay", "setModelUpdateInterval"); cerr << ex2.what() << endl; //ex2.raise();
+    }
+}
+
+void SFMTranscriptInterface_TiledDelaunay::setMinVertexDisplacement(double dDepthFraction){
+    try{
+        m_dMinVertexDisplacement = dDepthFraction;
+        for(std::vector<Tile *>::iterator it = m_arrTiles.begin(); it != m_arrTiles.end(); it++)
+            (*it)->objInterface.setMinVertexDisplacement(dDepthFraction);
+    }
+    catch(std::exception & ex){
+        dlovi::Exception ex2(ex.what()); ex2.tag("SFMTranscriptInterface_TiledDelaunay", "setMinVertexDisplacement"); cerr << ex2.what() << endl; //ex2.raise();
+    }
+}
+
+// Public Methods
+
+void SFMTranscriptInterface_TiledDelaunay::loadTranscriptFromFile(const std::string & strFileName){
+    try{
+        m_pTranscript->readFromFile(strFileName);
+    }
+    catch(std::exception & ex){
+        dlovi::Exception ex2(ex.what()); ex2.tag("SFMTranscriptInterface_TiledDelaunay", "loadTranscriptFromFile"); cerr << ex2.what() << endl; //ex2.raise();
+    }
+}
+
+void SFMTranscriptInterface_TiledDelaunay::runFull(){
+    try{
+        rewind();
+        while(!isDone())
+            step();
+        updateModel(true);
+    }
+    catch(std::exception & ex){
+        dlovi::Exception ex2(ex.what()); ex2.tag("SFMTranscriptInterface_TiledDelaunay", "runFull"); cerr << ex2.what() << endl; //ex2.raise();
+    }
+}
+
+void SFMTranscriptInterface_TiledDelaunay::runRemainder(){
+    try{
+        while(!isDone())
+            step();
+        updateModel();
+    }
+    catch(std::exception & ex){
+        dlovi::Exception ex2(ex.what()); ex2.tag("SFMTranscriptInterface_TiledDelaunay", "runRemainder"); cerr << ex2.what() << endl; //ex2.raise();
+    }
+}
+
+void SFMTranscriptInterface_TiledDelaunay::step(){
+    try{
+        // The transcript is stepped here, once.  The tiles only read the entry, concurrently.
+        m_pTranscript->stepTranscriptText(m_nCurrentEntryIndex == 0);
+        m_nCurrentEntryIndex++;
+
+        if(getCurrentEntryType() == dlovi::compvis::SFMTranscript::ET_RESET){
+            clearTiles();
+            m_nNumPointsSeen = 0;
+            m_arrModelPoints.clear();
+            m_arrModelPointIndices.clear();
+            m_lstModelTris.clear();
+            m_bModelOutdated = false;
+            return;
+        }
+        else if(getCurrentEntryType() == dlovi::compvis::SFMTranscript::ET_INVALID)
+            throw dlovi::Exception("Invalid log entry.");
+        else if(getCurrentEntryType() == dlovi::compvis::SFMTranscript::ET_KEYFRAMEINSERTION)
+            addTilesForNewPoints();
+
+        // Each tile applies only the entries that observe or touch points of its region, and skips the rest
+        m_threadPool.ParallelFor(m_arrTiles.size(), [this](size_t i){
+            SFMTranscriptInterface_Delaunay & objInterface = m_arrTiles[i]->objInterface;
+            if(objInterface.currentEntryConcernsRegion())
+                objInterface.applyCurrentEntry();
+            else
+                objInterface.skipCurrentEntry();
+        });
+        m_bModelOutdated = true;
+    }
+    catch(std::exception & ex){
+        dlovi::Exception ex2(ex.what()); ex2.tag("SFMTranscriptInterface_TiledDelaunay", "step"); cerr << ex2.what() << endl; //ex2.raise();
+    }
+}
+
+void SFMTranscriptInterface_TiledDelaunay::rewind(){
+    try{
+        clearTiles();
+        m_nNumPointsSeen = 0;
+        m_nCurrentEntryIndex = 0;
+        m_arrModelPoints.clear();
+        m_arrModelPointIndices.clear();
+        m_lstModelTris.clear();
+        m_bModelOutdated = false;
+        m_dLastModelUpdate = 0.0;
+        m_pTranscript->invalidate();
+    }
+    catch(std::exception & ex){
+        dlovi::Exception ex2(ex.what()); ex2.tag("SFMTranscriptInterface_TiledDelaunay", "rewind"); cerr << ex2.what() << endl; //ex2.raise();
+    }
+}
+
+bool SFMTranscriptInterface_TiledDelaunay::isDone(){
+    try{
+        return m_pTranscript->isValid();
+    }
+    catch(std::exception & ex){
+        dlovi::Exception ex2(ex.what()); ex2.tag("SFMTranscriptInterface_TiledDelaunay", "isDone"); cerr << ex2.what() << endl; //ex2.raise();
+        return false;
+    }
+}
+
+void SFMTranscriptInterface_TiledDelaunay::writeCurrentModelToFile(const std::string & strFileName) const{
+    try{
+        compvis::MeshWriter::writeFile(strFileName, m_arrModelPoints, m_lstModelTris);
+    }
+    catch(std::exception & ex){
+        dlovi::Exception ex2(ex.what()); ex2.tag("SFMTranscriptInterface_TiledDelaunay", "writeCurrentModelToFile"); cerr << ex2.what() << endl; //ex2.raise();
+    }
+}
+
+bool SFMTranscriptInterface_TiledDelaunay::updateModel(bool bForce){
+    try{
+        if(! m_bModelOutdated)
+            return false;
+        if(! bForce && timestamp() - m_dLastModelUpdate < m_dModelUpdateInterval)
+            return false;
+
+        computeCurrentModel();
+        return true;
+    }
+    catch(std::exception & ex){
+        dlovi::Exception ex2(ex.what()); ex2.tag("SFMTranscriptInterface_TiledDelaunay", "updateModel"); cerr << ex2.what() << endl; //ex2.raise();
+        return false;
+    }
+}
+
+// Private Methods
+
+void SFMTranscriptInterface_TiledDelaunay::clearTiles(){
+    try{
+        for(std::vector<Tile *>::iterator it = m_arrTiles.begin(); it != m_arrTiles.end(); it++)
+            delete *it;
+        m_arrTiles.clear();
+        m_mapCell_Tile.clear();
+    }
+    catch(std::exception & ex){
+        dlovi::Exception ex2(ex.what()); ex2.tag("SFMTranscriptInterface_TiledDelaunay", "clearTiles"); cerr << ex2.what() << endl; //ex2.raise();
+    }
+}
+
+void SFMTranscriptInterface_TiledDelaunay::addTilesForNewPoints(){
+    try{
+        // Tiles are created as the map grows into their cubes
+        const std::vector<dlovi::Matrix> & arrPoints = m_pTranscript->getEntryPoints_Step();
+        for(int nLoop = m_nNumPointsSeen; nLoop < (int)arrPoints.size(); nLoop++){
+            double arrCell[3];
+            bool bValid = true;
+            for(int i = 0; i < 3; i++){
+                arrCell[i] = floor(arrPoints[nLoop](i) / m_dTileSize);
+                bValid = bValid && fabs(arrCell[i]) < 1e6; // also false for NaN
+            }
+            if(bValid && m_mapCell_Tile.count(std::make_tuple((int)arrCell[0], (int)arrCell[1], (int)arrCell[2])) == 0)
+                addTile((int)arrCell[0], (int)arrCell[1], (int)arrCell[2]);
+        }
+        m_nNumPointsSeen = (int)arrPoints.size();
+    }
+    catch(std::exception & ex){
+        dlovi::Exception ex2(ex.what()); ex2.tag("SFMTranscriptInterface_TiledDelaunay", "addTilesForNewPoints"); cerr << ex2.what() << endl; //ex2.raise();
+    }
+}
+
+void SFMTranscriptInterface_TiledDelaunay::addTile(int nX, int nY, int nZ){
+    try{
+        Tile * pTile = new Tile(m_pTranscript);
+        pTile->matCoreMin = dlovi::Matrix(3, 1);
+        pTile->matCoreMin(0) = nX * m_dTileSize; pTile->matCoreMin(1) = nY * m_dTileSize; pTile->matCoreMin(2) = nZ * m_dTileSize;
+        pTile->matCoreMax = pTile->matCoreMin + m_dTileSize;
+
+        const double dMargin = m_dTileOverlap * m_dTileSize;
+        pTile->objInterface.setRegion(pTile->matCoreMin - dMargin, pTile->matCoreMax + dMargin);
+        pTile->objInterface.setModelUpdateBatchSize(INT_MAX);
+        pTile->objInterface.setModelUpdateInterval(0.0);
+        pTile->objInterface.setMinVertexDisplacement(m_dMinVertexDisplacement);
+
+        // Free-space constraints are cut one tile size past the region, which still carves the cells around its points, and the
+        // bounds (the same for all 3 axes) take in the clip box with a tile size to spare, so that every cut constraint ends inside
+        // the triangulation however far away its camera is
+        dlovi::Matrix matClipMin = pTile->matCoreMin - (dMargin + m_dTileSize);
+        dlovi::Matrix matClipMax = pTile->matCoreMax + (dMargin + m_dTileSize);
+        pTile->objAlgorithm.setConstraintClipBox(matClipMin, matClipMax);
+        double dBoundsMin = std::min(matClipMin(0), std::min(matClipMin(1), matClipMin(2))) - m_dTileSize;
+        double dBoundsMax = std::max(matClipMax(0), std::max(matClipMax(1), matClipMax(2))) + m_dTileSize;
+        pTile->objAlgorithm.setBounds(dBoundsMin, dBoundsMax);
+
+        m_mapCell_Tile[std::make_tuple(nX, nY, nZ)] = (int)m_arrTiles.size();
+        m_arrTiles.push_back(pTile);
+    }
+    catch(std::exception & ex){
+        dlovi::Exception ex2(ex.what()); ex2.tag("SFMTranscriptInterface_TiledDelaunay", "addTile"); cerr << ex2.what() << endl; //ex2.raise();
+    }
+}
+
+void SFMTranscriptInterface_TiledDelaunay::computeCurrentModel(){
+    try{
+        // Graph cuts of the tiles that changed, concurrently
+        m_threadPool.ParallelFor(m_arrTiles.size(), [this](size_t i){
+            m_arrTiles[i]->objInterface.updateModel(true);
+        });
+
+        // Stitch: each tile keeps the triangles centered in its own cube, and the vertices shared by neighbouring tiles (same
+        // transcript point) are welded
+        m_arrModelPoints.clear();
+        m_arrModelPointIndices.clear();
+        m_lstModelTris.clear();
+        std::map<int, int> mapPoint_Index;
+        for(std::vector<Tile *>::iterator itTile = m_arrTiles.begin(); itTile != m_arrTiles.end(); itTile++){
+            std::pair<std::vector<dlovi::Matrix>, std::list<dlovi::Matrix> > objModel = (*itTile)->objInterface.getCurrentModel();
+            std::vector<int> arrPointIndices = (*itTile)->objInterface.getCurrentModelPointIndices();
+            std::vector<int> arrModelIndex(objModel.first.size(), -1);
+
+            for(std::list<dlovi::Matrix>::iterator itTri = objModel.second.begin(); itTri != objModel.second.end(); itTri++){
+                int arrIndices[3] = {(int)round(itTri->at(0)), (int)round(itTri->at(1)), (int)round(itTri->at(2))};
+                bool bInCore = true;
+                for(int i = 0; i < 3; i++){
+                    double dCentroid = (objModel.first[arrIndices[0]](i) + objModel.first[arrIndices[1]](i) + objModel.first[arrIndices[2]](i)) / 3.0;
+                    bInCore = bInCore && dCentroid >= (*itTile)->matCoreMin(i) && dCentroid < (*itTile)->matCoreMax(i);
+                }
+                if(! bInCore)
+                    continue;
+
+                for(int i = 0; i < 3; i++){
+                    if(arrModelIndex[arrIndices[i]] < 0){
+                        int nPointIndex = arrPointIndices[arrIndices[i]];
+                        int nModelIndex = (int)m_arrModelPoints.size();
+                        if(nPointIndex >= 0)
+                            nModelIndex = mapPoint_Index.insert(std::make_pair(nPointIndex, nModelIndex)).first->second;
+                        if(nModelIndex == (int)m_arrModelPoints.size()){
+                            m_arrModelPoints.push_back(objModel.first[arrIndices[i]]);
+                            m_arrModelPointIndices.push_back(nPointIndex);
+                        }
+                        arrModelIndex[arrIndices[i]] = nModelIndex;
+                    }
+                    (*itTri)(i) = arrModelIndex[arrIndices[i]];
+                }
+                m_lstModelTris.push_back(*itTri);
+            }
+        }
+
+        m_bModelOutdated = false;
+        m_dLastModelUpdate = timestamp();
+        m_nNumModelUpdates++;
+    }
+    catch(std::exception & ex){
+        dlovi::Exception ex2(ex.what()); ex2.tag("SFMTranscriptInterface_TiledDelaunay", "computeCurrentModel"); cerr << ex2.what() << endl; //ex2.raise();
+    }
+}
+
+double SFMTranscriptInterface_TiledDelaunay::timestamp() const{
+    timeval t;
+    gettimeofday(&t, 0);
+    return (double)(t.tv_sec + (t.tv_usec / 1000000.0));
+}
+
+#endif
@@ -0,0 +1,460 @@
+#ifndef __SFMTRANSCRIPTSTREAM_CPP
+#define __SFMTRANSCRIPTSTREAM_CPP
+
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <sstream>
+#include <iostream>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include "Modeler/SFMTranscriptStream.h"
+#include "Modeler/SFMTranscript.h"
+#include "Modeler/StringFunctions.h"
+#include "Modeler/Exception.h"
+#include "Modeler/WireFormat.h"
+
+namespace dlovi{
+    namespace compvis{
+
+        using namespace dlovi::stringfunctions;
+        using namespace dlovi::compvis::transcriptstream;
+        using namespace dlovi::wireformat;
+
+        // Line parsing helpers
+
+        namespace{
+            // Parses "[x; y; z]" at pStr into three floats (the transcript writes 6 significant digits, which float32 holds
+            // exactly), and returns the position after the "]".
+            const char * parseVec3(const char * pStr, float * arrXYZ){
+                const char * p = std::strchr(pStr, '[');
+                if(p == NULL)
+                    throw dlovi::Exception("Expected a [x; y; z] position.");
+                p++;
+                for(int i = 0; i < 3; i++){
+                    char * pEnd;
+                    arrXYZ[i] = std::strtof(p, & pEnd);
+                    if(pEnd == p)
+                        throw dlovi::Exception("Malformed [x; y; z] position.");
+                    p = pEnd;
+                    while(*p == ';' || *p == ' ')
+                        p++;
+                }
+                if(*p != ']')
+                    throw dlovi::Exception("Malformed [x; y; z] position.");
+                return p + 1;
+            }
+
+            // Parses the ", n1, n2, ..." index list at pStr
+            void parseIndexList(const char * pStr, std::vector<uint32_t> & arrIndices){
+                arrIndices.clear();
+                const char * p = pStr;
+                while(*p == ',' || *p == ' '){
+                    while(*p == ',' || *p == ' ')
+                        p++;
+                    if(*p == '\0')
+                        break;
+                    char * pEnd;
+                    long n = std::strtol(p, & pEnd, 10);
+                    if(pEnd == p || n < 0)
+                        throw dlovi::Exception("Malformed index list.");
+                    arrIndices.push_back((uint32_t)n);
+                    p = pEnd;
+                }
+            }
+
+            uint32_t parseIndex(const char * pStr){
+                char * pEnd;
+                long n = std::strtol(pStr, & pEnd, 10);
+                if(pEnd == pStr || n < 0)
+                    throw dlovi::Exception("Malformed index.");
+                return (uint32_t)n;
+            }
+
+            bool startsWith(const std::string & str, const char * pPrefix){
+                return str.compare(0, std::strlen(pPrefix), pPrefix) == 0;
+            }
+        }
+
+        // FileDescriptorSink
+
+        FileDescriptorSink::FileDescriptorSink(int nFd) : m_nFd(nFd) {
+            struct stat objStat;
+            m_bSocket = fstat(m_nFd, & objStat) == 0 && S_ISSOCK(objStat.st_mode);
+        }
+
+        bool FileDescriptorSink::write(const char * pData, size_t nSize){
+            try{
+                while(nSize > 0){
+                    // A reader that goes away on a socket fails the send instead of raising SIGPIPE in the whole process
+#ifdef MSG_NOSIGNAL
+                    ssize_t nWritten = m_bSocket ? ::send(m_nFd, pData, nSize, MSG_NOSIGNAL) : ::write(m_nFd, pData, nSize);
+#else
+                    ssize_t nWritten = ::write(m_nFd, pData, nSize);
+#endif
+                    if(nWritten < 0){
+                        if(errno == EINTR)
+                            continue;
+                        return false;
+                    }
+                    pData += nWritten;
+                    nSize -= nWritten;
+                }
+                return true;
+            }
+            catch(std::exception & ex){
+                dlovi::Exception ex2(ex.what()); ex2.tag("FileDescriptorSink", "write"); ex2.raise();
+                return false;
+            }
+        }
+
+        // BufferSink
+
+        bool BufferSink::write(const char * pData, size_t nSize){
+            try{
+                m_arrBuffer.insert(m_arrBuffer.end(), (const uint8_t *)pData, (const uint8_t *)pData + nSize);
+                return true;
+            }
+            catch(std::exception & ex){
+                dlovi::Exception ex2(ex.what()); ex2.tag("BufferSink", "write"); ex2.raise();
+                return false;
+            }
+        }
+
+        const std::vector<uint8_t> & BufferSink::getBuffer() const{
+            return m_arrBuffer;
+        }
+
+        void BufferSink::clear(){
+            m_arrBuffer.clear();
+        }
+
+        // SFMTranscriptEncoder
+
+        SFMTranscriptEncoder::SFMTranscriptEncoder(){
+            m_nNumCams = 0;
+            m_nNumPoints = 0;
+            m_bInKeyFrameBlock = false;
+        }
+
+        void SFMTranscriptEncoder::encodeLine(const std::string & strLineOriginal, std::string & strPayload){
+            try{
+                const std::string strLine = trim(strLineOriginal);
+                float arrXYZ[3];
+                std::vector<uint32_t> arrIndices;
+
+                // Same precedence as SFMTranscript's parser: "del observation" before "observation", etc.
+                if(strLine == "}"){
+                    putByte(strPayload, RT_ENDBLOCK);
+                    m_bInKeyFrameBlock = false;
+                }
+                else if(strLine.find("reset") != std::string::npos){
+                    putByte(strPayload, RT_RESET);
+                    m_nNumCams = 0;
+                    m_nNumPoints = 0;
+                }
+                else if(startsWith(strLine, "new point: ")){
+                    const char * p = parseVec3(strLine.c_str() + 11, arrXYZ); // 11 == strlen("new point: ")
+                    parseIndexList(p, arrIndices);
+                    putByte(strPayload, RT_NEWPOINT);
+                    putVarint(strPayload, m_nNumPoints++);
+                    for(int i = 0; i < 3; i++)
+                        putFloat(strPayload, arrXYZ[i]);
+                    putVarint(strPayload, arrIndices.size());
+                    for(size_t i = 0; i < arrIndices.size(); i++)
+                        putVarint(strPayload, arrIndices[i]);
+                }
+                else if(startsWith(strLine, "del point: ")){
+                    putByte(strPayload, RT_DELPOINT);
+                    putVarint(strPayload, parseIndex(strLine.c_str() + 11)); // 11 == strlen("del point: ")
+                }
+                else if(startsWith(strLine, "move point: ") || startsWith(strLine, "move cam: ")){
+                    bool bPoint = startsWith(strLine, "move point: ");
+                    const char * p = strLine.c_str() + (bPoint ? 12 : 10); // strlen("move point: "), strlen("move cam: ")
+                    uint32_t nIndex = parseIndex(p);
+                    parseVec3(p, arrXYZ);
+                    putByte(strPayload, bPoint ? RT_MOVEPOINT : RT_MOVECAM);
+                    putVarint(strPayload, nIndex);
+                    for(int i = 0; i < 3; i++)
+                        putFloat(strPayload, arrXYZ[i]);
+                }
+                else if(startsWith(strLine, "del observation: ")){
+                    parseIndexList(strLine.c_str() + 16, arrIndices); // 16 == strlen("del observation:")
+                    if(arrIndices.size() != 2)
+                        throw dlovi::Exception("Malformed observation deletion.");
+                    putByte(strPayload, RT_DELOBSERVATION);
+                    putVarint(strPayload, arrIndices[0]);
+                    putVarint(strPayload, arrIndices[1]);
+                }
+                else if(startsWith(strLine, "observation: ")){
+                    parseIndexList(strLine.c_str() + 12, arrIndices); // 12 == strlen("observation:")
+                    if(m_bInKeyFrameBlock && arrIndices.size() == 1){
+                        putByte(strPayload, RT_KEYFRAMEOBSERVATION);
+                        putVarint(strPayload, arrIndices[0]);
+                    }
+                    else if(! m_bInKeyFrameBlock && arrIndices.size() == 2){
+                        putByte(strPayload, RT_OBSERVATION);
+                        putVarint(strPayload, arrIndices[0]);
+                        putVarint(strPayload, arrIndices[1]);
+                    }
+                    else
+                        throw dlovi::Exception("Malformed observation.");
+                }
+                else if(startsWith(strLine, "new cam: ")){
+                    parseVec3(strLine.c_str() + 9, arrXYZ); // 9 == strlen("new cam: ")
+                    putByte(strPayload, RT_NEWCAM);
+                    putVarint(strPayload, m_nNumCams++);
+                    for(int i = 0; i < 3; i++)
+                        putFloat(strPayload, arrXYZ[i]);
+                    m_bInKeyFrameBlock = true;
+                }
+                else if(strLine == "bundle {")
+                    putByte(strPayload, RT_BUNDLE);
+                else if(! strLine.empty())
+                    throw dlovi::Exception("Unrecognized transcript line: " + strLine);
+            }
+            catch(std::exception & ex){
+                dlovi::Exception ex2(ex.what()); ex2.tag("SFMTranscriptEncoder", "encodeLine"); ex2.raise();
+            }
+        }
+
+        void SFMTranscriptEncoder::encodeKeyFramePose(const KeyFramePose & objPose, std::string & strPayload){
+            try{
+                putByte(strPayload, RT_KEYFRAMEPOSE);
+                putVarint(strPayload, objPose.nId);
+                putDouble(strPayload, objPose.dTimestamp);
+                for(int i = 0; i < 12; i++)
+                    putFloat(strPayload, objPose.arrTwc[i]);
+            }
+            catch(std::exception & ex){
+                dlovi::Exception ex2(ex.what()); ex2.tag("SFMTranscriptEncoder", "encodeKeyFramePose"); ex2.raise();
+            }
+        }
+
+        void SFMTranscriptEncoder::writeFrame(const std::string & strPayload, std::string & strFrame){
+            try{
+                strFrame.clear();
+                strFrame.reserve(FRAME_HEADER_SIZE + strPayload.size());
+                putByte(strFrame, 'C');
+                putByte(strFrame, 'V');
+                putByte(strFrame, VERSION);
+                putU32(strFrame, (uint32_t)strPayload.size());
+                strFrame += strPayload;
+            }
+            catch(std::exception & ex){
+                dlovi::Exception ex2(ex.what()); ex2.tag("SFMTranscriptEncoder", "writeFrame"); ex2.raise();
+            }
+        }
+
+        // SFMTranscriptDecoder
+
+        SFMTranscriptDecoder::SFMTranscriptDecoder(SFMTranscript * pTranscript){
+            try{
+                m_pTranscript = pTranscript;
+                m_nNumCams = 0;
+                m_nNumPoints = 0;
+                m_bInKeyFrameBlock = false;
+                m_nNumFramesDecoded = 0;
+
+                m_pTranscript->addLine("SFM Transcript: ORBSLAM");
+                m_pTranscript->addLine("*** BODY ***");
+            }
+            catch(std::exception & ex){
+                dlovi::Exception ex2(ex.what()); ex2.tag("SFMTranscriptDecoder", "SFMTranscriptDecoder"); ex2.raise();
+            }
+        }
+
+        void SFMTranscriptDecoder::feed(const char * pData, size_t nSize){
+            try{
+                m_strPending.append(pData, nSize);
+
+                size_t nPos = 0;
+                while(m_strPending.size() - nPos >= FRAME_HEADER_SIZE){
+                    const char * pFrame = m_strPending.data() + nPos;
+                    if(pFrame[0] != 'C' || pFrame[1] != 'V')
+                        throw dlovi::Exception("Bad frame magic in transcript stream.");
+                    if((uint8_t)pFrame[2] != VERSION)
+                        throw dlovi::Exception("Unsupported transcript stream version.");
+                    uint32_t nPayloadSize = WireReader(pFrame + 3, 4).getU32();
+                    if(m_strPending.size() - nPos - FRAME_HEADER_SIZE < nPayloadSize)
+                        break;
+
+                    decodePayload(pFrame + FRAME_HEADER_SIZE, nPayloadSize);
+                    m_nNumFramesDecoded++;
+                    nPos += FRAME_HEADER_SIZE + nPayloadSize;
+                }
+                m_strPending.erase(0, nPos);
+            }
+            catch(std::exception & ex){
+                dlovi::Exception ex2(ex.what()); ex2.tag("SFMTranscriptDecoder", "feed"); ex2.raise();
+            }
+        }
+
+        void SFMTranscriptDecoder::takeKeyFramePoses(std::vector<KeyFramePose> & arrPoses){
+            try{
+                arrPoses.swap(m_arrPoses);
+                m_arrPoses.clear();
+            }
+            catch(std::exception & ex){
+                dlovi::Exception ex2(ex.what()); ex2.tag("SFMTranscriptDecoder", "takeKeyFramePoses"); ex2.raise();
+            }
+        }
+
+        int SFMTranscriptDecoder::numFramesDecoded() const{
+            return m_nNumFramesDecoded;
+        }
+
+        void SFMTranscriptDecoder::decodePayload(const char * pData, size_t nSize){
+            try{
+                WireReader objReader(pData, nSize);
+                std::ostringstream ssTmp; // default formatting, as the transcript was written
+
+                while(! objReader.done()){
+                    ssTmp.str("");
+                    uint8_t nType = objReader.getByte();
+                    switch(nType){
+                    case RT_RESET:
+                        m_pTranscript->addLine("reset");
+                        m_nNumCams = 0;
+                        m_nNumPoints = 0;
+                        break;
+                    case RT_NEWCAM:{
+                        if((int)objReader.getVarint() != m_nNumCams++)
+                            throw dlovi::Exception("Camera index out of sequence: the stream was not received from the start.");
+                        float x = objReader.getFloat(), y = objReader.getFloat(), z = objReader.getFloat();
+                        ssTmp << "new cam: [" << x << "; " << y << "; " << z << "] {";
+                        m_pTranscript->addLine(ssTmp.str());
+                        m_bInKeyFrameBlock = true;
+                        break;
+                    }
+                    case RT_NEWPOINT:{
+                        if((int)objReader.getVarint() != m_nNumPoints++)
+                            throw dlovi::Exception("Point index out of sequence: the stream was not received from the start.");
+                        float x = objReader.getFloat(), y = objReader.getFloat(), z = objReader.getFloat();
+                        ssTmp << "new point: [" << x << "; " << y << "; " << z << "]";
+                        uint32_t nNumCams = objReader.getVarint();
+                        for(uint32_t i = 0; i < nNumCams; i++)
+                            ssTmp << ", " << objReader.getVarint();
+                        m_pTranscript->addLine(ssTmp.str());
+                        break;
+                    }
+                    case RT_KEYFRAMEOBSERVATION:
+                        ssTmp << "observation: " << objReader.getVarint();
+                        m_pTranscript->addLine(ssTmp.str());
+                        break;
+                    case RT_OBSERVATION:
+                    case RT_DELOBSERVATION:{
+                        uint32_t nCamIndex = objReader.getVarint();
+                        uint32_t nPointIndex = objReader.getVarint();
+                        ssTmp << (nType == RT_OBSERVATION ? "observation: " : "del observation: ") << nCamIndex << ", " << nPointIndex;
+                        m_pTranscript->addLine(ssTmp.str());
+                        break;
+                    }
+                    case RT_DELPOINT:
+                        ssTmp << "del point: " << objReader.getVarint();
+                        m_pTranscript->addLine(ssTmp.str());
+                        break;
+                    case RT_BUNDLE:
+                        m_pTranscript->addLine("bundle {");
+                        break;
+                    case RT_MOVEPOINT:
+                    case RT_MOVECAM:{
+                        uint32_t nIndex = objReader.getVarint();
+                        float x = objReader.getFloat(), y = objReader.getFloat(), z = objReader.getFloat();
+                        ssTmp << (nType == RT_MOVEPOINT ? "move point: " : "move cam: ") << nIndex << ", [" << x << "; " << y << "; " << z << "]";
+                        m_pTranscript->addLine(ssTmp.str());
+                        break;
+                    }
+                    case RT_ENDBLOCK:
+                        m_pTranscript->addLine("}");
+                        m_bInKeyFrameBlock = false;
+                        break;
+                    case RT_KEYFRAMEPOSE:{
+                        KeyFramePose objPose;
+                        objPose.nId = objReader.getVarint();
+                        objPose.dTimestamp = objReader.getDouble();
+                        for(int i = 0; i < 12; i++)
+                            objPose.arrTwc[i] = objReader.getFloat();
+                        m_arrPoses.push_back(objPose);
+                        break;
+                    }
+                    default:
+                        throw dlovi::Exception("Unknown record type in transcript stream.");
+                    }
+                }
+            }
+            catch(std::exception & ex){
+                dlovi::Exception ex2(ex.what()); ex2.tag("SFMTranscriptDecoder", "decodePayload"); ex2.raise();
+            }
+        }
+
+        // SFMTranscriptPublisher
+
+        SFMTranscriptPublisher::SFMTranscriptPublisher(SFMTranscript * pTranscript, std::mutex * pMutex, ByteSink * pSink){
+            m_pTranscript = pTranscript;
+            m_pMutex = pMutex;
+            m_pSink = pSink;
+            m_nNumBytesPublished = 0;
+
+            // A receiver can only rebuild the model from the whole transcript, so the stream has to start at its first line
+            std::unique_lock<std::mutex> lock(*m_pMutex);
+            if(! m_pTranscript->hasAllLines())
+                throw dlovi::Exception("Cannot publish a transcript whose first lines were released or compacted.");
+            // The lines added from here on are kept until published, even if the first publishNew() comes late
+            m_pTranscript->trackNewLines();
+        }
+
+        int SFMTranscriptPublisher::publishNew(){
+            try{
+                {
+                    std::unique_lock<std::mutex> lock(*m_pMutex);
+                    m_pTranscript->getNewLines(m_arrStrLines);
+                }
+
+                std::string strPayload;
+                for(std::vector<std::string>::const_iterator it = m_arrStrLines.begin(); it != m_arrStrLines.end(); it++){
+                    m_objEncoder.encodeLine(*it, strPayload);
+                    if(strPayload.size() >= MAX_FRAME_PAYLOAD && ! sendFrame(strPayload))
+                        return -1;
+                }
+                if(! strPayload.empty() && ! sendFrame(strPayload))
+                    return -1;
+
+                return (int)m_arrStrLines.size();
+            }
+            catch(std::exception & ex){
+                dlovi::Exception ex2(ex.what()); ex2.tag("SFMTranscriptPublisher", "publishNew"); std::cerr << ex2.what() << std::endl; //ex2.raise();
+                return -1;
+            }
+        }
+
+        bool SFMTranscriptPublisher::publishKeyFramePose(const KeyFramePose & objPose){
+            try{
+                std::string strPayload;
+                m_objEncoder.encodeKeyFramePose(objPose, strPayload);
+                return sendFrame(strPayload);
+            }
+            catch(std::exception & ex){
+                dlovi::Exception ex2(ex.what()); ex2.tag("SFMTranscriptPublisher", "publishKeyFramePose"); std::cerr << ex2.what() << std::endl; //ex2.raise();
+                return false;
+            }
+        }
+
+        size_t SFMTranscriptPublisher::numBytesPublished() const{
+            return m_nNumBytesPublished;
+        }
+
+        bool SFMTranscriptPublisher::sendFrame(std::string & strPayload){
+            std::string strFrame;
+            SFMTranscriptEncoder::writeFrame(strPayload, strFrame);
+            strPayload.clear();
+            if(! m_pSink->write(strFrame.data(), strFrame.size()))
+                return false;
+            m_nNumBytesPublished += strFrame.size();
+            return true;
+        }
+    }
+}
+
+#endif
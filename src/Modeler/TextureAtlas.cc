@@ -0,0 +1,321 @@
+#include "Modeler/TextureAtlas.h"
+
+#include <cmath>
+#include <limits>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <opencv2/highgui/highgui.hpp>
+
+#include "KeyFrame.h"
+
+namespace ORB_SLAM2 {
+
+    TextureAtlas::View::View(KeyFrame* pKF, const cv::Mat& imView, long nViewSeq):
+            frame(pKF), im(imView), orientation(3,1), nSeq(nViewSeq)
+    {
+        SetPose();
+    }
+
+    void TextureAtlas::View::UpdatePose()
+    {
+        // bundle adjustment and loop closure move the keyframe after it was queued; a culled one keeps its last pose
+        if (frame.mpKF == NULL || frame.mpKF->isBad())
+            return;
+        cv::Mat Tcw = frame.mpKF->GetPose();
+        frame.mRcw = Tcw.rowRange(0, 3).colRange(0, 3);
+        frame.mtcw = Tcw.rowRange(0, 3).col(3);
+        frame.mTwc = frame.mpKF->GetPoseInverse();
+        SetPose();
+    }
+
+    void TextureAtlas::View::SetPose()
+    {
+        for (int i = 0; i < 3; i++) {
+            for (int j = 0; j < 3; j++)
+                Rcw(i,j) = frame.mRcw.at<float>(i,j);
+            tcw(i) = frame.mtcw.at<float>(i);
+        }
+        cv::Mat texOrient = frame.GetOrientation();
+        orientation(0) = texOrient.at<float>(0);
+        orientation(1) = texOrient.at<float>(1);
+        orientation(2) = texOrient.at<float>(2);
+    }
+
+    bool TextureAtlas::View::Project(const Position& P, cv::Point2f& uv) const
+    {
+        cv::Vec3f Pc = Rcw * cv::Vec3f(std::get<0>(P), std::get<1>(P), std::get<2>(P)) + tcw;
+        if (Pc(2) <= 0)
+            return false;
+        uv.x = frame.mfx * Pc(0) / Pc(2) + frame.mcx;
+        uv.y = frame.mfy * Pc(1) / Pc(2) + frame.mcy;
+        return uv.x > frame.mnMinX && uv.x < std::min(frame.mnMaxX, (float)im.cols) &&
+               uv.y > frame.mnMinY && uv.y < std::min(frame.mnMaxY, (float)im.rows);
+    }
+
+    TextureAtlas::TextureAtlas(int nPageSize, int nSlotSize, size_t nMaxViews):
+            mnPageSize(nPageSize), mnSlotSize(nSlotSize), mnSlotsPerRow(nPageSize / nSlotSize), mnMaxViews(nMaxViews),
+            mnNextViewSeq(0), mnGeneration(0), mnNextSlot(0)
+    {
+    }
+
+    void TextureAtlas::AddView(KeyFrame* pKF, const cv::Mat& im)
+    {
+        if (im.empty())
+            return;
+
+        // the frame images are not written to once queued, the view shares them
+        cv::Mat imRGB = im;
+        if (im.type() != CV_8UC3)
+            cv::cvtColor(im, imRGB, CV_GRAY2RGB);
+
+        std::unique_lock<std::mutex> lock(mMutexAtlas);
+        mdViews.push_back(View(pKF, imRGB, mnNextViewSeq++));
+        if (mdViews.size() > mnMaxViews)
+            mdViews.pop_front();
+    }
+
+    int TextureAtlas::AllocateSlot()
+    {
+        if (!mvFreeSlots.empty()) {
+            int nSlot = mvFreeSlots.back();
+            mvFreeSlots.pop_back();
+            return nSlot;
+        }
+
+        int nSlot = mnNextSlot++;
+        size_t nPage = nSlot / (mnSlotsPerRow * mnSlotsPerRow);
+        if (nPage >= mvPages.size()) {
+            mvPages.push_back(cv::Mat::zeros(mnPageSize, mnPageSize, CV_8UC3));
+            mvDirtyRows.push_back(std::make_pair(0, 0));
+        }
+        return nSlot;
+    }
+
+    bool TextureAtlas::BakeSlot(const View& view, BakedTriangle& tri)
+    {
+        cv::Point2f arrSrc[3];
+        for (int i = 0; i < 3; i++) {
+            if (!view.Project(tri.arrPos[i], arrSrc[i]))
+                return false;
+        }
+        // a triangle seen edge-on has no texture to speak of
+        cv::Point2f e1 = arrSrc[1] - arrSrc[0], e2 = arrSrc[2] - arrSrc[0];
+        if (std::abs(e1.cross(e2)) < 1.0)
+            return false;
+
+        if (tri.nSlot < 0)
+            tri.nSlot = AllocateSlot();
+
+        const int nSlotsPerPage = mnSlotsPerRow * mnSlotsPerRow;
+        const int nPage = tri.nSlot / nSlotsPerPage;
+        const int x = (tri.nSlot % nSlotsPerPage) % mnSlotsPerRow * mnSlotSize;
+        const int y = (tri.nSlot % nSlotsPerPage) / mnSlotsPerRow * mnSlotSize;
+
+        // the triangle covers half of the slot; the rest of it, warped from around the triangle, keeps linear filtering
+        // from bleeding in other triangles at its edges
+        const float m = 1.5f;
+        cv::Point2f arrDst[3] = {cv::Point2f(m, m), cv::Point2f(mnSlotSize - m, m), cv::Point2f(m, mnSlotSize - m)};
+
+        cv::Mat M = cv::getAffineTransform(arrSrc, arrDst);
+        cv::Mat slot = mvPages[nPage](cv::Rect(x, y, mnSlotSize, mnSlotSize));
+        cv::warpAffine(view.im, slot, M, slot.size(), cv::INTER_LINEAR, cv::BORDER_REPLICATE);
+
+        for (int i = 0; i < 3; i++) {
+            tri.arrUV[2*i] = (x + arrDst[i].x) / mnPageSize;
+            tri.arrUV[2*i+1] = (y + arrDst[i].y) / mnPageSize;
+        }
+
+        std::pair<int, int>& dirty = mvDirtyRows[nPage];
+        if (dirty.first >= dirty.second)
+            dirty = std::make_pair(y, y + mnSlotSize);
+        else
+            dirty = std::make_pair(std::min(dirty.first, y), std::max(dirty.second, y + mnSlotSize));
+        return true;
+    }
+
+    std::vector<TriangleTexture> TextureAtlas::Bake(const std::vector<dlovi::Matrix>& vPoints, const std::vector<int>& vPointIndices,
+                                                    const std::list<dlovi::Matrix>& lTris)
+    {
+        std::unique_lock<std::mutex> lock(mMutexAtlas);
+        mnGeneration++;
+        for (std::deque<View>::iterator itView = mdViews.begin(); itView != mdViews.end(); itView++)
+            itView->UpdatePose();
+
+        std::vector<TriangleTexture> vTriTextures;
+        vTriTextures.reserve(lTris.size());
+        for (std::list<dlovi::Matrix>::const_iterator it = lTris.begin(); it != lTris.end(); it++) {
+            // the indices are held as doubles in the triangle
+            int arrIndices[3] = {(int)std::lround((*it)(0)), (int)std::lround((*it)(1)), (int)std::lround((*it)(2))};
+            const dlovi::Matrix& point0 = vPoints[arrIndices[0]];
+            const dlovi::Matrix& point1 = vPoints[arrIndices[1]];
+            const dlovi::Matrix& point2 = vPoints[arrIndices[2]];
+            Position arrPos[3] = {Position(point0(0), point0(1), point0(2)),
+                                  Position(point1(0), point1(1), point1(2)),
+                                  Position(point2(0), point2(1), point2(2))};
+
+            TriangleTexture tex;
+            tex.nPage = -1;
+            tex.nFrameId = -1;
+            if (vPointIndices.size() != vPoints.size() || vPointIndices[arrIndices[0]] < 0 ||
+                vPointIndices[arrIndices[1]] < 0 || vPointIndices[arrIndices[2]] < 0) {
+                vTriTextures.push_back(tex); // no transcript points to tell the triangle by
+                continue;
+            }
+
+            // the vertices in the order of their transcript points, which is the order of the key
+            int arrOrder[3] = {0, 1, 2};
+            std::sort(arrOrder, arrOrder + 3, [&](int a, int b) { return vPointIndices[arrIndices[a]] < vPointIndices[arrIndices[b]]; });
+            TriangleKey key = {{vPointIndices[arrIndices[arrOrder[0]]], vPointIndices[arrIndices[arrOrder[1]]], vPointIndices[arrIndices[arrOrder[2]]]}};
+
+            std::pair<std::map<TriangleKey, BakedTriangle>::iterator, bool> itInsert =
+                    mmTriangles.insert(std::make_pair(key, BakedTriangle()));
+            BakedTriangle& tri = itInsert.first->second;
+            if (itInsert.second)
+                tri.nSlot = -1;
+            bool bMoved = false;
+            for (int j = 0; j < 3 && !itInsert.second; j++)
+                bMoved = bMoved || tri.arrPos[j] != arrPos[arrOrder[j]];
+            if (itInsert.second || bMoved) {
+                // baked from scratch, into the same slot, once its points moved (bundle adjustment, loop closure)
+                tri.nFrameId = -1;
+                tri.dScore = -std::numeric_limits<double>::infinity();
+                tri.nViewsChecked = 0;
+                for (int j = 0; j < 3; j++)
+                    tri.arrPos[j] = arrPos[arrOrder[j]];
+            }
+            tri.nGeneration = mnGeneration;
+
+            // same choice as the views used to be picked on each draw: the one facing the triangle most that sees it all,
+            // among the views it was not tried with yet
+            dlovi::Matrix normal = (point2 - point0).cross(point1 - point0);
+            double dNorm = normal.norm();
+            if (dNorm > 0)
+                normal = normal / dNorm;
+
+            double dBestScore = tri.dScore;
+            const View* pBestView = NULL;
+            for (std::deque<View>::const_iterator itView = mdViews.begin(); itView != mdViews.end(); itView++) {
+                if (itView->nSeq < tri.nViewsChecked)
+                    continue;
+                double dScore = normal.dot(itView->orientation);
+                if (dScore <= dBestScore)
+                    continue;
+                cv::Point2f uv;
+                if (itView->Project(tri.arrPos[0], uv) && itView->Project(tri.arrPos[1], uv) && itView->Project(tri.arrPos[2], uv)) {
+                    dBestScore = dScore;
+                    pBestView = &(*itView);
+                }
+            }
+            tri.nViewsChecked = mnNextViewSeq;
+
+            if (pBestView != NULL && BakeSlot(*pBestView, tri)) {
+                tri.dScore = dBestScore;
+                tri.nFrameId = (long)pBestView->frame.mFrameID;
+            }
+
+            tex.nFrameId = tri.nFrameId;
+            if (tri.nFrameId >= 0) {
+                tex.nPage = tri.nSlot / (mnSlotsPerRow * mnSlotsPerRow);
+                for (int j = 0; j < 3; j++) {
+                    tex.arrUV[2*arrOrder[j]] = tri.arrUV[2*j];
+                    tex.arrUV[2*arrOrder[j]+1] = tri.arrUV[2*j+1];
+                }
+            }
+            vTriTextures.push_back(tex);
+        }
+
+        // triangles no longer in the surface give their slot back
+        for (std::map<TriangleKey, BakedTriangle>::iterator it = mmTriangles.begin(); it != mmTriangles.end(); ) {
+            if (it->second.nGeneration != mnGeneration) {
+                if (it->second.nSlot >= 0)
+                    mvFreeSlots.push_back(it->second.nSlot);
+                mmTriangles.erase(it++);
+            } else {
+                it++;
+            }
+        }
+
+        mvLastPoints = vPoints;
+        mlLastTris = lTris;
+        mvLastTriTextures = vTriTextures;
+
+        return vTriTextures;
+    }
+
+    void TextureAtlas::ForEachDirtyPage(const std::function<void(int, const cv::Mat&, int, int)>& f)
+    {
+        std::unique_lock<std::mutex> lock(mMutexAtlas);
+        for (size_t i = 0; i < mvPages.size(); i++) {
+            if (mvDirtyRows[i].first >= mvDirtyRows[i].second)
+                continue;
+            f(i, mvPages[i], mvDirtyRows[i].first, mvDirtyRows[i].second);
+            mvDirtyRows[i] = std::make_pair(0, 0);
+        }
+    }
+
+    bool TextureAtlas::WriteObj(const std::string& strPrefix)
+    {
+        std::unique_lock<std::mutex> lock(mMutexAtlas);
+
+        std::string strBaseName = strPrefix.substr(strPrefix.find_last_of('/') + 1);
+        std::ofstream fileObj((strPrefix + ".obj").c_str(), std::ios::out);
+        std::ofstream fileMtl((strPrefix + ".mtl").c_str(), std::ios::out);
+        if (!fileObj || !fileMtl) {
+            std::cerr << "Failed to save the textured model to " << strPrefix << std::endl;
+            return false;
+        }
+
+        fileObj << "mtllib " << strBaseName << ".mtl\n";
+        for (size_t i = 0; i < mvLastPoints.size(); i++)
+            fileObj << "v " << mvLastPoints[i](0) << " " << mvLastPoints[i](1) << " " << mvLastPoints[i](2) << "\n";
+
+        std::vector<const dlovi::Matrix*> vpTris;
+        for (std::list<dlovi::Matrix>::const_iterator it = mlLastTris.begin(); it != mlLastTris.end(); it++)
+            vpTris.push_back(&(*it));
+
+        // triangles without texture first, then the triangles of each page with its material
+        for (size_t i = 0; i < vpTris.size(); i++) {
+            if (mvLastTriTextures[i].nPage < 0)
+                fileObj << "f " << std::lround((*vpTris[i])(0)) + 1 << " " << std::lround((*vpTris[i])(1)) + 1 << " " << std::lround((*vpTris[i])(2)) + 1 << "\n";
+        }
+        int nTexCoords = 0;
+        for (size_t nPage = 0; nPage < mvPages.size(); nPage++) {
+            fileObj << "usemtl page" << nPage << "\n";
+            for (size_t i = 0; i < vpTris.size(); i++) {
+                const TriangleTexture& tex = mvLastTriTextures[i];
+                if (tex.nPage != (int)nPage)
+                    continue;
+                // obj texture coordinates start at the bottom of the image
+                for (int j = 0; j < 3; j++)
+                    fileObj << "vt " << tex.arrUV[2*j] << " " << 1 - tex.arrUV[2*j+1] << "\n";
+                fileObj << "f";
+                for (int j = 0; j < 3; j++)
+                    fileObj << " " << std::lround((*vpTris[i])(j)) + 1 << "/" << nTexCoords + j + 1;
+                fileObj << "\n";
+                nTexCoords += 3;
+            }
+
+            std::string strPage = strBaseName + "_" + std::to_string(nPage) + ".png";
+            fileMtl << "newmtl page" << nPage << "\nKa 1 1 1\nKd 1 1 1\nmap_Kd " << strPage << "\n";
+            cv::imwrite(strPrefix + "_" + std::to_string(nPage) + ".png", mvPages[nPage]);
+        }
+
+        fileObj.close();
+        fileMtl.close();
+        return !fileObj.fail() && !fileMtl.fail();
+    }
+
+    void TextureAtlas::Clear()
+    {
+        std::unique_lock<std::mutex> lock(mMutexAtlas);
+        mdViews.clear();
+        mmTriangles.clear();
+        mvFreeSlots.clear();
+        mnNextSlot = 0;
+        mvLastPoints.clear();
+        mlLastTris.clear();
+        mvLastTriTextures.clear();
+    }
+}
@@ -0,0 +1,104 @@
+//
+// Lock-free hand-off of map changes from the SLAM threads to the modeler.
+//
+
+#include "Modeler/TranscriptEventQueue.h"
+
+namespace ORB_SLAM2 {
+
+    TranscriptEventQueue::TranscriptEventQueue(size_t nCapacity):
+            mnEnqueuePos(0), mnDequeuePos(0), mbOverflowing(false), mnNumOverflowed(0)
+    {
+        size_t nSize = 2;
+        while (nSize < nCapacity)
+            nSize <<= 1;
+
+        mpCells = new Cell[nSize];
+        mnMask = nSize - 1;
+        for (size_t i = 0; i < nSize; i++)
+            mpCells[i].mnSequence.store(i, std::memory_order_relaxed);
+    }
+
+    TranscriptEventQueue::~TranscriptEventQueue()
+    {
+        TranscriptEvent event;
+        while (Pop(event))
+            delete event.mpAdjusted;
+        delete[] mpCells;
+    }
+
+    void TranscriptEventQueue::Push(const TranscriptEvent& event)
+    {
+        if (!mbOverflowing.load(std::memory_order_acquire) && TryPushRing(event))
+            return;
+
+        std::unique_lock<std::mutex> lock(mMutexOverflow);
+        mdOverflow.push_back(event);
+        mnNumOverflowed++;
+        mbOverflowing.store(true, std::memory_order_release);
+    }
+
+    bool TranscriptEventQueue::Pop(TranscriptEvent& event)
+    {
+        // The ring holds the older records: spilling only starts once it is full.
+        if (TryPopRing(event))
+            return true;
+
+        if (!mbOverflowing.load(std::memory_order_acquire))
+            return false;
+
+        std::unique_lock<std::mutex> lock(mMutexOverflow);
+        if (mdOverflow.empty())
+            return false;
+        event = mdOverflow.front();
+        mdOverflow.pop_front();
+        if (mdOverflow.empty())
+            mbOverflowing.store(false, std::memory_order_release);
+        return true;
+    }
+
+    size_t TranscriptEventQueue::NumOverflowed()
+    {
+        std::unique_lock<std::mutex> lock(mMutexOverflow);
+        return mnNumOverflowed;
+    }
+
+    bool TranscriptEventQueue::TryPushRing(const TranscriptEvent& event)
+    {
+        size_t nPos = mnEnqueuePos.load(std::memory_order_relaxed);
+        while (true) {
+            Cell* pCell = &mpCells[nPos & mnMask];
+            size_t nSequence = pCell->mnSequence.load(std::memory_order_acquire);
+            intptr_t nDiff = (intptr_t)nSequence - (intptr_t)nPos;
+            if (nDiff == 0) {
+                // The cell is free for this lap: claim the position
+                if (mnEnqueuePos.compare_exchange_weak(nPos, nPos + 1, std::memory_order_relaxed)) {
+                    pCell->mEvent = event;
+                    pCell->mnSequence.store(nPos + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (nDiff < 0) {
+                // The consumer has not freed the cell from the previous lap yet: the ring is full
+                return false;
+            }
+            else {
+                // Another producer claimed this position first
+                nPos = mnEnqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool TranscriptEventQueue::TryPopRing(TranscriptEvent& event)
+    {
+        Cell* pCell = &mpCells[mnDequeuePos & mnMask];
+        size_t nSequence = pCell->mnSequence.load(std::memory_order_acquire);
+        if ((intptr_t)nSequence - (intptr_t)(mnDequeuePos + 1) < 0)
+            return false; // not written yet
+
+        event = pCell->mEvent;
+        pCell->mnSequence.store(mnDequeuePos + mnMask + 1, std::memory_order_release);
+        mnDequeuePos++;
+        return true;
+    }
+}
@@ -975,6 +975,39 @@ int ORBmatcher::Fuse(KeyFrame *pKF, const vector<MapPoint *> &vpMapPoints, const
 }
 
 int ORBmatcher::Fuse(KeyFrame *pKF, cv::Mat Scw, const vector<MapPoint *> &vpPoints, float th, vector<MapPoint *> &vpReplacePoint)
+{
+    vector<int> vnMatchedIdx;
+    SearchForFuse(pKF,Scw,vpPoints,th,vnMatchedIdx);
+
+    int nFused=0;
+
+    const int nPoints = vpPoints.size();
+    for(int iMP=0; iMP<nPoints; iMP++)
+    {
+        const int bestIdx = vnMatchedIdx[iMP];
+        if(bestIdx<0)
+            continue;
+
+        // If there is already a MapPoint replace otherwise add new measurement
+        MapPoint* pMP = vpPoints[iMP];
+        MapPoint* pMPinKF = pKF->GetMapPoint(bestIdx);
+        if(pMPinKF)
+        {
+            if(!pMPinKF->isBad())
+                vpReplacePoint[iMP] = pMPinKF;
+        }
+        else
+        {
+            pMP->AddObservation(pKF,bestIdx);
+            pKF->AddMapPoint(pMP,bestIdx);
+        }
+        nFused++;
+    }
+
+    return nFused;
+}
+
+int ORBmatcher::SearchForFuse(KeyFrame *pKF, cv::Mat Scw, const vector<MapPoint *> &vpPoints, float th, vector<int> &vnMatchedIdx)
 {
     // Get Calibration Parameters for later projection
     const float &fx = pKF->fx;
@@ -992,9 +1025,10 @@ int ORBmatcher::Fuse(KeyFrame *pKF, cv::Mat Scw, const vector<MapPoint *> &vpPoi
     // Set of MapPoints already found in the KeyFrame
     const set<MapPoint*> spAlreadyFound = pKF->GetMapPoints();
 
-    int nFused=0;
+    int nFound=0;
 
     const int nPoints = vpPoints.size();
+    vnMatchedIdx.assign(nPoints,-1);
 
     // For each candidate MapPoint project and match
     for(int iMP=0; iMP<nPoints; iMP++)
@@ -1078,25 +1112,14 @@ int ORBmatcher::Fuse(KeyFrame *pKF, cv::Mat Scw, const vector<MapPoint *> &vpPoi
             }
         }
 
-        // If there is already a MapPoint replace otherwise add new measurement
         if(bestDist<=TH_LOW)
         {
-            MapPoint* pMPinKF = pKF->GetMapPoint(bestIdx);
-            if(pMPinKF)
-            {
-                if(!pMPinKF->isBad())
-                    vpReplacePoint[iMP] = pMPinKF;
-            }
-            else
-            {
-                pMP->AddObservation(pKF,bestIdx);
-                pKF->AddMapPoint(pMP,bestIdx);
-            }
-            nFused++;
+            vnMatchedIdx[iMP] = bestIdx;
+            nFound++;
         }
     }
 
-    return nFused;
+    return nFound;
 }
 
 int ORBmatcher::SearchBySim3(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint*> &vpMatches12,
@@ -794,13 +794,17 @@ void Optimizer::LocalBundleAdjustment(KeyFrame *pKF, bool* pbStopFlag, Map* pMap
 void Optimizer::OptimizeEssentialGraph(Map* pMap, KeyFrame* pLoopKF, KeyFrame* pCurKF,
                                        const LoopClosing::KeyFrameAndPose &NonCorrectedSim3,
                                        const LoopClosing::KeyFrameAndPose &CorrectedSim3,
-                                       const map<KeyFrame *, set<KeyFrame *> > &LoopConnections, const bool &bFixScale)
+                                       const map<KeyFrame *, set<KeyFrame *> > &LoopConnections, const bool &bFixScale,
+                                       ThreadPool* pThreadPool)
 {
     // Setup optimizer
     g2o::SparseOptimizer optimizer;
     optimizer.setVerbose(false);
-    g2o::BlockSolver_7_3::LinearSolverType * linearSolver =
+    g2o::LinearSolverEigen<g2o::BlockSolver_7_3::PoseMatrixType> * linearSolver =
            new g2o::LinearSolverEigen<g2o::BlockSolver_7_3::PoseMatrixType>();
+    // The Hessian only has 7x7 pose blocks: computing the fill-reducing ordering
+    // on the block pattern is much cheaper than on the scalar matrix for large maps
+    linearSolver->setBlockOrdering(true);
     g2o::BlockSolver_7_3 * solver_ptr= new g2o::BlockSolver_7_3(linearSolver);
     g2o::OptimizationAlgorithmLevenberg* solver = new g2o::OptimizationAlgorithmLevenberg(solver_ptr);
 
@@ -1023,12 +1027,13 @@ void Optimizer::OptimizeEssentialGraph(Map* pMap, KeyFrame* pLoopKF, KeyFrame* p
     }
 
     // Correct points. Transform to "non-optimized" reference keyframe pose and transform back with optimized pose
-    for(size_t i=0, iend=vpMPs.size(); i<iend; i++)
+    // Every point only depends on its reference keyframe, so they can be corrected in parallel
+    auto correctPoint = [&](size_t i)
     {
         MapPoint* pMP = vpMPs[i];
 
         if(pMP->isBad())
-            continue;
+            return;
 
         int nIDr;
         if(pMP->mnCorrectedByKF==pCurKF->mnId)
@@ -1053,6 +1058,14 @@ void Optimizer::OptimizeEssentialGraph(Map* pMap, KeyFrame* pLoopKF, KeyFrame* p
         pMP->SetWorldPos(cvCorrectedP3Dw);
 
         pMP->UpdateNormalAndDepth();
+    };
+
+    if(pThreadPool)
+        pThreadPool->ParallelFor(vpMPs.size(),correctPoint);
+    else
+    {
+        for(size_t i=0, iend=vpMPs.size(); i<iend; i++)
+            correctPoint(i);
     }
 }
 
@@ -22,14 +22,46 @@
 
 #include "System.h"
 #include "Converter.h"
+#include "Modeler/ProbabilityMapping.h"
+#include "Modeler/LineMapping.h"
 #include <thread>
 #include <pangolin/pangolin.h>
 #include <iomanip>
 #include <time.h>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 namespace ORB_SLAM2
 {
 
+    //CARV: opens the mesh delta stream, a file or, for "unix:<path>", a connection to the Unix socket a viewer listens on
+    static int OpenMeshDeltaStream(const std::string &strPath)
+    {
+        if(strPath.compare(0, 5, "unix:") != 0)
+            return open(strPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, strPath.c_str() + 5, sizeof(addr.sun_path) - 1);
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if(fd >= 0 && connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+        {
+            close(fd);
+            return -1;
+        }
+#ifdef SO_NOSIGPIPE
+        // A viewer that goes away fails the writes rather than raising SIGPIPE (elsewhere the sink sends with MSG_NOSIGNAL)
+        int nOn = 1;
+        if(fd >= 0)
+            setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &nOn, sizeof(nOn));
+#endif
+        return fd;
+    }
+
     System::System(const string &strVocFile, const string &strSettingsFile, const eSensor sensor,
                    const bool bUseViewer):mSensor(sensor), mpViewer(static_cast<Viewer*>(NULL)), mbReset(false),mbActivateLocalizationMode(false),
                                           mbDeactivateLocalizationMode(false)
@@ -67,8 +99,13 @@ namespace ORB_SLAM2
         std::string suffixTxt = ".txt";
         std::size_t suffixIndex = strVocFile.find(suffixTxt, strVocFile.size() - suffixTxt.size());
         bool bTextFile = (suffixIndex != std::string::npos);
+        std::string suffixFlat = ".flat";
+        bool bFlatFile = strVocFile.size() >= suffixFlat.size() &&
+                strVocFile.compare(strVocFile.size() - suffixFlat.size(), suffixFlat.size(), suffixFlat) == 0;
         if (bTextFile)
             bVocLoad = mpVocabulary->loadFromTextFile(strVocFile);
+        else if (bFlatFile)
+            bVocLoad = mpVocabulary->loadFromFlatFile(strVocFile); // memory-mapped, shared between processes
         else
             bVocLoad = mpVocabulary->loadFromBinaryFile(strVocFile);
 
@@ -108,6 +145,83 @@ namespace ORB_SLAM2
 
         //CARV: Initialize the Modeler thread and launch
         mpModeler = new Modeler(mpModelDrawer);
+
+        //CARV: semi-dense depth maps of the keyframes, opt-in as they cost far more than the sparse map
+        mpProbabilityMapping = static_cast<ProbabilityMapping*>(NULL);
+        mptProbabilityMapping = static_cast<std::thread*>(NULL);
+        if((int)fsSettings["Modeler.SemiDense"] != 0)
+        {
+            int nSemiDenseThreads = fsSettings["Modeler.SemiDenseThreads"];
+            bool bSemiDenseToCARV = (int)fsSettings["Modeler.SemiDenseToCARV"] != 0;
+            cout << "Semi-dense mapping on, " << (bSemiDenseToCARV ? "points fed to CARV" : "point cloud only") << endl;
+            mpProbabilityMapping = new ProbabilityMapping(mpMap, nSemiDenseThreads > 0 ? nSemiDenseThreads : 0);
+            mpModeler->SetProbabilityMapping(mpProbabilityMapping, bSemiDenseToCARV);
+            mptProbabilityMapping = new thread(&ProbabilityMapping::Run, mpProbabilityMapping);
+        }
+
+        //CARV: points on the straight edges matched across keyframes, opt-in as well
+        mpLineMapping = static_cast<LineMapping*>(NULL);
+        mptLineMapping = static_cast<std::thread*>(NULL);
+        if((int)fsSettings["Modeler.Lines"] != 0)
+        {
+            int nLinesThreads = fsSettings["Modeler.LinesThreads"];
+            cout << "Line mapping on" << endl;
+            mpLineMapping = new LineMapping(nLinesThreads > 0 ? nLinesThreads : 0);
+            mpModeler->SetLineMapping(mpLineMapping);
+            mptLineMapping = new thread(&ORB_SLAM2::LineMapping::Run, mpLineMapping);
+        }
+
+        //CARV: bundle adjusted points that moved less than this fraction of the median scene depth stay where they are carved
+        if(!fsSettings["Modeler.MinVertexDisplacement"].empty())
+            mpModeler->SetMinVertexDisplacement((double)fsSettings["Modeler.MinVertexDisplacement"]);
+
+        //CARV: bundle adjustments only log the entities that moved more than this fraction of the median scene depth
+        if(!fsSettings["Modeler.BAMoveThreshold"].empty())
+            mpModeler->SetBundleAdjustmentMoveThreshold((float)fsSettings["Modeler.BAMoveThreshold"]);
+
+        //CARV: sliding window, the surface farther than this from the latest keyframe is frozen
+        if(!fsSettings["Modeler.WindowRadius"].empty())
+            mpModeler->SetWindowRadius((double)fsSettings["Modeler.WindowRadius"]);
+
+        //CARV: carving in cubic tiles, concurrently, for maps too large for one triangulation
+        double dTileSize = fsSettings["Modeler.TileSize"];
+        if(dTileSize > 0)
+        {
+            int nTileThreads = fsSettings["Modeler.TileThreads"];
+            cout << "Carving in tiles of " << dTileSize << endl;
+            mpModeler->SetTiling(dTileSize, nTileThreads > 0 ? nTileThreads : 0);
+        }
+
+        //CARV: snapshots of the surface on disk, the only output of a run without a viewer
+        std::string strModelExport = (std::string)fsSettings["Modeler.Export"];
+        if(!strModelExport.empty())
+        {
+            int nExportKeyFrames = fsSettings["Modeler.ExportKeyFrames"];
+            double dExportSeconds = fsSettings["Modeler.ExportSeconds"];
+            bool bExportColors = (int)fsSettings["Modeler.ExportColors"] != 0;
+            bool bRGB = (int)fsSettings["Camera.RGB"] != 0;
+            cout << "Surface snapshots to " << strModelExport << endl;
+            mpModeler->SetModelExport(strModelExport, nExportKeyFrames, dExportSeconds, bExportColors, bRGB);
+        }
+
+        //CARV: mesh deltas of every extracted surface, for a viewer elsewhere (see tools/carv_mesh_receive)
+        mpMeshDeltaSink = static_cast<dlovi::compvis::FileDescriptorSink*>(NULL);
+        mnMeshDeltaFd = -1;
+        std::string strMeshDelta = (std::string)fsSettings["Modeler.MeshDelta"];
+        if(!strMeshDelta.empty())
+        {
+            mnMeshDeltaFd = OpenMeshDeltaStream(strMeshDelta);
+            if(mnMeshDeltaFd < 0)
+                cerr << "Could not open the mesh delta stream " << strMeshDelta << endl;
+            else
+            {
+                bool bTextureFrames = (int)fsSettings["Modeler.MeshDeltaTextureFrames"] != 0;
+                cout << "Mesh deltas to " << strMeshDelta << endl;
+                mpMeshDeltaSink = new dlovi::compvis::FileDescriptorSink(mnMeshDeltaFd);
+                mpModeler->SetMeshDeltaSink(mpMeshDeltaSink, bTextureFrames);
+            }
+        }
+
         mptModeler = new thread(&ORB_SLAM2::Modeler::Run, mpModeler);
 
         //Initialize the Viewer thread and launch
@@ -130,6 +244,7 @@ namespace ORB_SLAM2
 
         //CARV: set pointer of modeler
         mpMap->SetModeler(mpModeler);
+        mpModeler->SetMap(mpMap);
         mpTracker->SetModeler(mpModeler);
         mpLocalMapper->SetModeler(mpModeler);
         mpModelDrawer->SetModeler(mpModeler);
@@ -326,19 +441,34 @@ namespace ORB_SLAM2
         mpLocalMapper->RequestFinish();
         mpLoopCloser->RequestFinish();
 
-        if(mpViewer) {
+        if(mpViewer)
             mpViewer->RequestFinish();
-            //carv finish modeler thread
-            mpModeler->RequestFinish();
-        }
+        //carv finish modeler thread
+        mpModeler->RequestFinish();
+        if(mpProbabilityMapping)
+            mpProbabilityMapping->RequestFinish();
+        if(mpLineMapping)
+            mpLineMapping->RequestFinish();
 
         // Wait until all thread have effectively stopped
         while(!mpLocalMapper->isFinished() || !mpLoopCloser->isFinished()  ||
-              !mpViewer->isFinished()      || mpLoopCloser->isRunningGBA() || !mpModeler->isFinished())
+              (mpViewer && !mpViewer->isFinished()) || mpLoopCloser->isRunningGBA() || !mpModeler->isFinished() ||
+              (mpProbabilityMapping && !mpProbabilityMapping->isFinished()) ||
+              (mpLineMapping && !mpLineMapping->isFinished()))
         {
             usleep(5000);
         }
 
+        //CARV: the last surface is sent before the stream is closed
+        if(mpMeshDeltaSink)
+        {
+            mpModeler->SetMeshDeltaSink(NULL);
+            delete mpMeshDeltaSink;
+            mpMeshDeltaSink = static_cast<dlovi::compvis::FileDescriptorSink*>(NULL);
+            close(mnMeshDeltaFd);
+            mnMeshDeltaFd = -1;
+        }
+
         if(mpViewer)
             pangolin::BindToContext("ORB-SLAM2: Map Viewer");
     }
@@ -0,0 +1,132 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "ThreadPool.h"
+
+#include <atomic>
+#include <memory>
+#include <algorithm>
+
+namespace ORB_SLAM2
+{
+
+ThreadPool::ThreadPool(size_t nThreads): mbFinishRequested(false)
+{
+    if(nThreads==0)
+    {
+        const unsigned int nHw = std::thread::hardware_concurrency();
+        nThreads = nHw>1 ? nHw-1 : 1;
+    }
+
+    mvWorkers.reserve(nThreads);
+    for(size_t i=0; i<nThreads; i++)
+        mvWorkers.push_back(std::thread(&ThreadPool::WorkerLoop,this));
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::unique_lock<std::mutex> lock(mMutexTasks);
+        mbFinishRequested = true;
+    }
+    mcvTasks.notify_all();
+
+    for(size_t i=0; i<mvWorkers.size(); i++)
+        mvWorkers[i].join();
+}
+
+void ThreadPool::Enqueue(const std::function<void()> &task)
+{
+    {
+        std::unique_lock<std::mutex> lock(mMutexTasks);
+        mlTasks.push_back(task);
+    }
+    mcvTasks.notify_one();
+}
+
+void ThreadPool::ParallelFor(size_t n, const std::function<void(size_t)> &f)
+{
+    if(n==0)
+        return;
+
+    // Shared loop state. Helpers that start after all the work was taken
+    // find nothing left to do, so the caller only waits for items in flight.
+    struct LoopState
+    {
+        std::atomic<size_t> nNext;
+        size_t nDone;
+        std::mutex mMutexDone;
+        std::condition_variable mcvDone;
+    };
+    std::shared_ptr<LoopState> pState = std::make_shared<LoopState>();
+    pState->nNext = 0;
+    pState->nDone = 0;
+
+    auto worker = [pState,n,&f]()
+    {
+        size_t nLocalDone = 0;
+        for(size_t i=pState->nNext++; i<n; i=pState->nNext++)
+        {
+            f(i);
+            nLocalDone++;
+        }
+
+        if(nLocalDone>0)
+        {
+            std::unique_lock<std::mutex> lock(pState->mMutexDone);
+            pState->nDone += nLocalDone;
+            if(pState->nDone==n)
+                pState->mcvDone.notify_all();
+        }
+    };
+
+    const size_t nHelpers = std::min(mvWorkers.size(), n-1);
+    for(size_t i=0; i<nHelpers; i++)
+        Enqueue(worker);
+
+    worker();
+
+    std::unique_lock<std::mutex> lock(pState->mMutexDone);
+    while(pState->nDone<n)
+        pState->mcvDone.wait(lock);
+}
+
+void ThreadPool::WorkerLoop()
+{
+    while(1)
+    {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mMutexTasks);
+            while(mlTasks.empty() && !mbFinishRequested)
+                mcvTasks.wait(lock);
+
+            if(mlTasks.empty())
+                return;
+
+            task = mlTasks.front();
+            mlTasks.pop_front();
+        }
+
+        task();
+    }
+}
+
+} //namespace ORB_SLAM
@@ -175,6 +175,8 @@ namespace ORB_SLAM2
                 mpMapDrawer->DrawKeyFrames(menuShowKeyFrames,menuShowGraph);
             if(menuShowPoints) {
                 mpMapDrawer->DrawMapPoints();
+                if(mpSystem->mpProbabilityMapping)
+                    mpMapDrawer->DrawSemiDensePoints(mpSystem->mpProbabilityMapping);
                 // carv: show model points
                 mpModelDrawer->DrawModelPoints();
             }
@@ -193,6 +195,7 @@ namespace ORB_SLAM2
             if(menuSaveCARV)
             {
               mpSystem->mpModeler->writeToFile("chris_CARV_Files");
+              mpSystem->mpModeler->writeTexturedModel("carv_textured_model");
               menuSaveCARV = false;
             }
             CheckGlDieOnError()
@@ -5,7 +5,7 @@ using namespace std;
 
 bool load_as_text(ORB_SLAM2::ORBVocabulary* voc, const std::string infile) {
   clock_t tStart = clock();
-  bool res = voc->loadFromTextFile(infile);
+  bool res = voc->loadFromTextFile(infile, true); // the tree is saved again below
   printf("Loading fom text: %.2fs\n", (double)(clock() - tStart)/CLOCKS_PER_SEC);
   return res;
 }
@@ -18,10 +18,17 @@ void load_as_xml(ORB_SLAM2::ORBVocabulary* voc, const std::string infile) {
 
 void load_as_binary(ORB_SLAM2::ORBVocabulary* voc, const std::string infile) {
   clock_t tStart = clock();
-  voc->loadFromBinaryFile(infile);
+  voc->loadFromBinaryFile(infile, true);
   printf("Loading fom binary: %.2fs\n", (double)(clock() - tStart)/CLOCKS_PER_SEC);
 }
 
+bool load_as_flat(ORB_SLAM2::ORBVocabulary* voc, const std::string infile) {
+  clock_t tStart = clock();
+  bool res = voc->loadFromFlatFile(infile);
+  printf("Loading fom flat (mapped): %.2fs\n", (double)(clock() - tStart)/CLOCKS_PER_SEC);
+  return res;
+}
+
 void save_as_xml(ORB_SLAM2::ORBVocabulary* voc, const std::string outfile) {
   clock_t tStart = clock();
   voc->save(outfile);
@@ -40,6 +47,12 @@ void save_as_binary(ORB_SLAM2::ORBVocabulary* voc, const std::string outfile) {
   printf("Saving as binary: %.2fs\n", (double)(clock() - tStart)/CLOCKS_PER_SEC);
 }
 
+void save_as_flat(ORB_SLAM2::ORBVocabulary* voc, const std::string outfile) {
+  clock_t tStart = clock();
+  voc->saveToFlatFile(outfile);
+  printf("Saving as flat: %.2fs\n", (double)(clock() - tStart)/CLOCKS_PER_SEC);
+}
+
 
 int main(int argc, char **argv) {
   cout << "BoW load/save benchmark" << endl;
@@ -47,6 +60,11 @@ int main(int argc, char **argv) {
 
   load_as_text(voc, "Vocabulary/ORBvoc.txt");
   save_as_binary(voc, "Vocabulary/ORBvoc.bin");
+  save_as_flat(voc, "Vocabulary/ORBvoc.flat");
+
+  ORB_SLAM2::ORBVocabulary* flat_voc = new ORB_SLAM2::ORBVocabulary();
+  load_as_flat(flat_voc, "Vocabulary/ORBvoc.flat");
+  delete flat_voc;
 
   return 0;
 }
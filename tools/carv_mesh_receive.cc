@@ -0,0 +1,97 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <iostream>
+#include <list>
+#include <string>
+#include <vector>
+
+#include "Modeler/MeshDeltaStream.h"
+#include "Modeler/MeshWriter.h"
+using namespace std;
+
+// Stand-in for a remote viewer: applies the mesh deltas published by the modeler (or carv_replay -m) and writes out the
+// latest surface (as OBJ, or binary PLY / GLB by extension).  Reads a file, stdin, or, for unix:<path>, the first
+// connection to a Unix socket it listens on.
+//
+// usage: carv_mesh_receive [-o output.obj|ply|glb] [stream | unix:path]
+
+int openStream(const std::string & strPath) {
+  if (strPath.compare(0, 5, "unix:") != 0)
+    return open(strPath.c_str(), O_RDONLY);
+
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, strPath.c_str() + 5, sizeof(addr.sun_path) - 1);
+  unlink(addr.sun_path);
+  int fdListen = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fdListen < 0 || bind(fdListen, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fdListen, 1) != 0)
+    return -1;
+  printf("Waiting for the publisher on %s\n", addr.sun_path);
+  int fd = accept(fdListen, NULL, NULL);
+  close(fdListen);
+  unlink(addr.sun_path);
+  return fd;
+}
+
+int main(int argc, char **argv) {
+  std::string strOutput;
+  int c;
+  while ((c = getopt(argc, argv, "o:")) != -1) {
+    switch (c) {
+      case 'o': strOutput = optarg; break;
+      default: optind = argc + 1; break;
+    }
+  }
+  if (optind < argc - 1 || optind > argc) {
+    printf("usage: %s [-o output.obj|ply|glb] [stream | unix:path]\n", argv[0]);
+    return 1;
+  }
+
+  int fd = 0;
+  if (optind == argc - 1) {
+    fd = openStream(argv[optind]);
+    if (fd < 0) {
+      printf("Could not open %s\n", argv[optind]);
+      return 1;
+    }
+  }
+
+  dlovi::compvis::MeshDeltaDecoder objDecoder;
+  vector<char> buffer(1 << 16);
+  size_t nBytes = 0;
+  ssize_t n;
+  while ((n = read(fd, &buffer[0], buffer.size())) != 0) {
+    if (n < 0) {
+      perror("read");
+      break;
+    }
+    nBytes += n;
+    try {
+      objDecoder.feed(&buffer[0], n);
+    }
+    catch (std::exception & ex) {
+      cerr << ex.what() << endl;
+      return 1;
+    }
+  }
+  if (fd != 0)
+    close(fd);
+
+  std::vector<dlovi::Matrix> arrPoints;
+  std::list<dlovi::Matrix> lstTris;
+  objDecoder.getModel(arrPoints, lstTris);
+  printf("Received %zu bytes, %d surfaces (last #%u)\n", nBytes, objDecoder.numModelsDecoded(), objDecoder.getSequence());
+  printf("Model: %zu vertices, %zu triangles\n", arrPoints.size(), lstTris.size());
+
+  if (!strOutput.empty())
+    dlovi::compvis::MeshWriter::writeFile(strOutput, arrPoints, lstTris);
+
+  return 0;
+}
@@ -0,0 +1,91 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "Modeler/SFMTranscript.h"
+#include "Modeler/SFMTranscriptStream.h"
+#include "Modeler/SFMTranscriptInterface_Delaunay.h"
+#include "Modeler/FreespaceDelaunayAlgorithm.h"
+using namespace std;
+
+// Reference decoder for the binary transcript stream: reads frames from a file, pipe or socket (stdin by default),
+// rebuilds the transcript and carves the model from it as the frames arrive.
+//
+// usage: carv_receive [-o output.obj|ply|glb] [-t transcript.txt] [stream]
+//
+// With -t, the rebuilt transcript is written out as text, which is line for line the transcript of the sender.
+
+int main(int argc, char **argv) {
+  std::string strOutput, strTranscriptOutput;
+  int c;
+  while ((c = getopt(argc, argv, "o:t:")) != -1) {
+    switch (c) {
+      case 'o': strOutput = optarg; break;
+      case 't': strTranscriptOutput = optarg; break;
+      default: optind = argc + 1; break;
+    }
+  }
+  if (optind < argc - 1 || optind > argc) {
+    printf("usage: %s [-o output.obj|ply|glb] [-t transcript.txt] [stream]\n", argv[0]);
+    return 1;
+  }
+
+  int fd = 0;
+  if (optind == argc - 1) {
+    fd = open(argv[optind], O_RDONLY);
+    if (fd < 0) {
+      printf("Could not open %s\n", argv[optind]);
+      return 1;
+    }
+  }
+
+  dlovi::compvis::SFMTranscript objTranscript;
+  dlovi::compvis::SFMTranscriptDecoder objDecoder(&objTranscript);
+  dlovi::FreespaceDelaunayAlgorithm objAlgorithm;
+  SFMTranscriptInterface_Delaunay objInterface(&objTranscript, &objAlgorithm);
+  objInterface.rewind();
+
+  vector<char> buffer(1 << 16);
+  size_t nBytes = 0;
+  std::vector<dlovi::compvis::transcriptstream::KeyFramePose> arrPoses;
+  size_t nNumPoses = 0;
+  ssize_t n;
+  while ((n = read(fd, &buffer[0], buffer.size())) != 0) {
+    if (n < 0) {
+      perror("read");
+      break;
+    }
+    nBytes += n;
+    try {
+      objDecoder.feed(&buffer[0], n);
+    }
+    catch (std::exception & ex) {
+      cerr << ex.what() << endl;
+      return 1;
+    }
+    objDecoder.takeKeyFramePoses(arrPoses);
+    nNumPoses += arrPoses.size();
+
+    objInterface.runRemainder();
+  }
+  if (fd != 0)
+    close(fd);
+
+  objInterface.updateModel(true);
+  std::pair<std::vector<dlovi::Matrix>, std::list<dlovi::Matrix> > objModel = objInterface.getCurrentModel();
+  printf("Received %zu bytes, %d frames, %d transcript lines, %zu keyframe poses\n", nBytes, objDecoder.numFramesDecoded(),
+         objTranscript.numLines(), nNumPoses);
+  printf("Model: %zu vertices, %zu triangles\n", objModel.first.size(), objModel.second.size());
+
+  if (!strOutput.empty())
+    objInterface.writeCurrentModelToFile(strOutput);
+  if (!strTranscriptOutput.empty())
+    objTranscript.writeToFile(strTranscriptOutput);
+
+  return 0;
+}
@@ -0,0 +1,285 @@
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <algorithm>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "Modeler/SFMTranscript.h"
+#include "Modeler/SFMTranscriptInterface_Delaunay.h"
+#include "Modeler/SFMTranscriptInterface_TiledDelaunay.h"
+#include "Modeler/SFMTranscriptStream.h"
+#include "Modeler/MeshDeltaStream.h"
+#include "Modeler/FreespaceDelaunayAlgorithm.h"
+using namespace std;
+
+// Headless replay of a recorded CARV transcript (e.g. sfmtranscript_orbslam.txt) through the Delaunay pipeline, timing
+// every entry by type.
+//
+// usage: carv_replay [-e keyframes per extraction] [-o output.obj|ply|glb] [-c checkpoint] [-w window radius]
+//                    [-t tile size] [-j threads] [-s stream] [-m mesh stream] <transcript>
+//
+// The surface is extracted after every n-th keyframe insertion (default 1, 0: only once at the end), which stands in for
+// the live modeler extracting once per group of new entries.  With -w, the replay uses the sliding-window mode and the
+// frozen tiles are written next to the output as <output>.tile<n>.obj.  With -t, space is carved in tiles of that size
+// with -j worker threads besides the main one (default: one per hardware thread).  With -s, the transcript is also
+// encoded as a binary stream into the given file (see carv_receive).  With -m, every extracted surface is published as a
+// mesh delta to the given file, or to the Unix socket at <path> for -m unix:<path> (see carv_mesh_receive).
+
+enum Timing {
+  T_KEYFRAME, T_BUNDLE, T_POINTDELETION, T_RAYINSERTION, T_RAYDELETION, T_RESET, T_OTHER, T_EXTRACTION, NUM_TIMINGS
+};
+
+static const char * TIMING_NAMES[NUM_TIMINGS] = {
+  "keyframe insertion", "bundle adjustment", "point deletion", "ray insertion", "ray deletion", "reset", "other", "surface extraction"
+};
+
+double timestamp() {
+  struct timeval tp;
+  gettimeofday(&tp, NULL);
+  return tp.tv_sec + tp.tv_usec / 1000000.0;
+}
+
+Timing timingOf(dlovi::compvis::SFMTranscript::EntryType type) {
+  switch (type) {
+    case dlovi::compvis::SFMTranscript::ET_KEYFRAMEINSERTION: return T_KEYFRAME;
+    case dlovi::compvis::SFMTranscript::ET_BUNDLEADJUSTMENT: return T_BUNDLE;
+    case dlovi::compvis::SFMTranscript::ET_POINTDELETION: return T_POINTDELETION;
+    case dlovi::compvis::SFMTranscript::ET_VISIBILITYRAYINSERTION: return T_RAYINSERTION;
+    case dlovi::compvis::SFMTranscript::ET_VISIBILITYRAYDELETION: return T_RAYDELETION;
+    case dlovi::compvis::SFMTranscript::ET_RESET: return T_RESET;
+    default: return T_OTHER;
+  }
+}
+
+// Latencies in ms: count, percentiles, and a histogram with power-of-two buckets starting at 1/64 ms
+void report(const char * name, vector<double> & samples) {
+  if (samples.empty())
+    return;
+  sort(samples.begin(), samples.end());
+  double total = 0.0;
+  for (size_t i = 0; i < samples.size(); i++)
+    total += samples[i];
+
+  printf("%s: %zu entries, total %.1f ms, mean %.3f ms, p50 %.3f ms, p90 %.3f ms, p99 %.3f ms, max %.3f ms\n", name,
+         samples.size(), total, total / samples.size(), samples[samples.size() / 2], samples[(samples.size() * 9) / 10],
+         samples[(samples.size() * 99) / 100], samples.back());
+
+  const int numBuckets = 24;
+  vector<size_t> buckets(numBuckets, 0);
+  for (size_t i = 0; i < samples.size(); i++) {
+    int b = samples[i] <= 1.0 / 64.0 ? 0 : (int)ceil(log2(samples[i] * 64.0));
+    buckets[min(b, numBuckets - 1)]++;
+  }
+  for (int b = 0; b < numBuckets; b++) {
+    if (buckets[b] == 0)
+      continue;
+    printf("  <= %10.3f ms %s: %zu\n", ldexp(1.0, b) / 64.0, b == numBuckets - 1 ? "(or more)" : "         ", buckets[b]);
+  }
+}
+
+// Opens the mesh delta stand-in: a file, or a connection to a Unix socket for "unix:<path>"
+int openMeshStream(const std::string & strPath) {
+  if (strPath.compare(0, 5, "unix:") != 0)
+    return open(strPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, strPath.c_str() + 5, sizeof(addr.sun_path) - 1);
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd >= 0 && connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// Extracts the surface, timing it, and hands it to the mesh delta publisher if there is one
+template <class Interface>
+void extract(Interface & objInterface, vector<vector<double> > & timings, dlovi::compvis::MeshDeltaPublisher * pMeshPublisher) {
+  double t = timestamp();
+  if (objInterface.updateModel(true)) {
+    timings[T_EXTRACTION].push_back((timestamp() - t) * 1000.0);
+    if (pMeshPublisher != NULL) {
+      std::pair<std::vector<dlovi::Matrix>, std::list<dlovi::Matrix> > objModel = objInterface.getCurrentModel();
+      pMeshPublisher->publish(objModel.first, objModel.second);
+    }
+  }
+}
+
+// Steps through the whole transcript, timing each entry and each surface extraction
+template <class Interface>
+void replay(Interface & objInterface, int nKeyFramesPerExtraction, vector<vector<double> > & timings,
+            dlovi::compvis::MeshDeltaPublisher * pMeshPublisher) {
+  double t;
+  int nKeyFramesSinceExtraction = 0;
+  while (!objInterface.isDone()) {
+    t = timestamp();
+    objInterface.step();
+    Timing timing = timingOf(objInterface.getCurrentEntryType());
+    timings[timing].push_back((timestamp() - t) * 1000.0);
+
+    if (timing == T_KEYFRAME && nKeyFramesPerExtraction > 0 && ++nKeyFramesSinceExtraction >= nKeyFramesPerExtraction) {
+      extract(objInterface, timings, pMeshPublisher);
+      nKeyFramesSinceExtraction = 0;
+    }
+  }
+  extract(objInterface, timings, pMeshPublisher);
+}
+
+int main(int argc, char **argv) {
+  int nKeyFramesPerExtraction = 1;
+  std::string strOutput, strCheckpoint, strStream, strMeshStream;
+  double dWindowRadius = 0.0, dTileSize = 0.0;
+  int nThreads = 0;
+  int c;
+  while ((c = getopt(argc, argv, "e:o:c:w:t:j:s:m:")) != -1) {
+    switch (c) {
+      case 'e': nKeyFramesPerExtraction = atoi(optarg); break;
+      case 'o': strOutput = optarg; break;
+      case 'c': strCheckpoint = optarg; break;
+      case 'w': dWindowRadius = atof(optarg); break;
+      case 't': dTileSize = atof(optarg); break;
+      case 'j': nThreads = atoi(optarg); break;
+      case 's': strStream = optarg; break;
+      case 'm': strMeshStream = optarg; break;
+      default: optind = argc + 1; break;
+    }
+  }
+  if (optind != argc - 1 || (dTileSize > 0.0 && (dWindowRadius > 0.0 || !strCheckpoint.empty()))) {
+    printf("usage: %s [-e keyframes per extraction] [-o output.obj|ply|glb] [-c checkpoint] [-w window radius] [-t tile size] [-j threads] [-s stream] [-m mesh stream] <transcript>\n", argv[0]);
+    printf("       (-t cannot be combined with -c or -w)\n");
+    return 1;
+  }
+  const std::string strTranscript = argv[optind];
+
+  cout << "CARV transcript replay benchmark" << endl;
+
+  dlovi::compvis::SFMTranscript objTranscript;
+  double t = timestamp();
+  objTranscript.readFromFile(strTranscript);
+  printf("Loading transcript: %.2fs (%d lines)\n", timestamp() - t, objTranscript.numLines());
+
+  if (!strStream.empty()) {
+    if (!objTranscript.hasAllLines()) {
+      printf("Cannot stream a compacted transcript\n");
+      return 1;
+    }
+    int fd = open(strStream.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+      printf("Could not open %s\n", strStream.c_str());
+      return 1;
+    }
+    size_t nTextBytes = 0;
+    for (int i = 0; i < objTranscript.numLines(); i++)
+      nTextBytes += objTranscript.getLine(i).size() + 1;
+
+    std::mutex mutexTranscript;
+    dlovi::compvis::FileDescriptorSink objSink(fd);
+    dlovi::compvis::SFMTranscriptPublisher objPublisher(&objTranscript, &mutexTranscript, &objSink);
+    t = timestamp();
+    if (objPublisher.publishNew() < 0)
+      printf("Could not write %s\n", strStream.c_str());
+    printf("Encoding stream: %.2fs (%zu bytes of text, %zu bytes of stream)\n", timestamp() - t, nTextBytes,
+           objPublisher.numBytesPublished());
+    close(fd);
+  }
+
+  int fdMesh = -1;
+  dlovi::compvis::FileDescriptorSink * pMeshSink = NULL;
+  dlovi::compvis::MeshDeltaPublisher * pMeshPublisher = NULL;
+  if (!strMeshStream.empty()) {
+    fdMesh = openMeshStream(strMeshStream);
+    if (fdMesh < 0) {
+      printf("Could not open %s\n", strMeshStream.c_str());
+      return 1;
+    }
+    pMeshSink = new dlovi::compvis::FileDescriptorSink(fdMesh);
+    pMeshPublisher = new dlovi::compvis::MeshDeltaPublisher(pMeshSink);
+  }
+
+  vector<vector<double> > timings(NUM_TIMINGS);
+  std::pair<std::vector<dlovi::Matrix>, std::list<dlovi::Matrix> > objModel;
+  double tStart;
+
+  if (dTileSize > 0.0) {
+    SFMTranscriptInterface_TiledDelaunay objInterface(&objTranscript, nThreads);
+    objInterface.setTileSize(dTileSize);
+    objInterface.setModelUpdateInterval(0.0);
+    objInterface.rewind();
+
+    tStart = timestamp();
+    replay(objInterface, nKeyFramesPerExtraction, timings, pMeshPublisher);
+    printf("Replay: %.2fs\n", timestamp() - tStart);
+
+    objModel = objInterface.getCurrentModel();
+    printf("Tiles: %d\n", objInterface.numTiles());
+    if (!strOutput.empty())
+      objInterface.writeCurrentModelToFile(strOutput);
+  }
+  else {
+    dlovi::FreespaceDelaunayAlgorithm objAlgorithm;
+    SFMTranscriptInterface_Delaunay objInterface(&objTranscript, &objAlgorithm);
+
+    // The benchmark decides when to extract the surface, not the interface's own batching
+    objInterface.setModelUpdateBatchSize(INT_MAX);
+    objInterface.setModelUpdateInterval(0.0);
+    if (dWindowRadius > 0.0) {
+      objInterface.setWindowRadius(dWindowRadius);
+      if (!strOutput.empty())
+        objInterface.setWindowTilePrefix(strOutput + ".tile");
+    }
+
+    objInterface.rewind();
+    if (!strCheckpoint.empty()) {
+      t = timestamp();
+      if (!objInterface.loadCheckpoint(strCheckpoint)) {
+        printf("Could not load checkpoint %s\n", strCheckpoint.c_str());
+        return 1;
+      }
+      printf("Loading checkpoint: %.2fs\n", timestamp() - t);
+    }
+
+    tStart = timestamp();
+    replay(objInterface, nKeyFramesPerExtraction, timings, pMeshPublisher);
+    printf("Replay: %.2fs\n", timestamp() - tStart);
+
+    objModel = objInterface.getCurrentModel();
+    printf("Free-space constraints: %d\n", objInterface.numFreeSpaceConstraintsInTriangulation());
+    if (!strOutput.empty())
+      objInterface.writeCurrentModelToFile(strOutput);
+  }
+
+  for (int i = 0; i < NUM_TIMINGS; i++)
+    report(TIMING_NAMES[i], timings[i]);
+
+  if (pMeshPublisher != NULL) {
+    pMeshPublisher->flush();
+    printf("Mesh deltas: %d sent (%zu bytes), %d surfaces coalesced\n", pMeshPublisher->numModelsSent(),
+           pMeshPublisher->numBytesSent(), pMeshPublisher->numModelsCoalesced());
+    delete pMeshPublisher;
+    delete pMeshSink;
+    close(fdMesh);
+  }
+
+  printf("Final mesh: %zu vertices, %zu triangles\n", objModel.first.size(), objModel.second.size());
+
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  printf("Peak memory: %.1f MB\n", usage.ru_maxrss / 1024.0);
+
+  return 0;
+}